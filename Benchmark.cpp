@@ -0,0 +1,712 @@
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "CGMData.h"
+#include "BolusCalculator.h"
+#include "BolusMonteCarlo.h"
+#include "Clock.h"
+#include "Event.h"
+#include "GlucoseModel.h"
+#include "GlucosePredictor.h"
+#include "GlucoseProfileSketch.h"
+#include "ControlIQ.h"
+#include "Metrics.h"
+#include "ScenarioRunner.h"
+#include "TherapyOptimizer.h"
+#include "TimelineRecorder.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Micro and macro benchmarks for the pump hot paths.
+ *
+ * Usage: pump_benchmark [--filter <substring>] [--min-time <seconds>] [--repetitions <n>] [--list]
+ *
+ * Results are written to stdout as JSON with a fixed layout (one entry per
+ * benchmark, in registration order) so runs can be diffed between releases;
+ * progress goes to stderr.
+ */
+
+namespace {
+    const time_t START_TIME = 1700000000; // Fixed so runs are reproducible
+    
+    // Keeps results alive so the optimizer cannot drop the measured work
+    volatile double sink;
+    
+    struct Benchmark {
+        std::string name;
+        std::string unit;           // What one operation is
+        std::function<void(uint64_t)> body;
+    };
+    
+    struct Measurement {
+        uint64_t iterations;
+        double medianNanoseconds;   // Per operation
+        double minNanoseconds;
+    };
+    
+    double timeRun(const Benchmark& benchmark, uint64_t iterations) {
+        auto started = std::chrono::steady_clock::now();
+        benchmark.body(iterations);
+        auto finished = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(finished - started).count();
+    }
+    
+    // Grow the iteration count until one run takes minTime, then repeat it
+    Measurement measure(const Benchmark& benchmark, double minTime, int repetitions) {
+        uint64_t iterations = 1;
+        double elapsed = timeRun(benchmark, iterations);
+        while (elapsed < minTime && iterations < (uint64_t(1) << 40)) {
+            double scale = elapsed > 0 ? std::min(10.0, std::max(1.5, 1.2 * minTime / elapsed)) : 10.0;
+            iterations = static_cast<uint64_t>(std::ceil(iterations * scale));
+            elapsed = timeRun(benchmark, iterations);
+        }
+        
+        std::vector<double> samples;
+        samples.push_back(elapsed);
+        for (int i = 1; i < repetitions; i++) {
+            samples.push_back(timeRun(benchmark, iterations));
+        }
+        std::sort(samples.begin(), samples.end());
+        
+        Measurement result;
+        result.iterations = iterations;
+        result.medianNanoseconds = samples[samples.size() / 2] * 1e9 / iterations;
+        result.minNanoseconds = samples.front() * 1e9 / iterations;
+        return result;
+    }
+    
+    // A powered-on pump on a virtual clock with a full reservoir and CGM
+    std::unique_ptr<TSlimX2Pump> makePump(std::shared_ptr<VirtualClock>& clock) {
+        clock = std::make_shared<VirtualClock>(START_TIME);
+        auto pump = std::make_unique<TSlimX2Pump>(clock);
+        pump->attachCGMData(std::make_shared<CGMData>(clock));
+        pump->powerOn();
+        pump->refillInsulin(300.0f);
+        pump->connectCGM();
+        pump->startBasal();
+        pump->setGlucoseSource([](time_t now) {
+            return 7.0f + 3.0f * static_cast<float>(std::sin(now / 7200.0));
+        });
+        return pump;
+    }
+    
+    // Concurrency stress: the pump is driven through simulated days, with a
+    // bolus at the top of every hour, while reader threads check every
+    // status snapshot they see. A torn snapshot would break one of the
+    // invariants; the first violation ends the benchmark run.
+    void runWithStatusReaders(uint64_t days, int readerCount, std::atomic<uint64_t>& reads) {
+        const float bolusStep = 0.05f;
+        std::shared_ptr<VirtualClock> clock;
+        auto pump = makePump(clock);
+        time_t start = clock->now();
+        
+        std::atomic<bool> stop(false);
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> readers;
+        for (int r = 0; r < readerCount; r++) {
+            readers.emplace_back([&pump, &stop, &failed, &reads, start, bolusStep]() {
+                time_t lastTimestamp = 0;
+                double lastDelivered = 0.0;
+                uint64_t count = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    TSlimX2Pump::Status status = pump->getStatus();
+                    count++;
+                    
+                    // Time and delivery only move forward, and basal never stops
+                    bool consistent = status.timestamp >= lastTimestamp &&
+                                      status.totalInsulinDelivered >= lastDelivered &&
+                                      status.state == TSlimX2Pump::DELIVERING_BASAL;
+                    
+                    // The last bolus is this hour's, and its amount encodes the hour
+                    if (status.lastBolusTime > 0) {
+                        long hour = static_cast<long>((status.lastBolusTime - start) / 3600);
+                        float expected = bolusStep * static_cast<float>(1 + hour % 20);
+                        consistent = consistent && status.lastBolusAmount == expected &&
+                                     status.timestamp >= status.lastBolusTime &&
+                                     status.timestamp - status.lastBolusTime <= 3600;
+                    }
+                    
+                    if (!consistent) {
+                        failed.store(true);
+                        break;
+                    }
+                    lastTimestamp = status.timestamp;
+                    lastDelivered = status.totalInsulinDelivered;
+                }
+                reads.fetch_add(count, std::memory_order_relaxed);
+            });
+        }
+        
+        long hour = 0;
+        for (uint64_t day = 0; day < days && !failed.load(std::memory_order_relaxed); day++) {
+            for (int h = 0; h < 24; h++, hour++) {
+                if (pump->getInsulinLevel() < 60.0f) {
+                    pump->refillInsulin(240.0f);
+                }
+                pump->deliverBolus(bolusStep * static_cast<float>(1 + hour % 20));
+                pump->runUntil(clock->now() + 3600);
+            }
+        }
+        
+        stop.store(true);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        if (failed.load()) {
+            std::cerr << "Inconsistent pump status snapshot" << std::endl;
+            std::exit(1);
+        }
+        sink = pump->getInsulinOnBoard();
+    }
+    
+    std::shared_ptr<Profile> makeProfile() {
+        auto profile = std::make_shared<Profile>("Benchmark");
+        for (int hour = 0; hour < 24; hour++) {
+            profile->addBasalRate(hour, 0, 0.4f + 0.05f * hour);
+            profile->addCarbRatio(hour, 0, 10.0f + (hour % 6));
+            profile->addCorrectionFactor(hour, 30, 2.0f + 0.1f * (hour % 4));
+            profile->addTargetGlucose(hour, 0, 6.0f);
+        }
+        return profile;
+    }
+    
+    void registerBenchmarks(std::vector<Benchmark>& benchmarks) {
+        // Pump operations
+        benchmarks.push_back({ "pump/deliverBolus", "bolus", [](uint64_t iterations) {
+            std::shared_ptr<VirtualClock> clock;
+            auto pump = makePump(clock);
+            for (uint64_t i = 0; i < iterations; i++) {
+                if (pump->getInsulinLevel() < 60.0f) {
+                    pump->refillInsulin(240.0f);
+                }
+                clock->advance(1);
+                pump->deliverBolus(0.05f);
+            }
+            sink = pump->getInsulinOnBoard();
+        } });
+        
+        benchmarks.push_back({ "pump/calculateSuggestedBolus", "call", [](uint64_t iterations) {
+            std::shared_ptr<VirtualClock> clock;
+            auto pump = makePump(clock);
+            pump->deliverBolus(2.0f);
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += pump->calculateSuggestedBolus(5.0f + (i % 100) * 0.1f, static_cast<float>(i % 90));
+            }
+            sink = total;
+        } });
+        
+        // Suggested boluses against a compiled profile, as one structure-of-arrays pass
+        benchmarks.push_back({ "bolus/batch4096", "batch", [](uint64_t iterations) {
+            const size_t count = 4096;
+            auto profile = makeProfile();
+            std::vector<int32_t> minute(count);
+            std::vector<float> glucose(count), carbs(count), onBoard(count), bolus(count);
+            for (size_t i = 0; i < count; i++) {
+                minute[i] = static_cast<int32_t>((i * 7) % Profile::MINUTES_PER_DAY);
+                glucose[i] = 5.0f + (i % 100) * 0.1f;
+                carbs[i] = static_cast<float>(i % 90);
+                onBoard[i] = (i % 30) * 0.1f;
+            }
+            for (uint64_t i = 0; i < iterations; i++) {
+                BolusCalculator::calculateBatch(*profile, minute.data(), glucose.data(), carbs.data(), onBoard.data(),
+                                                bolus.data(), count);
+            }
+            sink = bolus[count - 1];
+        } });
+        
+        benchmarks.push_back({ "pump/activateProfile", "switch", [](uint64_t iterations) {
+            std::shared_ptr<VirtualClock> clock;
+            auto pump = makePump(clock);
+            pump->createProfile("Benchmark");
+            pump->updateProfile("Benchmark", makeProfile());
+            for (uint64_t i = 0; i < iterations; i++) {
+                clock->advance(1);
+                pump->activateProfile(i % 2 ? "Default" : "Benchmark");
+            }
+            sink = pump->getActiveProfileVersion();
+        } });
+        
+        // Profile lookups
+        benchmarks.push_back({ "profile/getSettings", "lookup", [](uint64_t iterations) {
+            auto profile = makeProfile();
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                const Profile::Settings& settings = profile->getSettings(static_cast<int>((i * 7) % Profile::MINUTES_PER_DAY));
+                total += settings.basalRate + settings.carbRatio;
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "profile/getBasalRate", "lookup", [](uint64_t iterations) {
+            auto profile = makeProfile();
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                int minute = static_cast<int>((i * 7) % Profile::MINUTES_PER_DAY);
+                total += profile->getBasalRate(minute / 60, minute % 60);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "profile/getDailyBasalTotal", "call", [](uint64_t iterations) {
+            auto profile = makeProfile();
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += profile->getDailyBasalTotal();
+            }
+            sink = total;
+        } });
+        
+        // CGM statistics over 90 days of 5-minute readings, random day windows
+        auto cgmData = std::make_shared<CGMData>();
+        std::mt19937 random(7);
+        std::normal_distribution<float> noise(0.0f, 0.4f);
+        const int readingCount = 90 * 288;
+        cgmData->reserve(readingCount);
+        for (int i = 0; i < readingCount; i++) {
+            float value = 7.5f + 3.5f * static_cast<float>(std::sin(i / 40.0)) + noise(random);
+            cgmData->addReading(std::max(2.0f, value), START_TIME + i * 300);
+        }
+        auto window = [](uint64_t i) {
+            time_t start = START_TIME + static_cast<time_t>((i * 7919) % (89 * 288)) * 300;
+            return std::make_pair(start, start + 86400);
+        };
+        
+        benchmarks.push_back({ "cgm/getAverageGlucose", "query", [cgmData, window](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += cgmData->getAverageGlucose(range.first, range.second);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "cgm/getStandardDeviation", "query", [cgmData, window](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += cgmData->getStandardDeviation(range.first, range.second);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "cgm/getTimeInRange", "query", [cgmData, window](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += cgmData->getTimeInRange(3.9f, 10.0f, range.first, range.second);
+            }
+            sink = total;
+        } });
+        
+        // The same history with all but the last week in compressed blocks
+        auto compactData = std::make_shared<CGMData>();
+        compactData->enableCompactStorage();
+        for (const auto& reading : cgmData->getReadings(START_TIME, START_TIME + readingCount * 300)) {
+            compactData->addReading(reading.value, reading.timestamp);
+        }
+        
+        benchmarks.push_back({ "cgm/compact/getAverageGlucose", "query", [compactData, window](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += compactData->getAverageGlucose(range.first, range.second);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "cgm/compact/getTimeInRange", "query", [compactData, window](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += compactData->getTimeInRange(3.9f, 10.0f, range.first, range.second);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "cgm/compact/addReading", "reading", [](uint64_t iterations) {
+            CGMData data;
+            data.enableCompactStorage();
+            for (uint64_t i = 0; i < iterations; i++) {
+                data.addReading(5.0f + (i % 50) * 0.1f, START_TIME + static_cast<time_t>(i) * 300);
+            }
+            sink = data.getReadingCount();
+        } });
+        
+        benchmarks.push_back({ "cgm/addReading", "reading", [](uint64_t iterations) {
+            CGMData data;
+            data.reserve(static_cast<size_t>(iterations));
+            for (uint64_t i = 0; i < iterations; i++) {
+                data.addReading(5.0f + (i % 50) * 0.1f, START_TIME + static_cast<time_t>(i) * 300);
+            }
+            sink = data.getReadingCount();
+        } });
+        
+        benchmarks.push_back({ "cgm/predictGlucose", "prediction", [cgmData](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += cgmData->predictGlucose(30);
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "cgm/predictorUpdate", "reading", [](uint64_t iterations) {
+            GlucosePredictor predictor;
+            for (uint64_t i = 0; i < iterations; i++) {
+                predictor.update(5.0f + (i % 50) * 0.1f, START_TIME + static_cast<time_t>(i) * 300);
+            }
+            sink = predictor.getLevel();
+        } });
+        
+        // AGP sketch: streaming updates and a full report over 90 days
+        benchmarks.push_back({ "agp/add", "reading", [](uint64_t iterations) {
+            GlucoseProfileSketch sketch;
+            for (uint64_t i = 0; i < iterations; i++) {
+                sketch.add(5.0f + (i % 50) * 0.1f, START_TIME + static_cast<time_t>(i) * 300);
+            }
+            sink = static_cast<double>(sketch.getCount());
+        } });
+        
+        auto profileSketch = std::make_shared<GlucoseProfileSketch>();
+        for (const auto& reading : cgmData->getReadings(START_TIME, START_TIME + readingCount * 300)) {
+            profileSketch->add(reading.value, reading.timestamp);
+        }
+        
+        benchmarks.push_back({ "agp/report", "report", [profileSketch](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += profileSketch->getReport().bins[48].percentiles[2];
+            }
+            sink = total;
+        } });
+        
+        // History queries over 90 days of simulated pump use
+        std::shared_ptr<VirtualClock> historyClock;
+        std::shared_ptr<TSlimX2Pump> historyPump = makePump(historyClock);
+        for (int day = 0; day < 90; day++) {
+            historyPump->runUntil(historyClock->now() + 43200);
+            historyPump->deliverBolus(3.0f);
+            historyPump->runUntil(historyClock->now() + 43200);
+            historyPump->refillInsulin(300.0f);
+        }
+        
+        benchmarks.push_back({ "history/getHistory", "day", [historyPump, window](uint64_t iterations) {
+            size_t total = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += historyPump->getHistory(range.first, range.second).size();
+            }
+            sink = static_cast<double>(total);
+        } });
+        
+        benchmarks.push_back({ "history/getHistoryView", "day", [historyPump, window](uint64_t iterations) {
+            size_t total = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += historyPump->getHistoryView(range.first, range.second).size();
+            }
+            sink = static_cast<double>(total);
+        } });
+        
+        benchmarks.push_back({ "history/getHistoryByType", "day", [historyPump, window](uint64_t iterations) {
+            size_t total = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto range = window(i);
+                total += historyPump->getHistoryByType(Event::BOLUS, range.first, range.second).size();
+            }
+            sink = static_cast<double>(total);
+        } });
+        
+        // What-if branches off the 90-day pump: the fork alone, and a fork
+        // run forward an hour with a bolus (copies only the chunks it writes)
+        benchmarks.push_back({ "fork/snapshot", "fork", [historyPump](uint64_t iterations) {
+            size_t total = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += historyPump->fork()->getEventLog().size();
+            }
+            sink = static_cast<double>(total);
+        } });
+        
+        benchmarks.push_back({ "fork/branchHour", "branch", [historyPump](uint64_t iterations) {
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                auto branch = historyPump->fork();
+                branch->deliverBolus(1.0f);
+                branch->runUntil(branch->getClock()->now() + 3600);
+                total += branch->getInsulinOnBoard();
+            }
+            sink = total;
+        } });
+        
+        // Batched physiology: one minute for 1024 patients
+        benchmarks.push_back({ "model/step1024", "step", [](uint64_t iterations) {
+            GlucoseModel model;
+            GlucoseModel::Parameters parameters;
+            for (int i = 0; i < 1024; i++) {
+                model.addPatient(parameters, 5.0f + (i % 50) * 0.1f);
+            }
+            std::vector<float> insulin(1024, parameters.basalInsulinNeed / 60.0f);
+            for (uint64_t i = 0; i < iterations; i++) {
+                model.step(insulin.data());
+            }
+            sink = model.getGlucose(0);
+        } });
+        
+        // Control-IQ decisions, one at a time and as one structure-of-arrays pass
+        benchmarks.push_back({ "controliq/scalar", "decision", [](uint64_t iterations) {
+            ControlIQ::Settings settings;
+            ControlIQ::Input input = { 5.0f, 1.0f, 0.8f, 2.5f, 6.1f, 90 };
+            float total = 0.0f;
+            for (uint64_t i = 0; i < iterations; i++) {
+                input.predictedGlucose = 3.0f + (i % 128) * 0.1f;
+                total += ControlIQ::evaluate(settings, input).basalRate;
+            }
+            sink = total;
+        } });
+        
+        benchmarks.push_back({ "controliq/batch4096", "batch", [](uint64_t iterations) {
+            const size_t count = 4096;
+            ControlIQ::Settings settings;
+            std::vector<float> glucose(count), onBoard(count, 1.0f), basal(count, 0.8f);
+            std::vector<float> factor(count, 2.5f), target(count, 6.1f), rate(count), correction(count);
+            std::vector<int32_t> sinceCorrection(count, 90);
+            std::vector<uint8_t> action(count);
+            for (size_t i = 0; i < count; i++) {
+                glucose[i] = 3.0f + (i % 128) * 0.1f;
+            }
+            for (uint64_t i = 0; i < iterations; i++) {
+                ControlIQ::evaluateBatch(settings, glucose.data(), onBoard.data(), basal.data(), factor.data(),
+                                         target.data(), sinceCorrection.data(), rate.data(), correction.data(),
+                                         action.data(), count);
+            }
+            sink = rate[count - 1];
+        } });
+        
+        // Whole simulated day: basal, absorption and 288 CGM readings
+        benchmarks.push_back({ "simulation/day", "day", [](uint64_t iterations) {
+            std::shared_ptr<VirtualClock> clock;
+            auto pump = makePump(clock);
+            for (uint64_t i = 0; i < iterations; i++) {
+                pump->runUntil(clock->now() + 86400);
+                pump->refillInsulin(300.0f);
+            }
+            sink = pump->getInsulinOnBoard();
+        } });
+        
+        // Timer wheel holding a cohort's worth of timers (a million, up to
+        // three days out): pop the earliest and schedule a replacement
+        auto wheel = std::make_shared<TimerWheel>(START_TIME);
+        auto delays = std::make_shared<std::mt19937>(11);
+        for (uint32_t i = 0; i < 1000000; i++) {
+            wheel->schedule(START_TIME + 1 + (*delays)() % (3 * 86400), 0, i);
+        }
+        
+        benchmarks.push_back({ "scheduler/expireAndSchedule", "timer", [wheel, delays](uint64_t iterations) {
+            TimerWheel::Timer timer;
+            uint64_t total = 0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                wheel->expire(wheel->getTime() + 86400, timer);
+                wheel->schedule(timer.when + 1 + (*delays)() % (3 * 86400), timer.kind, timer.data);
+                total += timer.data;
+            }
+            sink = static_cast<double>(total);
+        } });
+        
+        benchmarks.push_back({ "scheduler/scheduleAndCancel", "timer", [wheel, delays](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++) {
+                TimerWheel::TimerId id = wheel->schedule(wheel->getTime() + 1 + (*delays)() % (3 * 86400), 1);
+                wheel->cancel(id);
+            }
+            sink = static_cast<double>(wheel->size());
+        } });
+        
+        // Amortized cost of an instrumented call, whether or not the pump is built with metrics
+        benchmarks.push_back({ "metrics/scopedTimer", "call", [](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++) {
+                Metrics::ScopedTimer timer(Metrics::LOG_EVENT);
+            }
+            sink = static_cast<double>(Metrics::snapshot().operations[Metrics::LOG_EVENT].count);
+        } });
+        
+        // Sustained span rate, bounded by the writer once the ring fills
+        benchmarks.push_back({ "timeline/recordSpan", "span", [](uint64_t iterations) {
+            TimelineRecorder timeline;
+            timeline.open("/dev/null");
+            for (uint64_t i = 0; i < iterations; i++) {
+                TimelineRecorder::Scope span(&timeline, "span");
+            }
+            timeline.close();
+            sink = static_cast<double>(timeline.getRecordCount());
+        } });
+        
+        // Status reads from other threads while a day is simulated
+        benchmarks.push_back({ "concurrency/dayWith8Readers", "day", [](uint64_t iterations) {
+            std::atomic<uint64_t> reads(0);
+            runWithStatusReaders(iterations, 8, reads);
+        } });
+        
+        benchmarks.push_back({ "concurrency/getStatus", "read", [](uint64_t iterations) {
+            std::shared_ptr<VirtualClock> clock;
+            auto pump = makePump(clock);
+            double total = 0.0;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += pump->getStatus().insulinLevel;
+            }
+            sink = total;
+        } });
+        
+        // Scripted scenarios: 16 one-day scenarios stepped as one block
+        ScenarioRunner scenarioRunner(1);
+        scenarioRunner.parse("scenario day\n"
+                             "repeat 16\n"
+                             "profile Default basal=0.8 carb-ratio=12 correction=2.5 target=6.1\n"
+                             "daily 07:30 meal 60 jitter=20\n"
+                             "daily 12:30 meal 45 jitter=30\n"
+                             "daily 18:30 meal 70 jitter=30\n"
+                             "day 1 02:00 sensor-gap 60\n"
+                             "end\n");
+        std::vector<ScenarioRunner::Scenario> scenarios;
+        for (size_t i = 0; i < scenarioRunner.getScenarioCount(); i++) {
+            scenarios.push_back(scenarioRunner.getScenario(i));
+        }
+        benchmarks.push_back({ "scenario/block16", "block", [scenarios](uint64_t iterations) {
+            std::vector<ScenarioRunner::Result> results(scenarios.size());
+            for (uint64_t i = 0; i < iterations; i++) {
+                ScenarioRunner::runBlock(scenarios.data(), scenarios.size(), results.data());
+            }
+            sink = results[0].averageGlucose;
+        } });
+        
+        // The same block with its phases and pump histories on a timeline
+        benchmarks.push_back({ "scenario/block16Timeline", "block", [scenarios](uint64_t iterations) {
+            std::vector<ScenarioRunner::Result> results(scenarios.size());
+            TimelineRecorder timeline;
+            timeline.open("/dev/null");
+            for (uint64_t i = 0; i < iterations; i++) {
+                ScenarioRunner::runBlock(scenarios.data(), scenarios.size(), results.data(), &timeline);
+            }
+            timeline.close();
+            sink = results[0].averageGlucose;
+        } });
+        
+        // Monte Carlo draws of the bolus calculation on one thread
+        benchmarks.push_back({ "montecarlo/draw", "draw", [](uint64_t iterations) {
+            BolusMonteCarlo monteCarlo(1);
+            BolusMonteCarlo::Scenario scenario = BolusMonteCarlo::getStandardScenarios(iterations, 1)[7];
+            sink = monteCarlo.run(scenario).outcomeGlucose.mean;
+        } });
+        
+        // One optimizer candidate: eight replicates of a patient for a day
+        CohortSimulation cohort(1);
+        cohort.generatePatients(1, 42, 1);
+        CohortSimulation::PatientConfig patient = cohort.getPatient(0);
+        benchmarks.push_back({ "optimizer/evaluate", "candidate", [patient](uint64_t iterations) {
+            TherapyOptimizer::Options options;
+            std::vector<TherapyOptimizer::Segment> segments = {
+                { 0, patient.basalRate, patient.carbRatio, patient.correctionFactor },
+                { 12 * 60, patient.basalRate, patient.carbRatio, patient.correctionFactor }
+            };
+            float total = 0.0f;
+            for (uint64_t i = 0; i < iterations; i++) {
+                total += TherapyOptimizer::evaluate(patient, options, segments).score;
+            }
+            sink = total;
+        } });
+    }
+    
+    void writeJson(std::ostream& out, const std::vector<Benchmark>& benchmarks,
+                   const std::vector<Measurement>& measurements, double minTime, int repetitions) {
+        out << "{\n";
+        out << "  \"schema_version\": 1,\n";
+        out << "  \"min_time_seconds\": " << minTime << ",\n";
+        out << "  \"repetitions\": " << repetitions << ",\n";
+        out << "  \"benchmarks\": [";
+        for (size_t i = 0; i < benchmarks.size(); i++) {
+            const Measurement& m = measurements[i];
+            out << (i == 0 ? "\n" : ",\n");
+            out << "    {\"name\": \"" << benchmarks[i].name << "\", "
+                << "\"unit\": \"" << benchmarks[i].unit << "\", "
+                << "\"iterations\": " << m.iterations << ", "
+                << std::fixed << std::setprecision(3)
+                << "\"ns_per_op\": " << m.medianNanoseconds << ", "
+                << "\"min_ns_per_op\": " << m.minNanoseconds << ", "
+                << std::setprecision(1)
+                << "\"ops_per_second\": " << (m.medianNanoseconds > 0 ? 1e9 / m.medianNanoseconds : 0.0) << "}"
+                << std::defaultfloat;
+        }
+        out << "\n  ]\n}\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    double minTime = 0.2;
+    int repetitions = 5;
+    bool listOnly = false;
+    const char* metricsPath = nullptr;
+    
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            minTime = std::max(0.001, std::atof(argv[++i]));
+        } else if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--list") == 0) {
+            listOnly = true;
+        } else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--filter <substring>] [--min-time <seconds>] [--repetitions <n>] [--list]"
+                      << " [--metrics <file>]" << std::endl;
+            return 1;
+        }
+    }
+    
+    std::vector<Benchmark> all;
+    registerBenchmarks(all);
+    
+    std::vector<Benchmark> selected;
+    for (const auto& benchmark : all) {
+        if (filter.empty() || benchmark.name.find(filter) != std::string::npos) {
+            selected.push_back(benchmark);
+        }
+    }
+    
+    if (listOnly) {
+        for (const auto& benchmark : selected) {
+            std::cout << benchmark.name << std::endl;
+        }
+        return 0;
+    }
+    
+    std::vector<Measurement> measurements;
+    for (const auto& benchmark : selected) {
+        measurements.push_back(measure(benchmark, minTime, repetitions));
+        std::cerr << std::left << std::setw(32) << benchmark.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(14) << measurements.back().medianNanoseconds
+                  << " ns/" << benchmark.unit << std::defaultfloat << std::endl;
+    }
+    
+    writeJson(std::cout, selected, measurements, minTime, repetitions);
+    if (metricsPath && !Metrics::dump(metricsPath)) {
+        std::cerr << "Unable to write " << metricsPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "BolusCalculator.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // Settings gathered from a profile per pass, structure-of-arrays
+    const size_t GATHER_BLOCK = 256;
+    
+    // Keeps value's bits where keep is 1 and gives +0 where it is 0. Conditional
+    // float ops stop GCC vectorizing, and blending arithmetically would turn
+    // some zeros negative and let infinities through as NaN.
+    inline float keepIf(int32_t keep, float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits &= static_cast<uint32_t>(-keep);
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    
+    // The one definition of the formula; every lane computes exactly what
+    // the pump's calculation always has
+    inline float suggestedBolus(float glucose, float carbs, float insulinOnBoard,
+                                float carbRatio, float correctionFactor, float targetGlucose) {
+        float foodBolus = carbs / carbRatio;
+        float glucoseDifference = glucose - targetGlucose;
+        float correctionBolus = keepIf(glucoseDifference > 0, glucoseDifference / correctionFactor);
+        float totalBolus = foodBolus + correctionBolus - insulinOnBoard;
+        return keepIf(!(totalBolus < 0), totalBolus);
+    }
+}
+
+float BolusCalculator::calculate(const Profile::Settings& settings, float glucose, float carbs, float insulinOnBoard) {
+    float bolus;
+    calculateBatch(settings, &glucose, &carbs, &insulinOnBoard, &bolus, 1);
+    return bolus;
+}
+
+void BolusCalculator::calculateBatch(const Profile::Settings& settings, const float* glucose, const float* carbs,
+                                     const float* insulinOnBoard, float* bolus, size_t count) {
+    const float carbRatio = settings.carbRatio;
+    const float correctionFactor = settings.correctionFactor;
+    const float targetGlucose = settings.targetGlucose;
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#elif defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#endif
+    for (size_t i = 0; i < count; i++) {
+        bolus[i] = suggestedBolus(glucose[i], carbs[i], insulinOnBoard[i], carbRatio, correctionFactor, targetGlucose);
+    }
+}
+
+void BolusCalculator::calculateBatch(const Profile& profile, const int32_t* minuteOfDay, const float* glucose,
+                                     const float* carbs, const float* insulinOnBoard, float* bolus, size_t count) {
+    alignas(64) float carbRatio[GATHER_BLOCK];
+    alignas(64) float correctionFactor[GATHER_BLOCK];
+    alignas(64) float targetGlucose[GATHER_BLOCK];
+    
+    for (size_t begin = 0; begin < count; begin += GATHER_BLOCK) {
+        size_t blockCount = std::min(GATHER_BLOCK, count - begin);
+        
+        // The settings table is array-of-structures; gather it by lane first
+        for (size_t i = 0; i < blockCount; i++) {
+            const Profile::Settings& settings = profile.getSettings(minuteOfDay[begin + i]);
+            carbRatio[i] = settings.carbRatio;
+            correctionFactor[i] = settings.correctionFactor;
+            targetGlucose[i] = settings.targetGlucose;
+        }
+        
+        const float* blockGlucose = glucose + begin;
+        const float* blockCarbs = carbs + begin;
+        const float* blockInsulin = insulinOnBoard + begin;
+        float* blockBolus = bolus + begin;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#elif defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#endif
+        for (size_t i = 0; i < blockCount; i++) {
+            blockBolus[i] = suggestedBolus(blockGlucose[i], blockCarbs[i], blockInsulin[i],
+                                           carbRatio[i], correctionFactor[i], targetGlucose[i]);
+        }
+    }
+}
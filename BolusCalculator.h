@@ -0,0 +1,31 @@
+#ifndef BOLUS_CALCULATOR_H
+#define BOLUS_CALCULATOR_H
+
+#include "Profile.h"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The pump's suggested bolus: carbs over the carb ratio, plus glucose
+ * above target over the correction factor, less insulin on board, and
+ * never below zero. Batches are structure-of-arrays and evaluated in
+ * branch-free passes that vectorize; a single calculation runs the same
+ * pass with a count of one, so batched and single results are
+ * bit-identical.
+ */
+class BolusCalculator {
+public:
+    // Single calculation, as the pump does it
+    static float calculate(const Profile::Settings& settings, float glucose, float carbs, float insulinOnBoard);
+    
+    // Many calculations under the same settings
+    static void calculateBatch(const Profile::Settings& settings, const float* glucose, const float* carbs,
+                               const float* insulinOnBoard, float* bolus, size_t count);
+    
+    // Many calculations against one compiled profile, each at its own
+    // minute of the day (wrapped into [0, 1440))
+    static void calculateBatch(const Profile& profile, const int32_t* minuteOfDay, const float* glucose,
+                               const float* carbs, const float* insulinOnBoard, float* bolus, size_t count);
+};
+
+#endif // BOLUS_CALCULATOR_H
@@ -0,0 +1,402 @@
+#include "BolusMonteCarlo.h"
+#include "BolusCalculator.h"
+#include "IOBEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+const float BolusMonteCarlo::PERCENTILES[BolusMonteCarlo::PERCENTILE_COUNT] = {
+    1.0f, 5.0f, 25.0f, 50.0f, 75.0f, 95.0f, 99.0f
+};
+
+namespace {
+    // Draws per random stream; the unit of work handed to the pool
+    const uint64_t CHUNK_DRAWS = 1 << 16;
+    
+    // Draws evaluated together, structure-of-arrays
+    const size_t BATCH = 256;
+    
+    const float TWO_PI = 6.28318530718f;
+    
+    // The CGM's reporting range (mmol/L)
+    const float SENSOR_MINIMUM = 2.2f;
+    const float SENSOR_MAXIMUM = 22.2f;
+    
+    // Outcome glucose is linear in the bolus error between the knees and
+    // saturates toward the bounds beyond them (mmol/L)
+    const float OUTCOME_FLOOR = 1.0f;
+    const float OUTCOME_LOW_KNEE = 3.0f;
+    const float OUTCOME_HIGH_KNEE = 22.2f;
+    const float OUTCOME_CEILING = 30.0f;
+    
+    enum Outcome {
+        BOLUS,
+        BOLUS_ERROR,
+        OUTCOME_GLUCOSE,
+        OUTCOME_COUNT
+    };
+    
+    // Histogram layouts: low edge, bin width, bins
+    const float HISTOGRAM_LOW[OUTCOME_COUNT] = { 0.0f, -20.0f, 0.0f };
+    const float HISTOGRAM_WIDTH[OUTCOME_COUNT] = { 0.01f, 0.01f, 0.05f };
+    const size_t HISTOGRAM_BINS[OUTCOME_COUNT] = { 4000, 4000, 600 };     // Glucose spans 0 to the ceiling
+    
+    // Exponential approach to the bound past a knee; continuous with slope
+    // 1 at the knee, so outcomes keep their order and the thresholds between
+    // the knees count exactly what the linear model does
+    inline float saturateGlucose(float glucose) {
+        if (glucose < OUTCOME_LOW_KNEE) {
+            const float span = OUTCOME_LOW_KNEE - OUTCOME_FLOOR;
+            return OUTCOME_FLOOR + span * std::exp((glucose - OUTCOME_LOW_KNEE) / span);
+        }
+        if (glucose > OUTCOME_HIGH_KNEE) {
+            const float span = OUTCOME_CEILING - OUTCOME_HIGH_KNEE;
+            return OUTCOME_CEILING - span * std::exp((OUTCOME_HIGH_KNEE - glucose) / span);
+        }
+        return glucose;
+    }
+    
+    uint64_t splitMix(uint64_t& state) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    
+    /**
+     * Random stream of one chunk: eight interleaved xoshiro128+ generators
+     * whose state is stored by lane, so a whole batch of uniforms comes
+     * from one vectorizable loop.
+     */
+    class RandomStream {
+    public:
+        static const size_t LANES = 8;
+        
+        RandomStream(uint64_t seed, uint64_t stream) {
+            uint64_t state = seed;
+            state = splitMix(state) ^ (stream * 0xD1B54A32D192ED03ULL);
+            for (size_t lane = 0; lane < LANES; lane++) {
+                uint64_t a = splitMix(state);
+                uint64_t b = splitMix(state);
+                s0[lane] = static_cast<uint32_t>(a);
+                s1[lane] = static_cast<uint32_t>(a >> 32);
+                s2[lane] = static_cast<uint32_t>(b);
+                s3[lane] = static_cast<uint32_t>(b >> 32) | 1; // Never all zero
+            }
+        }
+        
+        // Uniform in (0, 1]; count is a multiple of LANES
+        void fillUniform(float* values, size_t count) {
+            for (size_t i = 0; i < count; i += LANES) {
+                for (size_t lane = 0; lane < LANES; lane++) {
+                    uint32_t result = s0[lane] + s3[lane];
+                    uint32_t t = s1[lane] << 9;
+                    s2[lane] ^= s0[lane];
+                    s3[lane] ^= s1[lane];
+                    s1[lane] ^= s2[lane];
+                    s0[lane] ^= s3[lane];
+                    s2[lane] ^= t;
+                    s3[lane] = (s3[lane] << 11) | (s3[lane] >> 21);
+                    values[i + lane] = static_cast<float>((result >> 8) + 1) * (1.0f / 16777216.0f);
+                }
+            }
+        }
+        
+        // Standard normal (Box-Muller); count is a multiple of 2 * LANES
+        void fillNormal(float* values, size_t count) {
+            fillUniform(values, count);
+            for (size_t i = 0; i < count; i += 2) {
+                float radius = std::sqrt(-2.0f * std::log(values[i]));
+                float angle = TWO_PI * values[i + 1];
+                values[i] = radius * std::cos(angle);
+                values[i + 1] = radius * std::sin(angle);
+            }
+        }
+        
+    private:
+        uint32_t s0[LANES];
+        uint32_t s1[LANES];
+        uint32_t s2[LANES];
+        uint32_t s3[LANES];
+    };
+    
+    // Histograms, extremes and threshold counts of any number of chunks
+    struct Tally {
+        std::vector<uint64_t> counts[OUTCOME_COUNT];
+        float minimum[OUTCOME_COUNT];
+        float maximum[OUTCOME_COUNT];
+        uint64_t zeroBolus;
+        uint64_t severeLow;
+        uint64_t low;
+        uint64_t high;
+        uint64_t severeHigh;
+        
+        Tally() :
+            zeroBolus(0),
+            severeLow(0),
+            low(0),
+            high(0),
+            severeHigh(0)
+        {
+            for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+                counts[outcome].assign(HISTOGRAM_BINS[outcome], 0);
+                minimum[outcome] = HUGE_VALF;
+                maximum[outcome] = -HUGE_VALF;
+            }
+        }
+        
+        void merge(const Tally& other) {
+            for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+                for (size_t bin = 0; bin < counts[outcome].size(); bin++) {
+                    counts[outcome][bin] += other.counts[outcome][bin];
+                }
+                minimum[outcome] = std::min(minimum[outcome], other.minimum[outcome]);
+                maximum[outcome] = std::max(maximum[outcome], other.maximum[outcome]);
+            }
+            zeroBolus += other.zeroBolus;
+            severeLow += other.severeLow;
+            low += other.low;
+            high += other.high;
+            severeHigh += other.severeHigh;
+        }
+    };
+    
+    // Floating-point sums are kept per chunk and added in chunk order, so
+    // the moments do not depend on which thread ran which chunk
+    struct ChunkSums {
+        double sum[OUTCOME_COUNT];
+        double sumSquares[OUTCOME_COUNT];
+    };
+    
+    void simulateChunk(const BolusMonteCarlo::Scenario& scenario, const std::vector<float>& remaining,
+                       uint64_t chunk, uint64_t draws, Tally& tally, ChunkSums& sums) {
+        RandomStream stream(scenario.seed, chunk);
+        alignas(64) float sensorNoise[BATCH];
+        alignas(64) float carbNoise[BATCH];
+        alignas(64) float timingNoise[BATCH];
+        alignas(64) float trueGlucose[BATCH];
+        alignas(64) float reading[BATCH];
+        alignas(64) float counted[BATCH];
+        alignas(64) float insulinOnBoard[BATCH];
+        alignas(64) float outcomes[OUTCOME_COUNT][BATCH];
+        float* bolus = outcomes[BOLUS];
+        float* bolusError = outcomes[BOLUS_ERROR];
+        float* outcomeGlucose = outcomes[OUTCOME_GLUCOSE];
+        
+        const float lastMinute = static_cast<float>(remaining.size() - 1);
+        const float trueCarbInsulin = scenario.carbs / scenario.trueCarbRatio;
+        const Profile::Settings settings = { 0.0f, scenario.carbRatio, scenario.correctionFactor, scenario.targetGlucose };
+        std::fill(sums.sum, sums.sum + OUTCOME_COUNT, 0.0);
+        std::fill(sums.sumSquares, sums.sumSquares + OUTCOME_COUNT, 0.0);
+        
+        for (uint64_t offset = 0; offset < draws; offset += BATCH) {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(BATCH, draws - offset));
+            stream.fillNormal(sensorNoise, BATCH);
+            stream.fillNormal(carbNoise, BATCH);
+            stream.fillNormal(timingNoise, BATCH);
+            
+            // What the pump is told, and the glucose and insulin on board when the bolus is given
+            for (size_t i = 0; i < count; i++) {
+                float delay = scenario.timingJitter * timingNoise[i];
+                trueGlucose[i] = scenario.glucose + scenario.glucoseTrend * delay;
+                float sensed = trueGlucose[i] * (1.0f + scenario.sensorError * sensorNoise[i]);
+                reading[i] = std::min(SENSOR_MAXIMUM, std::max(SENSOR_MINIMUM, sensed));
+                counted[i] = std::max(0.0f, scenario.carbs * (1.0f + scenario.carbCountError * carbNoise[i]));
+                float minute = std::min(lastMinute, std::max(0.0f, scenario.minutesSinceBolus + delay));
+                insulinOnBoard[i] = scenario.previousBolus * remaining[static_cast<size_t>(minute)];
+            }
+            
+            // The pump's suggested bolus
+            BolusCalculator::calculateBatch(settings, reading, counted, insulinOnBoard, bolus, count);
+            
+            // Glucose once the bolus, the meal and the insulin on board have
+            // acted; the bolus that was needed lands exactly on target
+            for (size_t i = 0; i < count; i++) {
+                float needed = trueCarbInsulin + (trueGlucose[i] - scenario.targetGlucose) / scenario.trueSensitivity
+                    - insulinOnBoard[i];
+                bolusError[i] = bolus[i] - needed;
+                outcomeGlucose[i] = saturateGlucose(scenario.targetGlucose - scenario.trueSensitivity * bolusError[i]);
+            }
+            
+            for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+                const float* values = outcomes[outcome];
+                std::vector<uint64_t>& counts = tally.counts[outcome];
+                float low = HISTOGRAM_LOW[outcome];
+                float scale = 1.0f / HISTOGRAM_WIDTH[outcome];
+                float lastBin = static_cast<float>(counts.size() - 1);
+                double sum = 0.0, sumSquares = 0.0;
+                for (size_t i = 0; i < count; i++) {
+                    float bin = std::min(lastBin, std::max(0.0f, (values[i] - low) * scale));
+                    counts[static_cast<size_t>(bin)]++;
+                    sum += values[i];
+                    sumSquares += static_cast<double>(values[i]) * values[i];
+                    tally.minimum[outcome] = std::min(tally.minimum[outcome], values[i]);
+                    tally.maximum[outcome] = std::max(tally.maximum[outcome], values[i]);
+                }
+                sums.sum[outcome] += sum;
+                sums.sumSquares[outcome] += sumSquares;
+            }
+            
+            for (size_t i = 0; i < count; i++) {
+                tally.zeroBolus += bolus[i] <= 0.0f;
+                tally.severeLow += outcomeGlucose[i] < 3.0f;
+                tally.low += outcomeGlucose[i] < 3.9f;
+                tally.high += outcomeGlucose[i] > 10.0f;
+                tally.severeHigh += outcomeGlucose[i] > 13.9f;
+            }
+        }
+    }
+    
+    BolusMonteCarlo::Distribution makeDistribution(int outcome, const Tally& tally, double sum, double sumSquares) {
+        BolusMonteCarlo::Distribution distribution;
+        distribution.low = HISTOGRAM_LOW[outcome];
+        distribution.binWidth = HISTOGRAM_WIDTH[outcome];
+        distribution.counts = tally.counts[outcome];
+        distribution.total = 0;
+        for (uint64_t count : distribution.counts) {
+            distribution.total += count;
+        }
+        
+        uint64_t total = distribution.total;
+        distribution.mean = total > 0 ? sum / total : 0.0;
+        double variance = total > 1 ? (sumSquares - sum * distribution.mean) / (total - 1) : 0.0;
+        distribution.standardDeviation = std::sqrt(std::max(0.0, variance));
+        distribution.minimum = total > 0 ? tally.minimum[outcome] : 0.0f;
+        distribution.maximum = total > 0 ? tally.maximum[outcome] : 0.0f;
+        for (int i = 0; i < BolusMonteCarlo::PERCENTILE_COUNT; i++) {
+            distribution.percentiles[i] = distribution.getPercentile(BolusMonteCarlo::PERCENTILES[i]);
+        }
+        return distribution;
+    }
+}
+
+float BolusMonteCarlo::Distribution::getPercentile(float percentile) const {
+    if (total == 0) {
+        return 0.0f;
+    }
+    
+    uint64_t rank = static_cast<uint64_t>(std::ceil(std::min(100.0f, std::max(0.0f, percentile)) / 100.0 * total));
+    rank = std::max<uint64_t>(1, rank);
+    uint64_t cumulative = 0;
+    size_t bin = 0;
+    for (; bin + 1 < counts.size(); bin++) {
+        cumulative += counts[bin];
+        if (cumulative >= rank) {
+            break;
+        }
+    }
+    
+    // Edge bins also hold the values beyond them
+    float value = low + (static_cast<float>(bin) + 0.5f) * binWidth;
+    return std::min(maximum, std::max(minimum, value));
+}
+
+BolusMonteCarlo::BolusMonteCarlo(unsigned threadCount) :
+    pool(threadCount)
+{
+}
+
+void BolusMonteCarlo::addScenario(const Scenario& scenario) {
+    scenarios.push_back(scenario);
+}
+
+size_t BolusMonteCarlo::getScenarioCount() const {
+    return scenarios.size();
+}
+
+void BolusMonteCarlo::clearScenarios() {
+    scenarios.clear();
+}
+
+std::vector<BolusMonteCarlo::Result> BolusMonteCarlo::run() {
+    std::vector<Result> results;
+    for (const auto& scenario : scenarios) {
+        results.push_back(run(scenario));
+    }
+    return results;
+}
+
+BolusMonteCarlo::Result BolusMonteCarlo::run(const Scenario& scenario) {
+    auto started = std::chrono::steady_clock::now();
+    
+    // Remaining fraction of the earlier bolus by minute, zero past the end
+    auto curve = InsulinActionCurve::forDuration(scenario.insulinDuration);
+    int minutes = static_cast<int>(std::ceil(curve->getDuration() * 60.0f));
+    std::vector<float> remaining(minutes + 2, 0.0f);
+    for (int t = 0; t <= minutes; t++) {
+        remaining[t] = curve->getRemainingFraction(static_cast<float>(t));
+    }
+    
+    uint64_t chunks = (scenario.draws + CHUNK_DRAWS - 1) / CHUNK_DRAWS;
+    std::vector<ChunkSums> sums(chunks);
+    Tally tally;
+    std::mutex tallyMutex;
+    pool.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+        std::unique_ptr<Tally> local(new Tally());
+        for (size_t chunk = begin; chunk < end; chunk++) {
+            uint64_t draws = std::min(CHUNK_DRAWS, scenario.draws - chunk * CHUNK_DRAWS);
+            simulateChunk(scenario, remaining, chunk, draws, *local, sums[chunk]);
+        }
+        
+        std::lock_guard<std::mutex> lock(tallyMutex);
+        tally.merge(*local);
+    });
+    
+    Result result;
+    result.name = scenario.name;
+    result.draws = scenario.draws;
+    Distribution* distributions[OUTCOME_COUNT] = { &result.bolus, &result.bolusError, &result.outcomeGlucose };
+    for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+        double sum = 0.0, sumSquares = 0.0;
+        for (const auto& chunk : sums) {
+            sum += chunk.sum[outcome];
+            sumSquares += chunk.sumSquares[outcome];
+        }
+        *distributions[outcome] = makeDistribution(outcome, tally, sum, sumSquares);
+    }
+    
+    double draws = scenario.draws > 0 ? static_cast<double>(scenario.draws) : 1.0;
+    result.zeroBolus = tally.zeroBolus / draws;
+    result.severeLow = tally.severeLow / draws;
+    result.low = tally.low / draws;
+    result.high = tally.high / draws;
+    result.severeHigh = tally.severeHigh / draws;
+    
+    auto finished = std::chrono::steady_clock::now();
+    result.elapsedSeconds = std::chrono::duration<double>(finished - started).count();
+    result.drawsPerSecond = result.elapsedSeconds > 0 ? scenario.draws / result.elapsedSeconds : 0.0;
+    return result;
+}
+
+unsigned BolusMonteCarlo::getThreadCount() const {
+    return pool.getThreadCount();
+}
+
+std::vector<BolusMonteCarlo::Scenario> BolusMonteCarlo::getStandardScenarios(uint64_t draws, uint64_t seed) {
+    std::vector<Scenario> scenarios;
+    auto add = [&](const std::string& name, float glucose, float trend, float carbs,
+                   float previousBolus, int minutesSinceBolus) {
+        Scenario scenario;
+        scenario.name = name;
+        scenario.draws = draws;
+        scenario.seed = seed + scenarios.size();
+        scenario.glucose = glucose;
+        scenario.glucoseTrend = trend;
+        scenario.carbs = carbs;
+        scenario.previousBolus = previousBolus;
+        scenario.minutesSinceBolus = minutesSinceBolus;
+        scenarios.push_back(scenario);
+    };
+    
+    add("Meal at target", 6.1f, 0.0f, 60.0f, 0.0f, 0);
+    add("Meal above target", 11.0f, 0.0f, 60.0f, 0.0f, 0);
+    add("Meal while rising", 8.0f, 0.1f, 75.0f, 0.0f, 0);
+    add("Meal while falling", 5.5f, -0.1f, 45.0f, 0.0f, 0);
+    add("Meal near low", 4.2f, -0.05f, 30.0f, 0.0f, 0);
+    add("Correction only", 14.0f, 0.0f, 0.0f, 0.0f, 0);
+    add("Stacked correction", 12.0f, 0.0f, 0.0f, 4.0f, 60);
+    add("Meal after recent bolus", 7.5f, 0.0f, 50.0f, 3.0f, 90);
+    return scenarios;
+}
@@ -0,0 +1,110 @@
+#ifndef BOLUS_MONTE_CARLO_H
+#define BOLUS_MONTE_CARLO_H
+
+#include "ThreadPool.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Monte Carlo analysis of the pump's suggested bolus under the errors of
+ * real use: CGM error in the glucose entered, carb-counting error and the
+ * bolus being given early or late relative to the meal. Each draw runs the
+ * pump's calculation (carbs over carb ratio, plus correction above target,
+ * less insulin on board) on the erroneous inputs and predicts where glucose
+ * ends up once the bolus, the meal and the insulin already on board have
+ * acted, using the patient's true carb ratio and sensitivity.
+ * The outcome is linear in the bolus error from 3.0 to 22.2 mmol/L, the
+ * range over which a fixed sensitivity holds. Beyond it glucose saturates
+ * smoothly toward 1.0 mmol/L below and 30.0 mmol/L above, so a large
+ * overdose reads as profound hypoglycaemia rather than an impossible value.
+ * Read the tails for their ranks, not their depth.
+ * Draws are split into fixed chunks, each with its own random stream, and
+ * evaluated in structure-of-arrays batches across the thread pool; results
+ * depend only on the scenario, not on the thread count.
+ */
+class BolusMonteCarlo {
+public:
+    static const int PERCENTILE_COUNT = 7;
+    static const float PERCENTILES[PERCENTILE_COUNT];   // 1, 5, 25, 50, 75, 95, 99
+    
+    struct Scenario {
+        std::string name;
+        uint64_t draws = 1000000;
+        uint64_t seed = 1;
+        
+        // Pump settings at the meal
+        float carbRatio = 12.0f;            // g/U
+        float correctionFactor = 2.5f;      // mmol/L per U
+        float targetGlucose = 6.1f;         // mmol/L
+        float insulinDuration = 5.0f;       // Hours
+        
+        // The meal and the patient
+        float glucose = 7.0f;               // True glucose at the meal (mmol/L)
+        float glucoseTrend = 0.0f;          // mmol/L per minute around the meal
+        float carbs = 60.0f;                // Grams eaten
+        float previousBolus = 0.0f;         // Units given minutesSinceBolus before the meal
+        int minutesSinceBolus = 120;
+        float trueCarbRatio = 12.0f;        // g/U
+        float trueSensitivity = 2.5f;       // mmol/L per U
+        
+        // Errors, as standard deviations
+        float sensorError = 0.10f;          // CGM reading, relative to true glucose
+        float carbCountError = 0.20f;       // Carbs entered, relative to carbs eaten
+        float timingJitter = 10.0f;         // Minutes from the meal to the bolus
+    };
+    
+    // Fixed-width histogram of one outcome; values outside the range are
+    // counted in the edge bins, but the moments and extremes are exact
+    struct Distribution {
+        float low;
+        float binWidth;
+        std::vector<uint64_t> counts;
+        uint64_t total;
+        double mean;
+        double standardDeviation;
+        float minimum;
+        float maximum;
+        float percentiles[PERCENTILE_COUNT];
+        
+        float getPercentile(float percentile) const;   // Bin midpoint; percentile in [0, 100]
+    };
+    
+    struct Result {
+        std::string name;
+        uint64_t draws;
+        Distribution bolus;             // Suggested units
+        Distribution bolusError;        // Suggested less what was truly needed (U)
+        Distribution outcomeGlucose;    // mmol/L once everything has acted, within (1.0, 30.0)
+        double zeroBolus;               // Fraction of draws suggesting no insulin
+        double severeLow;               // Fraction of outcomes below 3.0 mmol/L
+        double low;                     // Below 3.9 mmol/L
+        double high;                    // Above 10.0 mmol/L
+        double severeHigh;              // Above 13.9 mmol/L
+        double elapsedSeconds;
+        double drawsPerSecond;
+    };
+    
+    // A thread count of 0 uses all hardware threads
+    explicit BolusMonteCarlo(unsigned threadCount = 0);
+    
+    void addScenario(const Scenario& scenario);
+    size_t getScenarioCount() const;
+    void clearScenarios();
+    
+    // Run every scenario, each across the whole pool; results in scenario order
+    std::vector<Result> run();
+    Result run(const Scenario& scenario);
+    
+    unsigned getThreadCount() const;
+    
+    // Meals, corrections and stacking cases around a typical adult's settings
+    static std::vector<Scenario> getStandardScenarios(uint64_t draws, uint64_t seed);
+    
+private:
+    ThreadPool pool;
+    std::vector<Scenario> scenarios;
+};
+
+#endif // BOLUS_MONTE_CARLO_H
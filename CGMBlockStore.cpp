@@ -0,0 +1,271 @@
+#include "CGMBlockStore.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+    uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+    
+    int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+    
+    void writeVarint(CowVector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    
+    uint64_t readVarint(CowVector<uint8_t>::const_iterator& in) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (*in & 0x80) {
+            value |= static_cast<uint64_t>(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+        return value | (static_cast<uint64_t>(*in++) << shift);
+    }
+}
+
+CGMBlockStore::CGMBlockStore(const std::vector<float>& trackedBounds, time_t cadenceSeconds) :
+    bounds(trackedBounds.begin(), trackedBounds.begin() + std::min<size_t>(trackedBounds.size(), MAX_TRACKED_BOUNDS)),
+    cadence(cadenceSeconds > 0 ? cadenceSeconds : 300)
+{
+    for (size_t i = 0; i < bounds.size(); i++) {
+        belowSteps[i] = firstStepWhere(bounds[i], false);
+        atOrBelowSteps[i] = firstStepWhere(bounds[i], true);
+    }
+}
+
+bool CGMBlockStore::append(time_t timestamp, float value, bool isValid) {
+    if (!blocks.empty() && timestamp < blocks.back().lastTimestamp) {
+        return false;
+    }
+    
+    size_t index = values.size();
+    if (blocks.empty() || blocks.back().count >= BLOCK_SIZE) {
+        Block block;
+        block.firstTimestamp = timestamp;
+        block.lastTimestamp = timestamp;
+        block.firstIndex = index;
+        block.timeOffset = timeDeltas.size();
+        block.count = 0;
+        block.onCadence = true;
+        block.minValue = std::numeric_limits<uint16_t>::max();
+        block.maxValue = 0;
+        block.totals = emptyTotals();
+        blocks.push_back(block);
+    } else {
+        // The first timestamp is in the summary; later ones are deltas
+        int64_t deviation = static_cast<int64_t>(timestamp - blocks.back().lastTimestamp) - cadence;
+        writeVarint(timeDeltas, zigzag(deviation));
+        if (deviation != 0) {
+            blocks.mutableBack().onCadence = false;
+        }
+    }
+    
+    Block& block = blocks.mutableBack();
+    uint16_t fixed = isValid ? toFixed(value) : 0;
+    values.push_back(fixed);
+    if (index % 64 == 0) {
+        validity.push_back(0);
+    }
+    if (isValid) {
+        validity.mutableBack() |= uint64_t(1) << (index % 64);
+        block.minValue = std::min(block.minValue, fixed);
+        block.maxValue = std::max(block.maxValue, fixed);
+        addToTotals(fixed, block.totals);
+    }
+    block.lastTimestamp = timestamp;
+    block.count++;
+    return true;
+}
+
+size_t CGMBlockStore::size() const {
+    return values.size();
+}
+
+size_t CGMBlockStore::getBlockCount() const {
+    return blocks.size();
+}
+
+bool CGMBlockStore::empty() const {
+    return values.empty();
+}
+
+time_t CGMBlockStore::getFirstTimestamp() const {
+    return blocks.empty() ? 0 : blocks.front().firstTimestamp;
+}
+
+time_t CGMBlockStore::getLastTimestamp() const {
+    return blocks.empty() ? 0 : blocks.back().lastTimestamp;
+}
+
+size_t CGMBlockStore::getMemoryUsage() const {
+    return blocks.getMemoryUsage() + values.getMemoryUsage() + validity.getMemoryUsage()
+        + timeDeltas.getMemoryUsage();
+}
+
+float CGMBlockStore::quantize(float value) {
+    return fromFixed(toFixed(value));
+}
+
+void CGMBlockStore::accumulate(time_t startTime, time_t endTime, Totals& totals) const {
+    size_t last = lastBlock(endTime);
+    for (size_t b = firstBlock(startTime); b < last; b++) {
+        const Block& block = blocks[b];
+        if (block.firstTimestamp >= startTime && block.lastTimestamp <= endTime) {
+            // Fully covered: the summary is enough
+            totals.validCount += block.totals.validCount;
+            totals.sum += block.totals.sum;
+            totals.sumSquares += block.totals.sumSquares;
+            for (size_t i = 0; i < bounds.size(); i++) {
+                totals.below[i] += block.totals.below[i];
+                totals.atOrBelow[i] += block.totals.atOrBelow[i];
+            }
+            continue;
+        }
+        scanBlock(block, startTime, endTime, [this, &totals](size_t index, time_t) {
+            if (isValidAt(index)) {
+                addToTotals(values[index], totals);
+            }
+        });
+    }
+}
+
+uint64_t CGMBlockStore::countInRange(float lowerBound, float upperBound, time_t startTime, time_t endTime) const {
+    if (lowerBound > upperBound) {
+        return 0;
+    }
+    
+    // Tracked bounds can use the block counts
+    int lowerTracked = -1, upperTracked = -1;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        if (bounds[i] == lowerBound) lowerTracked = static_cast<int>(i);
+        if (bounds[i] == upperBound) upperTracked = static_cast<int>(i);
+    }
+    
+    uint64_t count = 0;
+    size_t last = lastBlock(endTime);
+    for (size_t b = firstBlock(startTime); b < last; b++) {
+        const Block& block = blocks[b];
+        if (block.totals.validCount == 0) {
+            continue;
+        }
+        
+        bool covered = block.firstTimestamp >= startTime && block.lastTimestamp <= endTime;
+        float minValue = fromFixed(block.minValue);
+        float maxValue = fromFixed(block.maxValue);
+        if (maxValue < lowerBound || minValue > upperBound) {
+            continue; // Nothing in range
+        }
+        if (covered && minValue >= lowerBound && maxValue <= upperBound) {
+            count += block.totals.validCount;
+            continue;
+        }
+        if (covered && lowerTracked >= 0 && upperTracked >= 0) {
+            count += block.totals.atOrBelow[upperTracked] - block.totals.below[lowerTracked];
+            continue;
+        }
+        
+        scanBlock(block, startTime, endTime, [&](size_t index, time_t) {
+            float value = fromFixed(values[index]);
+            if (isValidAt(index) && value >= lowerBound && value <= upperBound) {
+                count++;
+            }
+        });
+    }
+    return count;
+}
+
+void CGMBlockStore::decode(time_t startTime, time_t endTime, std::vector<Reading>& out) const {
+    size_t last = lastBlock(endTime);
+    for (size_t b = firstBlock(startTime); b < last; b++) {
+        scanBlock(blocks[b], startTime, endTime, [this, &out](size_t index, time_t timestamp) {
+            bool valid = isValidAt(index);
+            out.push_back(Reading{ timestamp, valid ? fromFixed(values[index]) : 0.0f, valid });
+        });
+    }
+}
+
+CGMBlockStore::Totals CGMBlockStore::emptyTotals() {
+    Totals totals = {};
+    return totals;
+}
+
+uint16_t CGMBlockStore::toFixed(float value) {
+    float steps = std::round(value * VALUE_SCALE);
+    return static_cast<uint16_t>(std::min(65535.0f, std::max(1.0f, steps)));
+}
+
+float CGMBlockStore::fromFixed(uint16_t value) {
+    // Division (not a multiply by 0.01) so that n / 100 is exactly the float
+    // literal a caller would write, e.g. 390 -> 3.9f
+    return value / VALUE_SCALE;
+}
+
+bool CGMBlockStore::isValidAt(size_t index) const {
+    return (validity[index / 64] >> (index % 64)) & 1;
+}
+
+uint16_t CGMBlockStore::firstStepWhere(float bound, bool inclusive) {
+    // Smallest fixed value whose glucose is no longer below (or at) the bound
+    float start = std::floor(std::min(65535.0f, std::max(0.0f, bound * VALUE_SCALE)));
+    uint32_t step = static_cast<uint32_t>(start > 0 ? start - 1 : 0);
+    while (step < 65535 && (inclusive ? fromFixed(step) <= bound : fromFixed(step) < bound)) {
+        step++;
+    }
+    return static_cast<uint16_t>(step);
+}
+
+void CGMBlockStore::addToTotals(uint16_t value, Totals& totals) const {
+    totals.validCount++;
+    totals.sum += value;
+    totals.sumSquares += static_cast<uint64_t>(value) * value;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        totals.below[i] += value < belowSteps[i] ? 1 : 0;
+        totals.atOrBelow[i] += value < atOrBelowSteps[i] ? 1 : 0;
+    }
+}
+
+size_t CGMBlockStore::firstBlock(time_t startTime) const {
+    return blocks.partitionPoint([startTime](const Block& block) { return block.lastTimestamp < startTime; });
+}
+
+size_t CGMBlockStore::lastBlock(time_t endTime) const {
+    return blocks.partitionPoint([endTime](const Block& block) { return block.firstTimestamp <= endTime; });
+}
+
+template <typename Visitor>
+void CGMBlockStore::scanBlock(const Block& block, time_t startTime, time_t endTime, Visitor visit) const {
+    if (block.onCadence) {
+        // Timestamps are implicit, so the range maps straight to indices
+        time_t first = std::max<time_t>(0, (startTime - block.firstTimestamp + cadence - 1) / cadence);
+        time_t last = std::min<time_t>(block.count, (endTime - block.firstTimestamp) / cadence + 1);
+        if (startTime <= block.firstTimestamp) {
+            first = 0;
+        }
+        for (time_t i = first; i < last; i++) {
+            visit(block.firstIndex + i, block.firstTimestamp + i * cadence);
+        }
+        return;
+    }
+    
+    auto deltas = timeDeltas.begin() + block.timeOffset;
+    time_t timestamp = block.firstTimestamp;
+    for (uint32_t i = 0; i < block.count; i++) {
+        if (i > 0) {
+            timestamp += cadence + unzigzag(readVarint(deltas));
+        }
+        if (timestamp > endTime) {
+            break;
+        }
+        if (timestamp >= startTime) {
+            visit(block.firstIndex + i, timestamp);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef CGM_BLOCK_STORE_H
+#define CGM_BLOCK_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include "CowVector.h"
+
+/**
+ * Compressed, append-only store for long CGM histories.
+ * Readings are packed into blocks of up to BLOCK_SIZE: values as 16-bit
+ * fixed point (0.01 mmol/L), timestamps as zigzag varints of their
+ * deviation from the sensor cadence (one byte per on-time reading) and
+ * validity as a bitmap - about 3 bytes per reading. Every block carries a
+ * summary (time span, min/max, sums and counts against tracked glucose
+ * bounds) so range statistics decode only the blocks a range cuts through.
+ * Storage is shared copy-on-write, so copying a store is O(1).
+ */
+class CGMBlockStore {
+public:
+    static const size_t BLOCK_SIZE = 256;
+    static const int MAX_TRACKED_BOUNDS = 8;
+    static constexpr float VALUE_SCALE = 100.0f;    // Fixed-point steps per mmol/L
+    
+    // Also CGMData's GlucoseReading, so decoded ranges need no conversion
+    struct Reading {
+        time_t timestamp;
+        float value;     // Glucose value in mmol/L
+        bool isValid;    // Flag for valid reading
+    };
+    
+    // Sums over valid readings, in fixed-point units
+    struct Totals {
+        uint64_t validCount;
+        uint64_t sum;
+        uint64_t sumSquares;
+        uint64_t below[MAX_TRACKED_BOUNDS];     // value < bound
+        uint64_t atOrBelow[MAX_TRACKED_BOUNDS]; // value <= bound
+    };
+    
+    // Bounds (mmol/L, at most MAX_TRACKED_BOUNDS) get per-block counts
+    explicit CGMBlockStore(const std::vector<float>& trackedBounds, time_t cadenceSeconds = 300);
+    
+    // Append in time order; returns false for a reading earlier than the last
+    bool append(time_t timestamp, float value, bool isValid);
+    
+    size_t size() const;
+    size_t getBlockCount() const;
+    bool empty() const;
+    time_t getFirstTimestamp() const;
+    time_t getLastTimestamp() const;
+    size_t getMemoryUsage() const; // Bytes held, including summaries
+    
+    // Values as stored (rounded to the fixed-point step)
+    static float quantize(float value);
+    
+    // Add the valid readings within [startTime, endTime] to totals
+    void accumulate(time_t startTime, time_t endTime, Totals& totals) const;
+    
+    // Valid readings within [startTime, endTime] whose value is within
+    // [lowerBound, upperBound]; blocks entirely inside or outside the
+    // bounds, or covered by tracked bounds, are counted without decoding
+    uint64_t countInRange(float lowerBound, float upperBound, time_t startTime, time_t endTime) const;
+    
+    // Append the readings within [startTime, endTime] to out, in time order
+    // (invalid readings decode with a value of 0)
+    void decode(time_t startTime, time_t endTime, std::vector<Reading>& out) const;
+    
+    static Totals emptyTotals();
+    
+private:
+    struct Block {
+        time_t firstTimestamp;
+        time_t lastTimestamp;
+        size_t firstIndex;      // Index of the first reading in values / validity
+        size_t timeOffset;      // Byte offset of the block's timestamp deltas
+        uint32_t count;
+        bool onCadence;         // Every reading exactly one cadence after the last
+        uint16_t minValue;      // Over valid readings (fixed point)
+        uint16_t maxValue;
+        Totals totals;
+    };
+    
+    std::vector<float> bounds;
+    uint16_t belowSteps[MAX_TRACKED_BOUNDS];        // Fixed values below these are below the bound
+    uint16_t atOrBelowSteps[MAX_TRACKED_BOUNDS];    // ... and at or below it
+    time_t cadence;
+    
+    CowVector<Block> blocks;
+    CowVector<uint16_t> values;
+    CowVector<uint64_t> validity;       // One bit per reading
+    CowVector<uint8_t> timeDeltas;
+    
+    static uint16_t toFixed(float value);
+    static float fromFixed(uint16_t value);
+    static uint16_t firstStepWhere(float bound, bool inclusive);
+    bool isValidAt(size_t index) const;
+    void addToTotals(uint16_t value, Totals& totals) const;
+    
+    // Blocks overlapping [startTime, endTime]
+    size_t firstBlock(time_t startTime) const;
+    size_t lastBlock(time_t endTime) const;
+    
+    // Calls visit(index, timestamp) for each reading of a block within the range
+    template <typename Visitor>
+    void scanBlock(const Block& block, time_t startTime, time_t endTime, Visitor visit) const;
+};
+
+#endif // CGM_BLOCK_STORE_H
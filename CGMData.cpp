@@ -0,0 +1,435 @@
+#include "CGMData.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace {
+    // History replayed into the predictor after a late reading; the filter
+    // forgets its starting point well within this window
+    const time_t PREDICTOR_REPLAY_SECONDS = 6 * 3600;
+}
+
+const float CGMData::TRACKED_BOUNDS[CGMData::TRACKED_BOUND_COUNT] = { 3.0f, 3.9f, 10.0f, 13.9f };
+
+CGMData::ReadingView::ReadingView(const_iterator first, const_iterator last) :
+    first(first),
+    last(last)
+{
+}
+
+CGMData::ReadingView::const_iterator CGMData::ReadingView::begin() const {
+    return first;
+}
+
+CGMData::ReadingView::const_iterator CGMData::ReadingView::end() const {
+    return last;
+}
+
+size_t CGMData::ReadingView::size() const {
+    return static_cast<size_t>(last - first);
+}
+
+bool CGMData::ReadingView::empty() const {
+    return first == last;
+}
+
+const CGMData::GlucoseReading& CGMData::ReadingView::operator[](size_t index) const {
+    return first[index];
+}
+
+std::vector<CGMData::GlucoseReading> CGMData::ReadingView::toVector() const {
+    return std::vector<GlucoseReading>(first, last);
+}
+
+CGMData::CGMData() :
+    CGMData(std::make_shared<RealClock>())
+{
+}
+
+CGMData::CGMData(std::shared_ptr<const Clock> clock) :
+    clock(clock ? clock : std::make_shared<RealClock>()),
+    archiveRetainSeconds(0)
+{
+    rebuildPrefixes(0);
+}
+
+CGMData::CGMData(const CGMData& other, std::shared_ptr<const Clock> clock) :
+    clock(clock ? clock : other.clock),
+    readings(other.readings),
+    prefixes(other.prefixes),
+    predictor(other.predictor),
+    profileSketch(other.profileSketch),
+    archive(other.archive ? std::make_unique<CGMBlockStore>(*other.archive) : nullptr),
+    archiveRetainSeconds(other.archiveRetainSeconds)
+{
+}
+
+std::shared_ptr<CGMData> CGMData::fork(std::shared_ptr<const Clock> clock) const {
+    return std::shared_ptr<CGMData>(new CGMData(*this, clock));
+}
+
+void CGMData::addReading(float value) {
+    addReading(value, clock->now());
+}
+
+void CGMData::addReading(float value, time_t timestamp) {
+    GlucoseReading reading;
+    reading.timestamp = timestamp;
+    reading.value = value;
+    reading.isValid = value > 0.0f;
+    
+    if (profileSketch) {
+        // The sketch may be shared with a fork; add to a private copy
+        if (profileSketch.use_count() > 1) {
+            profileSketch = std::make_shared<GlucoseProfileSketch>(*profileSketch);
+        }
+        profileSketch->add(value, timestamp);
+    }
+    
+    // Readings normally arrive in order; late ones are inserted in place
+    if (readings.empty() || readings.back().timestamp <= timestamp) {
+        readings.push_back(reading);
+        appendPrefix(reading);
+        predictor.update(value, timestamp);
+        
+        // Archive once a whole block has aged past the retention window
+        if (archive && readings.size() > CGMBlockStore::BLOCK_SIZE &&
+            readings[CGMBlockStore::BLOCK_SIZE].timestamp < timestamp - archiveRetainSeconds) {
+            archiveOldReadings();
+        }
+        return;
+    }
+    
+    size_t index = upperIndex(timestamp);
+    readings.insert(index, reading);
+    rebuildPrefixes(index);
+    rebuildPredictor();
+}
+
+CGMData::GlucoseReading CGMData::getCurrentReading() const {
+    if (readings.empty()) {
+        return GlucoseReading{0, 0.0f, false};
+    }
+    return readings.back();
+}
+
+CGMData::ReadingView CGMData::getReadings(time_t startTime, time_t endTime) const {
+    size_t first = lowerIndex(startTime);
+    size_t last = std::max(first, upperIndex(endTime));
+    
+    if (!archive || archive->empty() || endTime < archive->getFirstTimestamp() ||
+        startTime > archive->getLastTimestamp()) {
+        return ReadingView(readings.begin() + first, readings.begin() + last);
+    }
+    
+    // Decode the archived part and merge in the recent readings (which can
+    // include late arrivals older than the archive's end)
+    std::vector<GlucoseReading> archived;
+    archive->decode(startTime, endTime, archived);
+    decodeBuffer.clear();
+    std::merge(archived.begin(), archived.end(), readings.begin() + first, readings.begin() + last,
+        std::back_inserter(decodeBuffer),
+        [](const GlucoseReading& a, const GlucoseReading& b) { return a.timestamp < b.timestamp; });
+    return ReadingView(decodeBuffer.begin(), decodeBuffer.end());
+}
+
+size_t CGMData::getReadingCount() const {
+    return readings.size() + (archive ? archive->size() : 0);
+}
+
+void CGMData::reserve(size_t count) {
+    if (archive) {
+        return; // Recent storage stays bounded by the retention window
+    }
+    
+    readings.reserve(count);
+    prefixes.reserve(count + 1);
+}
+
+float CGMData::calculateTrend() const {
+    // Filtered rate of change, maintained by the predictor
+    return predictor.getRate();
+}
+
+float CGMData::predictGlucose(int minutesAhead) const {
+    PUMP_METRIC(CGM_PREDICTION);
+    GlucoseReading current = getCurrentReading();
+    if (!current.isValid) {
+        return 0.0f;
+    }
+    return predictor.predict(minutesAhead).value;
+}
+
+GlucosePredictor::Prediction CGMData::getPrediction(int minutesAhead) const {
+    GlucoseReading current = getCurrentReading();
+    if (!current.isValid) {
+        return GlucosePredictor::Prediction{0.0f, 0.0f, 0.0f, 0.0f};
+    }
+    return predictor.predict(minutesAhead);
+}
+
+const GlucosePredictor& CGMData::getPredictor() const {
+    return predictor;
+}
+
+void CGMData::setPredictorParameters(const GlucosePredictor::Parameters& parameters) {
+    predictor = GlucosePredictor(parameters);
+    rebuildPredictor();
+}
+
+void CGMData::enableCompactStorage(time_t retainSeconds) {
+    if (!archive) {
+        std::vector<float> bounds(TRACKED_BOUNDS, TRACKED_BOUNDS + TRACKED_BOUND_COUNT);
+        archive = std::make_unique<CGMBlockStore>(bounds);
+    }
+    archiveRetainSeconds = std::max(retainSeconds, PREDICTOR_REPLAY_SECONDS);
+    archiveOldReadings();
+}
+
+bool CGMData::isCompactStorageEnabled() const {
+    return archive != nullptr;
+}
+
+size_t CGMData::getMemoryUsage() const {
+    size_t bytes = readings.getMemoryUsage() + prefixes.getMemoryUsage();
+    if (archive) {
+        bytes += archive->getMemoryUsage() + decodeBuffer.getMemoryUsage();
+    }
+    if (profileSketch) {
+        bytes += static_cast<size_t>(profileSketch->getBinCount()) * GlucoseProfileSketch::VALUE_BUCKETS * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+void CGMData::enableProfileSketch(int binMinutes) {
+    if (profileSketch && profileSketch->getBinMinutes() == binMinutes) {
+        return;
+    }
+    
+    profileSketch = std::make_shared<GlucoseProfileSketch>(binMinutes);
+    std::vector<GlucoseReading> archived;
+    if (archive) {
+        archive->decode(archive->getFirstTimestamp(), archive->getLastTimestamp(), archived);
+    }
+    for (const GlucoseReading& reading : archived) {
+        if (reading.isValid) {
+            profileSketch->add(reading.value, reading.timestamp);
+        }
+    }
+    for (const GlucoseReading& reading : readings) {
+        if (reading.isValid) {
+            profileSketch->add(reading.value, reading.timestamp);
+        }
+    }
+}
+
+const GlucoseProfileSketch* CGMData::getProfileSketch() const {
+    return profileSketch.get();
+}
+
+bool CGMData::isLowGlucose(float threshold) const {
+    GlucoseReading current = getCurrentReading();
+    return current.isValid && current.value < threshold;
+}
+
+bool CGMData::isHighGlucose(float threshold) const {
+    GlucoseReading current = getCurrentReading();
+    return current.isValid && current.value > threshold;
+}
+
+float CGMData::getAverageGlucose(time_t startTime, time_t endTime) const {
+    PUMP_METRIC(CGM_STATISTICS);
+    size_t first = lowerIndex(startTime);
+    size_t last = std::max(first, upperIndex(endTime));
+    CGMBlockStore::Totals archived = archivedTotals(startTime, endTime);
+    
+    const PrefixEntry& from = prefixes[first];
+    const PrefixEntry& to = prefixes[last];
+    
+    uint64_t count = to.validCount - from.validCount + archived.validCount;
+    if (count == 0) {
+        return 0.0f;
+    }
+    double sum = to.sum - from.sum + archived.sum / CGMBlockStore::VALUE_SCALE;
+    return static_cast<float>(sum / count);
+}
+
+float CGMData::getStandardDeviation(time_t startTime, time_t endTime) const {
+    PUMP_METRIC(CGM_STATISTICS);
+    size_t first = lowerIndex(startTime);
+    size_t last = std::max(first, upperIndex(endTime));
+    CGMBlockStore::Totals archived = archivedTotals(startTime, endTime);
+    
+    const PrefixEntry& from = prefixes[first];
+    const PrefixEntry& to = prefixes[last];
+    
+    uint64_t count = to.validCount - from.validCount + archived.validCount;
+    if (count == 0) {
+        return 0.0f;
+    }
+    
+    const double scale = CGMBlockStore::VALUE_SCALE;
+    double sum = to.sum - from.sum + archived.sum / scale;
+    double sumSquares = to.sumSquares - from.sumSquares + archived.sumSquares / (scale * scale);
+    double mean = sum / count;
+    double meanSquares = sumSquares / count;
+    double variance = std::max(0.0, meanSquares - mean * mean);
+    return static_cast<float>(std::sqrt(variance));
+}
+
+float CGMData::getTimeInRange(float lowerBound, float upperBound, time_t startTime, time_t endTime) const {
+    PUMP_METRIC(CGM_STATISTICS);
+    // Percentage of valid readings within [lowerBound, upperBound]
+    size_t first = lowerIndex(startTime);
+    size_t last = std::max(first, upperIndex(endTime));
+    
+    uint64_t count = prefixes[last].validCount - prefixes[first].validCount;
+    uint64_t inRange = 0;
+    if (archive) {
+        count += archivedTotals(startTime, endTime).validCount;
+        inRange += archive->countInRange(lowerBound, upperBound, startTime, endTime);
+    }
+    if (count == 0 || lowerBound > upperBound) {
+        return 0.0f;
+    }
+    
+    uint32_t atOrBelowUpper = 0;
+    uint32_t belowLower = 0;
+    if (countAtOrBelow(upperBound, first, last, atOrBelowUpper) &&
+        countBelow(lowerBound, first, last, belowLower)) {
+        inRange += atOrBelowUpper - belowLower;
+        return static_cast<float>(100.0 * inRange / count);
+    }
+    
+    // Untracked bounds fall back to scanning just the requested range
+    for (size_t i = first; i < last; i++) {
+        const GlucoseReading& reading = readings[i];
+        if (reading.isValid && reading.value >= lowerBound && reading.value <= upperBound) {
+            inRange++;
+        }
+    }
+    return static_cast<float>(100.0 * inRange / count);
+}
+
+void CGMData::rebuildPrefixes(size_t fromIndex) {
+    prefixes.resize(fromIndex + 1, PrefixEntry{});
+    
+    for (size_t i = fromIndex; i < readings.size(); i++) {
+        appendPrefix(readings[i]);
+    }
+}
+
+void CGMData::appendPrefix(const GlucoseReading& reading) {
+    bool valid = reading.isValid;
+    double value = valid ? reading.value : 0.0;
+    
+    PrefixEntry entry = prefixes.back();
+    entry.sum += value;
+    entry.sumSquares += value * value;
+    entry.validCount += valid ? 1 : 0;
+    for (int i = 0; i < TRACKED_BOUND_COUNT; i++) {
+        entry.below[i] += valid && reading.value < TRACKED_BOUNDS[i] ? 1 : 0;
+        entry.atOrBelow[i] += valid && reading.value <= TRACKED_BOUNDS[i] ? 1 : 0;
+    }
+    prefixes.push_back(entry);
+}
+
+void CGMData::rebuildPredictor() {
+    predictor.reset();
+    if (readings.empty()) {
+        return;
+    }
+    
+    for (size_t i = lowerIndex(readings.back().timestamp - PREDICTOR_REPLAY_SECONDS); i < readings.size(); i++) {
+        predictor.update(readings[i].value, readings[i].timestamp);
+    }
+}
+
+void CGMData::archiveOldReadings() {
+    if (!archive || readings.size() < 2) {
+        return;
+    }
+    
+    // Move whole blocks of readings older than the window, always keeping
+    // the latest reading here
+    size_t old = std::min(lowerIndex(readings.back().timestamp - archiveRetainSeconds), readings.size() - 1);
+    old -= old % CGMBlockStore::BLOCK_SIZE;
+    if (old == 0) {
+        return;
+    }
+    
+    // A late reading older than the archive's end cannot be appended and stays
+    std::vector<GlucoseReading> kept;
+    for (size_t i = 0; i < old; i++) {
+        const GlucoseReading& reading = readings[i];
+        if (!archive->append(reading.timestamp, reading.value, reading.isValid)) {
+            kept.push_back(reading);
+        }
+    }
+    if (!kept.empty()) {
+        CowVector<GlucoseReading> recent;
+        for (const GlucoseReading& reading : kept) {
+            recent.push_back(reading);
+        }
+        for (size_t i = old; i < readings.size(); i++) {
+            recent.push_back(readings[i]);
+        }
+        readings = std::move(recent);
+        rebuildPrefixes(0);
+        return;
+    }
+    
+    // Prefix entries are only ever differenced, so the remaining ones stand
+    readings.erasePrefix(old);
+    prefixes.erasePrefix(old);
+}
+
+CGMBlockStore::Totals CGMData::archivedTotals(time_t startTime, time_t endTime) const {
+    CGMBlockStore::Totals totals = CGMBlockStore::emptyTotals();
+    if (archive) {
+        archive->accumulate(startTime, endTime, totals);
+    }
+    return totals;
+}
+
+size_t CGMData::lowerIndex(time_t startTime) const {
+    return readings.partitionPoint([startTime](const GlucoseReading& reading) { return reading.timestamp < startTime; });
+}
+
+size_t CGMData::upperIndex(time_t endTime) const {
+    return readings.partitionPoint([endTime](const GlucoseReading& reading) { return reading.timestamp <= endTime; });
+}
+
+bool CGMData::countAtOrBelow(float bound, size_t first, size_t last, uint32_t& count) const {
+    if (bound <= 0.0f) {
+        count = 0; // Valid readings are always positive
+        return true;
+    }
+    if (std::isinf(bound) || bound >= 1000.0f) {
+        count = prefixes[last].validCount - prefixes[first].validCount;
+        return true;
+    }
+    for (int i = 0; i < TRACKED_BOUND_COUNT; i++) {
+        if (bound == TRACKED_BOUNDS[i]) {
+            count = prefixes[last].atOrBelow[i] - prefixes[first].atOrBelow[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CGMData::countBelow(float bound, size_t first, size_t last, uint32_t& count) const {
+    if (bound <= 0.0f) {
+        count = 0;
+        return true;
+    }
+    for (int i = 0; i < TRACKED_BOUND_COUNT; i++) {
+        if (bound == TRACKED_BOUNDS[i]) {
+            count = prefixes[last].below[i] - prefixes[first].below[i];
+            return true;
+        }
+    }
+    return false;
+}
@@ -3,46 +3,137 @@
 
 #include <vector>
 #include <ctime>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "GlucosePredictor.h"
+#include "GlucoseProfileSketch.h"
+#include "CGMBlockStore.h"
+#include "CowVector.h"
+
+class Clock;
 
 /**
- * Class representing Continuous Glucose Monitoring data
+ * Class representing Continuous Glucose Monitoring data.
+ * Readings are kept sorted by timestamp with running prefix sums so that
+ * range statistics are answered with two binary searches. A Kalman
+ * predictor is updated with every reading, so trend and forecasts are O(1).
+ * Long histories can move readings past a retention window into
+ * compressed blocks, which statistics read through their summaries.
+ * Storage is shared copy-on-write, so forking a history is O(1).
  */
 class CGMData {
 public:
-    struct GlucoseReading {
-        time_t timestamp;
-        float value;     // Glucose value in mmol/L
-        bool isValid;    // Flag for valid reading
+    using GlucoseReading = CGMBlockStore::Reading;
+    
+    /**
+     * Non-owning view over a consecutive run of readings.
+     * Invalidated by any later addReading call, and (when the range reaches
+     * into compact storage) by the next getReadings call.
+     */
+    class ReadingView {
+    public:
+        using const_iterator = CowVector<GlucoseReading>::const_iterator;
+        
+        ReadingView(const_iterator first, const_iterator last);
+        
+        const_iterator begin() const;
+        const_iterator end() const;
+        size_t size() const;
+        bool empty() const;
+        const GlucoseReading& operator[](size_t index) const;
+        std::vector<GlucoseReading> toVector() const;
+        
+    private:
+        const_iterator first;
+        const_iterator last;
     };
     
     CGMData();
+    explicit CGMData(std::shared_ptr<const Clock> clock);
+    CGMData& operator=(const CGMData&) = delete;
+    
+    // Independent copy that shares the stored history copy-on-write (O(1)
+    // in its length), timestamped by the given clock (this one's if null)
+    std::shared_ptr<CGMData> fork(std::shared_ptr<const Clock> clock = nullptr) const;
     
-    // Add a new glucose reading
-    void addReading(float value, time_t timestamp = time(nullptr));
+    // Add a new glucose reading (timestamped by the clock, or explicitly)
+    void addReading(float value);
+    void addReading(float value, time_t timestamp);
     
     // Get the most recent reading
     GlucoseReading getCurrentReading() const;
     
-    // Get readings within a time range
-    std::vector<GlucoseReading> getReadings(time_t startTime, time_t endTime) const;
+    // Get readings within a time range (inclusive, no copy)
+    ReadingView getReadings(time_t startTime, time_t endTime) const;
+    size_t getReadingCount() const;
+    void reserve(size_t count);
     
     // Get trend information
     float calculateTrend() const; // Returns rate of change in mmol/L per minute
     
-    // Predict future glucose based on current trend
+    // Predict future glucose based on current trend, optionally with a confidence band
     float predictGlucose(int minutesAhead) const;
+    GlucosePredictor::Prediction getPrediction(int minutesAhead) const;
+    const GlucosePredictor& getPredictor() const;
+    void setPredictorParameters(const GlucosePredictor::Parameters& parameters);
     
     // Check if readings indicate low or high glucose
     bool isLowGlucose(float threshold = 3.9) const;
     bool isHighGlucose(float threshold = 10.0) const;
     
-    // Get historical statistics
+    // Get historical statistics (O(log n); time in range is a percentage and
+    // is O(log n) when both bounds are tracked glucose thresholds)
     float getAverageGlucose(time_t startTime, time_t endTime) const;
     float getStandardDeviation(time_t startTime, time_t endTime) const;
     float getTimeInRange(float lowerBound, float upperBound, time_t startTime, time_t endTime) const;
     
+    // Compact storage: readings older than the retention window (at least
+    // six hours) move into compressed blocks, quantized to 0.01 mmol/L
+    void enableCompactStorage(time_t retainSeconds = 7 * 86400);
+    bool isCompactStorageEnabled() const;
+    size_t getMemoryUsage() const; // Approximate bytes held for readings and statistics
+    
+    // Ambulatory Glucose Profile sketch, kept up to date once enabled
+    // (enabling folds in the readings already stored); nullptr until then
+    void enableProfileSketch(int binMinutes = 15);
+    const GlucoseProfileSketch* getProfileSketch() const;
+    
+    // Thresholds with maintained prefix counts (mmol/L)
+    static const int TRACKED_BOUND_COUNT = 4;
+    static const float TRACKED_BOUNDS[TRACKED_BOUND_COUNT];
+    
 private:
-    std::vector<GlucoseReading> readings;
+    // Sums over valid readings [0, i) for prefix entry i
+    struct PrefixEntry {
+        double sum;
+        double sumSquares;
+        uint32_t validCount;
+        uint32_t below[TRACKED_BOUND_COUNT];     // value < bound
+        uint32_t atOrBelow[TRACKED_BOUND_COUNT]; // value <= bound
+    };
+    
+    std::shared_ptr<const Clock> clock;
+    CowVector<GlucoseReading> readings;
+    CowVector<PrefixEntry> prefixes;
+    GlucosePredictor predictor;
+    std::shared_ptr<GlucoseProfileSketch> profileSketch; // Copied before adding while shared
+    std::unique_ptr<CGMBlockStore> archive;
+    time_t archiveRetainSeconds;
+    mutable CowVector<GlucoseReading> decodeBuffer; // Backs views into archived ranges
+    
+    CGMData(const CGMData& other, std::shared_ptr<const Clock> clock);
+    
+    // Helper methods
+    void rebuildPrefixes(size_t fromIndex);
+    void appendPrefix(const GlucoseReading& reading);
+    void rebuildPredictor();
+    void archiveOldReadings();
+    CGMBlockStore::Totals archivedTotals(time_t startTime, time_t endTime) const;
+    size_t lowerIndex(time_t startTime) const;
+    size_t upperIndex(time_t endTime) const;
+    bool countAtOrBelow(float bound, size_t first, size_t last, uint32_t& count) const;
+    bool countBelow(float bound, size_t first, size_t last, uint32_t& count) const;
 };
 
 #endif // CGM_DATA_H
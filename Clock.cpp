@@ -0,0 +1,37 @@
+#include "Clock.h"
+
+struct tm Clock::toLocalTime(time_t timestamp) {
+    struct tm timeinfo = {};
+    localtime_r(&timestamp, &timeinfo);
+    return timeinfo;
+}
+
+int Clock::minuteOfDay(time_t timestamp) {
+    struct tm timeinfo = toLocalTime(timestamp);
+    return timeinfo.tm_hour * 60 + timeinfo.tm_min;
+}
+
+time_t RealClock::now() const {
+    return time(nullptr);
+}
+
+VirtualClock::VirtualClock(time_t startTime) :
+    currentTime(startTime)
+{
+}
+
+time_t VirtualClock::now() const {
+    return currentTime;
+}
+
+void VirtualClock::advance(time_t seconds) {
+    if (seconds > 0) {
+        currentTime += seconds;
+    }
+}
+
+void VirtualClock::setTime(time_t timestamp) {
+    if (timestamp > currentTime) {
+        currentTime = timestamp;
+    }
+}
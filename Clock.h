@@ -0,0 +1,48 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <ctime>
+
+/**
+ * Abstract time source used by the pump, CGM and event logging
+ */
+class Clock {
+public:
+    virtual ~Clock() = default;
+    
+    // Current time in seconds since the epoch
+    virtual time_t now() const = 0;
+    
+    // Local time helpers (reentrant, safe to call from any thread)
+    static struct tm toLocalTime(time_t timestamp);
+    static int minuteOfDay(time_t timestamp);
+};
+
+/**
+ * Clock backed by the system wall time
+ */
+class RealClock : public Clock {
+public:
+    time_t now() const override;
+};
+
+/**
+ * Discrete-event clock that only moves when told to, used for
+ * fast-forward simulation
+ */
+class VirtualClock : public Clock {
+public:
+    // Starts at the given time (defaults to the current wall time)
+    explicit VirtualClock(time_t startTime = time(nullptr));
+    
+    time_t now() const override;
+    
+    // Move the clock forward; time never moves backwards
+    void advance(time_t seconds);
+    void setTime(time_t timestamp);
+    
+private:
+    time_t currentTime;
+};
+
+#endif // CLOCK_H
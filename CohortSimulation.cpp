@@ -0,0 +1,208 @@
+#include "CohortSimulation.h"
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "Event.h"
+#include "EventLog.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include "PumpBlock.h"
+#include "TimelineRecorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+
+namespace {
+    // Patients simulated together through one batched glucose model
+    const size_t PATIENTS_PER_BLOCK = 16;
+    
+    time_t localMidnight(int year, int month, int day) {
+        struct tm timeinfo = {};
+        timeinfo.tm_year = year - 1900;
+        timeinfo.tm_mon = month - 1;
+        timeinfo.tm_mday = day;
+        timeinfo.tm_isdst = -1;
+        return mktime(&timeinfo);
+    }
+}
+
+CohortSimulation::CohortSimulation(unsigned threadCount) :
+    pool(threadCount)
+{
+}
+
+void CohortSimulation::addPatient(const PatientConfig& config) {
+    patients.push_back(config);
+}
+
+void CohortSimulation::generatePatients(size_t count, unsigned seed, int days, bool controlIQ) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> variation(0.8f, 1.2f);
+    std::uniform_real_distribution<float> basal(0.4f, 1.2f);
+    std::uniform_real_distribution<float> ratio(8.0f, 20.0f);
+    std::uniform_real_distribution<float> sensitivity(1.5f, 3.5f);
+    std::uniform_real_distribution<float> start(5.0f, 10.0f);
+    
+    time_t startTime = localMidnight(2024, 1, 1);
+    
+    for (size_t i = 0; i < count; i++) {
+        PatientConfig config;
+        config.id = static_cast<unsigned>(patients.size());
+        config.seed = rng();
+        config.days = days;
+        config.startTime = startTime;
+        config.basalRate = basal(rng);
+        config.carbRatio = ratio(rng);
+        config.correctionFactor = sensitivity(rng);
+        config.targetGlucose = 6.1f;
+        config.trueBasalNeed = config.basalRate * variation(rng);
+        config.trueCarbRatio = config.carbRatio * variation(rng);
+        config.trueSensitivity = config.correctionFactor * variation(rng);
+        config.initialGlucose = start(rng);
+        config.controlIQ = controlIQ;
+        patients.push_back(config);
+    }
+}
+
+size_t CohortSimulation::getPatientCount() const {
+    return patients.size();
+}
+
+const CohortSimulation::PatientConfig& CohortSimulation::getPatient(size_t index) const {
+    return patients[index];
+}
+
+void CohortSimulation::clearPatients() {
+    patients.clear();
+}
+
+void CohortSimulation::setTimeline(std::shared_ptr<TimelineRecorder> recorder) {
+    timeline = recorder;
+}
+
+CohortSimulation::Result CohortSimulation::run() {
+    Result result;
+    result.patients.resize(patients.size());
+    result.threadCount = pool.getThreadCount();
+    
+    auto started = std::chrono::steady_clock::now();
+    
+    // Each task steps a block of patients through one batched model, then
+    // folds its readings into the cohort profile
+    std::mutex profileMutex;
+    pool.parallelFor(patients.size(), PATIENTS_PER_BLOCK, [this, &result, &profileMutex](size_t begin, size_t end) {
+        GlucoseProfileSketch blockProfile;
+        simulateBlock(&patients[begin], end - begin, &result.patients[begin], &blockProfile, timeline.get());
+        
+        std::lock_guard<std::mutex> lock(profileMutex);
+        result.profile.merge(blockProfile);
+    });
+    
+    auto finished = std::chrono::steady_clock::now();
+    result.elapsedSeconds = std::chrono::duration<double>(finished - started).count();
+    
+    double patientDays = 0.0;
+    for (const auto& config : patients) {
+        patientDays += config.days;
+    }
+    result.patientsPerSecond = result.elapsedSeconds > 0 ? patients.size() / result.elapsedSeconds : 0.0;
+    result.patientDaysPerSecond = result.elapsedSeconds > 0 ? patientDays / result.elapsedSeconds : 0.0;
+    
+    return result;
+}
+
+CohortSimulation::PatientSummary CohortSimulation::simulatePatient(const PatientConfig& config) {
+    PatientSummary summary;
+    simulateBlock(&config, 1, &summary);
+    return summary;
+}
+
+void CohortSimulation::simulateBlock(const PatientConfig* configs, size_t count, PatientSummary* summaries,
+                                     GlucoseProfileSketch* profile, TimelineRecorder* timeline) {
+    TimelineRecorder::Scope blockSpan(timeline, "Patient block");
+    int64_t setupStart = timeline ? timeline->now() : 0;
+    PumpBlock block;
+    block.reserve(count);
+    
+    for (size_t i = 0; i < count; i++) {
+        const PatientConfig& config = configs[i];
+        
+        // Physiology follows the patient's true needs, not the profile
+        GlucoseModel::Parameters parameters;
+        parameters.basalGlucose = config.initialGlucose;
+        parameters.insulinSensitivity = config.trueSensitivity;
+        parameters.carbRatio = config.trueCarbRatio;
+        parameters.basalInsulinNeed = config.trueBasalNeed;
+        PumpBlock::Member& patient = block.add(config.startTime, config.days, config.seed, parameters,
+                                               config.initialGlucose);
+        patient.controlIQ = config.controlIQ;
+        if (profile) {
+            patient.cgmData->enableProfileSketch(profile->getBinMinutes());
+        }
+        
+        // Program the patient's therapy settings
+        TSlimX2Pump& pump = *patient.pump;
+        auto settings = std::make_shared<Profile>(*pump.getProfile("Default"));
+        for (int hour = 0; hour < 24; hour++) {
+            settings->addBasalRate(hour, 0, config.basalRate);
+            settings->addCarbRatio(hour, 0, config.carbRatio);
+            settings->addCorrectionFactor(hour, 0, config.correctionFactor);
+            settings->addTargetGlucose(hour, 0, config.targetGlucose);
+        }
+        pump.updateProfile("Default", settings);
+    }
+    block.start();
+    if (timeline) {
+        timeline->recordSpan("Setup", setupStart, timeline->now() - setupStart);
+    }
+    
+    DailyMeals meals(block);
+    block.run([&meals](size_t index, int minute, time_t now) { meals.act(index, minute, now); }, nullptr, timeline);
+    
+    TimelineRecorder::Scope summarySpan(timeline, "Summarize");
+    for (size_t i = 0; i < count; i++) {
+        const PatientConfig& config = configs[i];
+        const PumpBlock::Member& patient = block.getMember(i);
+        const TSlimX2Pump& pump = *patient.pump;
+        time_t endTime = patient.clock->now();
+        
+        if (profile) {
+            profile->merge(*patient.cgmData->getProfileSketch());
+        }
+        
+        PatientSummary& summary = summaries[i];
+        summary.id = config.id;
+        summary.averageGlucose = patient.cgmData->getAverageGlucose(config.startTime, endTime);
+        summary.timeInRange = patient.cgmData->getTimeInRange(3.9f, 10.0f, config.startTime, endTime);
+        summary.timeBelowRange = 100.0f - patient.cgmData->getTimeInRange(3.9f, HUGE_VALF, config.startTime, endTime);
+        summary.timeAboveRange = 100.0f - patient.cgmData->getTimeInRange(0.0f, 10.0f, config.startTime, endTime);
+        summary.totalInsulin = static_cast<float>(pump.getTotalInsulinDelivered());
+        summary.bolusCount = patient.bolusCount;
+        summary.autoCorrectionCount = 0;
+        summary.alarmCount = 0;
+        summary.lowGlucoseAlarms = 0;
+        summary.highGlucoseAlarms = 0;
+        
+        // Count alarms straight from the type index without building Event objects
+        for (const auto& record : pump.getHistoryByType(Event::ALARM, config.startTime, endTime)) {
+            summary.alarmCount++;
+            if (record.subtype == AlarmEvent::LOW_GLUCOSE) {
+                summary.lowGlucoseAlarms++;
+            } else if (record.subtype == AlarmEvent::HIGH_GLUCOSE) {
+                summary.highGlucoseAlarms++;
+            }
+        }
+        for (const auto& record : pump.getHistoryByType(Event::BOLUS, config.startTime, endTime)) {
+            if (record.subtype == BolusEvent::CORRECTION) {
+                summary.autoCorrectionCount++;
+            }
+        }
+        
+        if (timeline) {
+            timeline->recordHistory(config.id, "Patient " + std::to_string(config.id), pump.getEventLog(), config.startTime);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef COHORT_SIMULATION_H
+#define COHORT_SIMULATION_H
+
+#include "ThreadPool.h"
+#include "GlucoseProfileSketch.h"
+#include <cstddef>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+class TimelineRecorder;
+
+/**
+ * Headless runner that simulates a cohort of virtual patients, each with
+ * its own TSlimX2Pump and CGMData, across a work-stealing thread pool.
+ * The loop is closed: insulin the pumps deliver drives a GlucoseModel
+ * whose glucose is read back by the pumps' CGMs. Patients on Control-IQ
+ * are evaluated together, one batch per block on every CGM cycle.
+ */
+class CohortSimulation {
+public:
+    // Per-patient physiology and therapy settings
+    struct PatientConfig {
+        unsigned id;
+        unsigned seed;
+        int days;
+        time_t startTime;
+        float basalRate;           // Profile basal rate (U/hr)
+        float carbRatio;           // Profile carb ratio (g/U)
+        float correctionFactor;    // Profile correction factor (mmol/L per U)
+        float targetGlucose;       // Profile target (mmol/L)
+        float trueBasalNeed;       // Patient's actual basal requirement (U/hr)
+        float trueCarbRatio;       // Patient's actual carb ratio (g/U)
+        float trueSensitivity;     // Patient's actual sensitivity (mmol/L per U)
+        float initialGlucose;      // Starting glucose (mmol/L)
+        bool controlIQ;            // Closed-loop basal and automatic corrections
+    };
+    
+    // Outcome of one simulated patient
+    struct PatientSummary {
+        unsigned id;
+        float averageGlucose;
+        float timeInRange;         // % of readings within 3.9-10.0 mmol/L
+        float timeBelowRange;      // % of readings below 3.9 mmol/L
+        float timeAboveRange;      // % of readings above 10.0 mmol/L
+        float totalInsulin;        // Units delivered (basal + bolus)
+        int bolusCount;
+        int autoCorrectionCount;   // Control-IQ correction boluses
+        int alarmCount;
+        int lowGlucoseAlarms;
+        int highGlucoseAlarms;
+    };
+    
+    struct Result {
+        std::vector<PatientSummary> patients;
+        unsigned threadCount;
+        double elapsedSeconds;
+        double patientsPerSecond;
+        double patientDaysPerSecond;
+        GlucoseProfileSketch profile;   // AGP of every patient's sensor readings
+    };
+    
+    // A thread count of 0 uses all hardware threads
+    explicit CohortSimulation(unsigned threadCount = 0);
+    
+    // Cohort setup
+    void addPatient(const PatientConfig& config);
+    void generatePatients(size_t count, unsigned seed, int days, bool controlIQ = false);
+    size_t getPatientCount() const;
+    const PatientConfig& getPatient(size_t index) const;
+    void clearPatients();
+    
+    // Record simulation phases and every patient's history on a timeline
+    // (which must be open) during run; null stops recording
+    void setTimeline(std::shared_ptr<TimelineRecorder> recorder);
+    
+    // Run every patient and collect summaries (in patient order)
+    Result run();
+    
+    // Simulate a single patient, or a block of patients in lockstep through
+    // one batched glucose model, on the calling thread; readings are merged
+    // into profile and the run is recorded on timeline if given
+    static PatientSummary simulatePatient(const PatientConfig& config);
+    static void simulateBlock(const PatientConfig* configs, size_t count, PatientSummary* summaries,
+                              GlucoseProfileSketch* profile = nullptr, TimelineRecorder* timeline = nullptr);
+    
+private:
+    ThreadPool pool;
+    std::vector<PatientConfig> patients;
+    std::shared_ptr<TimelineRecorder> timeline;
+};
+
+#endif // COHORT_SIMULATION_H
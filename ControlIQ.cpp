@@ -0,0 +1,147 @@
+#include "ControlIQ.h"
+#include "TSlimX2Pump.h"
+#include <algorithm>
+#include <chrono>
+
+ControlIQ::Decision ControlIQ::evaluate(const Settings& settings, const Input& input) {
+    float basalRate, correctionBolus;
+    uint8_t action;
+    evaluateBatch(settings, &input.predictedGlucose, &input.insulinOnBoard, &input.scheduledBasal,
+                  &input.correctionFactor, &input.targetGlucose, &input.minutesSinceCorrection,
+                  &basalRate, &correctionBolus, &action, 1);
+    return Decision{ basalRate, correctionBolus, static_cast<Action>(action) };
+}
+
+void ControlIQ::evaluateBatch(const Settings& settings, const float* predictedGlucose, const float* insulinOnBoard,
+                              const float* scheduledBasal, const float* correctionFactor, const float* targetGlucose,
+                              const int32_t* minutesSinceCorrection, float* basalRate, float* correctionBolus,
+                              uint8_t* action, size_t count) {
+    const float suspendBelow = settings.suspendBelow;
+    const float decreaseBelow = settings.decreaseBelow;
+    const float increaseAbove = settings.increaseAbove;
+    const float correctionAbove = settings.correctionAbove;
+    const float correctionTarget = settings.correctionTarget;
+    const float correctionFraction = settings.correctionFraction;
+    const float maxCorrectionSteps = settings.maxCorrectionBolus * 20.0f; // 0.05 U steps
+    const float extraBasalLimit = std::max(0.0f, settings.maxBasalMultiplier - 1.0f);
+    const int32_t correctionInterval = settings.correctionIntervalMinutes;
+    const float decreaseSpan = std::max(0.01f, decreaseBelow - suspendBelow);
+    
+    // Selects rather than branches, so the pass vectorizes across pumps
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#elif defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#endif
+    for (size_t i = 0; i < count; i++) {
+        float predicted = predictedGlucose[i];
+        float scheduled = scheduledBasal[i];
+        float factor = std::max(0.1f, correctionFactor[i]);
+        float onBoard = insulinOnBoard[i];
+        
+        // Decrease: scale linearly from zero at the suspend threshold
+        float decreaseScale = std::max(0.0f, std::min(1.0f, (predicted - suspendBelow) / decreaseSpan));
+        
+        // Increase: add the insulin still needed to reach target, per hour
+        float basalNeed = (predicted - targetGlucose[i]) / factor - onBoard;
+        basalNeed = std::max(0.0f, std::min(scheduled * extraBasalLimit, basalNeed));
+        
+        int32_t suspend = predicted < suspendBelow;
+        int32_t decrease = !suspend & (predicted < decreaseBelow);
+        int32_t increase = predicted > increaseAbove;
+        
+        // The scale is 0 when suspending and 1 outside the lower band, so the
+        // rate is pure arithmetic (conditional float ops would stop GCC vectorizing)
+        basalRate[i] = scheduled * decreaseScale + basalNeed * static_cast<float>(increase);
+        
+        // Automatic correction, rounded down to the pump's 0.05 U resolution;
+        // selected as whole steps, since a conditional conversion also blocks vectorizing
+        float steps = ((predicted - correctionTarget) / factor - onBoard) * correctionFraction * 20.0f;
+        int32_t wholeSteps = static_cast<int32_t>(std::max(-1.0f, std::min(maxCorrectionSteps, steps)));
+        int32_t correct = (predicted > correctionAbove) & (minutesSinceCorrection[i] >= correctionInterval);
+        wholeSteps = std::max(0, wholeSteps) & -correct;
+        correctionBolus[i] = static_cast<float>(wholeSteps) * 0.05f;
+        
+        int32_t chosen = SCHEDULED;
+        chosen = increase ? INCREASE : chosen;
+        chosen = decrease ? DECREASE : chosen;
+        chosen = suspend ? SUSPEND : chosen;
+        action[i] = static_cast<uint8_t>(chosen);
+    }
+}
+
+ControlIQBatch::ControlIQBatch(const ControlIQ::Settings& settings) :
+    settings(settings),
+    stats{0, 0, 0.0, 0.0}
+{
+}
+
+void ControlIQBatch::setPumps(const std::vector<TSlimX2Pump*>& pumps) {
+    for (TSlimX2Pump* pump : this->pumps) {
+        pump->setControlIQBatched(false);
+    }
+    this->pumps = pumps;
+    for (TSlimX2Pump* pump : this->pumps) {
+        pump->setControlIQBatched(true);
+    }
+}
+
+size_t ControlIQBatch::run() {
+    auto started = std::chrono::steady_clock::now();
+    
+    active.clear();
+    predictedGlucose.clear();
+    insulinOnBoard.clear();
+    scheduledBasal.clear();
+    correctionFactor.clear();
+    targetGlucose.clear();
+    minutesSinceCorrection.clear();
+    
+    ControlIQ::Input input;
+    for (TSlimX2Pump* pump : pumps) {
+        if (pump->getControlIQInput(settings.predictionMinutes, input)) {
+            active.push_back(pump);
+            predictedGlucose.push_back(input.predictedGlucose);
+            insulinOnBoard.push_back(input.insulinOnBoard);
+            scheduledBasal.push_back(input.scheduledBasal);
+            correctionFactor.push_back(input.correctionFactor);
+            targetGlucose.push_back(input.targetGlucose);
+            minutesSinceCorrection.push_back(input.minutesSinceCorrection);
+        }
+    }
+    
+    size_t count = active.size();
+    basalRate.resize(count);
+    correctionBolus.resize(count);
+    action.resize(count);
+    
+    auto evaluating = std::chrono::steady_clock::now();
+    ControlIQ::evaluateBatch(settings, predictedGlucose.data(), insulinOnBoard.data(), scheduledBasal.data(),
+                             correctionFactor.data(), targetGlucose.data(), minutesSinceCorrection.data(),
+                             basalRate.data(), correctionBolus.data(), action.data(), count);
+    auto evaluated = std::chrono::steady_clock::now();
+    
+    for (size_t i = 0; i < count; i++) {
+        ControlIQ::Decision decision{ basalRate[i], correctionBolus[i], static_cast<ControlIQ::Action>(action[i]) };
+        active[i]->applyControlIQDecision(decision);
+    }
+    
+    auto finished = std::chrono::steady_clock::now();
+    stats.cycles++;
+    stats.decisions += count;
+    stats.evaluateNanoseconds += std::chrono::duration<double, std::nano>(evaluated - evaluating).count();
+    stats.totalNanoseconds += std::chrono::duration<double, std::nano>(finished - started).count();
+    return count;
+}
+
+const ControlIQBatch::Stats& ControlIQBatch::getStats() const {
+    return stats;
+}
+
+double ControlIQBatch::getNanosecondsPerDecision() const {
+    return stats.decisions > 0 ? stats.totalNanoseconds / stats.decisions : 0.0;
+}
+
+void ControlIQBatch::resetStats() {
+    stats = Stats{0, 0, 0.0, 0.0};
+}
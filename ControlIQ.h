@@ -0,0 +1,112 @@
+#ifndef CONTROL_IQ_H
+#define CONTROL_IQ_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TSlimX2Pump;
+
+/**
+ * Control-IQ style closed-loop controller.
+ * Every CGM cycle the glucose predicted a fixed time ahead selects the
+ * basal action: suspend below the low threshold, scale basal down in the
+ * lower band, keep the scheduled rate in the target band, and raise it
+ * (by the insulin still needed after IOB, up to a cap) above it. When the
+ * prediction is high enough an automatic correction bolus is added,
+ * limited in size and frequency. Decisions are pure functions of their
+ * inputs, so many pumps can be evaluated in one structure-of-arrays pass.
+ */
+class ControlIQ {
+public:
+    enum Action : uint8_t {
+        SCHEDULED,      // Profile basal rate
+        SUSPEND,        // Basal stopped for a predicted low
+        DECREASE,       // Reduced basal
+        INCREASE        // Increased basal
+    };
+    
+    // Thresholds are mmol/L
+    struct Settings {
+        int predictionMinutes = 30;
+        float suspendBelow = 3.9f;
+        float decreaseBelow = 6.25f;
+        float increaseAbove = 8.9f;
+        float correctionAbove = 10.0f;
+        float correctionTarget = 6.1f;
+        float correctionFraction = 0.6f;    // Share of the computed correction given
+        float maxCorrectionBolus = 6.0f;    // Units
+        int correctionIntervalMinutes = 60; // Minimum time between corrections
+        float maxBasalMultiplier = 3.0f;    // Cap on increased basal vs scheduled
+    };
+    
+    struct Input {
+        float predictedGlucose;     // mmol/L, predictionMinutes ahead
+        float insulinOnBoard;       // Units
+        float scheduledBasal;       // U/hr
+        float correctionFactor;     // mmol/L per unit
+        float targetGlucose;        // mmol/L
+        int32_t minutesSinceCorrection;
+    };
+    
+    struct Decision {
+        float basalRate;            // U/hr to deliver until the next cycle
+        float correctionBolus;      // Units (0 for none)
+        Action action;
+    };
+    
+    // Single decision
+    static Decision evaluate(const Settings& settings, const Input& input);
+    
+    // Many decisions in one pass; input and output arrays hold one entry per pump
+    static void evaluateBatch(const Settings& settings, const float* predictedGlucose, const float* insulinOnBoard,
+                              const float* scheduledBasal, const float* correctionFactor, const float* targetGlucose,
+                              const int32_t* minutesSinceCorrection, float* basalRate, float* correctionBolus,
+                              uint8_t* action, size_t count);
+};
+
+/**
+ * Drives Control-IQ for a set of pumps with one batched evaluation per CGM
+ * cycle: inputs are gathered from every pump into arrays, evaluated
+ * together and the decisions applied back. Pumps are switched to batched
+ * mode so they do not also evaluate on their own.
+ */
+class ControlIQBatch {
+public:
+    struct Stats {
+        size_t cycles;
+        size_t decisions;
+        double evaluateNanoseconds;     // Time spent in the batched evaluation
+        double totalNanoseconds;        // Including gathering inputs and applying
+    };
+    
+    explicit ControlIQBatch(const ControlIQ::Settings& settings = ControlIQ::Settings());
+    
+    void setPumps(const std::vector<TSlimX2Pump*>& pumps);
+    
+    // Evaluate every pump with Control-IQ enabled; returns decisions made
+    size_t run();
+    
+    const Stats& getStats() const;
+    double getNanosecondsPerDecision() const;
+    void resetStats();
+    
+private:
+    ControlIQ::Settings settings;
+    std::vector<TSlimX2Pump*> pumps;
+    Stats stats;
+    
+    // Gathered inputs and decisions for the current cycle
+    std::vector<TSlimX2Pump*> active;
+    std::vector<float> predictedGlucose;
+    std::vector<float> insulinOnBoard;
+    std::vector<float> scheduledBasal;
+    std::vector<float> correctionFactor;
+    std::vector<float> targetGlucose;
+    std::vector<int32_t> minutesSinceCorrection;
+    std::vector<float> basalRate;
+    std::vector<float> correctionBolus;
+    std::vector<uint8_t> action;
+};
+
+#endif // CONTROL_IQ_H
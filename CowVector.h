@@ -0,0 +1,273 @@
+#ifndef COW_VECTOR_H
+#define COW_VECTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+/**
+ * Vector whose elements live in fixed-size chunks shared between copies.
+ * Copying is O(1): the copy shares the chunk table, and the table or a
+ * chunk is only duplicated when one of its sharers first writes to it, so
+ * a copy of a long history costs one chunk per array it goes on to change.
+ * Copies may be used from different threads; one copy is not thread-safe.
+ */
+template <typename T>
+class CowVector {
+private:
+    static constexpr size_t CHUNK_BYTES = 16384;
+    
+    static constexpr size_t chunkBits() {
+        size_t bits = 0;
+        while ((size_t(2) << bits) * sizeof(T) <= CHUNK_BYTES) {
+            bits++;
+        }
+        return bits;
+    }
+    
+public:
+    using value_type = T;
+    
+    static constexpr size_t CHUNK_BITS = chunkBits();
+    static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    
+    /**
+     * Random-access iterator; walks a chunk at a time through a cached pointer
+     */
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+        
+        const_iterator() : owner(nullptr), index(0), item(nullptr), chunkEnd(nullptr) {}
+        const_iterator(const CowVector* owner, size_t index) : owner(owner), index(index) { reload(); }
+        
+        reference operator*() const { return *item; }
+        pointer operator->() const { return item; }
+        reference operator[](difference_type offset) const { return (*owner)[index + offset]; }
+        
+        const_iterator& operator++() {
+            ++index;
+            if (++item == chunkEnd) {
+                reload();
+            }
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+        const_iterator& operator--() { --index; reload(); return *this; }
+        const_iterator operator--(int) { const_iterator old = *this; --*this; return old; }
+        const_iterator& operator+=(difference_type offset) { index += offset; reload(); return *this; }
+        const_iterator& operator-=(difference_type offset) { index -= offset; reload(); return *this; }
+        const_iterator operator+(difference_type offset) const { return const_iterator(owner, index + offset); }
+        const_iterator operator-(difference_type offset) const { return const_iterator(owner, index - offset); }
+        friend const_iterator operator+(difference_type offset, const const_iterator& it) { return it + offset; }
+        difference_type operator-(const const_iterator& other) const {
+            return static_cast<difference_type>(index) - static_cast<difference_type>(other.index);
+        }
+        
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+        bool operator<(const const_iterator& other) const { return index < other.index; }
+        bool operator>(const const_iterator& other) const { return index > other.index; }
+        bool operator<=(const const_iterator& other) const { return index <= other.index; }
+        bool operator>=(const const_iterator& other) const { return index >= other.index; }
+        
+        size_t getIndex() const { return index; }
+        
+    private:
+        const CowVector* owner;
+        size_t index;
+        const T* item;
+        const T* chunkEnd;
+        
+        void reload() {
+            if (owner && index < owner->size()) {
+                size_t position = owner->first + index;
+                const Slot& slot = (*owner->table)[position >> CHUNK_BITS];
+                item = slot.items + (position & (CHUNK_SIZE - 1));
+                chunkEnd = slot.items + slot.size;
+            } else {
+                item = nullptr;
+                chunkEnd = nullptr;
+            }
+        }
+    };
+    
+    CowVector() : table(std::make_shared<Table>()), first(0), count(0) {}
+    
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    
+    const T& operator[](size_t index) const {
+        size_t position = first + index;
+        return (*table)[position >> CHUNK_BITS].items[position & (CHUNK_SIZE - 1)];
+    }
+    const T& front() const { return (*this)[0]; }
+    const T& back() const { return (*this)[count - 1]; }
+    
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+    
+    void push_back(const T& value) {
+        size_t position = first + count;
+        if ((position & (CHUNK_SIZE - 1)) == 0) {
+            // Full chunks stay as they are; start a new one
+            auto chunk = std::make_shared<Chunk>();
+            chunk->reserve(position == 0 ? std::min<size_t>(CHUNK_SIZE, 16) : CHUNK_SIZE);
+            writableTable().push_back(Slot{ chunk->data(), 0, chunk });
+        }
+        
+        Slot& slot = writableSlot(position >> CHUNK_BITS);
+        slot.chunk->push_back(value);
+        slot.items = slot.chunk->data();
+        slot.size = slot.chunk->size();
+        count++;
+    }
+    
+    // Writable element access; duplicates the element's chunk if it is shared
+    T& mutableAt(size_t index) {
+        size_t position = first + index;
+        return writableSlot(position >> CHUNK_BITS).items[position & (CHUNK_SIZE - 1)];
+    }
+    T& mutableBack() { return mutableAt(count - 1); }
+    
+    // Insert before index, shifting the later elements up (O(size - index))
+    void insert(size_t index, const T& value) {
+        if (index >= count) {
+            push_back(value);
+            return;
+        }
+        push_back(back());
+        for (size_t i = count - 2; i > index; i--) {
+            mutableAt(i) = (*this)[i - 1];
+        }
+        mutableAt(index) = value;
+    }
+    
+    void resize(size_t newCount, const T& value = T()) {
+        while (count < newCount) {
+            push_back(value);
+        }
+        if (newCount == count) {
+            return;
+        }
+        if (newCount == 0) {
+            clear();
+            return;
+        }
+        
+        size_t end = first + newCount;
+        size_t chunks = (end + CHUNK_SIZE - 1) >> CHUNK_BITS;
+        writableTable().resize(chunks);
+        if (end & (CHUNK_SIZE - 1)) {
+            Slot& slot = writableSlot(chunks - 1);
+            slot.chunk->resize(end & (CHUNK_SIZE - 1));
+            slot.size = slot.chunk->size();
+        }
+        count = newCount;
+    }
+    
+    // Drop the first elements; whole chunks are released, so this is
+    // O(size / CHUNK_SIZE)
+    void erasePrefix(size_t erased) {
+        if (erased >= count) {
+            clear();
+            return;
+        }
+        first += erased;
+        count -= erased;
+        size_t chunks = first >> CHUNK_BITS;
+        if (chunks > 0) {
+            Table& slots = writableTable();
+            slots.erase(slots.begin(), slots.begin() + chunks);
+            first -= chunks << CHUNK_BITS;
+        }
+    }
+    
+    void clear() {
+        table = std::make_shared<Table>();
+        first = 0;
+        count = 0;
+    }
+    
+    void reserve(size_t capacity) {
+        writableTable().reserve((first + capacity + CHUNK_SIZE - 1) >> CHUNK_BITS);
+    }
+    
+    // Index of the first element for which predicate is false, given
+    // elements partitioned by it: a binary search over chunks, then within one
+    template <typename Predicate>
+    size_t partitionPoint(Predicate predicate) const {
+        const Table& slots = *table;
+        auto slot = std::partition_point(slots.begin(), slots.end(),
+            [&predicate](const Slot& chunk) { return predicate(chunk.items[chunk.size - 1]); });
+        if (slot == slots.end()) {
+            return count;
+        }
+        
+        size_t chunkStart = static_cast<size_t>(slot - slots.begin()) << CHUNK_BITS;
+        const T* from = slot->items + (chunkStart < first ? first - chunkStart : 0);
+        const T* it = std::partition_point(from, static_cast<const T*>(slot->items + slot->size), predicate);
+        return chunkStart + static_cast<size_t>(it - slot->items) - first;
+    }
+    
+    // Bytes held by the chunks (shared chunks count in full)
+    size_t getMemoryUsage() const {
+        size_t bytes = table->capacity() * sizeof(Slot);
+        for (const Slot& slot : *table) {
+            bytes += slot.chunk->capacity() * sizeof(T);
+        }
+        return bytes;
+    }
+    
+private:
+    using Chunk = std::vector<T>;
+    
+    // A chunk with its data pointer and size cached, saving a hop per lookup
+    struct Slot {
+        T* items;
+        size_t size;
+        std::shared_ptr<Chunk> chunk;
+    };
+    using Table = std::vector<Slot>;
+    
+    std::shared_ptr<Table> table;
+    size_t first;   // Position of element 0 in the first chunk
+    size_t count;
+    
+    // Sole ownership; the fence orders a former sharer's reads before our writes
+    template <typename Pointer>
+    static bool isUnique(const Pointer& pointer) {
+        if (pointer.use_count() != 1) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+    
+    Table& writableTable() {
+        if (!isUnique(table)) {
+            table = std::make_shared<Table>(*table);
+        }
+        return *table;
+    }
+    
+    Slot& writableSlot(size_t chunkIndex) {
+        Slot& slot = writableTable()[chunkIndex];
+        if (!isUnique(slot.chunk)) {
+            auto copy = std::make_shared<Chunk>();
+            copy->reserve(CHUNK_SIZE);
+            copy->assign(slot.chunk->begin(), slot.chunk->end());
+            slot = Slot{ copy->data(), copy->size(), copy };
+        }
+        return slot;
+    }
+};
+
+#endif // COW_VECTOR_H
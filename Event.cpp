@@ -0,0 +1,207 @@
+#include "Event.h"
+#include <iomanip>
+#include <sstream>
+
+Event::Event(EventType type, time_t timestamp) :
+    type(type),
+    timestamp(timestamp)
+{
+}
+
+Event::EventType Event::getType() const {
+    return type;
+}
+
+time_t Event::getTimestamp() const {
+    return timestamp;
+}
+
+BolusEvent::BolusEvent(time_t timestamp, BolusType bolusType, float units, int durationMinutes) :
+    Event(BOLUS, timestamp),
+    bolusType(bolusType),
+    units(units),
+    durationMinutes(durationMinutes),
+    cancelled(false)
+{
+}
+
+BolusEvent::BolusType BolusEvent::getBolusType() const {
+    return bolusType;
+}
+
+float BolusEvent::getUnits() const {
+    return units;
+}
+
+int BolusEvent::getDurationMinutes() const {
+    return durationMinutes;
+}
+
+bool BolusEvent::isCancelled() const {
+    return cancelled;
+}
+
+void BolusEvent::setCancelled(bool cancelled) {
+    this->cancelled = cancelled;
+}
+
+std::string BolusEvent::getDescription() const {
+    static const char* typeNames[] = { "Manual", "Extended", "Quick", "Correction" };
+    
+    std::ostringstream description;
+    description << std::fixed << std::setprecision(2);
+    description << typeNames[bolusType] << " bolus: " << units << " U";
+    if (bolusType == EXTENDED) {
+        description << " over " << durationMinutes << " min";
+    }
+    if (cancelled) {
+        description << " (cancelled)";
+    }
+    return description.str();
+}
+
+BasalChangeEvent::BasalChangeEvent(time_t timestamp, float oldRate, float newRate, const std::string& reason) :
+    Event(BASAL_CHANGE, timestamp),
+    oldRate(oldRate),
+    newRate(newRate),
+    reason(reason)
+{
+}
+
+float BasalChangeEvent::getOldRate() const {
+    return oldRate;
+}
+
+float BasalChangeEvent::getNewRate() const {
+    return newRate;
+}
+
+std::string BasalChangeEvent::getReason() const {
+    return reason;
+}
+
+std::string BasalChangeEvent::getDescription() const {
+    std::ostringstream description;
+    description << std::fixed << std::setprecision(2);
+    description << "Basal rate changed from " << oldRate << " to " << newRate << " U/hr";
+    if (!reason.empty()) {
+        description << " (" << reason << ")";
+    }
+    return description.str();
+}
+
+ProfileChangeEvent::ProfileChangeEvent(time_t timestamp, const std::string& oldProfile, const std::string& newProfile,
+                                       uint32_t version) :
+    Event(PROFILE_CHANGE, timestamp),
+    oldProfile(oldProfile),
+    newProfile(newProfile),
+    version(version)
+{
+}
+
+std::string ProfileChangeEvent::getOldProfile() const {
+    return oldProfile;
+}
+
+std::string ProfileChangeEvent::getNewProfile() const {
+    return newProfile;
+}
+
+uint32_t ProfileChangeEvent::getVersion() const {
+    return version;
+}
+
+std::string ProfileChangeEvent::getDescription() const {
+    std::string description = oldProfile == newProfile ? "Profile updated: " + newProfile :
+        "Profile changed from " + oldProfile + " to " + newProfile;
+    if (version != 0) {
+        description += " (version " + std::to_string(version) + ")";
+    }
+    return description;
+}
+
+SuspendEvent::SuspendEvent(time_t timestamp, const std::string& reason) :
+    Event(SUSPEND, timestamp),
+    reason(reason)
+{
+}
+
+std::string SuspendEvent::getReason() const {
+    return reason;
+}
+
+std::string SuspendEvent::getDescription() const {
+    return "Insulin delivery suspended: " + reason;
+}
+
+ResumeEvent::ResumeEvent(time_t timestamp, const std::string& reason) :
+    Event(RESUME, timestamp),
+    reason(reason)
+{
+}
+
+std::string ResumeEvent::getReason() const {
+    return reason;
+}
+
+std::string ResumeEvent::getDescription() const {
+    return "Insulin delivery resumed: " + reason;
+}
+
+CGMReadingEvent::CGMReadingEvent(time_t timestamp, float glucoseValue) :
+    Event(CGM_READING, timestamp),
+    glucoseValue(glucoseValue)
+{
+}
+
+float CGMReadingEvent::getGlucoseValue() const {
+    return glucoseValue;
+}
+
+std::string CGMReadingEvent::getDescription() const {
+    std::ostringstream description;
+    description << std::fixed << std::setprecision(1);
+    description << "CGM reading: " << glucoseValue << " mmol/L";
+    return description.str();
+}
+
+AlarmEvent::AlarmEvent(time_t timestamp, AlarmType alarmType, const std::string& details) :
+    Event(ALARM, timestamp),
+    alarmType(alarmType),
+    details(details)
+{
+}
+
+AlarmEvent::AlarmType AlarmEvent::getAlarmType() const {
+    return alarmType;
+}
+
+std::string AlarmEvent::getDetails() const {
+    return details;
+}
+
+std::string AlarmEvent::getDescription() const {
+    static const char* alarmNames[] = {
+        "Low glucose", "High glucose", "Low insulin", "Low battery", "Occlusion", "CGM disconnected"
+    };
+    return std::string("Alarm (") + alarmNames[alarmType] + "): " + details;
+}
+
+ErrorEvent::ErrorEvent(time_t timestamp, const std::string& errorCode, const std::string& errorMessage) :
+    Event(ERROR, timestamp),
+    errorCode(errorCode),
+    errorMessage(errorMessage)
+{
+}
+
+std::string ErrorEvent::getErrorCode() const {
+    return errorCode;
+}
+
+std::string ErrorEvent::getErrorMessage() const {
+    return errorMessage;
+}
+
+std::string ErrorEvent::getDescription() const {
+    return "Error " + errorCode + ": " + errorMessage;
+}
@@ -2,6 +2,7 @@
 #define EVENT_H
 
 #include <string>
+#include <cstdint>
 #include <ctime>
 #include <memory>
 
@@ -84,15 +85,18 @@ private:
  */
 class ProfileChangeEvent : public Event {
 public:
-    ProfileChangeEvent(time_t timestamp, const std::string& oldProfile, const std::string& newProfile);
+    ProfileChangeEvent(time_t timestamp, const std::string& oldProfile, const std::string& newProfile,
+                       uint32_t version = 0);
     
     std::string getOldProfile() const;
     std::string getNewProfile() const;
+    uint32_t getVersion() const; // Version of the profile activated, 0 when unknown
     std::string getDescription() const override;
     
 private:
     std::string oldProfile;
     std::string newProfile;
+    uint32_t version;
 };
 
 /**
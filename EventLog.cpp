@@ -0,0 +1,444 @@
+#include "EventLog.h"
+#include "Journal.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+
+StringPool::StringPool() {
+    intern(""); // Id 0 is always the empty string
+}
+
+StringPool::StringPool(const StringPool& other) :
+    strings(other.strings)
+{
+    // Keys must view this pool's own copies
+    for (uint32_t id = 0; id < strings.size(); id++) {
+        ids.emplace(std::string_view(strings[id]), id);
+    }
+}
+
+uint32_t StringPool::intern(std::string_view text) {
+    uint32_t id;
+    if (find(text, id)) {
+        return id;
+    }
+    
+    id = static_cast<uint32_t>(strings.size());
+    strings.emplace_back(text);
+    ids.emplace(std::string_view(strings.back()), id);
+    return id;
+}
+
+bool StringPool::find(std::string_view text, uint32_t& id) const {
+    auto it = ids.find(text);
+    if (it == ids.end()) {
+        return false;
+    }
+    id = it->second;
+    return true;
+}
+
+const std::string& StringPool::get(uint32_t id) const {
+    return id < strings.size() ? strings[id] : strings[0];
+}
+
+size_t StringPool::size() const {
+    return strings.size();
+}
+
+EventLog::RecordView::RecordView(const_iterator first, const_iterator last, size_t firstIndex) :
+    first(first),
+    last(last),
+    firstIndex(firstIndex)
+{
+}
+
+EventLog::RecordView::const_iterator EventLog::RecordView::begin() const {
+    return first;
+}
+
+EventLog::RecordView::const_iterator EventLog::RecordView::end() const {
+    return last;
+}
+
+size_t EventLog::RecordView::size() const {
+    return static_cast<size_t>(last - first);
+}
+
+bool EventLog::RecordView::empty() const {
+    return first == last;
+}
+
+const EventLog::Record& EventLog::RecordView::operator[](size_t position) const {
+    return first[position];
+}
+
+size_t EventLog::RecordView::getLogIndex(size_t position) const {
+    return firstIndex + position;
+}
+
+EventLog::TypeView::const_iterator::const_iterator(const RecordStore* records, IndexStore::const_iterator position) :
+    records(records),
+    position(position)
+{
+}
+
+const EventLog::Record& EventLog::TypeView::const_iterator::operator*() const {
+    return (*records)[*position];
+}
+
+const EventLog::Record* EventLog::TypeView::const_iterator::operator->() const {
+    return &(*records)[*position];
+}
+
+EventLog::TypeView::const_iterator& EventLog::TypeView::const_iterator::operator++() {
+    ++position;
+    return *this;
+}
+
+bool EventLog::TypeView::const_iterator::operator==(const const_iterator& other) const {
+    return position == other.position;
+}
+
+bool EventLog::TypeView::const_iterator::operator!=(const const_iterator& other) const {
+    return position != other.position;
+}
+
+size_t EventLog::TypeView::const_iterator::getLogIndex() const {
+    return *position;
+}
+
+EventLog::TypeView::TypeView(const RecordStore* records, IndexStore::const_iterator first, IndexStore::const_iterator last) :
+    records(records),
+    first(first),
+    last(last)
+{
+}
+
+EventLog::TypeView::const_iterator EventLog::TypeView::begin() const {
+    return const_iterator(records, first);
+}
+
+EventLog::TypeView::const_iterator EventLog::TypeView::end() const {
+    return const_iterator(records, last);
+}
+
+size_t EventLog::TypeView::size() const {
+    return static_cast<size_t>(last - first);
+}
+
+bool EventLog::TypeView::empty() const {
+    return first == last;
+}
+
+const EventLog::Record& EventLog::TypeView::operator[](size_t position) const {
+    return (*records)[first[position]];
+}
+
+size_t EventLog::TypeView::getLogIndex(size_t position) const {
+    return first[position];
+}
+
+EventLog::EventLog() :
+    strings(std::make_shared<StringPool>()),
+    journal(nullptr),
+    anchor(NPOS)
+{
+}
+
+EventLog::EventLog(const EventLog& other) :
+    records(other.records),
+    strings(other.strings),
+    journal(nullptr),
+    anchor(other.anchor)
+{
+    for (int type = 0; type < EVENT_TYPE_COUNT; type++) {
+        typeIndex[type] = other.typeIndex[type];
+    }
+}
+
+size_t EventLog::logBolus(time_t timestamp, BolusEvent::BolusType bolusType, float units, int durationMinutes) {
+    return push(timestamp, Event::BOLUS, static_cast<uint8_t>(bolusType), units, 0.0f, 0, 0, durationMinutes);
+}
+
+size_t EventLog::logBasalChange(time_t timestamp, float oldRate, float newRate, std::string_view reason) {
+    return push(timestamp, Event::BASAL_CHANGE, 0, oldRate, newRate, intern(reason), 0, 0);
+}
+
+size_t EventLog::logProfileChange(time_t timestamp, std::string_view oldProfile, std::string_view newProfile,
+                                  uint32_t version) {
+    return push(timestamp, Event::PROFILE_CHANGE, 0, 0.0f, 0.0f,
+                intern(oldProfile), intern(newProfile), static_cast<int32_t>(version));
+}
+
+size_t EventLog::logSuspend(time_t timestamp, std::string_view reason) {
+    return push(timestamp, Event::SUSPEND, 0, 0.0f, 0.0f, intern(reason), 0, 0);
+}
+
+size_t EventLog::logResume(time_t timestamp, std::string_view reason) {
+    return push(timestamp, Event::RESUME, 0, 0.0f, 0.0f, intern(reason), 0, 0);
+}
+
+size_t EventLog::logCGMReading(time_t timestamp, float glucoseValue) {
+    return push(timestamp, Event::CGM_READING, 0, glucoseValue, 0.0f, 0, 0, 0);
+}
+
+size_t EventLog::logAlarm(time_t timestamp, AlarmEvent::AlarmType alarmType, std::string_view details) {
+    return push(timestamp, Event::ALARM, static_cast<uint8_t>(alarmType), 0.0f, 0.0f, intern(details), 0, 0);
+}
+
+size_t EventLog::logError(time_t timestamp, std::string_view errorCode, std::string_view errorMessage) {
+    return push(timestamp, Event::ERROR, 0, 0.0f, 0.0f,
+                intern(errorCode), intern(errorMessage), 0);
+}
+
+size_t EventLog::append(const Event& event) {
+    time_t timestamp = event.getTimestamp();
+    
+    switch (event.getType()) {
+        case Event::BOLUS: {
+            const auto& bolus = static_cast<const BolusEvent&>(event);
+            size_t index = logBolus(timestamp, bolus.getBolusType(), bolus.getUnits(), bolus.getDurationMinutes());
+            setCancelled(index, bolus.isCancelled());
+            return index;
+        }
+        case Event::BASAL_CHANGE: {
+            const auto& change = static_cast<const BasalChangeEvent&>(event);
+            return logBasalChange(timestamp, change.getOldRate(), change.getNewRate(), change.getReason());
+        }
+        case Event::PROFILE_CHANGE: {
+            const auto& change = static_cast<const ProfileChangeEvent&>(event);
+            return logProfileChange(timestamp, change.getOldProfile(), change.getNewProfile(), change.getVersion());
+        }
+        case Event::SUSPEND:
+            return logSuspend(timestamp, static_cast<const SuspendEvent&>(event).getReason());
+        case Event::RESUME:
+            return logResume(timestamp, static_cast<const ResumeEvent&>(event).getReason());
+        case Event::CGM_READING:
+            return logCGMReading(timestamp, static_cast<const CGMReadingEvent&>(event).getGlucoseValue());
+        case Event::ALARM: {
+            const auto& alarm = static_cast<const AlarmEvent&>(event);
+            return logAlarm(timestamp, alarm.getAlarmType(), alarm.getDetails());
+        }
+        case Event::ERROR: {
+            const auto& error = static_cast<const ErrorEvent&>(event);
+            return logError(timestamp, error.getErrorCode(), error.getErrorMessage());
+        }
+    }
+    return records.size();
+}
+
+size_t EventLog::appendRecord(const Record& record, std::string_view text, std::string_view secondText) {
+    if (record.type >= EVENT_TYPE_COUNT) {
+        return records.size();
+    }
+    
+    Record copy = record;
+    copy.text = text.empty() ? 0 : intern(text);
+    copy.secondText = secondText.empty() ? 0 : intern(secondText);
+    return insert(copy);
+}
+
+void EventLog::setJournal(JournalWriter* journal) {
+    this->journal = journal;
+}
+
+void EventLog::setAnchor(size_t index) {
+    anchor = index;
+}
+
+size_t EventLog::getAnchor() const {
+    return anchor;
+}
+
+size_t EventLog::size() const {
+    return records.size();
+}
+
+bool EventLog::empty() const {
+    return records.empty();
+}
+
+const EventLog::Record& EventLog::getRecord(size_t index) const {
+    return records[index];
+}
+
+const EventLog::Record& EventLog::operator[](size_t index) const {
+    return records[index];
+}
+
+const std::string& EventLog::getText(uint32_t id) const {
+    return strings->get(id);
+}
+
+void EventLog::setCancelled(size_t index, bool cancelled) {
+    if (index >= records.size()) {
+        return;
+    }
+    
+    uint8_t flags = records[index].flags;
+    uint8_t newFlags = cancelled ? flags | FLAG_CANCELLED : flags & ~FLAG_CANCELLED;
+    if (newFlags == flags) {
+        return;
+    }
+    records.mutableAt(index).flags = newFlags;
+    
+    if (journal) {
+        journal->appendCancelled(index, cancelled);
+    }
+}
+
+void EventLog::reserve(size_t count) {
+    records.reserve(count);
+}
+
+void EventLog::clear() {
+    records.clear();
+    anchor = NPOS;
+    for (auto& index : typeIndex) {
+        index.clear();
+    }
+}
+
+EventLog::RecordView EventLog::getRange(time_t startTime, time_t endTime) const {
+    size_t first = lowerBound(startTime);
+    size_t last = std::max(first, upperBound(endTime));
+    return RecordView(records.begin() + first, records.begin() + last, first);
+}
+
+EventLog::TypeView EventLog::getByType(Event::EventType type) const {
+    const IndexStore& index = typeIndex[type];
+    return TypeView(&records, index.begin(), index.end());
+}
+
+EventLog::TypeView EventLog::getByType(Event::EventType type, time_t startTime, time_t endTime) const {
+    // Record indices grow with time, so the global bounds bound the type index too
+    const IndexStore& index = typeIndex[type];
+    uint32_t firstRecord = static_cast<uint32_t>(lowerBound(startTime));
+    uint32_t lastRecord = static_cast<uint32_t>(upperBound(endTime));
+    size_t first = index.partitionPoint([firstRecord](uint32_t record) { return record < firstRecord; });
+    size_t last = index.partitionPoint([lastRecord](uint32_t record) { return record < lastRecord; });
+    return TypeView(&records, index.begin() + first, index.begin() + std::max(first, last));
+}
+
+size_t EventLog::countByType(Event::EventType type) const {
+    return typeIndex[type].size();
+}
+
+size_t EventLog::findLast(Event::EventType type) const {
+    const IndexStore& index = typeIndex[type];
+    return index.empty() ? NPOS : index.back();
+}
+
+size_t EventLog::lowerBound(time_t startTime) const {
+    return records.partitionPoint([startTime](const Record& record) { return record.timestamp < startTime; });
+}
+
+size_t EventLog::upperBound(time_t endTime) const {
+    return records.partitionPoint([endTime](const Record& record) { return record.timestamp <= endTime; });
+}
+
+std::shared_ptr<Event> EventLog::materialize(size_t index) const {
+    if (index >= records.size()) {
+        return nullptr;
+    }
+    
+    const Record& record = records[index];
+    switch (static_cast<Event::EventType>(record.type)) {
+        case Event::BOLUS: {
+            auto bolus = std::make_shared<BolusEvent>(record.timestamp,
+                static_cast<BolusEvent::BolusType>(record.subtype), record.value, record.duration);
+            bolus->setCancelled((record.flags & FLAG_CANCELLED) != 0);
+            return bolus;
+        }
+        case Event::BASAL_CHANGE:
+            return std::make_shared<BasalChangeEvent>(record.timestamp, record.value, record.newValue,
+                                                      strings->get(record.text));
+        case Event::PROFILE_CHANGE:
+            return std::make_shared<ProfileChangeEvent>(record.timestamp, strings->get(record.text),
+                                                        strings->get(record.secondText),
+                                                        static_cast<uint32_t>(record.duration));
+        case Event::SUSPEND:
+            return std::make_shared<SuspendEvent>(record.timestamp, strings->get(record.text));
+        case Event::RESUME:
+            return std::make_shared<ResumeEvent>(record.timestamp, strings->get(record.text));
+        case Event::CGM_READING:
+            return std::make_shared<CGMReadingEvent>(record.timestamp, record.value);
+        case Event::ALARM:
+            return std::make_shared<AlarmEvent>(record.timestamp,
+                static_cast<AlarmEvent::AlarmType>(record.subtype), strings->get(record.text));
+        case Event::ERROR:
+            return std::make_shared<ErrorEvent>(record.timestamp, strings->get(record.text),
+                                                strings->get(record.secondText));
+    }
+    return nullptr;
+}
+
+std::string EventLog::getDescription(size_t index) const {
+    auto event = materialize(index);
+    return event ? event->getDescription() : "";
+}
+
+size_t EventLog::push(time_t timestamp, Event::EventType type, uint8_t subtype, float value, float newValue,
+                      uint32_t text, uint32_t secondText, int32_t duration) {
+    PUMP_METRIC(LOG_EVENT);
+    Record record;
+    record.timestamp = timestamp;
+    record.value = value;
+    record.newValue = newValue;
+    record.text = text;
+    record.secondText = secondText;
+    record.duration = duration;
+    record.type = static_cast<uint8_t>(type);
+    record.subtype = subtype;
+    record.flags = 0;
+    return insert(record);
+}
+
+size_t EventLog::insert(const Record& record) {
+    // Records normally arrive in order; late ones are inserted in place so
+    // range queries can still binary search
+    size_t index = records.size();
+    if (index == 0 || records.back().timestamp <= record.timestamp) {
+        records.push_back(record);
+        typeIndex[record.type].push_back(static_cast<uint32_t>(index));
+    } else {
+        index = upperBound(record.timestamp);
+        records.insert(index, record);
+        
+        // Every later record moved up one place
+        for (IndexStore& indices : typeIndex) {
+            size_t first = indices.partitionPoint([index](uint32_t entry) { return entry < index; });
+            for (size_t position = first; position < indices.size(); position++) {
+                indices.mutableAt(position)++;
+            }
+        }
+        IndexStore& indices = typeIndex[record.type];
+        indices.insert(indices.partitionPoint([index](uint32_t entry) { return entry < index; }),
+                       static_cast<uint32_t>(index));
+        if (anchor != NPOS && anchor >= index) {
+            anchor++;
+        }
+    }
+    
+    if (journal) {
+        journal->appendEvent(*this, index);
+    }
+    return index;
+}
+
+uint32_t EventLog::intern(std::string_view text) {
+    uint32_t id;
+    if (strings->find(text, id)) {
+        return id;
+    }
+    
+    // The pool may be shared with a forked log; add to a private copy (a
+    // sole owner fences so a former sharer's lookups precede the write)
+    if (strings.use_count() > 1) {
+        strings = std::make_shared<StringPool>(*strings);
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return strings->intern(text);
+}
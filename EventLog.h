@@ -0,0 +1,196 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "Event.h"
+#include "CowVector.h"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class JournalWriter;
+
+/**
+ * Pool of interned strings; each distinct text is stored once and
+ * referred to by a 32-bit id
+ */
+class StringPool {
+public:
+    StringPool();
+    StringPool(const StringPool& other);
+    StringPool& operator=(const StringPool&) = delete;
+    
+    // Id of the text, adding it on first use (no allocation when already present)
+    uint32_t intern(std::string_view text);
+    bool find(std::string_view text, uint32_t& id) const;
+    const std::string& get(uint32_t id) const;
+    size_t size() const;
+    
+private:
+    std::deque<std::string> strings; // Deque keeps element addresses stable
+    std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+/**
+ * Allocation-free history of pump events.
+ * Every Event.h kind is stored as a fixed-size tagged record; reasons and
+ * details are interned, and Event objects / descriptions are only built
+ * when a caller asks for them. Records are kept in timestamp order with a
+ * per-type index (a late record is inserted in place, moving every later
+ * record and the anchor up one index), so range and type queries are
+ * binary searches that return zero-copy views. Records, indices and strings
+ * are shared copy-on-write, so copying a log (to fork a pump) is O(1).
+ */
+class EventLog {
+public:
+    // Fixed-size record shared by all event kinds
+    struct Record {
+        time_t timestamp;
+        float value;          // Bolus units, old basal rate or glucose value
+        float newValue;       // New basal rate
+        uint32_t text;        // Reason, details, old profile or error code
+        uint32_t secondText;  // New profile or error message
+        int32_t duration;     // Extended bolus duration (minutes) or activated profile version
+        uint8_t type;         // Event::EventType
+        uint8_t subtype;      // BolusEvent::BolusType or AlarmEvent::AlarmType
+        uint8_t flags;
+    };
+    
+    static const uint8_t FLAG_CANCELLED = 0x01;
+    static const int EVENT_TYPE_COUNT = Event::ERROR + 1;
+    static const size_t NPOS = static_cast<size_t>(-1);
+    
+    using RecordStore = CowVector<Record>;
+    using IndexStore = CowVector<uint32_t>;
+    
+    /**
+     * Zero-copy view over a consecutive run of records
+     */
+    class RecordView {
+    public:
+        using const_iterator = RecordStore::const_iterator;
+        
+        RecordView(const_iterator first, const_iterator last, size_t firstIndex);
+        
+        const_iterator begin() const;
+        const_iterator end() const;
+        size_t size() const;
+        bool empty() const;
+        const Record& operator[](size_t position) const;
+        size_t getLogIndex(size_t position) const; // Index in the full log
+        
+    private:
+        const_iterator first;
+        const_iterator last;
+        size_t firstIndex;
+    };
+    
+    /**
+     * Zero-copy view over the records of one event type
+     */
+    class TypeView {
+    public:
+        class const_iterator {
+        public:
+            const_iterator(const RecordStore* records, IndexStore::const_iterator position);
+            const Record& operator*() const;
+            const Record* operator->() const;
+            const_iterator& operator++();
+            bool operator==(const const_iterator& other) const;
+            bool operator!=(const const_iterator& other) const;
+            size_t getLogIndex() const;
+            
+        private:
+            const RecordStore* records;
+            IndexStore::const_iterator position;
+        };
+        
+        TypeView(const RecordStore* records, IndexStore::const_iterator first, IndexStore::const_iterator last);
+        
+        const_iterator begin() const;
+        const_iterator end() const;
+        size_t size() const;
+        bool empty() const;
+        const Record& operator[](size_t position) const;
+        size_t getLogIndex(size_t position) const;
+        
+    private:
+        const RecordStore* records;
+        IndexStore::const_iterator first;
+        IndexStore::const_iterator last;
+    };
+    
+    EventLog();
+    
+    // Shares this log's contents copy-on-write; the copy has no journal
+    EventLog(const EventLog& other);
+    EventLog& operator=(const EventLog&) = delete;
+    
+    // Typed appends; each returns the index of the new record
+    size_t logBolus(time_t timestamp, BolusEvent::BolusType bolusType, float units, int durationMinutes = 0);
+    size_t logBasalChange(time_t timestamp, float oldRate, float newRate, std::string_view reason);
+    size_t logProfileChange(time_t timestamp, std::string_view oldProfile, std::string_view newProfile,
+                            uint32_t version = 0);
+    size_t logSuspend(time_t timestamp, std::string_view reason);
+    size_t logResume(time_t timestamp, std::string_view reason);
+    size_t logCGMReading(time_t timestamp, float glucoseValue);
+    size_t logAlarm(time_t timestamp, AlarmEvent::AlarmType alarmType, std::string_view details);
+    size_t logError(time_t timestamp, std::string_view errorCode, std::string_view errorMessage);
+    
+    // Convert and append an Event object
+    size_t append(const Event& event);
+    
+    // Append a raw record whose text ids are replaced by the given texts
+    // (used when replaying a journal)
+    size_t appendRecord(const Record& record, std::string_view text, std::string_view secondText);
+    
+    // Mirror every append and cancellation to a journal (nullptr to detach)
+    void setJournal(JournalWriter* journal);
+    
+    // One record the owner holds on to by index (NPOS for none); a late
+    // record inserted before it moves the anchor along with the record
+    void setAnchor(size_t index);
+    size_t getAnchor() const;
+    
+    // Record access
+    size_t size() const;
+    bool empty() const;
+    const Record& getRecord(size_t index) const;
+    const Record& operator[](size_t index) const;
+    const std::string& getText(uint32_t id) const;
+    void setCancelled(size_t index, bool cancelled);
+    void reserve(size_t count);
+    void clear();
+    
+    // Time and type queries (inclusive bounds, O(log n))
+    RecordView getRange(time_t startTime, time_t endTime) const;
+    TypeView getByType(Event::EventType type) const;
+    TypeView getByType(Event::EventType type, time_t startTime, time_t endTime) const;
+    size_t countByType(Event::EventType type) const;
+    size_t findLast(Event::EventType type) const; // NPOS when there is none
+    size_t lowerBound(time_t startTime) const;
+    size_t upperBound(time_t endTime) const;
+    
+    // Lazily built views of a record
+    std::shared_ptr<Event> materialize(size_t index) const;
+    std::string getDescription(size_t index) const;
+    
+private:
+    RecordStore records;
+    IndexStore typeIndex[EVENT_TYPE_COUNT];
+    std::shared_ptr<StringPool> strings;    // Copied before adding a string while shared
+    JournalWriter* journal;
+    size_t anchor;
+    
+    uint32_t intern(std::string_view text);
+    size_t push(time_t timestamp, Event::EventType type, uint8_t subtype, float value, float newValue,
+                uint32_t text, uint32_t secondText, int32_t duration);
+    size_t insert(const Record& record);
+};
+
+#endif // EVENT_LOG_H
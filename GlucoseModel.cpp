@@ -0,0 +1,149 @@
+#include "GlucoseModel.h"
+#include <algorithm>
+
+namespace {
+    // Physiological bounds keep the explicit integration stable
+    const float MIN_GLUCOSE = 1.0f;
+    const float MAX_GLUCOSE = 40.0f;
+}
+
+GlucoseModel::GlucoseModel() {
+}
+
+size_t GlucoseModel::addPatient(const Parameters& parameters, float initialGlucose) {
+    float kI = 1.0f / std::max(1.0f, parameters.insulinPeakMinutes);
+    float kG = 1.0f / std::max(1.0f, parameters.carbPeakMinutes);
+    float scale = 1000.0f / parameters.insulinVolume;                  // mU/L per U
+    float basalPerMinute = parameters.basalInsulinNeed / 60.0f;
+    float basalPlasma = basalPerMinute * scale / parameters.insulinClearance;
+    float referenceGlucose = std::max(MIN_GLUCOSE, parameters.basalGlucose);
+    
+    // Choose the action gain so one unit lowers glucose by the sensitivity:
+    // integral of X = gain / decay * (1000 / (clearance * volume)) per unit
+    float gain = parameters.insulinSensitivity * parameters.insulinActionDecay *
+                 parameters.insulinClearance / (scale * referenceGlucose);
+    
+    glucose.push_back(std::min(MAX_GLUCOSE, std::max(MIN_GLUCOSE, initialGlucose)));
+    insulinAction.push_back(0.0f);
+    plasmaInsulin.push_back(basalPlasma);
+    subcutaneous1.push_back(basalPerMinute / kI);
+    subcutaneous2.push_back(basalPerMinute / kI);
+    gut1.push_back(0.0f);
+    gut2.push_back(0.0f);
+    
+    basalGlucose.push_back(parameters.basalGlucose);
+    glucoseEffectiveness.push_back(parameters.glucoseEffectiveness);
+    actionDecay.push_back(parameters.insulinActionDecay);
+    actionGain.push_back(gain);
+    basalInsulin.push_back(basalPlasma);
+    clearance.push_back(parameters.insulinClearance);
+    insulinRate.push_back(kI);
+    insulinScale.push_back(scale);
+    carbRate.push_back(kG);
+    carbScale.push_back(parameters.insulinSensitivity / std::max(1.0f, parameters.carbRatio));
+    
+    return glucose.size() - 1;
+}
+
+size_t GlucoseModel::size() const {
+    return glucose.size();
+}
+
+void GlucoseModel::reserve(size_t count) {
+    for (auto* values : { &glucose, &insulinAction, &plasmaInsulin, &subcutaneous1, &subcutaneous2, &gut1, &gut2,
+                          &basalGlucose, &glucoseEffectiveness, &actionDecay, &actionGain, &basalInsulin,
+                          &clearance, &insulinRate, &insulinScale, &carbRate, &carbScale }) {
+        values->reserve(count);
+    }
+}
+
+void GlucoseModel::addInsulin(size_t patient, float units) {
+    if (patient < size() && units > 0) {
+        subcutaneous1[patient] += units;
+    }
+}
+
+void GlucoseModel::addCarbs(size_t patient, float grams) {
+    if (patient < size() && grams > 0) {
+        gut1[patient] += grams;
+    }
+}
+
+void GlucoseModel::step(const float* insulinUnits) {
+    const size_t count = glucose.size();
+    if (!insulinUnits) {
+        zeroInsulin.resize(count, 0.0f);
+        insulinUnits = zeroInsulin.data();
+    }
+    
+    // Each pointer is a separate array, so the loop below carries no
+    // dependencies between patients and vectorizes across them
+    float* G = glucose.data();
+    float* X = insulinAction.data();
+    float* I = plasmaInsulin.data();
+    float* S1 = subcutaneous1.data();
+    float* S2 = subcutaneous2.data();
+    float* Q1 = gut1.data();
+    float* Q2 = gut2.data();
+    const float* dose = insulinUnits;
+    const float* Gb = basalGlucose.data();
+    const float* p1 = glucoseEffectiveness.data();
+    const float* p2 = actionDecay.data();
+    const float* p3 = actionGain.data();
+    const float* Ib = basalInsulin.data();
+    const float* n = clearance.data();
+    const float* kI = insulinRate.data();
+    const float* scale = insulinScale.data();
+    const float* kG = carbRate.data();
+    const float* carbEffect = carbScale.data();
+    
+    // One explicit Euler step of a minute; every derivative uses the old state
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#elif defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#endif
+    for (size_t i = 0; i < count; i++) {
+        float inflow = dose[i];
+        float insulinAppearance = kI[i] * S2[i];    // U/min
+        float carbAppearance = kG[i] * Q2[i];       // g/min
+        
+        float dS1 = std::max(0.0f, inflow) - kI[i] * S1[i];
+        float dS2 = kI[i] * (S1[i] - S2[i]);
+        float dI = insulinAppearance * scale[i] - n[i] * I[i];
+        float dX = p3[i] * (I[i] - Ib[i]) - p2[i] * X[i];
+        float dQ1 = -kG[i] * Q1[i];
+        float dQ2 = kG[i] * (Q1[i] - Q2[i]);
+        float dG = carbAppearance * carbEffect[i] - p1[i] * (G[i] - Gb[i]) - X[i] * G[i];
+        
+        S1[i] += dS1;
+        S2[i] += dS2;
+        I[i] += dI;
+        X[i] += dX;
+        Q1[i] += dQ1;
+        Q2[i] += dQ2;
+        G[i] = std::min(MAX_GLUCOSE, std::max(MIN_GLUCOSE, G[i] + dG));
+    }
+}
+
+void GlucoseModel::advance(time_t seconds) {
+    for (time_t elapsed = STEP_SECONDS; elapsed <= seconds; elapsed += STEP_SECONDS) {
+        step();
+    }
+}
+
+float GlucoseModel::getGlucose(size_t patient) const {
+    return patient < size() ? glucose[patient] : 0.0f;
+}
+
+const float* GlucoseModel::getGlucoseData() const {
+    return glucose.data();
+}
+
+float GlucoseModel::getPlasmaInsulin(size_t patient) const {
+    return patient < size() ? plasmaInsulin[patient] : 0.0f;
+}
+
+float GlucoseModel::getCarbsOnBoard(size_t patient) const {
+    return patient < size() ? gut1[patient] + gut2[patient] : 0.0f;
+}
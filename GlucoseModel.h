@@ -0,0 +1,81 @@
+#ifndef GLUCOSE_MODEL_H
+#define GLUCOSE_MODEL_H
+
+#include <cstddef>
+#include <ctime>
+#include <vector>
+
+/**
+ * Glucose-insulin-carbohydrate model for a batch of virtual patients.
+ * Plasma glucose follows the Bergman minimal model, fed by two-compartment
+ * subcutaneous insulin absorption and two-compartment gut absorption of
+ * carbohydrates. Patients are configured in clinical terms (sensitivity,
+ * carb ratio, basal need) from which the model coefficients are derived.
+ * State is stored structure-of-arrays so step() advances every patient in
+ * a single branch-free, vectorizable pass.
+ */
+class GlucoseModel {
+public:
+    static const int STEP_SECONDS = 60;
+    
+    struct Parameters {
+        float basalGlucose = 6.5f;          // Equilibrium when basal need is met (mmol/L)
+        float insulinSensitivity = 2.5f;    // Glucose drop per unit (mmol/L per U)
+        float carbRatio = 12.0f;            // Grams of carbohydrate one unit covers
+        float basalInsulinNeed = 0.8f;      // Basal rate that holds basalGlucose (U/hr)
+        float glucoseEffectiveness = 0.003f; // Insulin-independent return to basal (1/min)
+        float insulinActionDecay = 0.025f;  // Decay of remote insulin action (1/min)
+        float insulinClearance = 0.14f;     // Plasma insulin clearance (1/min)
+        float insulinVolume = 12.0f;        // Insulin distribution volume (L)
+        float insulinPeakMinutes = 55.0f;   // Subcutaneous absorption time constant
+        float carbPeakMinutes = 40.0f;      // Gut absorption time constant
+    };
+    
+    GlucoseModel();
+    
+    // Add a patient at basal steady state; returns its index
+    size_t addPatient(const Parameters& parameters, float initialGlucose);
+    size_t size() const;
+    void reserve(size_t count);
+    
+    // Inputs, applied at the next step
+    void addInsulin(size_t patient, float units);
+    void addCarbs(size_t patient, float grams);
+    
+    // Advance every patient one minute; insulinUnits (optional) holds each
+    // patient's insulin delivered during that minute
+    void step(const float* insulinUnits = nullptr);
+    void advance(time_t seconds);
+    
+    // Current state
+    float getGlucose(size_t patient) const;
+    const float* getGlucoseData() const;
+    float getPlasmaInsulin(size_t patient) const; // mU/L
+    float getCarbsOnBoard(size_t patient) const;  // Grams not yet absorbed
+    
+private:
+    // State
+    std::vector<float> glucose;         // mmol/L
+    std::vector<float> insulinAction;   // Remote insulin action X (1/min)
+    std::vector<float> plasmaInsulin;   // mU/L
+    std::vector<float> subcutaneous1;   // U
+    std::vector<float> subcutaneous2;   // U
+    std::vector<float> gut1;            // g
+    std::vector<float> gut2;            // g
+    
+    // Per-patient coefficients
+    std::vector<float> basalGlucose;
+    std::vector<float> glucoseEffectiveness;
+    std::vector<float> actionDecay;
+    std::vector<float> actionGain;
+    std::vector<float> basalInsulin;
+    std::vector<float> clearance;
+    std::vector<float> insulinRate;
+    std::vector<float> insulinScale;
+    std::vector<float> carbRate;
+    std::vector<float> carbScale;
+    
+    std::vector<float> zeroInsulin; // Input used when step() is given none
+};
+
+#endif // GLUCOSE_MODEL_H
@@ -0,0 +1,155 @@
+#include "GlucosePredictor.h"
+#include <algorithm>
+#include <cmath>
+
+const int GlucosePredictor::HORIZONS[GlucosePredictor::HORIZON_COUNT] = { 15, 30, 60 };
+
+namespace {
+    const double BAND_Z = 1.96; // Two-sided 95%
+    const double SENSOR_INTERVAL_MINUTES = 5.0;
+}
+
+GlucosePredictor::GlucosePredictor() :
+    GlucosePredictor(Parameters())
+{
+}
+
+GlucosePredictor::GlucosePredictor(const Parameters& parameters) :
+    parameters(parameters)
+{
+    readingStep = makeTransition(SENSOR_INTERVAL_MINUTES);
+    for (int i = 0; i < HORIZON_COUNT; i++) {
+        horizonSteps[i] = makeTransition(HORIZONS[i]);
+    }
+    reset();
+}
+
+void GlucosePredictor::update(float value, time_t timestamp) {
+    if (value <= 0.0f || (updateCount > 0 && timestamp <= lastTimestamp)) {
+        return;
+    }
+    
+    double minutes = static_cast<double>(timestamp - lastTimestamp) / 60.0;
+    if (updateCount == 0 || minutes > parameters.maxGapMinutes) {
+        // Start from the reading with an unknown trend
+        level = value;
+        rate = 0.0;
+        p00 = parameters.measurementNoise;
+        p01 = 0.0;
+        p11 = parameters.initialRateVariance;
+        lastTimestamp = timestamp;
+        updateCount++;
+        return;
+    }
+    
+    // Predict to the reading's time (the sensor interval is precomputed)
+    const Transition step = std::fabs(minutes - readingStep.minutes) < 1e-9 ? readingStep : makeTransition(minutes);
+    double predictedLevel = level + step.gain * rate;
+    double predictedRate = step.decay * rate;
+    double c00 = p00 + 2.0 * step.gain * p01 + step.gain * step.gain * p11 + step.q00;
+    double c01 = step.decay * (p01 + step.gain * p11) + step.q01;
+    double c11 = step.decay * step.decay * p11 + step.q11;
+    
+    // Correct with the reading
+    double innovation = value - predictedLevel;
+    double s = c00 + parameters.measurementNoise;
+    double k0 = c00 / s;
+    double k1 = c01 / s;
+    level = predictedLevel + k0 * innovation;
+    rate = predictedRate + k1 * innovation;
+    p00 = (1.0 - k0) * c00;
+    p01 = (1.0 - k0) * c01;
+    p11 = c11 - k1 * c01;
+    
+    lastTimestamp = timestamp;
+    updateCount++;
+}
+
+void GlucosePredictor::reset() {
+    level = 0.0;
+    rate = 0.0;
+    p00 = 0.0;
+    p01 = 0.0;
+    p11 = 0.0;
+    lastTimestamp = 0;
+    updateCount = 0;
+}
+
+bool GlucosePredictor::isInitialized() const {
+    return updateCount > 0;
+}
+
+size_t GlucosePredictor::getUpdateCount() const {
+    return updateCount;
+}
+
+time_t GlucosePredictor::getLastTimestamp() const {
+    return lastTimestamp;
+}
+
+const GlucosePredictor::Parameters& GlucosePredictor::getParameters() const {
+    return parameters;
+}
+
+float GlucosePredictor::getLevel() const {
+    return static_cast<float>(level);
+}
+
+float GlucosePredictor::getRate() const {
+    return static_cast<float>(rate);
+}
+
+GlucosePredictor::Prediction GlucosePredictor::predict(int minutesAhead) const {
+    for (int i = 0; i < HORIZON_COUNT; i++) {
+        if (HORIZONS[i] == minutesAhead) {
+            return forecast(horizonSteps[i]);
+        }
+    }
+    return forecast(makeTransition(minutesAhead > 0 ? minutesAhead : 0));
+}
+
+void GlucosePredictor::predictHorizons(Prediction predictions[HORIZON_COUNT]) const {
+    for (int i = 0; i < HORIZON_COUNT; i++) {
+        predictions[i] = forecast(horizonSteps[i]);
+    }
+}
+
+GlucosePredictor::Transition GlucosePredictor::makeTransition(double minutes) const {
+    Transition step;
+    step.minutes = minutes;
+    
+    double tau = parameters.trendDecayMinutes;
+    if (tau > 0.0) {
+        step.decay = std::exp(-minutes / tau);
+        step.gain = tau * (1.0 - step.decay);
+    } else {
+        step.decay = 1.0;
+        step.gain = minutes;
+    }
+    
+    // White-noise rate disturbance integrated over the interval (the
+    // undamped form, which slightly overstates uncertainty when damped)
+    double q = parameters.processNoise;
+    step.q00 = q * minutes * minutes * minutes / 3.0;
+    step.q01 = q * minutes * minutes / 2.0;
+    step.q11 = q * minutes;
+    return step;
+}
+
+GlucosePredictor::Prediction GlucosePredictor::forecast(const Transition& step) const {
+    if (updateCount == 0) {
+        return Prediction{0.0f, 0.0f, 0.0f, 0.0f};
+    }
+    
+    double value = level + step.gain * rate;
+    double variance = p00 + 2.0 * step.gain * p01 + step.gain * step.gain * p11 + step.q00
+        + parameters.measurementNoise;
+    double deviation = std::sqrt(variance > 0.0 ? variance : 0.0);
+    
+    Prediction prediction;
+    prediction.value = static_cast<float>(value > 0.0 ? value : 0.0);
+    prediction.lower = static_cast<float>(std::max(0.0, value - BAND_Z * deviation));
+    prediction.upper = static_cast<float>(value + BAND_Z * deviation);
+    prediction.standardDeviation = static_cast<float>(deviation);
+    return prediction;
+}
@@ -0,0 +1,79 @@
+#ifndef GLUCOSE_PREDICTOR_H
+#define GLUCOSE_PREDICTOR_H
+
+#include <cstddef>
+#include <ctime>
+
+/**
+ * Incremental glucose predictor.
+ * A two-state Kalman filter tracks glucose level and rate of change; the
+ * rate follows a first-order autoregressive process, so trends are damped
+ * rather than extrapolated in a straight line. Each reading is an O(1)
+ * update with no allocation, and predictions at any horizon come with a
+ * confidence band for the future sensor reading.
+ */
+class GlucosePredictor {
+public:
+    struct Parameters {
+        float measurementNoise = 0.04f;     // Sensor noise variance (mmol/L)^2
+        float processNoise = 0.00004f;      // Rate disturbance spectral density (mmol/L)^2 per min^3
+        float trendDecayMinutes = 45.0f;    // Time constant of the rate's return to zero (0 = none)
+        float initialRateVariance = 0.01f;  // Rate uncertainty after the first reading (mmol/L/min)^2
+        float maxGapMinutes = 30.0f;        // Longer gaps restart the filter
+    };
+    
+    struct Prediction {
+        float value;            // Expected glucose (mmol/L)
+        float lower;            // 95% band
+        float upper;
+        float standardDeviation;
+    };
+    
+    // Standard horizons (minutes), precomputed
+    static const int HORIZON_COUNT = 3;
+    static const int HORIZONS[HORIZON_COUNT];
+    
+    GlucosePredictor();
+    explicit GlucosePredictor(const Parameters& parameters);
+    
+    // Readings must arrive in time order; earlier or invalid ones are ignored
+    void update(float value, time_t timestamp);
+    void reset();
+    
+    bool isInitialized() const;
+    size_t getUpdateCount() const;
+    time_t getLastTimestamp() const;
+    const Parameters& getParameters() const;
+    
+    // Filtered state
+    float getLevel() const;             // mmol/L
+    float getRate() const;              // mmol/L per minute
+    
+    // Forecast from the last reading (value 0 before the first reading)
+    Prediction predict(int minutesAhead) const;
+    void predictHorizons(Prediction predictions[HORIZON_COUNT]) const;
+    
+private:
+    // State transition and process noise over an interval
+    struct Transition {
+        double minutes;
+        double decay;           // Rate carried over
+        double gain;            // Level change per unit of current rate
+        double q00, q01, q11;   // Process noise covariance
+    };
+    
+    Parameters parameters;
+    Transition readingStep;     // Cached for the usual sensor interval
+    Transition horizonSteps[HORIZON_COUNT];
+    
+    double level;
+    double rate;
+    double p00, p01, p11;       // State covariance
+    time_t lastTimestamp;
+    size_t updateCount;
+    
+    Transition makeTransition(double minutes) const;
+    Prediction forecast(const Transition& step) const;
+};
+
+#endif // GLUCOSE_PREDICTOR_H
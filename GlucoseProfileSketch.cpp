@@ -0,0 +1,182 @@
+#include "GlucoseProfileSketch.h"
+#include "Clock.h"
+#include <algorithm>
+#include <cmath>
+
+const float GlucoseProfileSketch::PERCENTILES[GlucoseProfileSketch::PERCENTILE_COUNT] = {
+    5.0f, 25.0f, 50.0f, 75.0f, 95.0f
+};
+
+namespace {
+    const double MG_DL_PER_MMOL_L = 18.016;
+}
+
+GlucoseProfileSketch::GlucoseProfileSketch(int binMinutes) :
+    binMinutes(binMinutes > 0 && binMinutes <= 1440 && 1440 % binMinutes == 0 ? binMinutes : 15),
+    binCount(1440 / this->binMinutes),
+    counts(static_cast<size_t>(binCount) * VALUE_BUCKETS, 0),
+    cachedHourStart(0),
+    cachedHourMinute(-1)
+{
+    clear();
+}
+
+void GlucoseProfileSketch::add(float value, int minuteOfDay) {
+    if (!(value > 0.0f)) {
+        return; // Invalid reading
+    }
+    
+    int minute = ((minuteOfDay % 1440) + 1440) % 1440;
+    counts[static_cast<size_t>(minute / binMinutes) * VALUE_BUCKETS + bucketOf(value)]++;
+    total++;
+    sum += value;
+    sumSquares += static_cast<double>(value) * value;
+    bandCounts[bandOf(value)]++;
+}
+
+void GlucoseProfileSketch::add(float value, time_t timestamp) {
+    if (cachedHourMinute < 0 || timestamp < cachedHourStart || timestamp >= cachedHourStart + 3600) {
+        struct tm timeinfo = Clock::toLocalTime(timestamp);
+        cachedHourStart = timestamp - timeinfo.tm_min * 60 - timeinfo.tm_sec;
+        cachedHourMinute = timeinfo.tm_hour * 60;
+    }
+    add(value, cachedHourMinute + static_cast<int>((timestamp - cachedHourStart) / 60));
+}
+
+bool GlucoseProfileSketch::merge(const GlucoseProfileSketch& other) {
+    if (other.binMinutes != binMinutes) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < counts.size(); i++) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    sumSquares += other.sumSquares;
+    for (int band = 0; band < BAND_COUNT; band++) {
+        bandCounts[band] += other.bandCounts[band];
+    }
+    return true;
+}
+
+void GlucoseProfileSketch::clear() {
+    std::fill(counts.begin(), counts.end(), 0u);
+    total = 0;
+    sum = 0.0;
+    sumSquares = 0.0;
+    std::fill(bandCounts, bandCounts + BAND_COUNT, 0u);
+}
+
+int GlucoseProfileSketch::getBinMinutes() const {
+    return binMinutes;
+}
+
+int GlucoseProfileSketch::getBinCount() const {
+    return binCount;
+}
+
+uint64_t GlucoseProfileSketch::getCount() const {
+    return total;
+}
+
+uint32_t GlucoseProfileSketch::getBinCount(int bin) const {
+    if (bin < 0 || bin >= binCount) {
+        return 0;
+    }
+    const uint32_t* histogram = &counts[static_cast<size_t>(bin) * VALUE_BUCKETS];
+    uint32_t count = 0;
+    for (int bucket = 0; bucket < VALUE_BUCKETS; bucket++) {
+        count += histogram[bucket];
+    }
+    return count;
+}
+
+float GlucoseProfileSketch::getPercentile(int bin, float percentile) const {
+    if (bin < 0 || bin >= binCount) {
+        return 0.0f;
+    }
+    float value;
+    percentilesOf(&counts[static_cast<size_t>(bin) * VALUE_BUCKETS], getBinCount(bin), &percentile, 1, &value);
+    return value;
+}
+
+float GlucoseProfileSketch::getPercentile(float percentile) const {
+    std::vector<uint32_t> histogram(VALUE_BUCKETS, 0);
+    for (int bin = 0; bin < binCount; bin++) {
+        const uint32_t* binHistogram = &counts[static_cast<size_t>(bin) * VALUE_BUCKETS];
+        for (int bucket = 0; bucket < VALUE_BUCKETS; bucket++) {
+            histogram[bucket] += binHistogram[bucket];
+        }
+    }
+    float value;
+    percentilesOf(histogram.data(), total, &percentile, 1, &value);
+    return value;
+}
+
+GlucoseProfileSketch::Report GlucoseProfileSketch::getReport() const {
+    Report report;
+    report.bins.resize(binCount);
+    report.count = total;
+    
+    for (int bin = 0; bin < binCount; bin++) {
+        const uint32_t* histogram = &counts[static_cast<size_t>(bin) * VALUE_BUCKETS];
+        BinSummary& summary = report.bins[bin];
+        summary.minuteOfDay = bin * binMinutes;
+        summary.count = 0;
+        for (int bucket = 0; bucket < VALUE_BUCKETS; bucket++) {
+            summary.count += histogram[bucket];
+        }
+        percentilesOf(histogram, summary.count, PERCENTILES, PERCENTILE_COUNT, summary.percentiles);
+    }
+    
+    double mean = total > 0 ? sum / total : 0.0;
+    double variance = total > 1 ? (sumSquares - sum * mean) / (total - 1) : 0.0;
+    report.mean = static_cast<float>(mean);
+    report.standardDeviation = static_cast<float>(std::sqrt(std::max(0.0, variance)));
+    report.coefficientOfVariation = mean > 0.0 ? static_cast<float>(100.0 * report.standardDeviation / mean) : 0.0f;
+    
+    // GMI (%) = 3.31 + 0.02392 x mean glucose in mg/dL
+    report.glucoseManagementIndicator = total > 0 ? static_cast<float>(3.31 + 0.02392 * mean * MG_DL_PER_MMOL_L) : 0.0f;
+    
+    for (int band = 0; band < BAND_COUNT; band++) {
+        report.bandPercent[band] = total > 0 ? static_cast<float>(100.0 * bandCounts[band] / total) : 0.0f;
+    }
+    return report;
+}
+
+int GlucoseProfileSketch::bucketOf(float value) {
+    int bucket = static_cast<int>(std::lround(value / VALUE_STEP));
+    return std::min(VALUE_BUCKETS - 1, std::max(0, bucket));
+}
+
+GlucoseProfileSketch::Band GlucoseProfileSketch::bandOf(float value) {
+    // Matches CGMData::getTimeInRange: the target range is inclusive
+    if (value < 3.0f) return VERY_LOW;
+    if (value < 3.9f) return LOW;
+    if (value <= 10.0f) return IN_RANGE;
+    if (value <= 13.9f) return HIGH;
+    return VERY_HIGH;
+}
+
+void GlucoseProfileSketch::percentilesOf(const uint32_t* histogram, uint64_t count, const float* percentiles,
+                                         int percentileCount, float* values) {
+    if (count == 0) {
+        std::fill(values, values + percentileCount, 0.0f);
+        return;
+    }
+    
+    // Walk the cumulative counts once; readings in a bucket are taken as
+    // evenly spread across its width
+    int bucket = 0;
+    uint64_t before = 0;
+    for (int i = 0; i < percentileCount; i++) {
+        double rank = std::min(100.0f, std::max(0.0f, percentiles[i])) / 100.0 * (count - 1);
+        while (bucket < VALUE_BUCKETS - 1 && before + histogram[bucket] <= rank) {
+            before += histogram[bucket];
+            bucket++;
+        }
+        double within = histogram[bucket] > 0 ? (rank - before + 0.5) / histogram[bucket] : 0.5;
+        values[i] = static_cast<float>((bucket - 0.5 + within) * VALUE_STEP);
+    }
+}
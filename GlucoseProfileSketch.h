@@ -0,0 +1,95 @@
+#ifndef GLUCOSE_PROFILE_SKETCH_H
+#define GLUCOSE_PROFILE_SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+/**
+ * Streaming sketch behind Ambulatory Glucose Profile reports.
+ * Each time-of-day bin holds a histogram of readings at the sensor's
+ * 0.1 mmol/L resolution, so percentiles are within half a step of exact
+ * while updates are O(1) and sketches from different patients or threads
+ * merge by adding counts. Mean, variance and the consensus time-in-range
+ * bands are tracked exactly alongside.
+ */
+class GlucoseProfileSketch {
+public:
+    // Consensus glucose bands (mmol/L): <3.0, 3.0-3.9, 3.9-10.0, 10.0-13.9, >13.9
+    enum Band {
+        VERY_LOW,
+        LOW,
+        IN_RANGE,
+        HIGH,
+        VERY_HIGH,
+        BAND_COUNT
+    };
+    
+    static const int PERCENTILE_COUNT = 5;
+    static const float PERCENTILES[PERCENTILE_COUNT]; // 5, 25, 50, 75, 95
+    
+    static constexpr float VALUE_STEP = 0.1f;   // mmol/L per histogram bucket
+    static const int VALUE_BUCKETS = 401;       // 0.0 to 40.0 mmol/L
+    
+    // AGP percentiles for one time-of-day bin
+    struct BinSummary {
+        int minuteOfDay;    // Start of the bin
+        uint32_t count;
+        float percentiles[PERCENTILE_COUNT];
+    };
+    
+    struct Report {
+        std::vector<BinSummary> bins;
+        uint64_t count;
+        float mean;                     // mmol/L
+        float standardDeviation;
+        float coefficientOfVariation;   // %
+        float glucoseManagementIndicator; // GMI, %
+        float bandPercent[BAND_COUNT];
+    };
+    
+    // binMinutes must divide the day (e.g. 5 or 15)
+    explicit GlucoseProfileSketch(int binMinutes = 15);
+    
+    // Add a reading at a local minute of day, or at a timestamp
+    void add(float value, int minuteOfDay);
+    void add(float value, time_t timestamp);
+    
+    // Combine another sketch into this one; fails if the bin sizes differ
+    bool merge(const GlucoseProfileSketch& other);
+    void clear();
+    
+    int getBinMinutes() const;
+    int getBinCount() const;
+    uint64_t getCount() const;
+    uint32_t getBinCount(int bin) const;
+    
+    // Percentile (0-100) of one bin, or of every reading
+    float getPercentile(int bin, float percentile) const;
+    float getPercentile(float percentile) const;
+    
+    // Everything an AGP report needs, in one pass over the histograms
+    Report getReport() const;
+    
+private:
+    int binMinutes;
+    int binCount;
+    std::vector<uint32_t> counts;   // counts[bin * VALUE_BUCKETS + bucket]
+    uint64_t total;
+    double sum;
+    double sumSquares;
+    uint64_t bandCounts[BAND_COUNT];
+    
+    // Local hour cached so timestamps need one localtime call per hour
+    time_t cachedHourStart;
+    int cachedHourMinute;
+    
+    static int bucketOf(float value);
+    static Band bandOf(float value);
+    // Percentiles must be ascending
+    static void percentilesOf(const uint32_t* histogram, uint64_t count, const float* percentiles,
+                              int percentileCount, float* values);
+};
+
+#endif // GLUCOSE_PROFILE_SKETCH_H
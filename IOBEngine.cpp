@@ -0,0 +1,135 @@
+#include "IOBEngine.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+namespace {
+    // x such that e^(-x) * (1 + x) = 0.01, i.e. 1% of a dose left at the duration
+    const float DURATION_IN_TIME_CONSTANTS = 6.638352f;
+    
+    std::mutex curveCacheMutex;
+    std::map<int, std::shared_ptr<const InsulinActionCurve>> curveCache;
+}
+
+InsulinActionCurve::InsulinActionCurve(float durationHours) :
+    durationHours(durationHours > 0 ? durationHours : 5.0f)
+{
+    float durationMinutes = this->durationHours * 60.0f;
+    timeConstant = durationMinutes / DURATION_IN_TIME_CONSTANTS;
+    
+    getTransition(TICK_SECONDS, tickDecay, tickTransfer);
+}
+
+std::shared_ptr<const InsulinActionCurve> InsulinActionCurve::forDuration(float durationHours) {
+    int key = static_cast<int>(std::lround(durationHours * 60.0f));
+    
+    std::lock_guard<std::mutex> lock(curveCacheMutex);
+    auto it = curveCache.find(key);
+    if (it != curveCache.end()) {
+        return it->second;
+    }
+    
+    auto curve = std::make_shared<const InsulinActionCurve>(key / 60.0f);
+    curveCache[key] = curve;
+    return curve;
+}
+
+float InsulinActionCurve::getDuration() const {
+    return durationHours;
+}
+
+float InsulinActionCurve::getTimeConstant() const {
+    return timeConstant;
+}
+
+float InsulinActionCurve::getRemainingFraction(float minutes) const {
+    if (minutes <= 0) {
+        return 1.0f;
+    }
+    float x = minutes / timeConstant;
+    return std::exp(-x) * (1.0f + x);
+}
+
+float InsulinActionCurve::getTickDecay() const {
+    return tickDecay;
+}
+
+float InsulinActionCurve::getTickTransfer() const {
+    return tickTransfer;
+}
+
+void InsulinActionCurve::getTransition(time_t seconds, float& decay, float& transfer) const {
+    // Exact solution of the two compartments over the interval:
+    // depot' = depot * decay, plasma' = plasma * decay + depot * transfer
+    float x = static_cast<float>(seconds) / 60.0f / timeConstant;
+    decay = std::exp(-x);
+    transfer = x * decay;
+}
+
+IOBEngine::IOBEngine(float durationHours) :
+    curve(InsulinActionCurve::forDuration(durationHours)),
+    depot(0.0f),
+    plasma(0.0f)
+{
+}
+
+void IOBEngine::setInsulinDuration(float durationHours) {
+    if (durationHours > 0 && std::fabs(durationHours - curve->getDuration()) > 0.001f) {
+        curve = InsulinActionCurve::forDuration(durationHours);
+    }
+}
+
+float IOBEngine::getInsulinDuration() const {
+    return curve->getDuration();
+}
+
+void IOBEngine::addDose(float units) {
+    depot += units;
+}
+
+void IOBEngine::advance(time_t seconds) {
+    if (seconds <= 0) {
+        return;
+    }
+    
+    float decay, transfer;
+    if (seconds == InsulinActionCurve::TICK_SECONDS) {
+        decay = curve->getTickDecay();
+        transfer = curve->getTickTransfer();
+    } else {
+        curve->getTransition(seconds, decay, transfer);
+    }
+    
+    plasma = plasma * decay + depot * transfer;
+    depot = depot * decay;
+    
+    // Flush denormal-sized residue once a dose is effectively gone
+    if (std::fabs(depot) + std::fabs(plasma) < 1e-4f) {
+        depot = 0.0f;
+        plasma = 0.0f;
+    }
+}
+
+float IOBEngine::getInsulinOnBoard() const {
+    return depot + plasma;
+}
+
+float IOBEngine::getActivity() const {
+    return plasma / curve->getTimeConstant();
+}
+
+void IOBEngine::reset() {
+    depot = 0.0f;
+    plasma = 0.0f;
+}
+
+void IOBEngine::getCompartments(float& depot, float& plasma) const {
+    depot = this->depot;
+    plasma = this->plasma;
+}
+
+void IOBEngine::setCompartments(float depot, float plasma) {
+    this->depot = depot;
+    this->plasma = plasma;
+}
@@ -0,0 +1,78 @@
+#ifndef IOB_ENGINE_H
+#define IOB_ENGINE_H
+
+#include <ctime>
+#include <memory>
+
+/**
+ * Insulin action curve for a given insulin duration.
+ * Uses a two-compartment (biexponential) model whose remaining fraction
+ * after t minutes is e^(-t/tau) * (1 + t/tau), with tau chosen so that 1%
+ * remains at the end of the insulin duration. Insulin on board comes from
+ * the closed-form update of the two compartments, so no sampled kernel is
+ * kept; curves are built once per duration and shared between pumps.
+ */
+class InsulinActionCurve {
+public:
+    static const int TICK_SECONDS = 60;
+    
+    explicit InsulinActionCurve(float durationHours);
+    
+    // Shared curve for a duration (built once, then cached)
+    static std::shared_ptr<const InsulinActionCurve> forDuration(float durationHours);
+    
+    float getDuration() const;
+    float getTimeConstant() const; // Minutes
+    
+    // Fraction of a dose still on board the given minutes after it was given
+    float getRemainingFraction(float minutes) const;
+    
+    // Compartment decay over one tick, and over an arbitrary interval
+    float getTickDecay() const;
+    float getTickTransfer() const;
+    void getTransition(time_t seconds, float& decay, float& transfer) const;
+    
+private:
+    float durationHours;
+    float timeConstant;
+    float tickDecay;
+    float tickTransfer;
+};
+
+/**
+ * Incremental insulin-on-board tracker.
+ * Doses (boluses, extended bolus pulses and basal deviations from the
+ * scheduled rate) enter a depot compartment and move through a second
+ * compartment before acting, so each tick is O(1) regardless of how many
+ * doses were given.
+ */
+class IOBEngine {
+public:
+    explicit IOBEngine(float durationHours = 5.0f);
+    
+    // Switch curves when the active profile's insulin duration changes
+    void setInsulinDuration(float durationHours);
+    float getInsulinDuration() const;
+    
+    // Add insulin (negative for basal delivered below the scheduled rate)
+    void addDose(float units);
+    
+    // Move the model forward in time
+    void advance(time_t seconds);
+    
+    // Net insulin on board (units) and current activity (units per minute)
+    float getInsulinOnBoard() const;
+    float getActivity() const;
+    void reset();
+    
+    // Raw compartment contents, for checkpointing and restoring
+    void getCompartments(float& depot, float& plasma) const;
+    void setCompartments(float depot, float plasma);
+    
+private:
+    std::shared_ptr<const InsulinActionCurve> curve;
+    float depot;
+    float plasma;
+};
+
+#endif // IOB_ENGINE_H
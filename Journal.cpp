@@ -0,0 +1,533 @@
+#include "Journal.h"
+#include "EventLog.h"
+#include "Profile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    static_assert(sizeof(Journal::RecordHeader) == 12, "Journal record header layout changed");
+    static_assert(sizeof(Journal::EventPayload) == 32, "Journal event layout changed");
+    static_assert(sizeof(Journal::StatePayload) == 64, "Journal state layout changed");
+    static_assert(sizeof(Journal::TempBasalPayload) == 16, "Journal temp basal layout changed");
+    
+    const size_t MAX_TEXT_LENGTH = 0xffff;
+    
+    // CRC-32C (Castagnoli), slicing-by-8 tables
+    struct CrcTables {
+        uint32_t table[8][256];
+        
+        CrcTables() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78u : 0u);
+                }
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int slice = 1; slice < 8; slice++) {
+                    table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+                }
+            }
+        }
+    };
+    
+    const CrcTables crcTables;
+    
+    uint32_t updateCrc(uint32_t crc, const unsigned char* bytes, size_t length) {
+        const auto& t = crcTables.table;
+        while (length >= 8) {
+            uint32_t low, high;
+            std::memcpy(&low, bytes, 4);
+            std::memcpy(&high, bytes + 4, 4);
+            low ^= crc;
+            crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+                  t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+            bytes += 8;
+            length -= 8;
+        }
+        while (length-- > 0) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *bytes++) & 0xff];
+        }
+        return crc;
+    }
+    
+    // Bounds-checked cursor over a record payload
+    class PayloadCursor {
+    public:
+        PayloadCursor(const char* data, size_t length) :
+            data(data),
+            remaining(length)
+        {
+        }
+        
+        template <typename T>
+        bool read(T& value) {
+            if (remaining < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&value, data, sizeof(T));
+            data += sizeof(T);
+            remaining -= sizeof(T);
+            return true;
+        }
+        
+        bool readText(size_t length, std::string_view& text) {
+            if (remaining < length) {
+                return false;
+            }
+            text = std::string_view(data, length);
+            data += length;
+            remaining -= length;
+            return true;
+        }
+        
+    private:
+        const char* data;
+        size_t remaining;
+    };
+}
+
+uint32_t Journal::checksum(uint8_t type, const void* data, size_t length) {
+    uint32_t crc = updateCrc(0xffffffffu, &type, 1);
+    crc = updateCrc(crc, static_cast<const unsigned char*>(data), length);
+    return ~crc;
+}
+
+JournalWriter::JournalWriter(size_t bufferSize) :
+    fd(-1),
+    bufferSize(bufferSize > 0 ? bufferSize : DEFAULT_BUFFER_SIZE),
+    recordStart(0),
+    fileSize(0),
+    eventCount(0)
+{
+    buffer.reserve(this->bufferSize + 4096);
+}
+
+JournalWriter::~JournalWriter() {
+    close();
+}
+
+bool JournalWriter::open(const std::string& path) {
+    close();
+    
+    // Find the end of the last complete record in an existing journal
+    size_t validLength = 0;
+    size_t existingEvents = 0;
+    struct stat info;
+    if (::stat(path.c_str(), &info) == 0 && info.st_size > 0) {
+        JournalReader reader;
+        if (!reader.open(path)) {
+            return false; // Not a journal; leave it untouched
+        }
+        JournalReader::Entry entry;
+        while (reader.next(entry)) {
+            if (entry.type == Journal::EVENT) {
+                existingEvents++;
+            }
+        }
+        validLength = reader.getValidLength();
+    }
+    
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    
+    // Drop a torn tail so new records follow the last good one
+    if (::ftruncate(fd, static_cast<off_t>(validLength)) != 0 ||
+        ::lseek(fd, static_cast<off_t>(validLength), SEEK_SET) < 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    
+    fileSize = validLength;
+    eventCount = existingEvents;
+    buffer.clear();
+    
+    if (validLength == 0) {
+        Journal::FileHeader header = { Journal::MAGIC, Journal::VERSION };
+        put(&header, sizeof(header));
+        return flush();
+    }
+    return true;
+}
+
+void JournalWriter::close() {
+    if (fd < 0) {
+        return;
+    }
+    flush();
+    ::close(fd);
+    fd = -1;
+}
+
+bool JournalWriter::isOpen() const {
+    return fd >= 0;
+}
+
+void JournalWriter::appendEvent(const EventLog& log, size_t index) {
+    if (fd < 0 || index >= log.size()) {
+        return;
+    }
+    
+    const EventLog::Record& record = log.getRecord(index);
+    const std::string& text = log.getText(record.text);
+    const std::string& secondText = log.getText(record.secondText);
+    
+    Journal::EventPayload event = {};
+    event.timestamp = static_cast<int64_t>(record.timestamp);
+    event.value = record.value;
+    event.newValue = record.newValue;
+    event.duration = record.duration;
+    event.textLength = static_cast<uint16_t>(std::min(text.size(), MAX_TEXT_LENGTH));
+    event.secondTextLength = static_cast<uint16_t>(std::min(secondText.size(), MAX_TEXT_LENGTH));
+    event.type = record.type;
+    event.subtype = record.subtype;
+    event.flags = record.flags;
+    
+    beginRecord(Journal::EVENT);
+    put(&event, sizeof(event));
+    put(text.data(), event.textLength);
+    put(secondText.data(), event.secondTextLength);
+    endRecord();
+    eventCount++;
+}
+
+void JournalWriter::appendCancelled(size_t index, bool cancelled) {
+    if (fd < 0) {
+        return;
+    }
+    
+    Journal::CancelledPayload payload = {};
+    payload.index = index;
+    payload.cancelled = cancelled ? 1 : 0;
+    
+    beginRecord(Journal::CANCELLED);
+    put(&payload, sizeof(payload));
+    endRecord();
+}
+
+void JournalWriter::appendProfile(const Profile& profile) {
+    if (fd < 0) {
+        return;
+    }
+    
+    std::string name = profile.getName();
+    uint16_t nameLength = static_cast<uint16_t>(std::min(name.size(), MAX_TEXT_LENGTH));
+    float duration = profile.getInsulinDuration();
+    
+    beginRecord(Journal::PROFILE);
+    put(&nameLength, sizeof(nameLength));
+    put(name.data(), nameLength);
+    put(&duration, sizeof(duration));
+    
+    const std::map<int, float> schedules[] = {
+        profile.getAllBasalRates(),
+        profile.getAllCarbRatios(),
+        profile.getAllCorrectionFactors(),
+        profile.getAllTargetGlucoses()
+    };
+    for (const auto& schedule : schedules) {
+        uint16_t count = static_cast<uint16_t>(schedule.size());
+        put(&count, sizeof(count));
+        for (const auto& entry : schedule) {
+            uint16_t minute = static_cast<uint16_t>(entry.first);
+            put(&minute, sizeof(minute));
+            put(&entry.second, sizeof(entry.second));
+        }
+    }
+    uint32_t version = profile.getVersion();
+    put(&version, sizeof(version));
+    endRecord();
+}
+
+void JournalWriter::appendProfileDeleted(std::string_view name) {
+    if (fd < 0) {
+        return;
+    }
+    
+    beginRecord(Journal::PROFILE_DELETED);
+    put(name.data(), std::min(name.size(), MAX_TEXT_LENGTH));
+    endRecord();
+}
+
+void JournalWriter::appendState(const Journal::StatePayload& state, std::string_view activeProfile,
+                                const Journal::TempBasalPayload& tempBasal) {
+    if (fd < 0) {
+        return;
+    }
+    
+    Journal::StatePayload payload = state;
+    payload.activeProfileLength = static_cast<uint16_t>(std::min(activeProfile.size(), MAX_TEXT_LENGTH));
+    
+    beginRecord(Journal::STATE);
+    put(&payload, sizeof(payload));
+    put(activeProfile.data(), payload.activeProfileLength);
+    put(&tempBasal, sizeof(tempBasal));
+    endRecord();
+}
+
+bool JournalWriter::flush() {
+    if (fd < 0) {
+        return false;
+    }
+    
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t result = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + written);
+            fileSize += written;
+            return false;
+        }
+        written += static_cast<size_t>(result);
+    }
+    
+    fileSize += written;
+    buffer.clear();
+    return true;
+}
+
+bool JournalWriter::sync() {
+    return flush() && ::fsync(fd) == 0;
+}
+
+size_t JournalWriter::getEventCount() const {
+    return eventCount;
+}
+
+size_t JournalWriter::getSize() const {
+    return fileSize + buffer.size();
+}
+
+void JournalWriter::beginRecord(Journal::RecordType type) {
+    recordStart = buffer.size();
+    Journal::RecordHeader header = {};
+    header.type = type;
+    put(&header, sizeof(header));
+}
+
+void JournalWriter::put(const void* data, size_t length) {
+    const char* bytes = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + length);
+}
+
+void JournalWriter::endRecord() {
+    // Fill in the length and checksum now that the payload is complete
+    Journal::RecordHeader header;
+    std::memcpy(&header, buffer.data() + recordStart, sizeof(header));
+    
+    const char* payload = buffer.data() + recordStart + sizeof(header);
+    header.length = static_cast<uint32_t>(buffer.size() - recordStart - sizeof(header));
+    header.checksum = Journal::checksum(header.type, payload, header.length);
+    std::memcpy(buffer.data() + recordStart, &header, sizeof(header));
+    
+    // Only whole records reach the file
+    if (buffer.size() >= bufferSize) {
+        flush();
+    }
+}
+
+JournalReader::JournalReader() :
+    data(nullptr),
+    size(0),
+    offset(0),
+    truncated(false)
+{
+}
+
+JournalReader::~JournalReader() {
+    close();
+}
+
+bool JournalReader::open(const std::string& path) {
+    close();
+    
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    
+    size_t fileSize = static_cast<size_t>(info.st_size);
+    if (fileSize < sizeof(Journal::FileHeader)) {
+        // Empty, or the header itself was torn: nothing to replay
+        ::close(fd);
+        truncated = fileSize > 0;
+        return true;
+    }
+    
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE; // Replay touches every page; fault them in up front
+#endif
+    void* mapping = ::mmap(nullptr, fileSize, PROT_READ, flags, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    ::madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    
+    Journal::FileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    if (header.magic != Journal::MAGIC || header.version != Journal::VERSION) {
+        ::munmap(mapping, fileSize);
+        return false;
+    }
+    
+    data = static_cast<const char*>(mapping);
+    size = fileSize;
+    offset = sizeof(Journal::FileHeader);
+    return true;
+}
+
+void JournalReader::close() {
+    if (data) {
+        ::munmap(const_cast<char*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    offset = 0;
+    truncated = false;
+}
+
+bool JournalReader::isOpen() const {
+    return data != nullptr;
+}
+
+bool JournalReader::next(Entry& entry) {
+    if (!data || truncated) {
+        return false;
+    }
+    
+    if (size - offset < sizeof(Journal::RecordHeader)) {
+        truncated = offset < size;
+        return false;
+    }
+    
+    Journal::RecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    const char* payload = data + offset + sizeof(header);
+    
+    if (header.length > size - offset - sizeof(header) ||
+        header.checksum != Journal::checksum(header.type, payload, header.length)) {
+        truncated = true;
+        return false;
+    }
+    
+    entry.type = static_cast<Journal::RecordType>(header.type);
+    entry.payload = payload;
+    entry.length = header.length;
+    offset += sizeof(header) + header.length;
+    return true;
+}
+
+void JournalReader::rewind() {
+    if (data) {
+        offset = sizeof(Journal::FileHeader);
+        truncated = false;
+    }
+}
+
+size_t JournalReader::getValidLength() const {
+    return offset;
+}
+
+bool JournalReader::isTruncated() const {
+    return truncated;
+}
+
+size_t JournalReader::getFileSize() const {
+    return size;
+}
+
+bool JournalReader::decodeEvent(const Entry& entry, Journal::EventPayload& event,
+                                std::string_view& text, std::string_view& secondText) {
+    PayloadCursor cursor(entry.payload, entry.length);
+    return entry.type == Journal::EVENT &&
+           cursor.read(event) &&
+           cursor.readText(event.textLength, text) &&
+           cursor.readText(event.secondTextLength, secondText);
+}
+
+bool JournalReader::decodeCancelled(const Entry& entry, Journal::CancelledPayload& cancelled) {
+    PayloadCursor cursor(entry.payload, entry.length);
+    return entry.type == Journal::CANCELLED && cursor.read(cancelled);
+}
+
+bool JournalReader::decodeState(const Entry& entry, Journal::StatePayload& state, std::string_view& activeProfile,
+                                Journal::TempBasalPayload& tempBasal) {
+    PayloadCursor cursor(entry.payload, entry.length);
+    if (entry.type != Journal::STATE || !cursor.read(state) ||
+        !cursor.readText(state.activeProfileLength, activeProfile)) {
+        return false;
+    }
+    
+    tempBasal = {};
+    cursor.read(tempBasal);
+    return true;
+}
+
+bool JournalReader::decodeProfileDeleted(const Entry& entry, std::string_view& name) {
+    if (entry.type != Journal::PROFILE_DELETED) {
+        return false;
+    }
+    name = std::string_view(entry.payload, entry.length);
+    return true;
+}
+
+std::shared_ptr<Profile> JournalReader::decodeProfile(const Entry& entry) {
+    PayloadCursor cursor(entry.payload, entry.length);
+    uint16_t nameLength;
+    std::string_view name;
+    float duration;
+    if (entry.type != Journal::PROFILE || !cursor.read(nameLength) ||
+        !cursor.readText(nameLength, name) || !cursor.read(duration)) {
+        return nullptr;
+    }
+    
+    auto profile = std::make_shared<Profile>(std::string(name));
+    profile->setInsulinDuration(duration);
+    
+    void (Profile::*adders[])(int, int, float) = {
+        &Profile::addBasalRate,
+        &Profile::addCarbRatio,
+        &Profile::addCorrectionFactor,
+        &Profile::addTargetGlucose
+    };
+    for (auto add : adders) {
+        uint16_t count;
+        if (!cursor.read(count)) {
+            return nullptr;
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            uint16_t minute;
+            float value;
+            if (!cursor.read(minute) || !cursor.read(value)) {
+                return nullptr;
+            }
+            (profile.get()->*add)(minute / 60, minute % 60, value);
+        }
+    }
+    
+    uint32_t version = 0;
+    cursor.read(version);
+    profile->setVersion(version);
+    return profile;
+}
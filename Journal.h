@@ -0,0 +1,205 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class EventLog;
+class Profile;
+
+/**
+ * On-disk layout of the pump journal.
+ * A journal is a file header followed by length-prefixed records, each
+ * protected by a CRC-32C over its type and payload. Records are only ever
+ * appended, so a crash can at worst leave a torn record at the tail, which
+ * readers stop at and writers truncate away. Multi-byte fields are stored in
+ * host byte order.
+ */
+namespace Journal {
+    static const uint32_t MAGIC = 0x4a4c5354; // "TSLJ"
+    static const uint32_t VERSION = 1;
+    
+    enum RecordType : uint8_t {
+        EVENT = 1,          // One EventLog record with its texts inline
+        CANCELLED,          // Cancelled flag change of an earlier event
+        PROFILE,            // Full copy of a profile's schedules
+        PROFILE_DELETED,    // Profile removed; the payload is its name
+        STATE               // Pump state checkpoint
+    };
+    
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+    };
+    
+    struct RecordHeader {
+        uint32_t length;    // Payload bytes following the header
+        uint32_t checksum;  // CRC-32C of the type byte and the payload
+        uint8_t type;
+        uint8_t reserved[3];
+    };
+    
+    // EVENT payload, followed by textLength + secondTextLength bytes of text
+    struct EventPayload {
+        int64_t timestamp;
+        float value;
+        float newValue;
+        int32_t duration;
+        uint16_t textLength;
+        uint16_t secondTextLength;
+        uint8_t type;
+        uint8_t subtype;
+        uint8_t flags;
+        uint8_t reserved[5];
+    };
+    
+    struct CancelledPayload {
+        uint64_t index;
+        uint8_t cancelled;
+        uint8_t reserved[7];
+    };
+    
+    // STATE payload, followed by activeProfileLength bytes of profile name
+    // and then a TempBasalPayload (absent in older journals)
+    struct StatePayload {
+        int64_t timestamp;
+        int64_t lastBolusTime;
+        uint64_t activeBolusIndex;
+        float batteryLevel;
+        float insulinLevel;
+        float insulinDepot;
+        float insulinPlasma;
+        float currentGlucose;
+        float lastBolusAmount;
+        float extendedBolusRemaining;
+        float extendedBolusRate;
+        uint8_t state;
+        uint8_t error;
+        uint8_t cgmConnected;
+        uint8_t controlIQEnabled;
+        uint16_t activeProfileLength;
+        uint8_t reserved[2];
+    };
+    
+    struct TempBasalPayload {
+        int64_t endTime;    // 0 when no temp basal is running
+        float percent;
+        uint8_t reserved[4];
+    };
+    
+    // PROFILE payload: name length (uint16) and name, insulin duration (float),
+    // then for each of the four schedules an entry count (uint16) followed by
+    // that many (minute uint16, value float) pairs, then the snapshot version
+    // (uint32; absent in older journals)
+    
+    uint32_t checksum(uint8_t type, const void* data, size_t length);
+}
+
+/**
+ * Buffered, append-only journal writer.
+ * Records accumulate in memory and reach the file in large writes once the
+ * buffer fills, on flush() or on destruction; sync() also forces them to
+ * stable storage.
+ */
+class JournalWriter {
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+    
+    explicit JournalWriter(size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    ~JournalWriter();
+    
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+    
+    // Open or create a journal; a torn or corrupt tail is truncated to the
+    // last complete record before appending resumes
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    
+    // Record appends
+    void appendEvent(const EventLog& log, size_t index);
+    void appendCancelled(size_t index, bool cancelled);
+    void appendProfile(const Profile& profile);
+    void appendProfileDeleted(std::string_view name);
+    void appendState(const Journal::StatePayload& state, std::string_view activeProfile,
+                     const Journal::TempBasalPayload& tempBasal);
+    
+    // Push buffered records to the file (and to disk)
+    bool flush();
+    bool sync();
+    
+    // Events in the journal (existing and appended) and its size in bytes
+    size_t getEventCount() const;
+    size_t getSize() const;
+    
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t bufferSize;
+    size_t recordStart;
+    size_t fileSize;
+    size_t eventCount;
+    
+    void beginRecord(Journal::RecordType type);
+    void put(const void* data, size_t length);
+    void endRecord();
+};
+
+/**
+ * Memory-mapped journal reader.
+ * Walks the records in place; payloads point into the mapping, so reading
+ * a journal performs no per-record allocation.
+ */
+class JournalReader {
+public:
+    struct Entry {
+        Journal::RecordType type;
+        const char* payload;
+        uint32_t length;
+    };
+    
+    JournalReader();
+    ~JournalReader();
+    
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+    
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    
+    // Next intact record; false at the end of the journal or at the first
+    // torn/corrupt record
+    bool next(Entry& entry);
+    void rewind();
+    
+    // Bytes covered by intact records so far, and whether reading stopped
+    // before the end of the file
+    size_t getValidLength() const;
+    bool isTruncated() const;
+    size_t getFileSize() const;
+    
+    // Payload decoders (false when the payload is malformed); text views
+    // point into the mapping
+    static bool decodeEvent(const Entry& entry, Journal::EventPayload& event,
+                            std::string_view& text, std::string_view& secondText);
+    static bool decodeCancelled(const Entry& entry, Journal::CancelledPayload& cancelled);
+    static bool decodeState(const Entry& entry, Journal::StatePayload& state, std::string_view& activeProfile,
+                            Journal::TempBasalPayload& tempBasal); // No temp basal when absent
+    static bool decodeProfileDeleted(const Entry& entry, std::string_view& name);
+    static std::shared_ptr<Profile> decodeProfile(const Entry& entry); // nullptr when malformed
+    
+private:
+    const char* data;
+    size_t size;
+    size_t offset;
+    bool truncated;
+};
+
+#endif // JOURNAL_H
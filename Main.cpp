@@ -1,15 +1,410 @@
 #include "TSlimX2Pump.h"
 #include "UserInterface.h"
+#include "CohortSimulation.h"
+#include "BolusMonteCarlo.h"
+#include "Journal.h"
+#include "TraceReader.h"
+#include "ScenarioRunner.h"
+#include "TherapyOptimizer.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include "TimelineRecorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <vector>
 
-int main() {
+// Headless cohort run: --cohort <patients> [--days <days>] [--threads <threads>] [--seed <seed>] [--control-iq]
+// [--metrics <file>] [--timeline <file>]
+static int runCohort(int argc, char* argv[]) {
+    size_t patientCount = 100;
+    int days = 14;
+    unsigned threads = 0;
+    unsigned seed = 42;
+    bool controlIQ = false;
+    const char* metricsPath = nullptr;
+    const char* timelinePath = nullptr;
+    
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--control-iq") == 0) {
+            controlIQ = true;
+        } else if (i + 1 >= argc) {
+            break;
+        } else if (std::strcmp(argv[i], "--cohort") == 0) {
+            patientCount = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--days") == 0) {
+            days = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--metrics") == 0) {
+            metricsPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--timeline") == 0) {
+            timelinePath = argv[++i];
+        }
+    }
+    
+    CohortSimulation cohort(threads);
+    cohort.generatePatients(patientCount, seed, days, controlIQ);
+    std::shared_ptr<TimelineRecorder> timeline;
+    if (timelinePath) {
+        timeline = std::make_shared<TimelineRecorder>();
+        if (!timeline->open(timelinePath)) {
+            std::cerr << "Unable to open " << timelinePath << std::endl;
+            return 1;
+        }
+        cohort.setTimeline(timeline);
+    }
+    CohortSimulation::Result result = cohort.run();
+    
+    double timeInRange = 0.0, timeBelow = 0.0, insulin = 0.0;
+    long alarms = 0, corrections = 0;
+    for (const auto& patient : result.patients) {
+        timeInRange += patient.timeInRange;
+        timeBelow += patient.timeBelowRange;
+        insulin += patient.totalInsulin;
+        alarms += patient.alarmCount;
+        corrections += patient.autoCorrectionCount;
+    }
+    double count = result.patients.empty() ? 1.0 : static_cast<double>(result.patients.size());
+    
+    std::cout << "Patients:              " << result.patients.size() << " x " << days << " days" << std::endl;
+    std::cout << "Threads:               " << result.threadCount << std::endl;
+    std::cout << "Mean time in range:    " << timeInRange / count << " %" << std::endl;
+    std::cout << "Mean time below range: " << timeBelow / count << " %" << std::endl;
+    std::cout << "Mean insulin per day:  " << insulin / count / (days > 0 ? days : 1) << " U" << std::endl;
+    std::cout << "Total alarms:          " << alarms << std::endl;
+    if (controlIQ) {
+        std::cout << "Auto corrections:      " << corrections << std::endl;
+    }
+    
+    // Ambulatory Glucose Profile across the whole cohort
+    GlucoseProfileSketch::Report agp = result.profile.getReport();
+    std::cout << "GMI:                   " << agp.glucoseManagementIndicator << " %" << std::endl;
+    std::cout << "CV:                    " << agp.coefficientOfVariation << " %" << std::endl;
+    std::cout << "Time in bands (%):     <3.0 " << agp.bandPercent[GlucoseProfileSketch::VERY_LOW]
+              << ", 3.0-3.9 " << agp.bandPercent[GlucoseProfileSketch::LOW]
+              << ", 3.9-10 " << agp.bandPercent[GlucoseProfileSketch::IN_RANGE]
+              << ", 10-13.9 " << agp.bandPercent[GlucoseProfileSketch::HIGH]
+              << ", >13.9 " << agp.bandPercent[GlucoseProfileSketch::VERY_HIGH] << std::endl;
+    std::cout << "AGP (5/25/50/75/95th percentiles, mmol/L):" << std::endl;
+    for (size_t bin = 0; bin < agp.bins.size(); bin += agp.bins.size() / 8) {
+        const GlucoseProfileSketch::BinSummary& summary = agp.bins[bin];
+        std::cout << "  " << std::setw(2) << std::setfill('0') << summary.minuteOfDay / 60 << ":"
+                  << std::setw(2) << summary.minuteOfDay % 60 << std::setfill(' ') << std::fixed << std::setprecision(1);
+        for (int i = 0; i < GlucoseProfileSketch::PERCENTILE_COUNT; i++) {
+            std::cout << " " << std::setw(5) << summary.percentiles[i];
+        }
+        std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+    
+    std::cout << "Elapsed:               " << result.elapsedSeconds << " s" << std::endl;
+    std::cout << "Patients per second:   " << result.patientsPerSecond << std::endl;
+    
+    if (metricsPath && !Metrics::dump(metricsPath)) {
+        std::cerr << "Unable to write " << metricsPath << std::endl;
+        return 1;
+    }
+    if (timeline && !timeline->close()) {
+        std::cerr << "Unable to write " << timelinePath << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Headless trace replay: --trace <file> [--pumps <count>] [--broadcast]
+static int runTrace(int argc, char* argv[]) {
+    size_t pumpCount = 1;
+    TraceReader::FeedMode mode = TraceReader::ROUTE_BY_STREAM;
+    for (int i = 3; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pumps") == 0 && i + 1 < argc) {
+            pumpCount = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--broadcast") == 0) {
+            mode = TraceReader::BROADCAST;
+        }
+    }
+    
+    TraceReader reader;
+    if (!reader.open(argv[2])) {
+        std::cerr << "Unable to open trace " << argv[2] << std::endl;
+        return 1;
+    }
+    
+    // First pass: parse only, and find where the pumps' clocks should start
+    auto start = std::chrono::steady_clock::now();
+    TraceReader::Reading reading;
+    size_t parsed = 0;
+    time_t firstTime = 0;
+    while (reader.next(reading)) {
+        if (parsed++ == 0) {
+            firstTime = reading.timestamp;
+        }
+    }
+    double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t malformed = reader.getMalformedCount();
+    
+    std::vector<std::unique_ptr<TSlimX2Pump>> pumps;
+    std::vector<TSlimX2Pump*> targets;
+    for (size_t i = 0; i < pumpCount; i++) {
+        auto clock = std::make_shared<VirtualClock>(firstTime);
+        pumps.push_back(std::make_unique<TSlimX2Pump>(clock));
+        pumps.back()->attachCGMData(std::make_shared<CGMData>(clock));
+        pumps.back()->powerOn();
+        pumps.back()->refillInsulin(300.0f);
+        pumps.back()->connectCGM();
+        pumps.back()->startBasal();
+        targets.push_back(pumps.back().get());
+    }
+    
+    reader.rewind();
+    TraceReader::FeedResult result = reader.feed(targets, mode);
+    
+    std::cout << "Format:                " << (reader.getFormat() == TraceReader::BINARY ? "binary" : "CSV") << std::endl;
+    std::cout << "Readings parsed:       " << parsed << " (" << malformed << " malformed lines)" << std::endl;
+    std::cout << "Parse throughput:      " << (parseSeconds > 0 ? parsed / parseSeconds : 0.0) << " readings/s" << std::endl;
+    std::cout << "Readings delivered:    " << result.readings << " to " << pumpCount << " pump(s)" << std::endl;
+    std::cout << "Readings skipped:      " << result.skipped << std::endl;
+    std::cout << "Ingest throughput:     " << result.readingsPerSecond << " readings/s" << std::endl;
+    
+    return 0;
+}
+
+// Headless scripted scenarios: --scenario <file> [<file>...] [--threads <threads>] [--output <file>]
+// [--metrics <file>] [--timeline <file>]
+// Results are JSON lines on stdout (or the output file); the summary goes to stderr
+static int runScenarios(int argc, char* argv[]) {
+    unsigned threads = 0;
+    const char* outputPath = nullptr;
+    const char* metricsPath = nullptr;
+    const char* timelinePath = nullptr;
+    std::vector<const char*> paths;
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+            timelinePath = argv[++i];
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    
+    ScenarioRunner runner(threads);
+    for (const char* path : paths) {
+        if (!runner.load(path)) {
+            std::cerr << runner.getError() << std::endl;
+            return 1;
+        }
+    }
+    
+    std::ofstream outputFile;
+    if (outputPath) {
+        outputFile.open(outputPath);
+        if (!outputFile) {
+            std::cerr << "Unable to open " << outputPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = outputPath ? outputFile : std::cout;
+    
+    std::shared_ptr<TimelineRecorder> timeline;
+    if (timelinePath) {
+        timeline = std::make_shared<TimelineRecorder>();
+        if (!timeline->open(timelinePath)) {
+            std::cerr << "Unable to open " << timelinePath << std::endl;
+            return 1;
+        }
+        runner.setTimeline(timeline);
+    }
+    
+    ScenarioRunner::Summary summary = runner.run();
+    for (const auto& result : summary.results) {
+        ScenarioRunner::writeJson(output, result);
+    }
+    output.flush();
+    
+    std::cerr << "Scenarios:             " << summary.results.size() << std::endl;
+    std::cerr << "Threads:               " << summary.threadCount << std::endl;
+    std::cerr << "Elapsed:               " << summary.elapsedSeconds << " s" << std::endl;
+    std::cerr << "Scenario-days per s:   " << summary.scenarioDaysPerSecond << std::endl;
+    
+    if (metricsPath && !Metrics::dump(metricsPath)) {
+        std::cerr << "Unable to write " << metricsPath << std::endl;
+        return 1;
+    }
+    if (timeline && !timeline->close()) {
+        std::cerr << "Unable to write " << timelinePath << std::endl;
+        return 1;
+    }
+    return output ? 0 : 1;
+}
+
+// Profile tuning for the first patient a cohort run with the same seed would generate:
+// --optimize [--segments <count>] [--days <days>] [--replicates <count>] [--generations <count>]
+// [--threads <threads>] [--seed <seed>] [--control-iq]
+static int runOptimizer(int argc, char* argv[]) {
+    int segmentCount = 4;
+    int days = 7;
+    unsigned threads = 0;
+    unsigned seed = 42;
+    bool controlIQ = false;
+    TherapyOptimizer::Options options;
+    
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--control-iq") == 0) {
+            controlIQ = true;
+        } else if (i + 1 >= argc) {
+            break;
+        } else if (std::strcmp(argv[i], "--segments") == 0) {
+            segmentCount = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--days") == 0) {
+            days = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--replicates") == 0) {
+            options.replicates = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--generations") == 0) {
+            options.maxGenerations = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+    }
+    
+    CohortSimulation cohort(1);
+    cohort.generatePatients(1, seed, days, controlIQ);
+    const CohortSimulation::PatientConfig& patient = cohort.getPatient(0);
+    
+    // Start from the patient's current flat profile, split into segments
+    auto current = TherapyOptimizer::makeProfile(
+        "Default", { { 0, patient.basalRate, patient.carbRatio, patient.correctionFactor } }, patient.targetGlucose);
+    
+    TherapyOptimizer optimizer(threads);
+    optimizer.setPatient(patient);
+    optimizer.setOptions(options);
+    TherapyOptimizer::Result result = optimizer.optimize(TherapyOptimizer::getSegments(*current, segmentCount));
+    
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Patient:               basal need " << patient.trueBasalNeed << " U/hr, carb ratio "
+              << patient.trueCarbRatio << " g/U, sensitivity " << patient.trueSensitivity << " mmol/L per U" << std::endl;
+    std::cout << "Replicates:            " << options.replicates << " x " << days << " days" << std::endl;
+    std::cout << "Threads:               " << result.threadCount << std::endl;
+    std::cout << "                       score    TIR %   TBR %   mean   U/day" << std::endl;
+    for (const TherapyOptimizer::Evaluation* evaluation : { &result.initial, &result.best }) {
+        std::cout << (evaluation == &result.initial ? "Initial:             " : "Best:                ")
+                  << std::setw(8) << evaluation->score << std::setw(8) << evaluation->timeInRange
+                  << std::setw(8) << evaluation->timeBelowRange << std::setw(8) << evaluation->averageGlucose
+                  << std::setw(8) << evaluation->dailyInsulin << std::endl;
+    }
+    std::cout << "Best settings (start, basal U/hr, carb ratio g/U, correction mmol/L per U):" << std::endl;
+    for (const auto& segment : result.best.segments) {
+        std::cout << "  " << std::setw(2) << std::setfill('0') << segment.startMinute / 60 << ":" << std::setw(2)
+                  << segment.startMinute % 60 << std::setfill(' ') << std::setw(8) << segment.basalRate
+                  << std::setw(8) << segment.carbRatio << std::setw(8) << segment.correctionFactor << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+    std::cout << "Generations:           " << result.generations << std::endl;
+    std::cout << "Evaluations:           " << result.evaluations << " (" << result.prunedCount << " pruned, "
+              << result.cacheHits << " cache hits)" << std::endl;
+    std::cout << "Elapsed:               " << result.elapsedSeconds << " s" << std::endl;
+    std::cout << "Evaluations per second: " << result.evaluationsPerSecond << std::endl;
+    std::cout << "Simulated days per s:  " << result.simulatedDaysPerSecond << std::endl;
+    return 0;
+}
+
+// Bolus calculator safety analysis: --monte-carlo [--draws <draws>] [--threads <threads>] [--seed <seed>]
+static int runMonteCarlo(int argc, char* argv[]) {
+    uint64_t draws = 1000000;
+    unsigned threads = 0;
+    uint64_t seed = 42;
+    
+    for (int i = 2; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--draws") == 0) {
+            draws = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+    }
+    
+    BolusMonteCarlo monteCarlo(threads);
+    for (const auto& scenario : BolusMonteCarlo::getStandardScenarios(draws, seed)) {
+        monteCarlo.addScenario(scenario);
+    }
+    std::vector<BolusMonteCarlo::Result> results = monteCarlo.run();
+    
+    std::cout << "Draws per scenario:    " << draws << std::endl;
+    std::cout << "Threads:               " << monteCarlo.getThreadCount() << std::endl;
+    std::cout << "Bolus (U) and outcome glucose (mmol/L) percentiles 1/5/50/95/99; outcomes below 3.9 and 3.0"
+              << " and above 10.0 mmol/L (%)" << std::endl;
+    const int shown[] = { 0, 1, 3, 5, 6 };
+    double elapsed = 0.0;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const auto& result : results) {
+        std::cout << "  " << std::left << std::setw(24) << result.name << std::right << " bolus";
+        for (int i : shown) {
+            std::cout << std::setw(7) << result.bolus.percentiles[i];
+        }
+        std::cout << "   glucose";
+        for (int i : shown) {
+            std::cout << std::setw(7) << result.outcomeGlucose.percentiles[i];
+        }
+        std::cout << std::setw(8) << 100.0 * result.low << std::setw(8) << 100.0 * result.severeLow
+                  << std::setw(8) << 100.0 * result.high << std::endl;
+        elapsed += result.elapsedSeconds;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+    std::cout << "Elapsed:               " << elapsed << " s" << std::endl;
+    std::cout << "Draws per second:      " << (elapsed > 0 ? draws * results.size() / elapsed : 0.0) << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Scenario results go to stdout, so this mode runs before the banner
+    if (argc > 2 && std::strcmp(argv[1], "--scenario") == 0) {
+        return runScenarios(argc, argv);
+    }
+    
     std::cout << "t:slim X2 Insulin Pump Simulator" << std::endl;
     std::cout << "================================" << std::endl;
     
+    if (argc > 1 && std::strcmp(argv[1], "--cohort") == 0) {
+        return runCohort(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--optimize") == 0) {
+        return runOptimizer(argc, argv);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--monte-carlo") == 0) {
+        return runMonteCarlo(argc, argv);
+    }
+    if (argc > 2 && std::strcmp(argv[1], "--trace") == 0) {
+        return runTrace(argc, argv);
+    }
+    
     // Initialize the pump with default settings
     auto pump = std::make_shared<TSlimX2Pump>();
     
+    // Persist history across runs: --journal <file>
+    if (argc > 2 && std::strcmp(argv[1], "--journal") == 0) {
+        pump->restoreFromJournal(argv[2]); // A missing journal starts a new one
+        
+        auto journal = std::make_shared<JournalWriter>();
+        if (!journal->open(argv[2]) || !pump->attachJournal(journal)) {
+            std::cerr << "Unable to open journal " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    
     // Initialize the user interface with a reference to the pump
     UserInterface ui(pump);
     
@@ -0,0 +1,359 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace {
+    // Log-linear buckets: values below 2 * SUB_BUCKETS get a bucket each,
+    // then every power of two is split into SUB_BUCKETS equal buckets
+    const int SUB_BUCKET_BITS = 4;
+    const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    const int MAX_EXPONENT = 47;        // Longer samples land in the last bucket
+    const size_t BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+    
+    const char* const OPERATION_NAMES[Metrics::OPERATION_COUNT] = {
+        "deliver_bolus",
+        "cancel_bolus",
+        "calculate_suggested_bolus",
+        "basal_command",
+        "profile_command",
+        "update_cgm",
+        "control_iq",
+        "run_until",
+        "get_history",
+        "get_history_view",
+        "fork",
+        "journal_checkpoint",
+        "journal_restore",
+        "log_event",
+        "cgm_statistics",
+        "cgm_prediction"
+    };
+    
+    size_t bucketIndex(uint64_t ticks) {
+        if (ticks < 2 * SUB_BUCKETS) {
+            return static_cast<size_t>(ticks);
+        }
+        int exponent = std::min(63 - __builtin_clzll(ticks), MAX_EXPONENT);
+        int shift = exponent - SUB_BUCKET_BITS;
+        uint64_t mantissa = std::min(ticks >> shift, 2 * SUB_BUCKETS - 1);
+        return static_cast<size_t>(shift * SUB_BUCKETS + mantissa);
+    }
+    
+    // First tick past the bucket
+    uint64_t bucketEnd(size_t index) {
+        if (index < 2 * SUB_BUCKETS) {
+            return index + 1;
+        }
+        int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+        uint64_t mantissa = index % SUB_BUCKETS + SUB_BUCKETS;
+        return (mantissa + 1) << shift;
+    }
+    
+    /**
+     * One thread's samples. Only the owning thread writes, so updates are
+     * relaxed loads and stores rather than read-modify-write operations;
+     * the atomics only make concurrent snapshots well defined.
+     */
+    struct Counters {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalTicks;
+        std::atomic<uint64_t> minTicks;
+        std::atomic<uint64_t> maxTicks;
+        std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    };
+    
+    struct ThreadBlock {
+        Metrics::ThreadCalls calls;
+        Counters operations[Metrics::OPERATION_COUNT];
+        
+        ThreadBlock() {
+            clear();
+        }
+        
+        void clear() {
+            for (auto& counter : calls.calls) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+            for (auto& counters : operations) {
+                counters.count.store(0, std::memory_order_relaxed);
+                counters.totalTicks.store(0, std::memory_order_relaxed);
+                counters.minTicks.store(UINT64_MAX, std::memory_order_relaxed);
+                counters.maxTicks.store(0, std::memory_order_relaxed);
+                for (auto& bucket : counters.buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+        
+        // Adds another block's samples; the caller serializes writers
+        void add(const ThreadBlock& other) {
+            for (int op = 0; op < Metrics::OPERATION_COUNT; op++) {
+                accumulate(calls.calls[op], other.calls.calls[op].load(std::memory_order_relaxed));
+                Counters& to = operations[op];
+                const Counters& from = other.operations[op];
+                accumulate(to.count, from.count.load(std::memory_order_relaxed));
+                accumulate(to.totalTicks, from.totalTicks.load(std::memory_order_relaxed));
+                to.minTicks.store(std::min(to.minTicks.load(std::memory_order_relaxed),
+                                           from.minTicks.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+                to.maxTicks.store(std::max(to.maxTicks.load(std::memory_order_relaxed),
+                                           from.maxTicks.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+                for (size_t b = 0; b < BUCKET_COUNT; b++) {
+                    accumulate(to.buckets[b], from.buckets[b].load(std::memory_order_relaxed));
+                }
+            }
+        }
+        
+        static void accumulate(std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
+    
+    struct Registry {
+        std::mutex mutex;
+        std::vector<ThreadBlock*> threads;
+        ThreadBlock retired;        // Samples of threads that have exited
+        uint64_t startTicks;
+        std::chrono::steady_clock::time_point startTime;
+        
+        Registry() :
+            startTicks(Metrics::now()),
+            startTime(std::chrono::steady_clock::now())
+        {
+        }
+    };
+    
+    // Never destroyed, so threads exiting during shutdown can still retire
+    Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+    
+    /**
+     * Owns the current thread's block: registers it on first use and folds
+     * it into the retired totals when the thread exits
+     */
+    class ThreadSlot {
+    public:
+        ThreadSlot() :
+            block(new ThreadBlock())
+        {
+            Registry& shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.threads.push_back(block);
+        }
+        
+        ~ThreadSlot() {
+            Registry& shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.retired.add(*block);
+            shared.threads.erase(std::find(shared.threads.begin(), shared.threads.end(), block));
+            delete block;
+        }
+        
+        ThreadBlock* const block;
+    };
+    
+    // Plain pointer for the timed path; the slot is only touched once per thread
+    thread_local ThreadBlock* currentBlock = nullptr;
+    
+    // Nanoseconds per tick, measured against the steady clock since start-up
+    double tickDuration(const Registry& shared) {
+#if defined(__x86_64__) || defined(__i386__)
+        // A short interval makes a poor measurement; wait for a usable one
+        std::chrono::steady_clock::time_point end;
+        uint64_t ticks;
+        do {
+            end = std::chrono::steady_clock::now();
+            ticks = Metrics::now();
+        } while (end - shared.startTime < std::chrono::milliseconds(10));
+        
+        double nanoseconds = std::chrono::duration<double, std::nano>(end - shared.startTime).count();
+        return nanoseconds / static_cast<double>(ticks - shared.startTicks);
+#else
+        (void)shared;
+        return 1.0;
+#endif
+    }
+    
+    uint64_t toNanoseconds(uint64_t ticks, double duration) {
+        return static_cast<uint64_t>(static_cast<double>(ticks) * duration + 0.5);
+    }
+}
+
+double Metrics::Histogram::getMean() const {
+    return count > 0 ? static_cast<double>(totalNanoseconds) / static_cast<double>(count) : 0.0;
+}
+
+uint64_t Metrics::Histogram::getPercentile(double percentile) const {
+    if (count == 0) {
+        return 0;
+    }
+    
+    // Report the bucket holding the requested rank, capped by the extremes
+    double rank = std::max(1.0, std::min(percentile, 100.0) / 100.0 * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (const auto& bucket : buckets) {
+        seen += bucket.second;
+        if (static_cast<double>(seen) >= rank) {
+            return std::max(minNanoseconds, std::min(bucket.first, maxNanoseconds));
+        }
+    }
+    return maxNanoseconds;
+}
+
+const char* Metrics::getName(Operation operation) {
+    return operation < OPERATION_COUNT ? OPERATION_NAMES[operation] : "unknown";
+}
+
+Metrics::ThreadCalls* Metrics::registerThread() {
+    thread_local ThreadSlot slot;
+    currentBlock = slot.block;
+    threadCalls = &slot.block->calls;
+    return threadCalls;
+}
+
+void Metrics::record(Operation operation, uint64_t ticks) {
+    ThreadBlock* block = currentBlock;
+    if (!block) {
+        registerThread();
+        block = currentBlock;
+    }
+    
+    Counters& counters = block->operations[operation];
+    ThreadBlock::accumulate(counters.count, 1);
+    ThreadBlock::accumulate(counters.totalTicks, ticks);
+    if (ticks < counters.minTicks.load(std::memory_order_relaxed)) {
+        counters.minTicks.store(ticks, std::memory_order_relaxed);
+    }
+    if (ticks > counters.maxTicks.load(std::memory_order_relaxed)) {
+        counters.maxTicks.store(ticks, std::memory_order_relaxed);
+    }
+    ThreadBlock::accumulate(counters.buckets[bucketIndex(ticks)], 1);
+}
+
+Metrics::Snapshot Metrics::snapshot() {
+    Registry& shared = registry();
+    std::unique_ptr<ThreadBlock> total(new ThreadBlock());
+    Snapshot result;
+    {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        total->add(shared.retired);
+        for (const ThreadBlock* block : shared.threads) {
+            total->add(*block);
+        }
+        result.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - shared.startTime).count();
+    }
+
+#ifdef PUMP_ENABLE_METRICS
+    result.enabled = true;
+#else
+    result.enabled = false;
+#endif
+    
+    double duration = tickDuration(shared);
+    for (int op = 0; op < OPERATION_COUNT; op++) {
+        const Counters& counters = total->operations[op];
+        Histogram& histogram = result.operations[op];
+        histogram.calls = total->calls.calls[op].load(std::memory_order_relaxed);
+        histogram.count = counters.count.load(std::memory_order_relaxed);
+        histogram.totalNanoseconds = toNanoseconds(counters.totalTicks.load(std::memory_order_relaxed), duration);
+        histogram.minNanoseconds = histogram.count > 0 ?
+            toNanoseconds(counters.minTicks.load(std::memory_order_relaxed), duration) : 0;
+        histogram.maxNanoseconds = toNanoseconds(counters.maxTicks.load(std::memory_order_relaxed), duration);
+        for (size_t b = 0; b < BUCKET_COUNT; b++) {
+            uint64_t count = counters.buckets[b].load(std::memory_order_relaxed);
+            if (count > 0) {
+                histogram.buckets.emplace_back(toNanoseconds(bucketEnd(b), duration), count);
+            }
+        }
+    }
+    return result;
+}
+
+void Metrics::reset() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    shared.retired.clear();
+    for (ThreadBlock* block : shared.threads) {
+        block->clear();
+    }
+    
+    // Restart the clock; the tick duration is measured over this interval
+    shared.startTicks = now();
+    shared.startTime = std::chrono::steady_clock::now();
+}
+
+void Metrics::writePrometheus(std::ostream& out, const Snapshot& snapshot) {
+    out << "# HELP pump_operation_calls_total Calls of pump operations.\n"
+        << "# TYPE pump_operation_calls_total counter\n";
+    for (int op = 0; op < OPERATION_COUNT; op++) {
+        out << "pump_operation_calls_total{operation=\"" << OPERATION_NAMES[op] << "\"} "
+            << snapshot.operations[op].calls << "\n";
+    }
+    
+    out << "# HELP pump_operation_duration_seconds Latency of sampled pump operation calls.\n"
+        << "# TYPE pump_operation_duration_seconds histogram\n";
+    for (int op = 0; op < OPERATION_COUNT; op++) {
+        const Histogram& histogram = snapshot.operations[op];
+        std::string label = std::string("{operation=\"") + OPERATION_NAMES[op] + "\"";
+        
+        // Buckets are cumulative; empty ones add nothing and are left out
+        uint64_t cumulative = 0;
+        for (const auto& bucket : histogram.buckets) {
+            cumulative += bucket.second;
+            out << "pump_operation_duration_seconds_bucket" << label << ",le=\""
+                << static_cast<double>(bucket.first) * 1e-9 << "\"} " << cumulative << "\n";
+        }
+        out << "pump_operation_duration_seconds_bucket" << label << ",le=\"+Inf\"} " << histogram.count << "\n"
+            << "pump_operation_duration_seconds_sum" << label << "} "
+            << static_cast<double>(histogram.totalNanoseconds) * 1e-9 << "\n"
+            << "pump_operation_duration_seconds_count" << label << "} " << histogram.count << "\n";
+    }
+}
+
+void Metrics::writeJson(std::ostream& out, const Snapshot& snapshot) {
+    out << "{\"enabled\": " << (snapshot.enabled ? "true" : "false")
+        << ", \"elapsed_seconds\": " << snapshot.elapsedSeconds
+        << ", \"operations\": [";
+    for (int op = 0; op < OPERATION_COUNT; op++) {
+        const Histogram& histogram = snapshot.operations[op];
+        out << (op > 0 ? ", " : "")
+            << "{\"name\": \"" << OPERATION_NAMES[op] << "\""
+            << ", \"calls\": " << histogram.calls
+            << ", \"samples\": " << histogram.count
+            << ", \"mean_ns\": " << histogram.getMean()
+            << ", \"min_ns\": " << histogram.minNanoseconds
+            << ", \"p50_ns\": " << histogram.getPercentile(50.0)
+            << ", \"p90_ns\": " << histogram.getPercentile(90.0)
+            << ", \"p99_ns\": " << histogram.getPercentile(99.0)
+            << ", \"p999_ns\": " << histogram.getPercentile(99.9)
+            << ", \"max_ns\": " << histogram.maxNanoseconds
+            << ", \"buckets\": [";
+        for (size_t b = 0; b < histogram.buckets.size(); b++) {
+            out << (b > 0 ? ", " : "") << "[" << histogram.buckets[b].first << ", " << histogram.buckets[b].second << "]";
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
+
+bool Metrics::dump(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    
+    Snapshot current = snapshot();
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+        writeJson(out, current);
+    } else {
+        writePrometheus(out, current);
+    }
+    out.flush();
+    return static_cast<bool>(out);
+}
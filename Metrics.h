@@ -0,0 +1,148 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+/**
+ * Latency metrics for pump operations.
+ * Each thread records into its own block of call counters and log-linear
+ * (HDR-style) latency histograms, so recording takes no locks and no
+ * shared cache lines. Every call is counted, but only the first and then
+ * every SAMPLE_INTERVAL-th call of an operation on a thread is timed: a
+ * timestamp read costs more than the rest of the bookkeeping together.
+ * snapshot() sums the blocks of all threads, including threads that have
+ * exited. Recording is compiled in only when PUMP_ENABLE_METRICS is defined
+ * (the CMake option of the same name); otherwise PUMP_METRIC expands to
+ * nothing and snapshots stay empty.
+ */
+namespace Metrics {
+    enum Operation : uint8_t {
+        DELIVER_BOLUS,
+        CANCEL_BOLUS,
+        CALCULATE_SUGGESTED_BOLUS,
+        BASAL_COMMAND,              // Start, stop and resume basal; temp basals
+        PROFILE_COMMAND,            // Profile edits and activation
+        UPDATE_CGM,                 // One sensor reading, manual or on a CGM tick
+        CONTROL_IQ,                 // One Control-IQ evaluation
+        RUN_UNTIL,
+        GET_HISTORY,                // Materialized events: getHistory, getRecentEvents
+        GET_HISTORY_VIEW,           // getHistoryView, getHistoryByType
+        FORK,
+        JOURNAL_CHECKPOINT,
+        JOURNAL_RESTORE,
+        LOG_EVENT,                  // One EventLog append
+        CGM_STATISTICS,             // CGMData average, deviation and time in range
+        CGM_PREDICTION,
+        OPERATION_COUNT
+    };
+    
+    static const uint64_t SAMPLE_INTERVAL = 16; // A power of two
+    
+    // Calls and sampled latency distribution of one operation, in nanoseconds
+    struct Histogram {
+        uint64_t calls;
+        uint64_t count;             // Timed calls
+        uint64_t totalNanoseconds;
+        uint64_t minNanoseconds;
+        uint64_t maxNanoseconds;
+        std::vector<std::pair<uint64_t, uint64_t>> buckets; // (upper bound, count) of non-empty buckets
+        
+        double getMean() const;
+        uint64_t getPercentile(double percentile) const; // percentile in [0, 100]
+    };
+    
+    struct Snapshot {
+        bool enabled;               // Built with PUMP_ENABLE_METRICS
+        double elapsedSeconds;      // Since start-up or the last reset
+        Histogram operations[OPERATION_COUNT];
+    };
+    
+    const char* getName(Operation operation);
+    
+    // Sum of all threads' samples. A reset while other threads are recording
+    // may keep the odd sample they were storing at the time.
+    Snapshot snapshot();
+    void reset();
+    
+    // Prometheus text exposition (seconds) or one JSON object (nanoseconds)
+    void writePrometheus(std::ostream& out, const Snapshot& snapshot);
+    void writeJson(std::ostream& out, const Snapshot& snapshot);
+    bool dump(const std::string& path); // JSON for a .json path, Prometheus text otherwise
+    
+    // Raw timestamp: TSC ticks where available, steady clock nanoseconds elsewhere
+    inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+    
+    // The current thread's call counters, registered on its first call
+    struct ThreadCalls {
+        std::atomic<uint64_t> calls[OPERATION_COUNT];
+    };
+    inline thread_local ThreadCalls* threadCalls = nullptr;
+    ThreadCalls* registerThread();
+    
+    void record(Operation operation, uint64_t ticks);
+    
+    // Counts the enclosing scope and times the sampled calls; inline so an
+    // untimed call costs a couple of nanoseconds
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Operation operation) :
+            operation(operation),
+            start(0)
+        {
+            ThreadCalls* counters = threadCalls;
+            if (!counters) {
+                counters = registerThread();
+            }
+            
+            // Only this thread writes its counters
+            std::atomic<uint64_t>& calls = counters->calls[operation];
+            uint64_t call = calls.load(std::memory_order_relaxed);
+            calls.store(call + 1, std::memory_order_relaxed);
+            if ((call & (SAMPLE_INTERVAL - 1)) == 0) {
+                start = now();
+            }
+        }
+        
+        ~ScopedTimer() {
+            if (start != 0) {
+                record(operation, now() - start);
+            }
+        }
+        
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+        
+    private:
+        Operation operation;
+        uint64_t start;
+    };
+}
+
+#define PUMP_METRIC_JOIN(name, line) name##line
+#define PUMP_METRIC_NAME(line) PUMP_METRIC_JOIN(metricTimer, line)
+
+#ifdef PUMP_ENABLE_METRICS
+#define PUMP_METRIC(operation) Metrics::ScopedTimer PUMP_METRIC_NAME(__LINE__)(Metrics::operation)
+#else
+#define PUMP_METRIC(operation) ((void)0)
+#endif
+
+#endif // METRICS_H
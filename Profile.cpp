@@ -0,0 +1,181 @@
+#include "Profile.h"
+#include <algorithm>
+
+Profile::Profile(const std::string& name) :
+    name(name),
+    version(0),
+    insulinDuration(5.0)
+{
+    std::fill(compiledSettings, compiledSettings + MINUTES_PER_DAY, Settings{0.0f, 0.0f, 0.0f, 0.0f});
+}
+
+std::string Profile::getName() const {
+    return name;
+}
+
+void Profile::setName(const std::string& name) {
+    this->name = name;
+}
+
+uint32_t Profile::getVersion() const {
+    return version;
+}
+
+void Profile::setVersion(uint32_t version) {
+    this->version = version;
+}
+
+void Profile::addBasalRate(int startHour, int startMinute, float rate) {
+    addSetting(basalRates, &Settings::basalRate, startHour, startMinute, rate);
+}
+
+float Profile::getBasalRate(int hour, int minute) const {
+    return getSettings(hour, minute).basalRate;
+}
+
+std::map<int, float> Profile::getAllBasalRates() const {
+    return basalRates;
+}
+
+void Profile::addCarbRatio(int startHour, int startMinute, float ratio) {
+    addSetting(carbRatios, &Settings::carbRatio, startHour, startMinute, ratio);
+}
+
+float Profile::getCarbRatio(int hour, int minute) const {
+    return getSettings(hour, minute).carbRatio;
+}
+
+std::map<int, float> Profile::getAllCarbRatios() const {
+    return carbRatios;
+}
+
+void Profile::addCorrectionFactor(int startHour, int startMinute, float factor) {
+    addSetting(correctionFactors, &Settings::correctionFactor, startHour, startMinute, factor);
+}
+
+float Profile::getCorrectionFactor(int hour, int minute) const {
+    return getSettings(hour, minute).correctionFactor;
+}
+
+std::map<int, float> Profile::getAllCorrectionFactors() const {
+    return correctionFactors;
+}
+
+void Profile::addTargetGlucose(int startHour, int startMinute, float target) {
+    addSetting(targetGlucoses, &Settings::targetGlucose, startHour, startMinute, target);
+}
+
+float Profile::getTargetGlucose(int hour, int minute) const {
+    return getSettings(hour, minute).targetGlucose;
+}
+
+std::map<int, float> Profile::getAllTargetGlucoses() const {
+    return targetGlucoses;
+}
+
+const Profile::Settings& Profile::getSettings(int minuteOfDay) const {
+    if (minuteOfDay < 0 || minuteOfDay >= MINUTES_PER_DAY) {
+        minuteOfDay = ((minuteOfDay % MINUTES_PER_DAY) + MINUTES_PER_DAY) % MINUTES_PER_DAY;
+    }
+    return compiledSettings[minuteOfDay];
+}
+
+const Profile::Settings& Profile::getSettings(int hour, int minute) const {
+    return getSettings(hour * 60 + minute);
+}
+
+std::vector<float> Profile::getDailyBasalSchedule() const {
+    std::vector<float> rates(MINUTES_PER_DAY);
+    getDailyBasalSchedule(rates.data());
+    return rates;
+}
+
+void Profile::getDailyBasalSchedule(float* rates) const {
+    for (int minute = 0; minute < MINUTES_PER_DAY; minute++) {
+        rates[minute] = compiledSettings[minute].basalRate;
+    }
+}
+
+float Profile::getDailyBasalTotal() const {
+    double total = 0.0;
+    for (int minute = 0; minute < MINUTES_PER_DAY; minute++) {
+        total += compiledSettings[minute].basalRate;
+    }
+    return static_cast<float>(total / 60.0);
+}
+
+void Profile::setInsulinDuration(float hours) {
+    insulinDuration = hours;
+}
+
+float Profile::getInsulinDuration() const {
+    return insulinDuration;
+}
+
+bool Profile::isValid() const {
+    return getValidationMessage().empty();
+}
+
+std::string Profile::getValidationMessage() const {
+    if (name.empty()) {
+        return "Profile name is empty";
+    }
+    if (basalRates.empty()) {
+        return "No basal rates defined";
+    }
+    if (carbRatios.empty()) {
+        return "No carb ratios defined";
+    }
+    if (correctionFactors.empty()) {
+        return "No correction factors defined";
+    }
+    if (targetGlucoses.empty()) {
+        return "No target glucose defined";
+    }
+    for (const auto& pair : basalRates) {
+        if (pair.second < 0) return "Basal rates cannot be negative";
+    }
+    for (const auto& pair : carbRatios) {
+        if (pair.second <= 0) return "Carb ratios must be positive";
+    }
+    for (const auto& pair : correctionFactors) {
+        if (pair.second <= 0) return "Correction factors must be positive";
+    }
+    for (const auto& pair : targetGlucoses) {
+        if (pair.second <= 0) return "Target glucose must be positive";
+    }
+    if (insulinDuration < 2.0 || insulinDuration > 8.0) {
+        return "Insulin duration must be between 2 and 8 hours";
+    }
+    return "";
+}
+
+int Profile::timeToMinutes(int hour, int minute) const {
+    return hour * 60 + minute;
+}
+
+void Profile::addSetting(std::map<int, float>& settings, float Settings::*field, int hour, int minute, float value) {
+    if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+        return;
+    }
+    
+    int startMinute = timeToMinutes(hour, minute);
+    settings[startMinute] = value;
+    
+    // Only the new segment changes: it runs until the next start time
+    auto next = settings.upper_bound(startMinute);
+    int endMinute = (next != settings.end()) ? next->first : MINUTES_PER_DAY;
+    fillSetting(field, startMinute, endMinute, value);
+    
+    // Minutes before the first segment carry over the last segment of the previous day
+    int firstMinute = settings.begin()->first;
+    if (firstMinute > 0 && (startMinute == firstMinute || next == settings.end())) {
+        fillSetting(field, 0, firstMinute, settings.rbegin()->second);
+    }
+}
+
+void Profile::fillSetting(float Settings::*field, int fromMinute, int toMinute, float value) {
+    for (int minute = fromMinute; minute < toMinute; minute++) {
+        compiledSettings[minute].*field = value;
+    }
+}
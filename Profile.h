@@ -1,15 +1,28 @@
 #ifndef PROFILE_H
 #define PROFILE_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 
 /**
- * Class representing a user profile for insulin delivery settings
+ * Class representing a user profile for insulin delivery settings.
+ * Alongside the editable schedules the profile keeps a compiled
+ * per-minute table so lookups are a single array index.
  */
 class Profile {
 public:
+    static const int MINUTES_PER_DAY = 24 * 60;
+    
+    // All settings in effect at one minute of the day
+    struct Settings {
+        float basalRate;
+        float carbRatio;
+        float correctionFactor;
+        float targetGlucose;
+    };
+    
     // Constructor with name
     Profile(const std::string& name);
     
@@ -17,6 +30,10 @@ public:
     std::string getName() const;
     void setName(const std::string& name);
     
+    // Snapshot version assigned when a pump stores the profile; 0 otherwise
+    uint32_t getVersion() const;
+    void setVersion(uint32_t version);
+    
     // Basal rate settings (in units per hour)
     void addBasalRate(int startHour, int startMinute, float rate);
     float getBasalRate(int hour, int minute) const;
@@ -37,6 +54,15 @@ public:
     float getTargetGlucose(int hour, int minute) const;
     std::map<int, float> getAllTargetGlucoses() const;
     
+    // Compiled lookups (minuteOfDay in [0, 1440))
+    const Settings& getSettings(int minuteOfDay) const;
+    const Settings& getSettings(int hour, int minute) const;
+    
+    // Whole-day basal schedule, one rate (U/hr) per minute
+    std::vector<float> getDailyBasalSchedule() const;
+    void getDailyBasalSchedule(float* rates) const;
+    float getDailyBasalTotal() const;
+    
     // Insulin duration (in hours)
     void setInsulinDuration(float hours);
     float getInsulinDuration() const;
@@ -47,15 +73,20 @@ public:
     
 private:
     std::string name;
+    uint32_t version;
     std::map<int, float> basalRates;        // Key is minutes since midnight
     std::map<int, float> carbRatios;        // Key is minutes since midnight
     std::map<int, float> correctionFactors; // Key is minutes since midnight
     std::map<int, float> targetGlucoses;    // Key is minutes since midnight
     float insulinDuration;
     
+    // Compiled per-minute table, kept in sync by the add* methods
+    alignas(64) Settings compiledSettings[MINUTES_PER_DAY];
+    
     // Helper methods
     int timeToMinutes(int hour, int minute) const;
-    float getValueAtTime(const std::map<int, float>& settings, int hour, int minute) const;
+    void addSetting(std::map<int, float>& settings, float Settings::*field, int hour, int minute, float value);
+    void fillSetting(float Settings::*field, int fromMinute, int toMinute, float value);
 };
 
 #endif // PROFILE_H
@@ -0,0 +1,195 @@
+#include "PumpBlock.h"
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include "TimelineRecorder.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const int MEAL_MINUTES[DailyMeals::MEALS_PER_DAY] = { 7 * 60 + 30, 12 * 60 + 30, 18 * 60 + 30 };
+    
+    // Phases of a simulated minute, totalled per day on the timeline
+    enum Phase {
+        PUMPS,
+        GLUCOSE_MODEL,
+        SENSORS,
+        PHASE_COUNT
+    };
+    const char* const PHASE_NAMES[PHASE_COUNT] = { "Pumps", "Glucose model", "Sensors and Control-IQ" };
+}
+
+PumpBlock::PumpBlock() {
+}
+
+PumpBlock::~PumpBlock() {
+}
+
+void PumpBlock::reserve(size_t count) {
+    members.reserve(count);
+    model.reserve(count);
+}
+
+PumpBlock::Member& PumpBlock::add(time_t startTime, int days, unsigned seed,
+                                  const GlucoseModel::Parameters& physiology, float initialGlucose) {
+    members.emplace_back();
+    Member& member = members.back();
+    member.clock = std::make_shared<VirtualClock>(startTime);
+    member.cgmData = std::make_shared<CGMData>(member.clock);
+    member.pump = std::make_unique<TSlimX2Pump>(member.clock);
+    member.pump->attachCGMData(member.cgmData);
+    member.rng.seed(seed);
+    member.startTime = startTime;
+    member.minutes = std::max(0, days) * Profile::MINUTES_PER_DAY;
+    
+    model.addPatient(physiology, initialGlucose);
+    return member;
+}
+
+void PumpBlock::start() {
+    for (Member& member : members) {
+        TSlimX2Pump& pump = *member.pump;
+        pump.powerOn();
+        pump.refillInsulin(300.0f);
+        pump.connectCGM();
+        pump.startBasal();
+        if (member.controlIQ && pump.enableControlIQ()) {
+            closedLoop.push_back(&pump);
+        }
+    }
+    controller.setPumps(closedLoop);
+}
+
+void PumpBlock::run(const MinuteAction& minuteAction, const DayEnd& dayEnd, TimelineRecorder* timeline) {
+    int totalMinutes = 0;
+    for (const Member& member : members) {
+        totalMinutes = std::max(totalMinutes, member.minutes);
+    }
+    
+    std::normal_distribution<float> sensorNoise(0.0f, 1.0f);
+    std::vector<float> delivered(members.size(), 0.0f);
+    
+    TimelineRecorder::PhaseTotals phases(timeline, PHASE_NAMES, PHASE_COUNT);
+    for (int minute = 0; minute < totalMinutes; minute++) {
+        phases.enter(PUMPS);
+        for (size_t i = 0; i < members.size(); i++) {
+            Member& member = members[i];
+            delivered[i] = 0.0f;
+            if (minute >= member.minutes) {
+                continue;
+            }
+            
+            TSlimX2Pump& pump = *member.pump;
+            time_t now = member.startTime + static_cast<time_t>(minute) * 60;
+            
+            // Change the cartridge before it runs dry
+            if (member.autoRefill && minute % Profile::MINUTES_PER_DAY == 0 && pump.getInsulinLevel() < 60.0f) {
+                refill(i, 300.0f);
+            }
+            if (minuteAction) {
+                minuteAction(i, minute, now);
+            }
+            
+            // Whatever the pump delivers this minute is absorbed by the patient
+            pump.runUntil(now + 60);
+            double total = pump.getTotalInsulinDelivered();
+            delivered[i] = static_cast<float>(total - member.lastDelivered);
+            member.lastDelivered = total;
+        }
+        
+        phases.enter(GLUCOSE_MODEL);
+        model.step(delivered.data());
+        
+        // The sensor reports every five minutes (ignored by a disconnected pump)
+        if ((minute + 1) % CGM_MINUTES == 0) {
+            phases.enter(SENSORS);
+            for (size_t i = 0; i < members.size(); i++) {
+                Member& member = members[i];
+                if (minute < member.minutes) {
+                    float reading = model.getGlucose(i) + member.sensorNoise * sensorNoise(member.rng);
+                    member.pump->updateCGMData(std::min(22.2f, std::max(2.2f, reading)));
+                }
+            }
+            if (!closedLoop.empty()) {
+                controller.run();
+            }
+        }
+        
+        if ((minute + 1) % Profile::MINUTES_PER_DAY == 0) {
+            phases.flush("Day");
+            if (dayEnd && !dayEnd(minute / Profile::MINUTES_PER_DAY)) {
+                break;
+            }
+        }
+    }
+}
+
+void PumpBlock::eat(size_t index, float carbs, float counted) {
+    Member& member = members[index];
+    model.addCarbs(index, carbs);
+    if (counted < 0) {
+        return;
+    }
+    
+    TSlimX2Pump& pump = *member.pump;
+    float bolus = pump.calculateSuggestedBolus(pump.getCurrentGlucose(), counted);
+    bolus = std::round(bolus * 20.0f) / 20.0f; // 0.05 U increments
+    if (bolus > 0 && pump.deliverBolus(bolus)) {
+        member.bolusCount++;
+    }
+}
+
+void PumpBlock::refill(size_t index, float units) {
+    Member& member = members[index];
+    TSlimX2Pump& pump = *member.pump;
+    pump.refillInsulin(units);
+    if (pump.getErrorState() == TSlimX2Pump::LOW_INSULIN) {
+        pump.clearError();
+    }
+    if (pump.getState() == TSlimX2Pump::SUSPENDED && member.suspensions == 0) {
+        pump.resumeBasal();
+    }
+}
+
+size_t PumpBlock::size() const {
+    return members.size();
+}
+
+PumpBlock::Member& PumpBlock::getMember(size_t index) {
+    return members[index];
+}
+
+const PumpBlock::Member& PumpBlock::getMember(size_t index) const {
+    return members[index];
+}
+
+DailyMeals::DailyMeals(PumpBlock& block) :
+    block(block),
+    plans(block.size()),
+    mealJitter(-30, 30),
+    mealSize(30.0f, 90.0f),
+    carbCountError(1.0f, 0.15f)
+{
+    for (Plan& plan : plans) {
+        plan.nextMeal = MEALS_PER_DAY;
+    }
+}
+
+void DailyMeals::act(size_t index, int minute, time_t now) {
+    PumpBlock::Member& member = block.getMember(index);
+    Plan& plan = plans[index];
+    if (minute % Profile::MINUTES_PER_DAY == 0) {
+        for (int meal = 0; meal < MEALS_PER_DAY; meal++) {
+            plan.mealTimes[meal] = now + (MEAL_MINUTES[meal] + mealJitter(member.rng)) * 60;
+            plan.mealCarbs[meal] = mealSize(member.rng);
+        }
+        plan.nextMeal = 0;
+    }
+    
+    // Bolus for the carbs as counted
+    while (plan.nextMeal < MEALS_PER_DAY && plan.mealTimes[plan.nextMeal] <= now) {
+        float carbs = plan.mealCarbs[plan.nextMeal++];
+        block.eat(index, carbs, std::max(0.0f, carbs * carbCountError(member.rng)));
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef PUMP_BLOCK_H
+#define PUMP_BLOCK_H
+
+#include "GlucoseModel.h"
+#include "ControlIQ.h"
+#include <cstddef>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+class CGMData;
+class TSlimX2Pump;
+class TimelineRecorder;
+class VirtualClock;
+
+/**
+ * A block of virtual patients stepped in lockstep, a minute at a time.
+ * Each patient has its own TSlimX2Pump and CGMData on a virtual clock;
+ * the insulin the pumps deliver drives one batched GlucoseModel, whose
+ * glucose the sensors read back every five minutes, and pumps on
+ * Control-IQ are evaluated together on each CGM cycle. What happens to a
+ * patient within a minute (meals, scripted actions) is up to the caller.
+ */
+class PumpBlock {
+public:
+    static const int CGM_MINUTES = 5;
+    
+    struct Member {
+        std::shared_ptr<VirtualClock> clock;
+        std::shared_ptr<CGMData> cgmData;
+        std::unique_ptr<TSlimX2Pump> pump;
+        std::mt19937 rng;
+        time_t startTime = 0;
+        int minutes = 0;                // Simulated length
+        bool controlIQ = false;
+        bool autoRefill = true;         // Change the cartridge at midnight below 60 U
+        float sensorNoise = 0.2f;       // Standard deviation (mmol/L)
+        int suspensions = 0;            // Nesting depth of user suspensions, which a refill leaves alone
+        int bolusCount = 0;
+        double lastDelivered = 0.0;
+    };
+    
+    // Called for every running patient at the start of each minute, after
+    // any automatic refill
+    using MinuteAction = std::function<void(size_t index, int minute, time_t now)>;
+    
+    // Called after each whole simulated day (counting from 0); returning
+    // false ends the run there
+    using DayEnd = std::function<bool(int day)>;
+    
+    PumpBlock();
+    ~PumpBlock();
+    
+    PumpBlock(const PumpBlock&) = delete;
+    PumpBlock& operator=(const PumpBlock&) = delete;
+    
+    void reserve(size_t count);
+    
+    // Add a patient with a pump and CGM attached on its own clock; program
+    // the pump's profiles and adjust the options on the returned member
+    // (valid until the next add), then start the block
+    Member& add(time_t startTime, int days, unsigned seed, const GlucoseModel::Parameters& physiology,
+                float initialGlucose);
+    
+    // Power on, fill, connect and start every pump, with Control-IQ where asked
+    void start();
+    
+    // Step every patient to the end of its days, or until dayEnd says stop;
+    // phases are totalled per day on timeline if given
+    void run(const MinuteAction& minuteAction, const DayEnd& dayEnd = nullptr, TimelineRecorder* timeline = nullptr);
+    
+    // Eat, and bolus for the carbs as counted in 0.05 U increments (no
+    // bolus when counted is negative)
+    void eat(size_t index, float carbs, float counted);
+    
+    // Fill the cartridge, clearing a low-insulin error and resuming delivery
+    // unless the user suspended it
+    void refill(size_t index, float units);
+    
+    size_t size() const;
+    Member& getMember(size_t index);
+    const Member& getMember(size_t index) const;
+    
+private:
+    std::vector<Member> members;
+    GlucoseModel model;
+    ControlIQBatch controller;
+    std::vector<TSlimX2Pump*> closedLoop;
+};
+
+/**
+ * Three meals a day of 30-90 g around 07:30, 12:30 and 18:30 (give or take
+ * half an hour), each bolused for with 15% carb-counting error; drawn per
+ * patient at midnight from the member's random stream
+ */
+class DailyMeals {
+public:
+    static const int MEALS_PER_DAY = 3;
+    
+    explicit DailyMeals(PumpBlock& block);
+    
+    // The block's minute action
+    void act(size_t index, int minute, time_t now);
+    
+private:
+    struct Plan {
+        time_t mealTimes[MEALS_PER_DAY];    // In time order
+        float mealCarbs[MEALS_PER_DAY];
+        int nextMeal;
+    };
+    
+    PumpBlock& block;
+    std::vector<Plan> plans;
+    std::uniform_int_distribution<int> mealJitter;
+    std::uniform_real_distribution<float> mealSize;
+    std::normal_distribution<float> carbCountError;
+};
+
+#endif // PUMP_BLOCK_H
@@ -0,0 +1,117 @@
+#include "TSlimX2Pump.h"
+#include "Clock.h"
+#include "Event.h"
+#include "EventLog.h"
+#include "Journal.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/*
+ * Journal round trip for the delivery timers.
+ *
+ * Usage: pump_restore [journal path]
+ *
+ * A pump running an extended bolus and a temp basal is checkpointed half
+ * an hour in, then restored into fresh pumps: one at the same moment,
+ * whose bolus and temp basal must end when they were due, and one hours
+ * later, whose temp basal has run out and must end at once. Exits
+ * non-zero on the first failed check.
+ */
+
+namespace {
+    const time_t START_TIME = 1700000000;
+    const time_t EXTENDED_END = START_TIME + 3600;
+    const time_t TEMP_BASAL_END = START_TIME + 7200;
+    const time_t CHECKPOINT_TIME = START_TIME + 1800;
+    const time_t TIMER_SLACK = 60; // Timers fire on the next delivery step
+    
+    int failures = 0;
+    
+    void check(bool condition, const char* message) {
+        if (!condition) {
+            std::cerr << "pump_restore: " << message << std::endl;
+            failures++;
+        }
+    }
+    
+    // Time of the newest basal change with the reason, or -1
+    time_t lastBasalChange(const TSlimX2Pump& pump, const std::string& reason) {
+        const EventLog& history = pump.getEventLog();
+        EventLog::TypeView changes = history.getByType(Event::BASAL_CHANGE);
+        for (size_t position = changes.size(); position-- > 0;) {
+            if (history.getText(changes[position].text) == reason) {
+                return changes[position].timestamp;
+            }
+        }
+        return -1;
+    }
+    
+    bool near(time_t actual, time_t expected) {
+        return actual >= expected && actual <= expected + TIMER_SLACK;
+    }
+    
+    std::unique_ptr<TSlimX2Pump> restore(const std::string& path, time_t now) {
+        auto pump = std::make_unique<TSlimX2Pump>(std::make_shared<VirtualClock>(now));
+        check(pump->restoreFromJournal(path), "journal did not restore");
+        return pump;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = argc > 1 ? argv[1] : "pump_restore.journal";
+    std::remove(path.c_str());
+    
+    // Record: a two-hour 150% temp basal and a one-hour extended bolus
+    {
+        auto clock = std::make_shared<VirtualClock>(START_TIME);
+        TSlimX2Pump pump(clock);
+        pump.powerOn();
+        pump.refillInsulin(300.0f);
+        pump.startBasal();
+        auto journal = std::make_shared<JournalWriter>();
+        if (!journal->open(path) || !pump.attachJournal(journal)) {
+            std::cerr << "pump_restore: unable to open journal " << path << std::endl;
+            return 1;
+        }
+        check(pump.startTempBasal(150.0f, 120), "temp basal did not start");
+        check(pump.deliverBolus(3.0f, true, 60), "extended bolus did not start");
+        pump.runUntil(CHECKPOINT_TIME);
+        pump.detachJournal();
+    }
+    
+    // Restored at the checkpoint: both end when they were due
+    {
+        auto pump = restore(path, CHECKPOINT_TIME);
+        check(pump->getState() == TSlimX2Pump::DELIVERING_BOLUS, "extended bolus not running after restore");
+        check(pump->getTempBasalPercent() == 150.0f, "temp basal not running after restore");
+        
+        pump->runUntil(EXTENDED_END + TIMER_SLACK);
+        check(near(lastBasalChange(*pump, "Extended bolus complete"), EXTENDED_END),
+              "extended bolus did not end on time");
+        check(pump->getState() == TSlimX2Pump::DELIVERING_BASAL, "pump still delivering the extended bolus");
+        check(pump->getTempBasalPercent() == 150.0f, "temp basal ended early");
+        
+        pump->runUntil(TEMP_BASAL_END + TIMER_SLACK);
+        check(near(lastBasalChange(*pump, "Temp basal ended"), TEMP_BASAL_END), "temp basal did not end on time");
+        check(pump->getTempBasalPercent() < 0, "temp basal still running");
+    }
+    
+    // Restored after the temp basal ran out: it ends on the first step
+    {
+        time_t restart = TEMP_BASAL_END + 3600;
+        auto pump = restore(path, restart);
+        pump->runUntil(restart + TIMER_SLACK);
+        check(near(lastBasalChange(*pump, "Temp basal ended"), restart), "expired temp basal did not end at once");
+        check(pump->getTempBasalPercent() < 0, "expired temp basal still running");
+    }
+    
+    std::remove(path.c_str());
+    if (failures == 0) {
+        std::cout << "Journal restore checks passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
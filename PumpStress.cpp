@@ -0,0 +1,223 @@
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include "Event.h"
+#include "EventLog.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Concurrency stress test for the pump's threading contract.
+ *
+ * Usage: pump_stress [--days <n>] [--readers <n>]
+ *
+ * One thread fast-forwards the pump through simulated days while two more
+ * each issue a fixed number of boluses, temp basals and profile edits
+ * against it, all through the recursive command lock (the glucose source
+ * also nests a command inside runUntil). Reader threads meanwhile check the
+ * lock-free status getters. Exits non-zero on the first broken invariant.
+ */
+
+namespace {
+    const time_t START_TIME = 1700000000;
+    const uint64_t COMMANDS_PER_THREAD = 5000;
+    
+    std::atomic<bool> failed(false);
+    
+    void fail(const std::string& message) {
+        if (!failed.exchange(true)) {
+            std::cerr << "pump_stress: " << message << std::endl;
+        }
+    }
+    
+    // Each scalar getter reads a whole published snapshot, so every value
+    // is one the pump really had, and time and delivery only move forward
+    void readScalars(const TSlimX2Pump& pump, const std::atomic<bool>& stop, std::atomic<uint64_t>& reads) {
+        time_t lastTimestamp = 0;
+        double lastDelivered = 0.0;
+        uint64_t count = 0;
+        while (!stop.load(std::memory_order_relaxed) && !failed.load(std::memory_order_relaxed)) {
+            float battery = pump.getBatteryLevel();
+            float insulin = pump.getInsulinLevel();
+            float onBoard = pump.getInsulinOnBoard();
+            float glucose = pump.getCurrentGlucose();
+            TSlimX2Pump::State state = pump.getState();
+            double delivered = pump.getTotalInsulinDelivered();
+            TSlimX2Pump::Status status = pump.getStatus();
+            count++;
+            
+            if (battery < 0.0f || battery > 100.0f) {
+                fail("battery level out of range: " + std::to_string(battery));
+            } else if (insulin < 0.0f || insulin > 300.0f) {
+                fail("insulin level out of range: " + std::to_string(insulin));
+            } else if (!std::isfinite(onBoard)) {
+                fail("insulin on board is not finite");
+            } else if (glucose != 0.0f && (glucose < 4.0f || glucose > 10.0f)) {
+                fail("glucose outside the source's range: " + std::to_string(glucose));
+            } else if (state != TSlimX2Pump::DELIVERING_BASAL && state != TSlimX2Pump::DELIVERING_BOLUS) {
+                fail("pump stopped delivering (state " + std::to_string(state) + ")");
+            } else if (delivered < lastDelivered) {
+                fail("total insulin delivered went backwards");
+            } else if (status.timestamp < lastTimestamp || status.totalInsulinDelivered < delivered) {
+                fail("status snapshot went backwards");
+            }
+            lastTimestamp = status.timestamp;
+            lastDelivered = status.totalInsulinDelivered;
+            std::this_thread::yield();
+        }
+        reads.fetch_add(count, std::memory_order_relaxed);
+    }
+    
+    // Keep the cartridge well clear of empty, which would suspend delivery
+    void topUp(TSlimX2Pump& pump) {
+        if (pump.getInsulinLevel() < 80.0f) {
+            pump.refillInsulin(150.0f);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int days = 30;
+    int readerCount = 3;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+            days = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            readerCount = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--days <n>] [--readers <n>]" << std::endl;
+            return 2;
+        }
+    }
+    
+    auto clock = std::make_shared<VirtualClock>(START_TIME);
+    TSlimX2Pump pump(clock);
+    pump.attachCGMData(std::make_shared<CGMData>(clock));
+    pump.powerOn();
+    pump.refillInsulin(300.0f);
+    pump.connectCGM();
+    pump.startBasal();
+    pump.createProfile("Exercise");
+    
+    // Runs inside runUntil, so the profile lookup re-enters the command lock
+    std::atomic<uint64_t> nestedCommands(0);
+    pump.setGlucoseSource([&pump, &nestedCommands](time_t now) {
+        if (!pump.getAllProfileNames().empty()) {
+            nestedCommands.fetch_add(1, std::memory_order_relaxed);
+        }
+        return 7.0f + 3.0f * static_cast<float>(std::sin(now / 7200.0));
+    });
+    
+    std::atomic<bool> stop(false);
+    std::atomic<int> commandThreads(2);
+    std::atomic<uint64_t> reads(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readerCount; r++) {
+        threads.emplace_back(readScalars, std::cref(pump), std::cref(stop), std::ref(reads));
+    }
+    
+    // Boluses from a second thread, with the occasional extended one
+    std::atomic<uint64_t> boluses(0);
+    threads.emplace_back([&pump, &commandThreads, &boluses]() {
+        for (uint64_t i = 0; i < COMMANDS_PER_THREAD && !failed.load(std::memory_order_relaxed); i++) {
+            topUp(pump);
+            bool extended = i % 16 == 0;
+            if (pump.deliverBolus(0.05f * static_cast<float>(1 + i % 6), extended, extended ? 60 : 0)) {
+                boluses.fetch_add(1, std::memory_order_relaxed);
+            }
+            pump.calculateSuggestedBolus(8.0f, 30.0f);
+            std::this_thread::yield();
+        }
+        commandThreads.fetch_sub(1);
+    });
+    
+    // Temp basals and profile edits from a third
+    std::atomic<uint64_t> tempBasals(0);
+    threads.emplace_back([&pump, &commandThreads, &tempBasals]() {
+        const float percents[] = { 50.0f, 120.0f, 150.0f };
+        for (uint64_t i = 0; i < COMMANDS_PER_THREAD && !failed.load(std::memory_order_relaxed); i++) {
+            if (i % 3 == 2) {
+                pump.cancelTempBasal();
+            } else if (pump.startTempBasal(percents[i % 3], 30 + static_cast<int>(i % 4) * 30)) {
+                tempBasals.fetch_add(1, std::memory_order_relaxed);
+            }
+            
+            auto edited = std::make_shared<Profile>(*pump.getProfile("Exercise"));
+            edited->addBasalRate(static_cast<int>(i % 24), 0, 0.5f + 0.05f * static_cast<float>(i % 10));
+            pump.updateProfile("Exercise", edited);
+            pump.activateProfile(i % 2 ? "Exercise" : "Default");
+            pump.getErrorMessage();
+            std::this_thread::yield();
+        }
+        commandThreads.fetch_sub(1);
+    });
+    
+    // The driving thread: an hour at a time, with a bolus on the hour
+    uint64_t hourlyBoluses = 0;
+    for (int hour = 0; hour < days * 24 && !failed.load(); hour++) {
+        topUp(pump);
+        if (pump.deliverBolus(0.05f * static_cast<float>(1 + hour % 20))) {
+            hourlyBoluses++;
+        }
+        pump.runUntil(clock->now() + 3600);
+        std::this_thread::yield();
+    }
+    while (commandThreads.load() > 0) {
+        std::this_thread::yield();
+    }
+    
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    // Every successful command left exactly one record, in time order
+    const EventLog& history = pump.getEventLog();
+    size_t typed = 0;
+    for (int type = 0; type < EventLog::EVENT_TYPE_COUNT; type++) {
+        typed += history.countByType(static_cast<Event::EventType>(type));
+    }
+    size_t tempBasalRecords = 0;
+    for (const auto& record : history.getByType(Event::BASAL_CHANGE)) {
+        if (history.getText(record.text) == "Temp basal started") {
+            tempBasalRecords++;
+        }
+    }
+    for (size_t i = 1; i < history.size(); i++) {
+        if (history[i].timestamp < history[i - 1].timestamp) {
+            fail("history out of time order at record " + std::to_string(i));
+            break;
+        }
+    }
+    if (typed != history.size()) {
+        fail("type index covers " + std::to_string(typed) + " of " + std::to_string(history.size()) + " records");
+    }
+    if (history.countByType(Event::BOLUS) != hourlyBoluses + boluses.load()) {
+        fail("bolus records " + std::to_string(history.countByType(Event::BOLUS)) + " for " +
+             std::to_string(hourlyBoluses + boluses.load()) + " boluses");
+    }
+    if (tempBasalRecords != tempBasals.load()) {
+        fail("temp basal records " + std::to_string(tempBasalRecords) + " for " +
+             std::to_string(tempBasals.load()) + " temp basals");
+    }
+    if (reads.load() == 0 || nestedCommands.load() == 0) {
+        fail("readers or nested commands never ran");
+    }
+    
+    std::cout << "Days:                  " << days << "\n"
+              << "Status reads:          " << reads.load() << "\n"
+              << "Boluses:               " << hourlyBoluses + boluses.load() << "\n"
+              << "Temp basals:           " << tempBasals.load() << "\n"
+              << "Nested commands:       " << nestedCommands.load() << "\n"
+              << "History records:       " << history.size() << std::endl;
+    return failed.load() ? 1 : 0;
+}
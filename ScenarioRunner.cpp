@@ -0,0 +1,718 @@
+#include "ScenarioRunner.h"
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "Event.h"
+#include "EventLog.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include "PumpBlock.h"
+#include "TimelineRecorder.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <sstream>
+
+namespace {
+    // Scenarios stepped together through one batched glucose model
+    const size_t SCENARIOS_PER_BLOCK = 16;
+    
+    /**
+     * Action occurrence on a scenario's timeline; actions with a duration
+     * have a second, ending occurrence
+     */
+    struct TimedAction {
+        int minute;
+        bool ending;
+        uint32_t action;
+        
+        bool operator<(const TimedAction& other) const {
+            if (minute != other.minute) {
+                return minute < other.minute;
+            }
+            if (ending != other.ending) {
+                return ending; // End one gap before the next starts
+            }
+            return action < other.action;
+        }
+    };
+    
+    /**
+     * One scenario's timeline; its pump, sensor and physiology are the
+     * PumpBlock member at the same index
+     */
+    struct RunningScenario {
+        std::vector<TimedAction> timeline;
+        size_t nextAction;
+        
+        // Nesting depth of overlapping gaps and occlusions (suspensions are
+        // counted on the member, so refills leave them alone)
+        int sensorGaps;
+        int occlusions;
+    };
+    
+    std::string_view trim(std::string_view text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos) {
+            return std::string_view();
+        }
+        size_t last = text.find_last_not_of(" \t\r");
+        return text.substr(first, last - first + 1);
+    }
+    
+    std::vector<std::string_view> split(std::string_view line) {
+        std::vector<std::string_view> tokens;
+        size_t position = 0;
+        while (position < line.size()) {
+            size_t first = line.find_first_not_of(" \t", position);
+            if (first == std::string_view::npos) {
+                break;
+            }
+            size_t last = line.find_first_of(" \t", first);
+            if (last == std::string_view::npos) {
+                last = line.size();
+            }
+            tokens.push_back(line.substr(first, last - first));
+            position = last;
+        }
+        return tokens;
+    }
+    
+    bool parseFloat(std::string_view text, float& value) {
+        auto parsed = std::from_chars(text.data(), text.data() + text.size(), value);
+        return parsed.ec == std::errc() && parsed.ptr == text.data() + text.size() && std::isfinite(value);
+    }
+    
+    template <typename Integer>
+    bool parseInteger(std::string_view text, Integer& value) {
+        auto parsed = std::from_chars(text.data(), text.data() + text.size(), value);
+        return parsed.ec == std::errc() && parsed.ptr == text.data() + text.size();
+    }
+    
+    // HH:MM as a minute of the day
+    bool parseClockTime(std::string_view text, int& minuteOfDay) {
+        size_t colon = text.find(':');
+        int hour, minute;
+        if (colon == std::string_view::npos || !parseInteger(text.substr(0, colon), hour) ||
+            !parseInteger(text.substr(colon + 1), minute) || hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+            return false;
+        }
+        minuteOfDay = hour * 60 + minute;
+        return true;
+    }
+    
+    // YYYY-MM-DD (local midnight) or epoch seconds
+    bool parseStartTime(std::string_view text, time_t& startTime) {
+        long long seconds;
+        if (parseInteger(text, seconds)) {
+            startTime = static_cast<time_t>(seconds);
+            return true;
+        }
+        
+        int year, month, day;
+        if (text.size() != 10 || text[4] != '-' || text[7] != '-' || !parseInteger(text.substr(0, 4), year) ||
+            !parseInteger(text.substr(5, 2), month) || !parseInteger(text.substr(8, 2), day) ||
+            month < 1 || month > 12 || day < 1 || day > 31) {
+            return false;
+        }
+        struct tm timeinfo = {};
+        timeinfo.tm_year = year - 1900;
+        timeinfo.tm_mon = month - 1;
+        timeinfo.tm_mday = day;
+        timeinfo.tm_isdst = -1;
+        startTime = mktime(&timeinfo);
+        return startTime != static_cast<time_t>(-1);
+    }
+    
+    bool parseOnOff(std::string_view text, bool& value) {
+        if (text == "on") {
+            value = true;
+        } else if (text == "off") {
+            value = false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    // key=value
+    bool splitOption(std::string_view token, std::string_view& key, std::string_view& value) {
+        size_t equals = token.find('=');
+        if (equals == std::string_view::npos || equals == 0) {
+            return false;
+        }
+        key = token.substr(0, equals);
+        value = token.substr(equals + 1);
+        return true;
+    }
+    
+    // A new scenario profile starts from the pump's default settings
+    std::shared_ptr<Profile> makeProfile(const std::string& name) {
+        auto profile = std::make_shared<Profile>(name);
+        profile->addBasalRate(0, 0, 0.5f);
+        profile->addCarbRatio(0, 0, 15.0f);
+        profile->addCorrectionFactor(0, 0, 2.0f);
+        profile->addTargetGlucose(0, 0, 6.7f);
+        profile->setInsulinDuration(5.0f);
+        return profile;
+    }
+    
+    ScenarioRunner::Scenario makeScenario(std::string_view name) {
+        ScenarioRunner::Scenario scenario;
+        scenario.name = std::string(name);
+        scenario.replicate = 0;
+        scenario.seed = 1;
+        parseStartTime("2024-01-01", scenario.startTime);
+        scenario.days = 1;
+        scenario.controlIQ = false;
+        scenario.autoRefill = true;
+        scenario.sensorNoise = 0.2f;
+        scenario.initialGlucose = -1.0f; // Basal glucose unless given
+        return scenario;
+    }
+    
+    void writeJsonString(std::ostream& out, const std::string& text) {
+        static const char hex[] = "0123456789abcdef";
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+}
+
+ScenarioRunner::ScenarioRunner(unsigned threadCount) :
+    pool(threadCount)
+{
+}
+
+bool ScenarioRunner::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = path + ": unable to open";
+        return false;
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return parse(text.str(), path);
+}
+
+bool ScenarioRunner::parse(std::string_view text, const std::string& source) {
+    std::vector<Scenario> parsed;
+    bool open = false;
+    Scenario current;
+    unsigned repeat = 1;
+    std::map<std::string, std::shared_ptr<Profile>> profiles;
+    std::vector<std::string> profileOrder;
+    std::vector<int> actionLines;
+    std::vector<int> profileLines;
+    int lineNumber = 0;
+    
+    auto fail = [this, &source, &lineNumber](const std::string& message) {
+        error = source + ":" + std::to_string(lineNumber) + ": " + message;
+        return false;
+    };
+    
+    // Check a finished scenario and add its replicates
+    auto close = [&]() {
+        for (size_t i = 0; i < current.actions.size(); i++) {
+            const Action& action = current.actions[i];
+            if (action.type == PROFILE && profiles.find(action.profile) == profiles.end() && action.profile != "Default") {
+                lineNumber = actionLines[i];
+                return fail("unknown profile '" + action.profile + "'");
+            }
+            if (!action.daily && action.minute >= current.days * Profile::MINUTES_PER_DAY) {
+                lineNumber = actionLines[i];
+                return fail("action after the last day");
+            }
+        }
+        for (size_t i = 0; i < profileOrder.size(); i++) {
+            const Profile& profile = *profiles[profileOrder[i]];
+            if (!profile.isValid()) {
+                lineNumber = profileLines[i];
+                return fail("profile '" + profileOrder[i] + "': " + profile.getValidationMessage());
+            }
+            current.profiles.push_back(profiles[profileOrder[i]]);
+        }
+        if (current.initialGlucose <= 0) {
+            current.initialGlucose = current.physiology.basalGlucose;
+        }
+        
+        for (unsigned r = 0; r < repeat; r++) {
+            parsed.push_back(current);
+            parsed.back().replicate = r;
+            parsed.back().seed = current.seed + r;
+        }
+        open = false;
+        return true;
+    };
+    
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t newline = text.find('\n', position);
+        if (newline == std::string_view::npos) {
+            newline = text.size();
+        }
+        std::string_view line = text.substr(position, newline - position);
+        position = newline + 1;
+        lineNumber++;
+        
+        size_t comment = line.find('#');
+        if (comment != std::string_view::npos) {
+            line = line.substr(0, comment);
+        }
+        std::vector<std::string_view> tokens = split(trim(line));
+        if (tokens.empty()) {
+            continue;
+        }
+        std::string_view keyword = tokens[0];
+        
+        if (keyword == "scenario") {
+            if (open) {
+                return fail("missing 'end' before the next scenario");
+            }
+            if (tokens.size() != 2) {
+                return fail("expected 'scenario <name>'");
+            }
+            current = makeScenario(tokens[1]);
+            repeat = 1;
+            profiles.clear();
+            profileOrder.clear();
+            actionLines.clear();
+            profileLines.clear();
+            open = true;
+            continue;
+        }
+        if (!open) {
+            return fail("expected 'scenario <name>'");
+        }
+        
+        if (keyword == "end") {
+            if (!close()) {
+                return false;
+            }
+        } else if (keyword == "start") {
+            if (tokens.size() != 2 || !parseStartTime(tokens[1], current.startTime)) {
+                return fail("expected 'start <YYYY-MM-DD | epoch seconds>'");
+            }
+        } else if (keyword == "days") {
+            if (tokens.size() != 2 || !parseInteger(tokens[1], current.days) || current.days <= 0) {
+                return fail("expected 'days <count>'");
+            }
+        } else if (keyword == "seed") {
+            if (tokens.size() != 2 || !parseInteger(tokens[1], current.seed)) {
+                return fail("expected 'seed <number>'");
+            }
+        } else if (keyword == "repeat") {
+            if (tokens.size() != 2 || !parseInteger(tokens[1], repeat) || repeat == 0) {
+                return fail("expected 'repeat <count>'");
+            }
+        } else if (keyword == "control-iq") {
+            if (tokens.size() != 2 || !parseOnOff(tokens[1], current.controlIQ)) {
+                return fail("expected 'control-iq on|off'");
+            }
+        } else if (keyword == "auto-refill") {
+            if (tokens.size() != 2 || !parseOnOff(tokens[1], current.autoRefill)) {
+                return fail("expected 'auto-refill on|off'");
+            }
+        } else if (keyword == "noise") {
+            if (tokens.size() != 2 || !parseFloat(tokens[1], current.sensorNoise) || current.sensorNoise < 0) {
+                return fail("expected 'noise <mmol/L>'");
+            }
+        } else if (keyword == "patient") {
+            GlucoseModel::Parameters& physiology = current.physiology;
+            for (size_t i = 1; i < tokens.size(); i++) {
+                std::string_view key, value;
+                float number;
+                if (!splitOption(tokens[i], key, value) || !parseFloat(value, number) || number <= 0) {
+                    return fail("expected <key>=<positive number>, got '" + std::string(tokens[i]) + "'");
+                }
+                if (key == "glucose") {
+                    current.initialGlucose = number;
+                } else if (key == "basal-glucose") {
+                    physiology.basalGlucose = number;
+                } else if (key == "sensitivity") {
+                    physiology.insulinSensitivity = number;
+                } else if (key == "carb-ratio") {
+                    physiology.carbRatio = number;
+                } else if (key == "basal-need") {
+                    physiology.basalInsulinNeed = number;
+                } else {
+                    return fail("unknown patient setting '" + std::string(key) + "'");
+                }
+            }
+        } else if (keyword == "profile") {
+            if (tokens.size() < 2) {
+                return fail("expected 'profile <name> [from=HH:MM] <key>=<value>...'");
+            }
+            std::string name(tokens[1]);
+            auto& profile = profiles[name];
+            if (!profile) {
+                profile = makeProfile(name);
+                profileOrder.push_back(name);
+                profileLines.push_back(lineNumber);
+            }
+            
+            int from = 0;
+            for (size_t i = 2; i < tokens.size(); i++) {
+                std::string_view key, value;
+                float number;
+                if (!splitOption(tokens[i], key, value)) {
+                    return fail("expected <key>=<value>, got '" + std::string(tokens[i]) + "'");
+                }
+                if (key == "from") {
+                    if (!parseClockTime(value, from)) {
+                        return fail("expected from=HH:MM");
+                    }
+                    continue;
+                }
+                if (!parseFloat(value, number)) {
+                    return fail("expected a number for '" + std::string(key) + "'");
+                }
+                if (key == "basal") {
+                    profile->addBasalRate(from / 60, from % 60, number);
+                } else if (key == "carb-ratio") {
+                    profile->addCarbRatio(from / 60, from % 60, number);
+                } else if (key == "correction") {
+                    profile->addCorrectionFactor(from / 60, from % 60, number);
+                } else if (key == "target") {
+                    profile->addTargetGlucose(from / 60, from % 60, number);
+                } else if (key == "duration") {
+                    profile->setInsulinDuration(number);
+                } else {
+                    return fail("unknown profile setting '" + std::string(key) + "'");
+                }
+            }
+        } else if (keyword == "day" || keyword == "daily") {
+            // day <n> HH:MM <action> ... | daily HH:MM <action> ...
+            Action action = {};
+            action.daily = keyword == "daily";
+            action.counted = -1.0f;
+            size_t next = 1;
+            int day = 1;
+            if (!action.daily && (tokens.size() < 2 || !parseInteger(tokens[next++], day) || day < 1)) {
+                return fail("expected 'day <n> HH:MM <action>'");
+            }
+            if (tokens.size() < next + 2 || !parseClockTime(tokens[next++], action.minute)) {
+                return fail("expected HH:MM and an action");
+            }
+            action.minute += (day - 1) * Profile::MINUTES_PER_DAY;
+            
+            std::string_view type = tokens[next++];
+            bool needsAmount = true;
+            if (type == "meal") {
+                action.type = MEAL;
+            } else if (type == "bolus") {
+                action.type = BOLUS;
+            } else if (type == "profile") {
+                action.type = PROFILE;
+                needsAmount = false;
+            } else if (type == "sensor-gap") {
+                action.type = SENSOR_GAP;
+            } else if (type == "occlusion") {
+                action.type = OCCLUSION;
+            } else if (type == "suspend") {
+                action.type = SUSPEND;
+            } else if (type == "refill") {
+                action.type = REFILL;
+            } else {
+                return fail("unknown action '" + std::string(type) + "'");
+            }
+            
+            if (next >= tokens.size()) {
+                return fail("missing argument for '" + std::string(type) + "'");
+            }
+            if (!needsAmount) {
+                action.profile = std::string(tokens[next++]);
+            } else {
+                std::string_view amount = tokens[next++];
+                bool minutes = action.type == SENSOR_GAP || action.type == OCCLUSION || action.type == SUSPEND;
+                if (minutes ? !parseInteger(amount, action.duration) || action.duration <= 0
+                            : !parseFloat(amount, action.value) || action.value <= 0) {
+                    return fail("expected a positive amount, got '" + std::string(amount) + "'");
+                }
+                if (action.type == MEAL) {
+                    action.counted = action.value;
+                }
+            }
+            
+            for (; next < tokens.size(); next++) {
+                std::string_view key, value;
+                if (action.type == MEAL && tokens[next] == "nobolus") {
+                    action.counted = -1.0f;
+                } else if (!splitOption(tokens[next], key, value)) {
+                    return fail("unexpected '" + std::string(tokens[next]) + "'");
+                } else if (key == "jitter") {
+                    if (!parseInteger(value, action.jitter) || action.jitter < 0) {
+                        return fail("expected jitter=<minutes>");
+                    }
+                } else if (key == "counted" && action.type == MEAL) {
+                    if (!parseFloat(value, action.counted) || action.counted < 0) {
+                        return fail("expected counted=<grams>");
+                    }
+                } else if (key == "extended" && action.type == BOLUS) {
+                    if (!parseInteger(value, action.duration) || action.duration <= 0) {
+                        return fail("expected extended=<minutes>");
+                    }
+                } else {
+                    return fail("unknown option '" + std::string(key) + "' for '" + std::string(type) + "'");
+                }
+            }
+            
+            current.actions.push_back(action);
+            actionLines.push_back(lineNumber);
+        } else {
+            return fail("unknown keyword '" + std::string(keyword) + "'");
+        }
+    }
+    
+    if (open && !close()) {
+        return false;
+    }
+    
+    scenarios.insert(scenarios.end(), parsed.begin(), parsed.end());
+    error.clear();
+    return true;
+}
+
+const std::string& ScenarioRunner::getError() const {
+    return error;
+}
+
+void ScenarioRunner::addScenario(const Scenario& scenario) {
+    scenarios.push_back(scenario);
+}
+
+size_t ScenarioRunner::getScenarioCount() const {
+    return scenarios.size();
+}
+
+const ScenarioRunner::Scenario& ScenarioRunner::getScenario(size_t index) const {
+    return scenarios[index];
+}
+
+void ScenarioRunner::clearScenarios() {
+    scenarios.clear();
+}
+
+void ScenarioRunner::setTimeline(std::shared_ptr<TimelineRecorder> recorder) {
+    timeline = recorder;
+}
+
+ScenarioRunner::Summary ScenarioRunner::run() {
+    Summary summary;
+    summary.results.resize(scenarios.size());
+    summary.threadCount = pool.getThreadCount();
+    
+    auto started = std::chrono::steady_clock::now();
+    pool.parallelFor(scenarios.size(), SCENARIOS_PER_BLOCK, [this, &summary](size_t begin, size_t end) {
+        runBlock(&scenarios[begin], end - begin, &summary.results[begin], timeline.get(), static_cast<uint32_t>(begin));
+    });
+    auto finished = std::chrono::steady_clock::now();
+    summary.elapsedSeconds = std::chrono::duration<double>(finished - started).count();
+    
+    double scenarioDays = 0.0;
+    for (const auto& scenario : scenarios) {
+        scenarioDays += scenario.days;
+    }
+    summary.scenarioDaysPerSecond = summary.elapsedSeconds > 0 ? scenarioDays / summary.elapsedSeconds : 0.0;
+    
+    return summary;
+}
+
+void ScenarioRunner::runBlock(const Scenario* scenarios, size_t count, Result* results,
+                              TimelineRecorder* timeline, uint32_t firstTrack) {
+    TimelineRecorder::Scope blockSpan(timeline, "Scenario block");
+    int64_t setupStart = timeline ? timeline->now() : 0;
+    PumpBlock block;
+    block.reserve(count);
+    std::vector<RunningScenario> running(count);
+    
+    for (size_t i = 0; i < count; i++) {
+        const Scenario& scenario = scenarios[i];
+        PumpBlock::Member& member = block.add(scenario.startTime, scenario.days, scenario.seed, scenario.physiology,
+                                              scenario.initialGlucose);
+        member.controlIQ = scenario.controlIQ;
+        member.autoRefill = scenario.autoRefill;
+        member.sensorNoise = scenario.sensorNoise;
+        
+        // Lay out every occurrence, with this replicate's timing jitter
+        RunningScenario& state = running[i];
+        state.nextAction = 0;
+        state.sensorGaps = 0;
+        state.occlusions = 0;
+        for (uint32_t a = 0; a < scenario.actions.size(); a++) {
+            const Action& action = scenario.actions[a];
+            int occurrences = action.daily ? std::max(0, scenario.days) : 1;
+            for (int day = 0; day < occurrences; day++) {
+                int minute = action.minute + day * Profile::MINUTES_PER_DAY;
+                if (action.jitter > 0) {
+                    minute += std::uniform_int_distribution<int>(-action.jitter, action.jitter)(member.rng);
+                }
+                minute = std::max(0, minute);
+                if (minute >= member.minutes) {
+                    continue;
+                }
+                state.timeline.push_back({ minute, false, a });
+                if (action.type == SENSOR_GAP || action.type == OCCLUSION || action.type == SUSPEND) {
+                    state.timeline.push_back({ minute + action.duration, true, a });
+                }
+            }
+        }
+        std::sort(state.timeline.begin(), state.timeline.end());
+        
+        // Program the scenario's profiles; the first is active
+        TSlimX2Pump& pump = *member.pump;
+        for (const auto& profile : scenario.profiles) {
+            pump.createProfile(profile->getName());
+            pump.updateProfile(profile->getName(), profile);
+        }
+        if (!scenario.profiles.empty()) {
+            pump.activateProfile(scenario.profiles.front()->getName());
+        }
+    }
+    block.start();
+    if (timeline) {
+        timeline->recordSpan("Setup", setupStart, timeline->now() - setupStart);
+    }
+    
+    block.run([&](size_t i, int minute, time_t) {
+        const Scenario& scenario = scenarios[i];
+        RunningScenario& state = running[i];
+        PumpBlock::Member& member = block.getMember(i);
+        TSlimX2Pump& pump = *member.pump;
+        
+        while (state.nextAction < state.timeline.size() && state.timeline[state.nextAction].minute <= minute) {
+            const TimedAction& timed = state.timeline[state.nextAction++];
+            const Action& action = scenario.actions[timed.action];
+            
+            switch (action.type) {
+                case MEAL:
+                    block.eat(i, action.value, action.counted);
+                    break;
+                case BOLUS:
+                    if (pump.deliverBolus(action.value, action.duration > 0, action.duration)) {
+                        member.bolusCount++;
+                    }
+                    break;
+                case PROFILE:
+                    pump.activateProfile(action.profile);
+                    break;
+                case SENSOR_GAP:
+                    if (!timed.ending && state.sensorGaps++ == 0) {
+                        pump.disconnectCGM();
+                    } else if (timed.ending && --state.sensorGaps == 0) {
+                        pump.connectCGM();
+                        if (scenario.controlIQ) {
+                            pump.enableControlIQ();
+                        }
+                    }
+                    break;
+                case OCCLUSION:
+                    if (!timed.ending && state.occlusions++ == 0) {
+                        pump.reportOcclusion();
+                    } else if (timed.ending && --state.occlusions == 0) {
+                        // The set is changed and delivery restarted
+                        pump.clearError();
+                        pump.startBasal();
+                        if (member.suspensions > 0) {
+                            pump.stopBasal();
+                        }
+                    }
+                    break;
+                case SUSPEND:
+                    if (!timed.ending && member.suspensions++ == 0) {
+                        pump.stopBasal();
+                    } else if (timed.ending && --member.suspensions == 0) {
+                        pump.resumeBasal();
+                    }
+                    break;
+                case REFILL:
+                    block.refill(i, action.value);
+                    break;
+            }
+        }
+    }, nullptr, timeline);
+    
+    TimelineRecorder::Scope summarySpan(timeline, "Summarize");
+    for (size_t i = 0; i < count; i++) {
+        const Scenario& scenario = scenarios[i];
+        const PumpBlock::Member& member = block.getMember(i);
+        const TSlimX2Pump& pump = *member.pump;
+        const CGMData& cgmData = *member.cgmData;
+        time_t startTime = scenario.startTime;
+        time_t endTime = member.clock->now();
+        
+        Result& result = results[i];
+        result.name = scenario.name;
+        result.replicate = scenario.replicate;
+        result.days = scenario.days;
+        result.averageGlucose = cgmData.getAverageGlucose(startTime, endTime);
+        result.timeInRange = cgmData.getTimeInRange(3.9f, 10.0f, startTime, endTime);
+        result.timeBelowRange = 100.0f - cgmData.getTimeInRange(3.9f, HUGE_VALF, startTime, endTime);
+        result.timeAboveRange = 100.0f - cgmData.getTimeInRange(0.0f, 10.0f, startTime, endTime);
+        result.totalInsulin = static_cast<float>(pump.getTotalInsulinDelivered());
+        result.finalInsulinOnBoard = pump.getInsulinOnBoard();
+        result.bolusCount = member.bolusCount;
+        result.autoCorrectionCount = 0;
+        result.alarmCount = 0;
+        result.lowGlucoseAlarms = 0;
+        result.highGlucoseAlarms = 0;
+        result.occlusionAlarms = 0;
+        result.readingCount = cgmData.getReadingCount();
+        result.eventCount = pump.getEventLog().size();
+        
+        // Count straight from the type index without building Event objects
+        for (const auto& record : pump.getHistoryByType(Event::ALARM, startTime, endTime)) {
+            result.alarmCount++;
+            if (record.subtype == AlarmEvent::LOW_GLUCOSE) {
+                result.lowGlucoseAlarms++;
+            } else if (record.subtype == AlarmEvent::HIGH_GLUCOSE) {
+                result.highGlucoseAlarms++;
+            } else if (record.subtype == AlarmEvent::OCCLUSION) {
+                result.occlusionAlarms++;
+            }
+        }
+        for (const auto& record : pump.getHistoryByType(Event::BOLUS, startTime, endTime)) {
+            if (record.subtype == BolusEvent::CORRECTION) {
+                result.autoCorrectionCount++;
+            }
+        }
+        
+        if (timeline) {
+            std::string track = scenario.name + " #" + std::to_string(scenario.replicate);
+            timeline->recordHistory(firstTrack + static_cast<uint32_t>(i), track, pump.getEventLog(), startTime);
+        }
+    }
+}
+
+void ScenarioRunner::writeJson(std::ostream& out, const Result& result) {
+    out << "{\"scenario\": ";
+    writeJsonString(out, result.name);
+    out << ", \"replicate\": " << result.replicate
+        << ", \"days\": " << result.days
+        << ", \"mean_glucose\": " << result.averageGlucose
+        << ", \"time_in_range\": " << result.timeInRange
+        << ", \"time_below_range\": " << result.timeBelowRange
+        << ", \"time_above_range\": " << result.timeAboveRange
+        << ", \"total_insulin\": " << result.totalInsulin
+        << ", \"final_iob\": " << result.finalInsulinOnBoard
+        << ", \"boluses\": " << result.bolusCount
+        << ", \"auto_corrections\": " << result.autoCorrectionCount
+        << ", \"alarms\": " << result.alarmCount
+        << ", \"low_alarms\": " << result.lowGlucoseAlarms
+        << ", \"high_alarms\": " << result.highGlucoseAlarms
+        << ", \"occlusion_alarms\": " << result.occlusionAlarms
+        << ", \"readings\": " << result.readingCount
+        << ", \"events\": " << result.eventCount << "}\n";
+}
@@ -0,0 +1,148 @@
+#ifndef SCENARIO_RUNNER_H
+#define SCENARIO_RUNNER_H
+
+#include "ThreadPool.h"
+#include "GlucoseModel.h"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Profile;
+class TimelineRecorder;
+
+/**
+ * Non-interactive driver for scripted pump scenarios.
+ * A scenario file holds one or more blocks of the form:
+ *
+ *   scenario <name>
+ *   start 2024-01-01           (local midnight; or epoch seconds)
+ *   days 7
+ *   seed 42
+ *   repeat 100                 (copies with seeds seed, seed + 1, ...)
+ *   control-iq on
+ *   auto-refill on             (change the cartridge at midnight below 60 U)
+ *   noise 0.2                  (sensor noise SD, mmol/L)
+ *   patient glucose=7 sensitivity=2.5 carb-ratio=12 basal-need=0.8
+ *   profile Default basal=0.8 carb-ratio=12 correction=2.5 target=6.1 duration=5
+ *   profile Default from=06:00 basal=1.0
+ *   daily 07:30 meal 60 jitter=20
+ *   day 2 18:00 meal 80 counted=60
+ *   day 3 02:00 sensor-gap 120
+ *   day 4 09:00 occlusion 90
+ *   day 5 06:00 profile Exercise
+ *   day 6 10:00 bolus 3 extended=120
+ *   end
+ *
+ * Other actions are "meal <g> nobolus", "bolus <units>", "suspend <minutes>"
+ * and "refill <units>". '#' starts a comment. Scenarios run closed-loop
+ * against a batched GlucoseModel, a block of them in lockstep per thread
+ * pool task, as fast as the pumps can be stepped.
+ */
+class ScenarioRunner {
+public:
+    enum ActionType {
+        MEAL,
+        BOLUS,
+        PROFILE,
+        SENSOR_GAP,
+        OCCLUSION,
+        SUSPEND,
+        REFILL
+    };
+    
+    struct Action {
+        int minute;             // From the scenario start; for daily actions, of the day
+        bool daily;
+        int jitter;             // Random shift of up to +/- this many minutes
+        ActionType type;
+        float value;            // Carbs (g), bolus or refill units
+        float counted;          // Meal carbs entered in the bolus calculator; negative for none
+        int duration;           // Extended bolus, gap, occlusion or suspension (minutes)
+        std::string profile;    // Profile to activate
+    };
+    
+    struct Scenario {
+        std::string name;
+        unsigned replicate;
+        unsigned seed;
+        time_t startTime;
+        int days;
+        bool controlIQ;
+        bool autoRefill;
+        float sensorNoise;      // Standard deviation (mmol/L)
+        float initialGlucose;   // mmol/L
+        GlucoseModel::Parameters physiology;
+        std::vector<std::shared_ptr<const Profile>> profiles;  // The first is active at the start
+        std::vector<Action> actions;
+    };
+    
+    // Outcome of one scenario
+    struct Result {
+        std::string name;
+        unsigned replicate;
+        int days;
+        float averageGlucose;
+        float timeInRange;          // % of readings within 3.9-10.0 mmol/L
+        float timeBelowRange;
+        float timeAboveRange;
+        float totalInsulin;         // Units delivered
+        float finalInsulinOnBoard;
+        int bolusCount;
+        int autoCorrectionCount;
+        int alarmCount;
+        int lowGlucoseAlarms;
+        int highGlucoseAlarms;
+        int occlusionAlarms;
+        size_t readingCount;
+        size_t eventCount;
+    };
+    
+    struct Summary {
+        std::vector<Result> results;    // In scenario order
+        unsigned threadCount;
+        double elapsedSeconds;
+        double scenarioDaysPerSecond;
+    };
+    
+    // A thread count of 0 uses all hardware threads
+    explicit ScenarioRunner(unsigned threadCount = 0);
+    
+    // Parse scenarios and add them; on failure nothing is added and
+    // getError() describes the first problem as "source:line: message"
+    bool load(const std::string& path);
+    bool parse(std::string_view text, const std::string& source = "<text>");
+    const std::string& getError() const;
+    
+    void addScenario(const Scenario& scenario);
+    size_t getScenarioCount() const;
+    const Scenario& getScenario(size_t index) const;
+    void clearScenarios();
+    
+    // Record run phases and every scenario's pump history on a timeline
+    // (which must be open) during run; null stops recording
+    void setTimeline(std::shared_ptr<TimelineRecorder> recorder);
+    
+    // Run every scenario across the pool
+    Summary run();
+    
+    // Run a block of scenarios in lockstep on the calling thread, recording
+    // it on timeline if given with tracks numbered from firstTrack
+    static void runBlock(const Scenario* scenarios, size_t count, Result* results,
+                         TimelineRecorder* timeline = nullptr, uint32_t firstTrack = 0);
+    
+    // One JSON object per line
+    static void writeJson(std::ostream& out, const Result& result);
+    
+private:
+    ThreadPool pool;
+    std::vector<Scenario> scenarios;
+    std::string error;
+    std::shared_ptr<TimelineRecorder> timeline;
+};
+
+#endif // SCENARIO_RUNNER_H
@@ -0,0 +1,71 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Single-writer sequence lock around a small trivially copyable value.
+ * The writer never waits for readers; a reader copies the value and
+ * retries if a store overlapped the copy, so it always sees one complete
+ * store. The value is kept in relaxed atomic words so the racing copy is
+ * well defined. Stores must not overlap each other (one writer at a time).
+ */
+template <typename T>
+class alignas(64) SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable value");
+    
+public:
+    SeqLock() : sequence(0) {
+        for (auto& word : words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+    
+    void store(const T& value) {
+        uint64_t buffer[WORDS] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        
+        // An odd sequence marks a store in progress
+        uint32_t start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        sequence.store(start + 2, std::memory_order_release);
+    }
+    
+    T load() const {
+        uint64_t buffer[WORDS];
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; i++) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) != 0 || before != after);
+        
+        T value;
+        std::memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+    
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    
+    // Aligned (with the class) to whole cache lines, so readers polling the
+    // value do not slow the writer's other data
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> words[WORDS];
+};
+
+#endif // SEQ_LOCK_H
@@ -6,14 +6,47 @@
 #include <map>
 #include <ctime>
 #include <memory>
+#include <mutex>
+#include <functional>
+#include "IOBEngine.h"
+#include "EventLog.h"
+#include "ControlIQ.h"
+#include "SeqLock.h"
+#include "TimerWheel.h"
 
 // Forward declarations
 class Profile;
 class Event;
 class CGMData;
+class Clock;
+class VirtualClock;
+class JournalWriter;
 
 /**
- * Class representing the t:slim X2 Insulin Pump
+ * Class representing the t:slim X2 Insulin Pump.
+ *
+ * Threading: commands (the non-const methods) are serialized, so one
+ * thread at a time drives the pump and commands may nest. When the
+ * outermost command returns, and on each CGM tick of a runUntil, the pump
+ * publishes a Status snapshot through a seqlock. getStatus() and the
+ * status getters read that snapshot without locking and never hold up
+ * delivery. The error message, profile names and the CGM data pointer are
+ * read under the command lock. References and views into history are only
+ * valid on the driving thread; other threads should fork() the pump and
+ * read the branch.
+ *
+ * Delivery: under runUntil the pump motor delivers insulin in pulses of
+ * PULSE_UNITS. Pulses, basal schedule segment boundaries, the end of an
+ * extended bolus and the expiry of a temp basal are timers on a timer
+ * wheel, fired in time order as the virtual clock advances.
+ *
+ * Profiles: the pump stores each profile as an immutable, versioned
+ * snapshot. Editing means copying a profile, changing the copy and storing
+ * it with updateProfile(), which gives it a new version. Activation
+ * atomically publishes the snapshot, so delivery and the bolus calculator
+ * read it without a name lookup, and getActiveProfile() needs no lock.
+ * Profile change events record the version activated, and every version
+ * that has been active stays available through getProfileVersion().
  */
 class TSlimX2Pump {
 public:
@@ -37,10 +70,47 @@ public:
         CGM_DISCONNECTION,
         CRITICAL_ERROR
     };
-
+    
+    // Source of simulated sensor values sampled on every CGM tick
+    using GlucoseSource = std::function<float(time_t)>;
+    
+    // Consistent view of the pump as of its last published command or step
+    struct Status {
+        time_t timestamp;
+        State state;
+        ErrorType error;
+        float batteryLevel;
+        float insulinLevel;
+        float insulinOnBoard;
+        float currentGlucose;
+        float lastBolusAmount;
+        float tempBasalPercent;     // Negative when no temp basal is running
+        uint32_t activeProfileVersion;
+        time_t lastBolusTime;
+        double totalInsulinDelivered;
+        ControlIQ::Action controlIQAction;
+        bool cgmConnected;
+        bool controlIQEnabled;
+    };
+    
     TSlimX2Pump();
+    explicit TSlimX2Pump(std::shared_ptr<Clock> clock);
     ~TSlimX2Pump();
     
+    TSlimX2Pump(const TSlimX2Pump&) = delete;
+    TSlimX2Pump& operator=(const TSlimX2Pump&) = delete;
+    
+    // What-if branching: an independent pump holding this pump's full state.
+    // History and CGM data are shared copy-on-write and profile snapshots are
+    // shared outright, so forking is
+    // O(1) in the history length and branches can run on separate threads.
+    // The branch gets its own virtual clock (when this pump has one) and no
+    // journal; the glucose source callable is copied as is.
+    std::unique_ptr<TSlimX2Pump> fork();
+    
+    // Time source
+    std::shared_ptr<Clock> getClock() const;
+    
     // Basic pump functions
     bool powerOn();
     bool powerOff();
@@ -53,15 +123,20 @@ public:
     bool chargeBattery(float amount);
     bool refillInsulin(float amount);
     
-    // Profile management (CRUD operations)
+    // Profile management (CRUD operations). Stored profiles are immutable;
+    // updateProfile stores a copy of the given profile as a new version
     bool createProfile(const std::string& name);
-    std::shared_ptr<Profile> getProfile(const std::string& name);
+    std::shared_ptr<const Profile> getProfile(const std::string& name) const;
     std::vector<std::string> getAllProfileNames() const;
-    bool updateProfile(const std::string& name, std::shared_ptr<Profile> profile);
+    bool updateProfile(const std::string& name, std::shared_ptr<const Profile> profile);
     bool deleteProfile(const std::string& name);
     bool activateProfile(const std::string& name);
-    std::string getActiveProfileName() const;
-    std::shared_ptr<Profile> getActiveProfile() const;
+    std::string getActiveProfileName() const;                   // Lock-free
+    std::shared_ptr<const Profile> getActiveProfile() const;    // Lock-free
+    uint32_t getActiveProfileVersion() const;
+    
+    // A profile version that is or has been active, nullptr when unknown
+    std::shared_ptr<const Profile> getProfileVersion(uint32_t version) const;
     
     // Insulin delivery functions
     bool deliverBolus(float units, bool extended = false, int durationMinutes = 0);
@@ -71,11 +146,27 @@ public:
     bool resumeBasal();
     float getInsulinOnBoard() const;
     
+    // Temp basal: 0-250% of the scheduled rate for 15 minutes to 72 hours,
+    // replacing any running one; not available while Control-IQ is on
+    bool startTempBasal(float percent, int durationMinutes);
+    bool cancelTempBasal();
+    float getTempBasalPercent() const; // Negative when none is running
+    
     // Control IQ technology functions
     bool enableControlIQ();
     bool disableControlIQ();
     bool isControlIQEnabled() const;
     float calculateSuggestedBolus(float currentGlucose, float carbIntake);
+    void setControlIQSettings(const ControlIQ::Settings& settings);
+    const ControlIQ::Settings& getControlIQSettings() const;
+    ControlIQ::Action getControlIQAction() const;
+    float getCurrentBasalRate(); // Rate being delivered now (U/hr), including Control-IQ adjustments
+    
+    // Batched Control-IQ: in batched mode the pump does not evaluate on each
+    // CGM reading; a ControlIQBatch gathers inputs and applies decisions
+    void setControlIQBatched(bool batched);
+    bool getControlIQInput(int predictionMinutes, ControlIQ::Input& input);
+    void applyControlIQDecision(const ControlIQ::Decision& decision);
     
     // CGM integration
     bool connectCGM();
@@ -83,46 +174,152 @@ public:
     bool isCGMConnected() const;
     float getCurrentGlucose() const;
     void updateCGMData(float glucoseValue);
+    void attachCGMData(std::shared_ptr<CGMData> cgmData);
+    std::shared_ptr<CGMData> getCGMData() const;
+    void setGlucoseSource(GlucoseSource source);
+    
+    // Fast-forward simulation (requires a VirtualClock): advances the clock
+    // to endTime, delivering basal, absorbing insulin and sampling the
+    // glucose source (if any) on the CGM cadence
+    bool runUntil(time_t endTime);
     
     // History and data storage
     std::vector<std::shared_ptr<Event>> getHistory(time_t startTime, time_t endTime);
+    EventLog::RecordView getHistoryView(time_t startTime, time_t endTime) const;
+    EventLog::TypeView getHistoryByType(Event::EventType type, time_t startTime, time_t endTime) const;
     std::vector<std::shared_ptr<Event>> getRecentEvents(int count);
+    const EventLog& getEventLog() const;
     float getLastBolusAmount() const;
     time_t getLastBolusTime() const;
+    double getTotalInsulinDelivered() const; // Units pumped since construction
+    
+    // Persistence: replay a journal into this pump (before attaching one),
+    // then mirror history and profile changes into an attached journal.
+    // Attaching writes a state checkpoint, as does destroying the pump.
+    bool restoreFromJournal(const std::string& path);
+    bool attachJournal(std::shared_ptr<JournalWriter> journal);
+    void detachJournal();
+    void checkpointJournal();
     
     // Error handling
     ErrorType getErrorState() const;
     std::string getErrorMessage() const;
     bool clearError();
     
+    // Delivery fault: stops all insulin, including an extended bolus, until
+    // the error is cleared and basal is started again
+    bool reportOcclusion();
+    
     // Pump state
     State getState() const;
+    Status getStatus() const; // Lock-free; safe from any thread
     
 private:
+    class CommandGuard;
+    
+    // Simulation step and CGM sampling interval (seconds)
+    static constexpr time_t SIMULATION_STEP = 60;
+    static constexpr time_t CGM_INTERVAL = 300;
+    
+    // Smallest amount the motor delivers (units)
+    static constexpr float PULSE_UNITS = 0.05f;
+    
+    // Delivery timer kinds
+    enum DeliveryTimer : uint32_t {
+        PULSE_TIMER,
+        BASAL_SEGMENT_TIMER,
+        EXTENDED_BOLUS_TIMER,
+        TEMP_BASAL_TIMER
+    };
+    
     // Private implementation details
+    std::shared_ptr<Clock> clock;
+    std::shared_ptr<VirtualClock> virtualClock;
+    
     State currentState;
     ErrorType currentError;
     std::string errorMessage;
     
     float batteryLevel;
     float insulinLevel;
-    float insulinOnBoard;
+    IOBEngine insulinOnBoard;
+    time_t lastAbsorptionTime;
+    float extendedBolusRemaining;   // Units still to be delivered
+    float extendedBolusRate;        // Units per second
     time_t lastBolusTime;
     float lastBolusAmount;
+    double totalInsulinDelivered;
+    
+    // Delivery schedule
+    TimerWheel deliveryTimers;
+    TimerWheel::TimerId pulseTimer;
+    TimerWheel::TimerId basalSegmentTimer;
+    TimerWheel::TimerId extendedBolusTimer;
+    TimerWheel::TimerId tempBasalTimer;
+    float scheduledBasalRate;       // Active profile's rate (U/hr), kept current by the segment timer
+    float tempBasalPercent;         // Negative when no temp basal is running
+    time_t tempBasalEndTime;
+    float deliveryRate;             // Rate the next pulse is paced for (U/hr)
+    float pulseAccrued;             // Units owed toward the next pulse
     
     bool controlIQEnabled;
+    bool controlIQBatched;
+    ControlIQ::Settings controlIQSettings;
+    ControlIQ::Action controlIQAction;
+    float controlIQBasalRate;       // Adjusted rate (U/hr), negative when following the schedule
+    time_t lastAutoCorrectionTime;
     bool cgmConnected;
     float currentGlucose;
+    bool lowGlucoseAlarmActive;
+    bool highGlucoseAlarmActive;
+    std::shared_ptr<CGMData> cgmData;
+    GlucoseSource glucoseSource;
+    time_t nextCGMTime;
+    
+    // Cached local hour used to resolve minute-of-day without localtime per tick
+    time_t cachedHourStart;
+    int cachedHourMinute;
+    
+    // Profile snapshots: the latest version of each profile by name, and
+    // every version that has been active. The active profile is published
+    // with atomic shared_ptr operations; the driving thread reads it directly.
+    std::shared_ptr<const Profile> activeProfile;
+    std::map<std::string, std::shared_ptr<const Profile>> profiles;
+    std::map<uint32_t, std::shared_ptr<const Profile>> activeVersions;
+    uint32_t nextProfileVersion;
+    EventLog eventHistory;
+    std::shared_ptr<JournalWriter> journal;
+    
+    // Single writer: commands hold the lock, readers use the snapshot
+    mutable std::recursive_mutex commandMutex;
+    int commandDepth;
+    SeqLock<Status> status;
     
-    std::string activeProfileName;
-    std::map<std::string, std::shared_ptr<Profile>> profiles;
-    std::vector<std::shared_ptr<Event>> eventHistory;
+    TSlimX2Pump(const TSlimX2Pump& other, std::shared_ptr<Clock> clock);
     
     // Helper methods
-    void logEvent(std::shared_ptr<Event> event);
+    void publishStatus();
+    void recordCGMReading(float glucoseValue);
+    std::shared_ptr<const Profile> storeProfile(const Profile& profile, const std::string& name, uint32_t version);
+    void publishActiveProfile(std::shared_ptr<const Profile> profile);
+    float currentInsulinOnBoard() const;
     void updateInsulinOnBoard();
     bool checkSafety() const;
-    void simulateInsulinAbsorption();
+    void simulateInsulinAbsorption(time_t elapsedSeconds);
+    void advanceDelivery(time_t until);
+    void deliverPulse();
+    void scheduleDelivery();
+    void schedulePulse();
+    void fireDeliveryTimer(const TimerWheel::Timer& timer);
+    void updateScheduledBasal(const char* reason);
+    void stopExtendedBolus();
+    void endTempBasal(const char* reason);
+    float adjustedBasalRate(float scheduledRate) const;
+    int localMinuteOfDay(time_t timestamp);
+    float getScheduledBasalRate(time_t now);
+    void startBolus(float units, BolusEvent::BolusType bolusType, int durationMinutes);
+    void runControlIQ();
+    void resetControlIQ(const char* reason);
 };
 
 #endif // TSLIM_X2_PUMP_H
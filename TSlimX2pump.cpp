@@ -1,61 +1,206 @@
 #include "TSlimX2Pump.h"
+#include "BolusCalculator.h"
 #include "Profile.h"
 #include "Event.h"
+#include "EventLog.h"
 #include "CGMData.h"
+#include "Clock.h"
+#include "Journal.h"
+#include "Metrics.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 
-TSlimX2Pump::TSlimX2Pump() : 
+/**
+ * Holds the command lock for one command; when the outermost command
+ * returns, delivery is re-paced for any rate it changed and its result is
+ * published to status readers
+ */
+class TSlimX2Pump::CommandGuard {
+public:
+    explicit CommandGuard(TSlimX2Pump& pump) :
+        pump(pump)
+    {
+        pump.commandMutex.lock();
+        pump.commandDepth++;
+    }
+    
+    ~CommandGuard() {
+        if (--pump.commandDepth == 0) {
+            pump.scheduleDelivery();
+            pump.publishStatus();
+        }
+        pump.commandMutex.unlock();
+    }
+    
+    CommandGuard(const CommandGuard&) = delete;
+    CommandGuard& operator=(const CommandGuard&) = delete;
+    
+private:
+    TSlimX2Pump& pump;
+};
+
+namespace {
+    // Factory settings; snapshots are immutable, so every pump shares one
+    std::shared_ptr<const Profile> defaultProfile() {
+        static const std::shared_ptr<const Profile> profile = [] {
+            auto profile = std::make_shared<Profile>("Default");
+            
+            // Set up default basal rates (0.5 U/hr)
+            for (int hour = 0; hour < 24; hour++) {
+                profile->addBasalRate(hour, 0, 0.5);
+            }
+            
+            // Set up default carb ratios (15g/U)
+            for (int hour = 0; hour < 24; hour++) {
+                profile->addCarbRatio(hour, 0, 15.0);
+            }
+            
+            // Set up default correction factors (2 mmol/L per unit)
+            for (int hour = 0; hour < 24; hour++) {
+                profile->addCorrectionFactor(hour, 0, 2.0);
+            }
+            
+            // Set up default target glucose (6.7 mmol/L)
+            for (int hour = 0; hour < 24; hour++) {
+                profile->addTargetGlucose(hour, 0, 6.7);
+            }
+            
+            // Set default insulin duration (5 hours)
+            profile->setInsulinDuration(5.0);
+            profile->setVersion(1);
+            return profile;
+        }();
+        return profile;
+    }
+}
+
+TSlimX2Pump::TSlimX2Pump() :
+    TSlimX2Pump(std::make_shared<RealClock>())
+{
+}
+
+TSlimX2Pump::TSlimX2Pump(std::shared_ptr<Clock> clock) : 
+    clock(clock ? clock : std::make_shared<RealClock>()),
+    virtualClock(std::dynamic_pointer_cast<VirtualClock>(clock)),
     currentState(OFF),
     currentError(NONE),
     errorMessage(""),
     batteryLevel(100.0),
     insulinLevel(0.0),
-    insulinOnBoard(0.0),
+    insulinOnBoard(5.0),
+    lastAbsorptionTime(this->clock->now()),
+    extendedBolusRemaining(0.0),
+    extendedBolusRate(0.0),
     lastBolusTime(0),
     lastBolusAmount(0.0),
+    totalInsulinDelivered(0.0),
+    deliveryTimers(this->clock->now()),
+    pulseTimer(TimerWheel::NO_TIMER),
+    basalSegmentTimer(TimerWheel::NO_TIMER),
+    extendedBolusTimer(TimerWheel::NO_TIMER),
+    tempBasalTimer(TimerWheel::NO_TIMER),
+    scheduledBasalRate(0.0f),
+    tempBasalPercent(-1.0f),
+    tempBasalEndTime(0),
+    deliveryRate(0.0f),
+    pulseAccrued(0.0f),
     controlIQEnabled(false),
+    controlIQBatched(false),
+    controlIQSettings(),
+    controlIQAction(ControlIQ::SCHEDULED),
+    controlIQBasalRate(-1.0f),
+    lastAutoCorrectionTime(0),
     cgmConnected(false),
     currentGlucose(0.0),
-    activeProfileName("")
+    lowGlucoseAlarmActive(false),
+    highGlucoseAlarmActive(false),
+    nextCGMTime(0),
+    cachedHourStart(0),
+    cachedHourMinute(-1),
+    nextProfileVersion(2),
+    commandDepth(0)
 {
-    // Create a default profile
-    std::shared_ptr<Profile> defaultProfile = std::make_shared<Profile>("Default");
-    
-    // Set up default basal rates (0.5 U/hr)
-    for (int hour = 0; hour < 24; hour++) {
-        defaultProfile->addBasalRate(hour, 0, 0.5);
-    }
-    
-    // Set up default carb ratios (15g/U)
-    for (int hour = 0; hour < 24; hour++) {
-        defaultProfile->addCarbRatio(hour, 0, 15.0);
-    }
-    
-    // Set up default correction factors (2 mmol/L per unit)
-    for (int hour = 0; hour < 24; hour++) {
-        defaultProfile->addCorrectionFactor(hour, 0, 2.0);
-    }
+    // Start on the default profile
+    profiles["Default"] = defaultProfile();
+    publishActiveProfile(profiles["Default"]);
+    updateScheduledBasal(nullptr);
     
-    // Set up default target glucose (6.7 mmol/L)
-    for (int hour = 0; hour < 24; hour++) {
-        defaultProfile->addTargetGlucose(hour, 0, 6.7);
-    }
-    
-    // Set default insulin duration (5 hours)
-    defaultProfile->setInsulinDuration(5.0);
-    
-    // Add default profile to profiles map
-    profiles["Default"] = defaultProfile;
-    activeProfileName = "Default";
+    publishStatus();
+}
+
+TSlimX2Pump::TSlimX2Pump(const TSlimX2Pump& other, std::shared_ptr<Clock> clock) :
+    clock(clock),
+    virtualClock(std::dynamic_pointer_cast<VirtualClock>(clock)),
+    currentState(other.currentState),
+    currentError(other.currentError),
+    errorMessage(other.errorMessage),
+    batteryLevel(other.batteryLevel),
+    insulinLevel(other.insulinLevel),
+    insulinOnBoard(other.insulinOnBoard),
+    lastAbsorptionTime(other.lastAbsorptionTime),
+    extendedBolusRemaining(other.extendedBolusRemaining),
+    extendedBolusRate(other.extendedBolusRate),
+    lastBolusTime(other.lastBolusTime),
+    lastBolusAmount(other.lastBolusAmount),
+    totalInsulinDelivered(other.totalInsulinDelivered),
+    deliveryTimers(other.deliveryTimers),
+    pulseTimer(other.pulseTimer),
+    basalSegmentTimer(other.basalSegmentTimer),
+    extendedBolusTimer(other.extendedBolusTimer),
+    tempBasalTimer(other.tempBasalTimer),
+    scheduledBasalRate(other.scheduledBasalRate),
+    tempBasalPercent(other.tempBasalPercent),
+    tempBasalEndTime(other.tempBasalEndTime),
+    deliveryRate(other.deliveryRate),
+    pulseAccrued(other.pulseAccrued),
+    controlIQEnabled(other.controlIQEnabled),
+    controlIQBatched(other.controlIQBatched),
+    controlIQSettings(other.controlIQSettings),
+    controlIQAction(other.controlIQAction),
+    controlIQBasalRate(other.controlIQBasalRate),
+    lastAutoCorrectionTime(other.lastAutoCorrectionTime),
+    cgmConnected(other.cgmConnected),
+    currentGlucose(other.currentGlucose),
+    lowGlucoseAlarmActive(other.lowGlucoseAlarmActive),
+    highGlucoseAlarmActive(other.highGlucoseAlarmActive),
+    cgmData(other.cgmData ? other.cgmData->fork(clock) : nullptr),
+    glucoseSource(other.glucoseSource),
+    nextCGMTime(other.nextCGMTime),
+    cachedHourStart(other.cachedHourStart),
+    cachedHourMinute(other.cachedHourMinute),
+    activeProfile(other.activeProfile),
+    profiles(other.profiles),
+    activeVersions(other.activeVersions),
+    nextProfileVersion(other.nextProfileVersion),
+    eventHistory(other.eventHistory),
+    commandDepth(0)
+{
+    publishStatus();
 }
 
 TSlimX2Pump::~TSlimX2Pump() {
-    // Nothing to clean up specifically
+    detachJournal();
+}
+
+std::unique_ptr<TSlimX2Pump> TSlimX2Pump::fork() {
+    PUMP_METRIC(FORK);
+    CommandGuard guard(*this);
+    // A branch keeps its own simulated time; wall time is shared
+    std::shared_ptr<Clock> branchClock = clock;
+    if (virtualClock) {
+        branchClock = std::make_shared<VirtualClock>(virtualClock->now());
+    }
+    return std::unique_ptr<TSlimX2Pump>(new TSlimX2Pump(*this, branchClock));
+}
+
+std::shared_ptr<Clock> TSlimX2Pump::getClock() const {
+    return clock;
 }
 
 bool TSlimX2Pump::powerOn() {
+    CommandGuard guard(*this);
     if (currentState == OFF) {
         if (batteryLevel <= 0) {
             currentError = LOW_BATTERY;
@@ -66,8 +211,7 @@ bool TSlimX2Pump::powerOn() {
         currentState = ON;
         
         // Log power on event
-        auto event = std::make_shared<ResumeEvent>(time(nullptr), "Power on");
-        logEvent(event);
+        eventHistory.logResume(clock->now(), "Power on");
         
         return true;
     }
@@ -75,20 +219,24 @@ bool TSlimX2Pump::powerOn() {
 }
 
 bool TSlimX2Pump::powerOff() {
+    CommandGuard guard(*this);
     if (currentState != OFF) {
         // Log any active delivery
         if (currentState == DELIVERING_BOLUS || currentState == DELIVERING_BASAL) {
-            auto event = std::make_shared<SuspendEvent>(time(nullptr), "Power off");
-            logEvent(event);
+            eventHistory.logSuspend(clock->now(), "Power off");
         }
         
         currentState = OFF;
+        stopExtendedBolus();
+        endTempBasal(nullptr);
+        resetControlIQ("Power off");
         return true;
     }
     return false; // Already off
 }
 
 bool TSlimX2Pump::sleep() {
+    CommandGuard guard(*this);
     if (currentState == ON || currentState == DELIVERING_BASAL) {
         currentState = SLEEP;
         return true;
@@ -97,6 +245,7 @@ bool TSlimX2Pump::sleep() {
 }
 
 bool TSlimX2Pump::wake() {
+    CommandGuard guard(*this);
     if (currentState == SLEEP) {
         currentState = ON;
         return true;
@@ -105,14 +254,15 @@ bool TSlimX2Pump::wake() {
 }
 
 float TSlimX2Pump::getBatteryLevel() const {
-    return batteryLevel;
+    return status.load().batteryLevel;
 }
 
 float TSlimX2Pump::getInsulinLevel() const {
-    return insulinLevel;
+    return status.load().insulinLevel;
 }
 
 bool TSlimX2Pump::chargeBattery(float amount) {
+    CommandGuard guard(*this);
     if (amount <= 0) return false;
     
     batteryLevel += amount;
@@ -129,6 +279,7 @@ bool TSlimX2Pump::chargeBattery(float amount) {
 }
 
 bool TSlimX2Pump::refillInsulin(float amount) {
+    CommandGuard guard(*this);
     if (amount <= 0) return false;
     if (currentState == OFF) return false;
     
@@ -150,24 +301,29 @@ bool TSlimX2Pump::refillInsulin(float amount) {
 }
 
 bool TSlimX2Pump::createProfile(const std::string& name) {
+    PUMP_METRIC(PROFILE_COMMAND);
+    CommandGuard guard(*this);
     if (name.empty() || profiles.find(name) != profiles.end()) {
         return false; // Invalid name or profile already exists
     }
     
-    profiles[name] = std::make_shared<Profile>(name);
+    auto profile = storeProfile(Profile(name), name, 0);
+    
+    if (journal) {
+        journal->appendProfile(*profile);
+    }
     
     return true;
 }
 
-std::shared_ptr<Profile> TSlimX2Pump::getProfile(const std::string& name) {
+std::shared_ptr<const Profile> TSlimX2Pump::getProfile(const std::string& name) const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex);
     auto it = profiles.find(name);
-    if (it != profiles.end()) {
-        return it->second;
-    }
-    return nullptr;
+    return it != profiles.end() ? it->second : nullptr;
 }
 
 std::vector<std::string> TSlimX2Pump::getAllProfileNames() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex);
     std::vector<std::string> names;
     for (const auto& pair : profiles) {
         names.push_back(pair.first);
@@ -175,81 +331,88 @@ std::vector<std::string> TSlimX2Pump::getAllProfileNames() const {
     return names;
 }
 
-bool TSlimX2Pump::updateProfile(const std::string& name, std::shared_ptr<Profile> profile) {
+bool TSlimX2Pump::updateProfile(const std::string& name, std::shared_ptr<const Profile> profile) {
+    PUMP_METRIC(PROFILE_COMMAND);
+    CommandGuard guard(*this);
     if (name.empty() || profiles.find(name) == profiles.end() || !profile) {
         return false;
     }
     
-    profiles[name] = profile;
+    auto snapshot = storeProfile(*profile, name, 0);
+    
+    if (journal) {
+        journal->appendProfile(*snapshot);
+    }
     
-    // If this is the active profile, we need to log the change
-    if (name == activeProfileName) {
-        auto event = std::make_shared<ProfileChangeEvent>(time(nullptr), name, name);
-        logEvent(event);
+    // If this is the active profile, the new version takes over
+    if (name == activeProfile->getName()) {
+        eventHistory.logProfileChange(clock->now(), name, name, snapshot->getVersion());
+        publishActiveProfile(snapshot);
+        updateScheduledBasal("Profile change");
     }
     
     return true;
 }
 
 bool TSlimX2Pump::deleteProfile(const std::string& name) {
+    PUMP_METRIC(PROFILE_COMMAND);
+    CommandGuard guard(*this);
     if (name == "Default" || name.empty() || profiles.find(name) == profiles.end()) {
         return false; // Cannot delete default profile or profile doesn't exist
     }
     
     // If this is the active profile, switch to Default
-    if (name == activeProfileName) {
+    if (name == activeProfile->getName()) {
         activateProfile("Default");
     }
     
     profiles.erase(name);
+    
+    if (journal) {
+        journal->appendProfileDeleted(name);
+    }
     return true;
 }
 
 bool TSlimX2Pump::activateProfile(const std::string& name) {
-    if (name.empty() || profiles.find(name) == profiles.end()) {
+    PUMP_METRIC(PROFILE_COMMAND);
+    CommandGuard guard(*this);
+    auto it = profiles.find(name);
+    if (name.empty() || it == profiles.end()) {
         return false; // Profile doesn't exist
     }
     
     // Log profile change
-    auto event = std::make_shared<ProfileChangeEvent>(time(nullptr), activeProfileName, name);
-    logEvent(event);
+    eventHistory.logProfileChange(clock->now(), activeProfile->getName(), name, it->second->getVersion());
     
-    std::string oldProfileName = activeProfileName;
-    activeProfileName = name;
-    
-    // Update basal rate if we're currently delivering
-    if (currentState == DELIVERING_BASAL) {
-        time_t now = time(nullptr);
-        struct tm* timeinfo = localtime(&now);
-        
-        auto oldProfile = getProfile(oldProfileName);
-        auto newProfile = getProfile(name);
-        
-        float oldRate = oldProfile->getBasalRate(timeinfo->tm_hour, timeinfo->tm_min);
-        float newRate = newProfile->getBasalRate(timeinfo->tm_hour, timeinfo->tm_min);
-        
-        if (oldRate != newRate) {
-            auto event = std::make_shared<BasalChangeEvent>(now, oldRate, newRate, "Profile change");
-            logEvent(event);
-        }
-    }
+    // Follow the new schedule from now, logging the rate change if delivering
+    publishActiveProfile(it->second);
+    updateScheduledBasal("Profile change");
     
     return true;
 }
 
 std::string TSlimX2Pump::getActiveProfileName() const {
-    return activeProfileName;
+    return std::atomic_load(&activeProfile)->getName();
 }
 
-std::shared_ptr<Profile> TSlimX2Pump::getActiveProfile() const {
-    auto it = profiles.find(activeProfileName);
-    if (it != profiles.end()) {
-        return it->second;
-    }
-    return nullptr;
+std::shared_ptr<const Profile> TSlimX2Pump::getActiveProfile() const {
+    return std::atomic_load(&activeProfile);
+}
+
+uint32_t TSlimX2Pump::getActiveProfileVersion() const {
+    return status.load().activeProfileVersion;
+}
+
+std::shared_ptr<const Profile> TSlimX2Pump::getProfileVersion(uint32_t version) const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex);
+    auto it = activeVersions.find(version);
+    return it != activeVersions.end() ? it->second : nullptr;
 }
 
 bool TSlimX2Pump::deliverBolus(float units, bool extended, int durationMinutes) {
+    PUMP_METRIC(DELIVER_BOLUS);
+    CommandGuard guard(*this);
     // Check various safety conditions
     if (currentState == OFF || currentState == SLEEP || currentState == ERROR) {
         return false;
@@ -259,23 +422,37 @@ bool TSlimX2Pump::deliverBolus(float units, bool extended, int durationMinutes)
         return false;
     }
     
-    if (extended && durationMinutes <= 0) {
-        return false;
+    if (extended && (durationMinutes <= 0 || extendedBolusRemaining > 0)) {
+        return false; // Only one extended bolus can run at a time
     }
     
     // Set up the bolus type
     BolusEvent::BolusType bolusType = extended ? 
         BolusEvent::EXTENDED : BolusEvent::MANUAL;
     
+    startBolus(units, bolusType, durationMinutes);
+    return true;
+}
+
+void TSlimX2Pump::startBolus(float units, BolusEvent::BolusType bolusType, int durationMinutes) {
     // Log the bolus event
-    auto event = std::make_shared<BolusEvent>(time(nullptr), bolusType, units, durationMinutes);
-    logEvent(event);
+    time_t now = clock->now();
+    size_t bolusIndex = eventHistory.logBolus(now, bolusType, units, durationMinutes);
     
-    // Update pump state
+    // Update pump state; extended boluses are pumped as time advances
+    updateInsulinOnBoard();
     currentState = DELIVERING_BOLUS;
-    insulinLevel -= units;
-    insulinOnBoard += units;
-    lastBolusTime = time(nullptr);
+    if (bolusType == BolusEvent::EXTENDED) {
+        extendedBolusRemaining = units;
+        extendedBolusRate = units / (durationMinutes * 60.0f);
+        eventHistory.setAnchor(bolusIndex); // Followed through late inserts
+        extendedBolusTimer = deliveryTimers.schedule(now + durationMinutes * 60, EXTENDED_BOLUS_TIMER);
+    } else {
+        insulinLevel -= units;
+        insulinOnBoard.addDose(units);
+        totalInsulinDelivered += units;
+    }
+    lastBolusTime = now;
     lastBolusAmount = units;
     
     // Check if insulin is running low
@@ -284,53 +461,42 @@ bool TSlimX2Pump::deliverBolus(float units, bool extended, int durationMinutes)
         errorMessage = "Low insulin reservoir";
     }
     
-    // After bolus delivery is complete, return to basal delivery
-    // In a real implementation, this would be handled by a timer or thread
-    // For this simulation, we'll just transition immediately
-    if (!extended) {
+    // A standard bolus is pumped at once; an extended one returns the pump
+    // to basal delivery when its timer fires
+    if (extendedBolusRemaining <= 0) {
         currentState = DELIVERING_BASAL;
     }
-    
-    return true;
 }
 
 bool TSlimX2Pump::cancelBolus() {
+    PUMP_METRIC(CANCEL_BOLUS);
+    CommandGuard guard(*this);
     if (currentState != DELIVERING_BOLUS) {
         return false; // No active bolus to cancel
     }
     
-    // Find the most recent uncancelled bolus event
-    for (auto it = eventHistory.rbegin(); it != eventHistory.rend(); ++it) {
-        auto bolusEvent = std::dynamic_pointer_cast<BolusEvent>(*it);
-        if (bolusEvent && !bolusEvent->isCancelled()) {
-            // Cancel this bolus
-            bolusEvent->setCancelled(true);
-            
-            // Calculate how much insulin was actually delivered
-            // For simplicity, we'll assume half was delivered if cancelled
-            float undeliveredInsulin = bolusEvent->getUnits() / 2.0;
-            
-            // Add the undelivered insulin back to the reservoir
-            insulinLevel += undeliveredInsulin;
-            
-            // Adjust insulin on board
-            insulinOnBoard -= undeliveredInsulin;
-            
-            // Log the cancellation
-            auto event = std::make_shared<SuspendEvent>(time(nullptr), "Bolus cancelled");
-            logEvent(event);
-            
-            // Return to basal delivery
-            currentState = DELIVERING_BASAL;
-            
-            return true;
-        }
+    // The history anchors the running extended bolus, no scan needed
+    if (eventHistory.getAnchor() == EventLog::NPOS) {
+        return false;
     }
     
-    return false; // No bolus found to cancel
+    // Stop the undelivered remainder; it never left the reservoir
+    // and what was already pumped stays on board
+    updateInsulinOnBoard();
+    stopExtendedBolus();
+    
+    // Log the cancellation
+    eventHistory.logSuspend(clock->now(), "Bolus cancelled");
+    
+    // Return to basal delivery
+    currentState = DELIVERING_BASAL;
+    
+    return true;
 }
 
 bool TSlimX2Pump::startBasal() {
+    PUMP_METRIC(BASAL_COMMAND);
+    CommandGuard guard(*this);
     if (currentState == OFF || currentState == SLEEP || currentState == ERROR) {
         return false;
     }
@@ -344,34 +510,34 @@ bool TSlimX2Pump::startBasal() {
     currentState = DELIVERING_BASAL;
     
     // Log the basal start event
-    auto profile = getActiveProfile();
-    if (profile) {
-        time_t now = time(nullptr);
-        struct tm* timeinfo = localtime(&now);
-        float rate = profile->getBasalRate(timeinfo->tm_hour, timeinfo->tm_min);
-        
-        auto event = std::make_shared<BasalChangeEvent>(now, 0.0, rate, "Basal started");
-        logEvent(event);
-    }
+    time_t now = clock->now();
+    eventHistory.logBasalChange(now, 0.0f, getScheduledBasalRate(now), "Basal started");
     
     return true;
 }
 
 bool TSlimX2Pump::stopBasal() {
+    PUMP_METRIC(BASAL_COMMAND);
+    CommandGuard guard(*this);
     if (currentState != DELIVERING_BASAL && currentState != DELIVERING_BOLUS) {
         return false; // Not delivering insulin
     }
     
+    // Stopping insulin also stops a running extended bolus and temp basal
     currentState = SUSPENDED;
+    stopExtendedBolus();
+    endTempBasal(nullptr);
+    resetControlIQ("User stopped insulin"); // Resuming restarts from the schedule
     
     // Log the stop event
-    auto event = std::make_shared<SuspendEvent>(time(nullptr), "User stopped insulin");
-    logEvent(event);
+    eventHistory.logSuspend(clock->now(), "User stopped insulin");
     
     return true;
 }
 
 bool TSlimX2Pump::resumeBasal() {
+    PUMP_METRIC(BASAL_COMMAND);
+    CommandGuard guard(*this);
     if (currentState != SUSPENDED) {
         return false; // Not suspended
     }
@@ -385,27 +551,61 @@ bool TSlimX2Pump::resumeBasal() {
     currentState = DELIVERING_BASAL;
     
     // Log the resume event
-    auto profile = getActiveProfile();
-    if (profile) {
-        time_t now = time(nullptr);
-        struct tm* timeinfo = localtime(&now);
-        float rate = profile->getBasalRate(timeinfo->tm_hour, timeinfo->tm_min);
-        
-        auto event = std::make_shared<ResumeEvent>(now, "User resumed insulin");
-        logEvent(event);
-        
-        auto basal_event = std::make_shared<BasalChangeEvent>(now, 0.0, rate, "Basal resumed");
-        logEvent(basal_event);
-    }
+    time_t now = clock->now();
+    eventHistory.logResume(now, "User resumed insulin");
+    
+    eventHistory.logBasalChange(now, 0.0f, getScheduledBasalRate(now), "Basal resumed");
     
     return true;
 }
 
 float TSlimX2Pump::getInsulinOnBoard() const {
-    return insulinOnBoard;
+    return status.load().insulinOnBoard;
+}
+
+bool TSlimX2Pump::startTempBasal(float percent, int durationMinutes) {
+    PUMP_METRIC(BASAL_COMMAND);
+    CommandGuard guard(*this);
+    if (currentState != DELIVERING_BASAL && currentState != DELIVERING_BOLUS) {
+        return false;
+    }
+    
+    if (controlIQEnabled) {
+        return false; // Control-IQ sets the rate itself
+    }
+    
+    if (percent < 0.0f || percent > 250.0f || durationMinutes < 15 || durationMinutes > 72 * 60) {
+        return false;
+    }
+    
+    time_t now = clock->now();
+    float oldRate = adjustedBasalRate(scheduledBasalRate);
+    deliveryTimers.cancel(tempBasalTimer);
+    tempBasalPercent = percent;
+    tempBasalEndTime = now + durationMinutes * 60;
+    tempBasalTimer = deliveryTimers.schedule(tempBasalEndTime, TEMP_BASAL_TIMER);
+    
+    eventHistory.logBasalChange(now, oldRate, adjustedBasalRate(scheduledBasalRate), "Temp basal started");
+    return true;
+}
+
+bool TSlimX2Pump::cancelTempBasal() {
+    PUMP_METRIC(BASAL_COMMAND);
+    CommandGuard guard(*this);
+    if (tempBasalPercent < 0) {
+        return false;
+    }
+    
+    endTempBasal("Temp basal cancelled");
+    return true;
+}
+
+float TSlimX2Pump::getTempBasalPercent() const {
+    return status.load().tempBasalPercent;
 }
 
 bool TSlimX2Pump::enableControlIQ() {
+    CommandGuard guard(*this);
     if (currentState == OFF || currentState == ERROR) {
         return false;
     }
@@ -414,41 +614,883 @@ bool TSlimX2Pump::enableControlIQ() {
         return false; // Control IQ requires CGM
     }
     
+    endTempBasal("Temp basal cancelled");
     controlIQEnabled = true;
     return true;
 }
 
 bool TSlimX2Pump::disableControlIQ() {
+    CommandGuard guard(*this);
+    if (controlIQEnabled) {
+        resetControlIQ("Control-IQ disabled");
+    }
     controlIQEnabled = false;
     return true;
 }
 
 bool TSlimX2Pump::isControlIQEnabled() const {
-    return controlIQEnabled;
+    return status.load().controlIQEnabled;
+}
+
+void TSlimX2Pump::setControlIQSettings(const ControlIQ::Settings& settings) {
+    CommandGuard guard(*this);
+    controlIQSettings = settings;
+}
+
+const ControlIQ::Settings& TSlimX2Pump::getControlIQSettings() const {
+    return controlIQSettings;
+}
+
+ControlIQ::Action TSlimX2Pump::getControlIQAction() const {
+    return status.load().controlIQAction;
+}
+
+float TSlimX2Pump::getCurrentBasalRate() {
+    CommandGuard guard(*this);
+    if (currentState != DELIVERING_BASAL && currentState != DELIVERING_BOLUS) {
+        return 0.0f;
+    }
+    return adjustedBasalRate(getScheduledBasalRate(clock->now()));
+}
+
+void TSlimX2Pump::setControlIQBatched(bool batched) {
+    CommandGuard guard(*this);
+    controlIQBatched = batched;
+}
+
+bool TSlimX2Pump::getControlIQInput(int predictionMinutes, ControlIQ::Input& input) {
+    CommandGuard guard(*this);
+    if (!controlIQEnabled || !cgmConnected || currentGlucose <= 0) {
+        return false;
+    }
+    if (currentState != DELIVERING_BASAL && currentState != DELIVERING_BOLUS) {
+        return false; // Suspended by the user or stopped for an error
+    }
+    
+    time_t now = clock->now();
+    const Profile::Settings& settings = activeProfile->getSettings(localMinuteOfDay(now));
+    updateInsulinOnBoard();
+    
+    // Without a reading history there is no trend; hold the current value
+    float predicted = currentGlucose;
+    if (cgmData && cgmData->getReadingCount() >= 2) {
+        predicted = cgmData->predictGlucose(predictionMinutes);
+    }
+    
+    input.predictedGlucose = predicted;
+    input.insulinOnBoard = currentInsulinOnBoard();
+    input.scheduledBasal = settings.basalRate;
+    input.correctionFactor = settings.correctionFactor;
+    input.targetGlucose = settings.targetGlucose;
+    input.minutesSinceCorrection = lastAutoCorrectionTime > 0
+        ? static_cast<int32_t>(std::min<time_t>((now - lastAutoCorrectionTime) / 60, INT32_MAX))
+        : INT32_MAX;
+    return true;
+}
+
+void TSlimX2Pump::applyControlIQDecision(const ControlIQ::Decision& decision) {
+    CommandGuard guard(*this);
+    if (!controlIQEnabled || (currentState != DELIVERING_BASAL && currentState != DELIVERING_BOLUS)) {
+        return;
+    }
+    
+    time_t now = clock->now();
+    float scheduled = getScheduledBasalRate(now);
+    float oldRate = controlIQBasalRate >= 0 ? controlIQBasalRate : scheduled;
+    float newRate = decision.action == ControlIQ::SCHEDULED ? scheduled : decision.basalRate;
+    
+    // Log suspensions and resumptions as such; otherwise only rate changes
+    // the pump could actually deliver differently
+    if (decision.action == ControlIQ::SUSPEND && controlIQAction != ControlIQ::SUSPEND) {
+        eventHistory.logSuspend(now, "Control-IQ: predicted low");
+    } else if (decision.action != ControlIQ::SUSPEND && controlIQAction == ControlIQ::SUSPEND) {
+        eventHistory.logResume(now, "Control-IQ: glucose recovering");
+        eventHistory.logBasalChange(now, 0.0f, newRate, "Control-IQ resumed");
+    } else if (decision.action != ControlIQ::SUSPEND && std::fabs(newRate - oldRate) >= 0.05f) {
+        static const char* reasons[] = {
+            "Control-IQ scheduled", "Control-IQ suspend", "Control-IQ decrease", "Control-IQ increase"
+        };
+        eventHistory.logBasalChange(now, oldRate, newRate, reasons[decision.action]);
+    }
+    
+    controlIQAction = decision.action;
+    controlIQBasalRate = decision.action == ControlIQ::SCHEDULED ? -1.0f : newRate;
+    
+    if (decision.correctionBolus > 0 && insulinLevel >= decision.correctionBolus) {
+        startBolus(decision.correctionBolus, BolusEvent::CORRECTION, 0);
+        lastAutoCorrectionTime = now;
+    }
+}
+
+void TSlimX2Pump::runControlIQ() {
+    PUMP_METRIC(CONTROL_IQ);
+    ControlIQ::Input input;
+    if (getControlIQInput(controlIQSettings.predictionMinutes, input)) {
+        applyControlIQDecision(ControlIQ::evaluate(controlIQSettings, input));
+    }
+}
+
+void TSlimX2Pump::resetControlIQ(const char* reason) {
+    // Hand delivery back to the profile schedule
+    if (controlIQBasalRate >= 0 && (currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS)) {
+        time_t now = clock->now();
+        if (controlIQAction == ControlIQ::SUSPEND) {
+            eventHistory.logResume(now, reason);
+        }
+        eventHistory.logBasalChange(now, controlIQBasalRate, getScheduledBasalRate(now), reason);
+    }
+    controlIQAction = ControlIQ::SCHEDULED;
+    controlIQBasalRate = -1.0f;
 }
 
 float TSlimX2Pump::calculateSuggestedBolus(float currentGlucose, float carbIntake) {
-    auto profile = getActiveProfile();
-    if (!profile) {
-        return 0.0;
+    PUMP_METRIC(CALCULATE_SUGGESTED_BOLUS);
+    CommandGuard guard(*this);
+    // Get current settings from the active snapshot in a single lookup
+    const Profile::Settings& settings = activeProfile->getSettings(localMinuteOfDay(clock->now()));
+    
+    // Account for insulin still active from previous boluses
+    updateInsulinOnBoard();
+    return BolusCalculator::calculate(settings, currentGlucose, carbIntake, currentInsulinOnBoard());
+}
+
+bool TSlimX2Pump::connectCGM() {
+    CommandGuard guard(*this);
+    if (currentState == OFF) {
+        return false;
+    }
+    
+    cgmConnected = true;
+    
+    if (currentError == CGM_DISCONNECTION) {
+        currentError = NONE;
+        errorMessage = "";
+    }
+    
+    return true;
+}
+
+bool TSlimX2Pump::disconnectCGM() {
+    CommandGuard guard(*this);
+    if (!cgmConnected) {
+        return false;
+    }
+    
+    cgmConnected = false;
+    
+    // Control IQ cannot run without sensor data
+    if (controlIQEnabled) {
+        resetControlIQ("CGM disconnected");
+    }
+    controlIQEnabled = false;
+    
+    return true;
+}
+
+bool TSlimX2Pump::isCGMConnected() const {
+    return status.load().cgmConnected;
+}
+
+float TSlimX2Pump::getCurrentGlucose() const {
+    return status.load().currentGlucose;
+}
+
+void TSlimX2Pump::updateCGMData(float glucoseValue) {
+    CommandGuard guard(*this);
+    recordCGMReading(glucoseValue);
+}
+
+void TSlimX2Pump::recordCGMReading(float glucoseValue) {
+    PUMP_METRIC(UPDATE_CGM);
+    if (!cgmConnected || glucoseValue <= 0) {
+        return;
     }
     
-    time_t now = time(nullptr);
-    struct tm* timeinfo = localtime(&now);
+    time_t now = clock->now();
+    currentGlucose = glucoseValue;
     
-    // Get current settings from profile
-    float carbRatio = profile->getCarbRatio(timeinfo->tm_hour, timeinfo->tm_min);
-    float correctionFactor = profile->getCorrectionFactor(timeinfo->tm_hour, timeinfo->tm_min);
-    float targetGlucose = profile->getTargetGlucose(timeinfo->tm_hour, timeinfo->tm_min);
+    if (cgmData) {
+        cgmData->addReading(glucoseValue, now);
+    }
     
-    // Calculate food component
-    float foodBolus = carbIntake / carbRatio;
+    eventHistory.logCGMReading(now, glucoseValue);
     
-    // Calculate correction component
-    float glucoseDifference = currentGlucose - targetGlucose;
-    float correctionBolus = 0.0;
-    if (glucoseDifference > 0) {
-        correctionBolus = glucoseDifference / correctionFactor;
+    // Raise glucose alarms once per excursion
+    if (glucoseValue < 3.9) {
+        if (!lowGlucoseAlarmActive) {
+            eventHistory.logAlarm(now, AlarmEvent::LOW_GLUCOSE, "Glucose below 3.9 mmol/L");
+            lowGlucoseAlarmActive = true;
+        }
+    } else {
+        lowGlucoseAlarmActive = false;
+    }
+    
+    if (glucoseValue > 13.9) {
+        if (!highGlucoseAlarmActive) {
+            eventHistory.logAlarm(now, AlarmEvent::HIGH_GLUCOSE, "Glucose above 13.9 mmol/L");
+            highGlucoseAlarmActive = true;
+        }
+    } else {
+        highGlucoseAlarmActive = false;
     }
     
-    // Account for
+    if (controlIQEnabled && !controlIQBatched) {
+        runControlIQ();
+    }
+}
+
+void TSlimX2Pump::attachCGMData(std::shared_ptr<CGMData> cgmData) {
+    CommandGuard guard(*this);
+    this->cgmData = cgmData;
+}
+
+std::shared_ptr<CGMData> TSlimX2Pump::getCGMData() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex);
+    return cgmData;
+}
+
+void TSlimX2Pump::setGlucoseSource(GlucoseSource source) {
+    CommandGuard guard(*this);
+    glucoseSource = source;
+}
+
+bool TSlimX2Pump::runUntil(time_t endTime) {
+    PUMP_METRIC(RUN_UNTIL);
+    CommandGuard guard(*this);
+    if (!virtualClock || endTime < virtualClock->now()) {
+        return false; // Fast-forward needs a virtual clock
+    }
+    
+    updateInsulinOnBoard();
+    if (nextCGMTime <= virtualClock->now()) {
+        nextCGMTime = virtualClock->now() + CGM_INTERVAL;
+    }
+    
+    while (virtualClock->now() < endTime) {
+        time_t stepEnd = std::min(virtualClock->now() + SIMULATION_STEP, endTime);
+        
+        // Timers due within the step fire at their own times, in order
+        TimerWheel::Timer timer;
+        while (deliveryTimers.expire(stepEnd, timer)) {
+            advanceDelivery(timer.when);
+            fireDeliveryTimer(timer);
+            scheduleDelivery();
+        }
+        advanceDelivery(stepEnd);
+        updateInsulinOnBoard();
+        
+        // Sample the sensor on its own cadence; without a source, readings
+        // arrive through updateCGMData (e.g. from a recorded trace). Status
+        // readers follow a long fast-forward at the same cadence.
+        if (virtualClock->now() >= nextCGMTime) {
+            nextCGMTime += CGM_INTERVAL;
+            if (cgmConnected && glucoseSource) {
+                recordCGMReading(glucoseSource(virtualClock->now()));
+                scheduleDelivery();
+            }
+            if (virtualClock->now() < endTime) {
+                publishStatus();
+            }
+        }
+    }
+    
+    return true;
+}
+
+std::vector<std::shared_ptr<Event>> TSlimX2Pump::getHistory(time_t startTime, time_t endTime) {
+    PUMP_METRIC(GET_HISTORY);
+    CommandGuard guard(*this);
+    // Event objects are only built for the records being returned
+    EventLog::RecordView range = eventHistory.getRange(startTime, endTime);
+    std::vector<std::shared_ptr<Event>> result;
+    result.reserve(range.size());
+    for (size_t i = 0; i < range.size(); i++) {
+        result.push_back(eventHistory.materialize(range.getLogIndex(i)));
+    }
+    return result;
+}
+
+EventLog::RecordView TSlimX2Pump::getHistoryView(time_t startTime, time_t endTime) const {
+    PUMP_METRIC(GET_HISTORY_VIEW);
+    return eventHistory.getRange(startTime, endTime);
+}
+
+EventLog::TypeView TSlimX2Pump::getHistoryByType(Event::EventType type, time_t startTime, time_t endTime) const {
+    PUMP_METRIC(GET_HISTORY_VIEW);
+    return eventHistory.getByType(type, startTime, endTime);
+}
+
+std::vector<std::shared_ptr<Event>> TSlimX2Pump::getRecentEvents(int count) {
+    PUMP_METRIC(GET_HISTORY);
+    CommandGuard guard(*this);
+    std::vector<std::shared_ptr<Event>> result;
+    for (size_t i = eventHistory.size(); i-- > 0 && count > 0; --count) {
+        result.push_back(eventHistory.materialize(i));
+    }
+    return result;
+}
+
+const EventLog& TSlimX2Pump::getEventLog() const {
+    return eventHistory;
+}
+
+float TSlimX2Pump::getLastBolusAmount() const {
+    return status.load().lastBolusAmount;
+}
+
+time_t TSlimX2Pump::getLastBolusTime() const {
+    return status.load().lastBolusTime;
+}
+
+double TSlimX2Pump::getTotalInsulinDelivered() const {
+    return status.load().totalInsulinDelivered;
+}
+
+bool TSlimX2Pump::restoreFromJournal(const std::string& path) {
+    PUMP_METRIC(JOURNAL_RESTORE);
+    CommandGuard guard(*this);
+    if (journal) {
+        return false; // Replaying would echo every record into the attached journal
+    }
+    
+    JournalReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    
+    // Size the containers up front; most records are events
+    size_t estimate = reader.getFileSize() / (sizeof(Journal::RecordHeader) + sizeof(Journal::EventPayload));
+    eventHistory.clear();
+    eventHistory.reserve(estimate);
+    if (cgmData) {
+        cgmData->reserve(cgmData->getReadingCount() + estimate);
+    }
+    
+    // History is replaced, and with it the versions it refers to
+    std::string activeName = activeProfile->getName();
+    std::map<uint32_t, std::shared_ptr<const Profile>> snapshots;
+    std::vector<uint32_t> activated;
+    activeVersions.clear();
+    
+    JournalReader::Entry entry;
+    Journal::EventPayload event;
+    Journal::CancelledPayload cancelled;
+    Journal::StatePayload state;
+    Journal::TempBasalPayload tempBasal = {};
+    std::string_view text, secondText;
+    
+    while (reader.next(entry)) {
+        switch (entry.type) {
+            case Journal::EVENT: {
+                if (!JournalReader::decodeEvent(entry, event, text, secondText)) {
+                    break;
+                }
+                EventLog::Record record = {};
+                record.timestamp = static_cast<time_t>(event.timestamp);
+                record.value = event.value;
+                record.newValue = event.newValue;
+                record.duration = event.duration;
+                record.type = event.type;
+                record.subtype = event.subtype;
+                record.flags = event.flags;
+                eventHistory.appendRecord(record, text, secondText);
+                
+                if (record.type == Event::CGM_READING) {
+                    currentGlucose = record.value;
+                    if (cgmData) {
+                        cgmData->addReading(record.value, record.timestamp);
+                    }
+                } else if (record.type == Event::PROFILE_CHANGE) {
+                    activeName.assign(secondText);
+                    activated.push_back(static_cast<uint32_t>(record.duration));
+                }
+                break;
+            }
+            case Journal::CANCELLED:
+                if (JournalReader::decodeCancelled(entry, cancelled)) {
+                    eventHistory.setCancelled(static_cast<size_t>(cancelled.index), cancelled.cancelled != 0);
+                }
+                break;
+            case Journal::PROFILE: {
+                auto profile = JournalReader::decodeProfile(entry);
+                if (profile) {
+                    // Older journals carry no version; those get a new one
+                    auto snapshot = storeProfile(*profile, profile->getName(), profile->getVersion());
+                    snapshots[snapshot->getVersion()] = snapshot;
+                }
+                break;
+            }
+            case Journal::PROFILE_DELETED:
+                if (JournalReader::decodeProfileDeleted(entry, text) && text != "Default") {
+                    profiles.erase(std::string(text));
+                }
+                break;
+            case Journal::STATE:
+                if (!JournalReader::decodeState(entry, state, text, tempBasal)) {
+                    break;
+                }
+                currentState = static_cast<State>(state.state);
+                currentError = static_cast<ErrorType>(state.error);
+                batteryLevel = state.batteryLevel;
+                insulinLevel = state.insulinLevel;
+                insulinOnBoard.setCompartments(state.insulinDepot, state.insulinPlasma);
+                lastAbsorptionTime = static_cast<time_t>(state.timestamp);
+                extendedBolusRemaining = state.extendedBolusRemaining;
+                extendedBolusRate = state.extendedBolusRate;
+                eventHistory.setAnchor(static_cast<size_t>(state.activeBolusIndex));
+                lastBolusTime = static_cast<time_t>(state.lastBolusTime);
+                lastBolusAmount = state.lastBolusAmount;
+                currentGlucose = state.currentGlucose;
+                cgmConnected = state.cgmConnected != 0;
+                controlIQEnabled = state.controlIQEnabled != 0;
+                activeName.assign(text);
+                break;
+        }
+    }
+    
+    // A seeded journal holds profiles after the events that activated them
+    for (uint32_t version : activated) {
+        auto it = snapshots.find(version);
+        if (it != snapshots.end()) {
+            activeVersions[version] = it->second;
+        }
+    }
+    auto active = profiles.find(activeName);
+    if (active == profiles.end()) {
+        active = profiles.find("Default");
+    }
+    publishActiveProfile(active->second);
+    if (eventHistory.getAnchor() >= eventHistory.size()) {
+        eventHistory.setAnchor(EventLog::NPOS);
+    }
+    lowGlucoseAlarmActive = currentGlucose > 0 && currentGlucose < 3.9f;
+    highGlucoseAlarmActive = currentGlucose > 13.9f;
+    
+    // Timers are not journaled; rebuild them from the restored state. Only
+    // a delivering pump can have an extended bolus or temp basal running.
+    deliveryTimers.clear();
+    pulseTimer = TimerWheel::NO_TIMER;
+    extendedBolusTimer = TimerWheel::NO_TIMER;
+    tempBasalTimer = TimerWheel::NO_TIMER;
+    tempBasalPercent = -1.0f;
+    tempBasalEndTime = 0;
+    deliveryRate = 0.0f;
+    pulseAccrued = 0.0f;
+    updateScheduledBasal(nullptr);
+    if (currentState == DELIVERING_BOLUS && extendedBolusRemaining > 0 && extendedBolusRate > 0) {
+        time_t remaining = static_cast<time_t>(std::ceil(extendedBolusRemaining / extendedBolusRate));
+        extendedBolusTimer = deliveryTimers.schedule(clock->now() + remaining, EXTENDED_BOLUS_TIMER);
+    } else {
+        extendedBolusRemaining = 0.0f;
+        extendedBolusRate = 0.0f;
+        eventHistory.setAnchor(EventLog::NPOS);
+    }
+    
+    // A temp basal keeps its end time; one that ran out while the pump was
+    // down ends on the first delivery step
+    bool delivering = currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS;
+    if (delivering && !controlIQEnabled && tempBasal.endTime > 0 && tempBasal.percent >= 0) {
+        tempBasalPercent = tempBasal.percent;
+        tempBasalEndTime = static_cast<time_t>(tempBasal.endTime);
+        tempBasalTimer = deliveryTimers.schedule(std::max(tempBasalEndTime, clock->now()), TEMP_BASAL_TIMER);
+    }
+    
+    return true;
+}
+
+bool TSlimX2Pump::attachJournal(std::shared_ptr<JournalWriter> journal) {
+    CommandGuard guard(*this);
+    if (!journal || !journal->isOpen()) {
+        return false;
+    }
+    
+    // Cancellation records refer to log indices, so the journal must hold
+    // exactly this pump's history; a fresh journal is seeded with it and
+    // with the current profile versions (later versions are appended as
+    // they are stored)
+    if (journal->getEventCount() == 0) {
+        for (size_t i = 0; i < eventHistory.size(); i++) {
+            journal->appendEvent(eventHistory, i);
+        }
+        for (const auto& pair : profiles) {
+            journal->appendProfile(*pair.second);
+        }
+    } else if (journal->getEventCount() != eventHistory.size()) {
+        return false;
+    }
+    
+    detachJournal();
+    this->journal = journal;
+    eventHistory.setJournal(journal.get());
+    checkpointJournal();
+    return true;
+}
+
+void TSlimX2Pump::detachJournal() {
+    CommandGuard guard(*this);
+    if (!journal) {
+        return;
+    }
+    
+    checkpointJournal();
+    journal->flush();
+    eventHistory.setJournal(nullptr);
+    journal.reset();
+}
+
+void TSlimX2Pump::checkpointJournal() {
+    PUMP_METRIC(JOURNAL_CHECKPOINT);
+    CommandGuard guard(*this);
+    if (!journal) {
+        return;
+    }
+    
+    Journal::StatePayload state = {};
+    state.timestamp = static_cast<int64_t>(lastAbsorptionTime);
+    state.lastBolusTime = static_cast<int64_t>(lastBolusTime);
+    state.activeBolusIndex = static_cast<uint64_t>(eventHistory.getAnchor());
+    state.batteryLevel = batteryLevel;
+    state.insulinLevel = insulinLevel;
+    insulinOnBoard.getCompartments(state.insulinDepot, state.insulinPlasma);
+    state.currentGlucose = currentGlucose;
+    state.lastBolusAmount = lastBolusAmount;
+    state.extendedBolusRemaining = extendedBolusRemaining;
+    state.extendedBolusRate = extendedBolusRate;
+    state.state = static_cast<uint8_t>(currentState);
+    state.error = static_cast<uint8_t>(currentError);
+    state.cgmConnected = cgmConnected ? 1 : 0;
+    state.controlIQEnabled = controlIQEnabled ? 1 : 0;
+    
+    Journal::TempBasalPayload tempBasal = {};
+    if (tempBasalPercent >= 0) {
+        tempBasal.endTime = static_cast<int64_t>(tempBasalEndTime);
+        tempBasal.percent = tempBasalPercent;
+    }
+    journal->appendState(state, activeProfile->getName(), tempBasal);
+}
+
+TSlimX2Pump::ErrorType TSlimX2Pump::getErrorState() const {
+    return status.load().error;
+}
+
+std::string TSlimX2Pump::getErrorMessage() const {
+    std::lock_guard<std::recursive_mutex> lock(commandMutex);
+    return errorMessage;
+}
+
+bool TSlimX2Pump::clearError() {
+    CommandGuard guard(*this);
+    if (currentError == NONE) {
+        return false;
+    }
+    
+    currentError = NONE;
+    errorMessage = "";
+    
+    if (currentState == ERROR) {
+        currentState = ON;
+    }
+    
+    return true;
+}
+
+bool TSlimX2Pump::reportOcclusion() {
+    CommandGuard guard(*this);
+    if (currentState == OFF || currentState == ERROR) {
+        return false;
+    }
+    
+    time_t now = clock->now();
+    updateInsulinOnBoard();
+    resetControlIQ("Occlusion detected");
+    
+    // The rest of an extended bolus never left the reservoir
+    stopExtendedBolus();
+    endTempBasal(nullptr);
+    
+    currentState = ERROR;
+    currentError = OCCLUSION;
+    errorMessage = "Occlusion detected";
+    
+    eventHistory.logAlarm(now, AlarmEvent::OCCLUSION, "Occlusion detected");
+    eventHistory.logSuspend(now, "Occlusion detected");
+    
+    return true;
+}
+
+TSlimX2Pump::State TSlimX2Pump::getState() const {
+    return status.load().state;
+}
+
+TSlimX2Pump::Status TSlimX2Pump::getStatus() const {
+    return status.load();
+}
+
+void TSlimX2Pump::publishStatus() {
+    Status snapshot;
+    snapshot.timestamp = clock->now();
+    snapshot.state = currentState;
+    snapshot.error = currentError;
+    snapshot.batteryLevel = batteryLevel;
+    snapshot.insulinLevel = insulinLevel;
+    snapshot.insulinOnBoard = currentInsulinOnBoard();
+    snapshot.currentGlucose = currentGlucose;
+    snapshot.lastBolusAmount = lastBolusAmount;
+    snapshot.tempBasalPercent = tempBasalPercent;
+    snapshot.activeProfileVersion = activeProfile->getVersion();
+    snapshot.lastBolusTime = lastBolusTime;
+    snapshot.totalInsulinDelivered = totalInsulinDelivered;
+    snapshot.controlIQAction = controlIQAction;
+    snapshot.cgmConnected = cgmConnected;
+    snapshot.controlIQEnabled = controlIQEnabled;
+    status.store(snapshot);
+}
+
+std::shared_ptr<const Profile> TSlimX2Pump::storeProfile(const Profile& profile, const std::string& name,
+                                                         uint32_t version) {
+    // The pump keeps its own copy, so no caller can change a stored version
+    auto snapshot = std::make_shared<Profile>(profile);
+    snapshot->setName(name);
+    snapshot->setVersion(version != 0 ? version : nextProfileVersion);
+    nextProfileVersion = std::max(nextProfileVersion, snapshot->getVersion() + 1);
+    profiles[name] = snapshot;
+    return snapshot;
+}
+
+void TSlimX2Pump::publishActiveProfile(std::shared_ptr<const Profile> profile) {
+    // Keep every version that has been active for history to refer to
+    activeVersions[profile->getVersion()] = profile;
+    std::atomic_store(&activeProfile, std::move(profile));
+}
+
+float TSlimX2Pump::currentInsulinOnBoard() const {
+    // Net IOB can dip below zero after a suspension; report only positive insulin
+    return std::max(0.0f, insulinOnBoard.getInsulinOnBoard());
+}
+
+void TSlimX2Pump::updateInsulinOnBoard() {
+    // Bring insulin on board up to the current clock time
+    time_t now = clock->now();
+    if (now > lastAbsorptionTime) {
+        simulateInsulinAbsorption(now - lastAbsorptionTime);
+    }
+    lastAbsorptionTime = now;
+}
+
+bool TSlimX2Pump::checkSafety() const {
+    if (currentState == ERROR || currentError == CRITICAL_ERROR) {
+        return false;
+    }
+    return batteryLevel > 0 && insulinLevel > 0;
+}
+
+void TSlimX2Pump::simulateInsulinAbsorption(time_t elapsedSeconds) {
+    if (elapsedSeconds <= 0) {
+        return;
+    }
+    
+    // The curve follows the active profile's insulin duration (see updateScheduledBasal)
+    insulinOnBoard.advance(elapsedSeconds);
+}
+
+void TSlimX2Pump::advanceDelivery(time_t until) {
+    time_t now = virtualClock->now();
+    if (until <= now) {
+        return; // Overdue timers fire at the current time
+    }
+    
+    time_t elapsedSeconds = until - now;
+    if (currentState != OFF) {
+        float scheduledUnits = scheduledBasalRate * elapsedSeconds / 3600.0f;
+        
+        if (currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS) {
+            // Control-IQ and temp basals replace the schedule; IOB still counts the difference
+            pulseAccrued += adjustedBasalRate(scheduledBasalRate) * elapsedSeconds / 3600.0f;
+            
+            // Meter out the next slice of an extended bolus
+            if (extendedBolusRemaining > 0) {
+                float extendedUnits = std::min(extendedBolusRemaining, extendedBolusRate * elapsedSeconds);
+                extendedBolusRemaining -= extendedUnits;
+                pulseAccrued += extendedUnits;
+            }
+        }
+        
+        // Only insulin above or below the scheduled basal counts toward IOB;
+        // pulses add what is actually pumped
+        insulinOnBoard.addDose(-scheduledUnits);
+    }
+    virtualClock->advance(elapsedSeconds);
+}
+
+void TSlimX2Pump::deliverPulse() {
+    float units = std::min(pulseAccrued, PULSE_UNITS);
+    pulseAccrued -= units;
+    
+    if (units >= insulinLevel) {
+        // Reservoir ran dry
+        units = insulinLevel;
+        insulinLevel = 0.0;
+        pulseAccrued = 0.0f;
+        stopExtendedBolus();
+        endTempBasal(nullptr);
+        currentState = SUSPENDED;
+        currentError = LOW_INSULIN;
+        errorMessage = "Insulin reservoir empty";
+        resetControlIQ("Insulin reservoir empty");
+        
+        eventHistory.logSuspend(clock->now(), "Insulin reservoir empty");
+    } else {
+        insulinLevel -= units;
+        
+        if (insulinLevel < 50.0 && currentError == NONE) {
+            currentError = LOW_INSULIN;
+            errorMessage = "Low insulin reservoir";
+        }
+    }
+    totalInsulinDelivered += units;
+    insulinOnBoard.addDose(units);
+}
+
+void TSlimX2Pump::scheduleDelivery() {
+    float rate = 0.0f;
+    if (currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS) {
+        rate = adjustedBasalRate(scheduledBasalRate) + extendedBolusRate * 3600.0f;
+    }
+    if (rate == deliveryRate) {
+        return;
+    }
+    
+    deliveryRate = rate;
+    deliveryTimers.cancel(pulseTimer);
+    pulseTimer = TimerWheel::NO_TIMER;
+    if (rate > 0) {
+        schedulePulse();
+    }
+}
+
+void TSlimX2Pump::schedulePulse() {
+    // The next pulse is due once a full pulse has accrued at the current rate
+    float owed = std::max(0.0f, PULSE_UNITS - pulseAccrued);
+    time_t seconds = std::max<time_t>(1, static_cast<time_t>(std::ceil(owed * 3600.0f / deliveryRate)));
+    pulseTimer = deliveryTimers.schedule(clock->now() + seconds, PULSE_TIMER);
+}
+
+void TSlimX2Pump::fireDeliveryTimer(const TimerWheel::Timer& timer) {
+    switch (timer.kind) {
+        case PULSE_TIMER:
+            pulseTimer = TimerWheel::NO_TIMER;
+            deliverPulse();
+            if (currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS) {
+                schedulePulse();
+            } else {
+                deliveryRate = 0.0f;
+            }
+            break;
+        case BASAL_SEGMENT_TIMER:
+            basalSegmentTimer = TimerWheel::NO_TIMER;
+            updateScheduledBasal("Basal schedule");
+            break;
+        case EXTENDED_BOLUS_TIMER: {
+            extendedBolusTimer = TimerWheel::NO_TIMER;
+            float basalRate = adjustedBasalRate(scheduledBasalRate);
+            eventHistory.logBasalChange(clock->now(), basalRate + extendedBolusRate * 3600.0f, basalRate,
+                                        "Extended bolus complete");
+            
+            // Any rounding remainder goes out with the next pulse
+            pulseAccrued += extendedBolusRemaining;
+            extendedBolusRemaining = 0.0f;
+            extendedBolusRate = 0.0f;
+            eventHistory.setAnchor(EventLog::NPOS);
+            if (currentState == DELIVERING_BOLUS) {
+                currentState = DELIVERING_BASAL;
+            }
+            break;
+        }
+        case TEMP_BASAL_TIMER:
+            tempBasalTimer = TimerWheel::NO_TIMER;
+            endTempBasal("Temp basal ended");
+            break;
+    }
+}
+
+void TSlimX2Pump::updateScheduledBasal(const char* reason) {
+    time_t now = clock->now();
+    int minute = localMinuteOfDay(now);
+    const Profile& profile = *activeProfile;
+    float rate = profile.getSettings(minute).basalRate;
+    insulinOnBoard.setInsulinDuration(profile.getInsulinDuration());
+    
+    // Log what the pump delivers, unless Control-IQ has taken over the rate
+    float oldRate = adjustedBasalRate(scheduledBasalRate);
+    float newRate = adjustedBasalRate(rate);
+    if (reason && newRate != oldRate && controlIQBasalRate < 0 &&
+        (currentState == DELIVERING_BASAL || currentState == DELIVERING_BOLUS)) {
+        eventHistory.logBasalChange(now, oldRate, newRate, reason);
+    }
+    scheduledBasalRate = rate;
+    
+    // Wake at the next minute with a different rate, and at least hourly so
+    // clock changes are picked up
+    time_t next = cachedHourStart + 3600;
+    for (int offset = minute - cachedHourMinute + 1; offset < 60; offset++) {
+        if (profile.getSettings(cachedHourMinute + offset).basalRate != rate) {
+            next = cachedHourStart + offset * 60;
+            break;
+        }
+    }
+    deliveryTimers.cancel(basalSegmentTimer);
+    basalSegmentTimer = deliveryTimers.schedule(next, BASAL_SEGMENT_TIMER);
+}
+
+void TSlimX2Pump::stopExtendedBolus() {
+    // Whatever is still to come of a running extended bolus is not delivered
+    size_t activeBolus = eventHistory.getAnchor();
+    if (activeBolus != EventLog::NPOS) {
+        eventHistory.setCancelled(activeBolus, true);
+        eventHistory.setAnchor(EventLog::NPOS);
+    }
+    deliveryTimers.cancel(extendedBolusTimer);
+    extendedBolusTimer = TimerWheel::NO_TIMER;
+    extendedBolusRemaining = 0.0f;
+    extendedBolusRate = 0.0f;
+}
+
+void TSlimX2Pump::endTempBasal(const char* reason) {
+    if (tempBasalPercent < 0) {
+        return;
+    }
+    
+    float oldRate = adjustedBasalRate(scheduledBasalRate);
+    tempBasalPercent = -1.0f;
+    deliveryTimers.cancel(tempBasalTimer);
+    tempBasalTimer = TimerWheel::NO_TIMER;
+    
+    if (reason) {
+        eventHistory.logBasalChange(clock->now(), oldRate, adjustedBasalRate(scheduledBasalRate), reason);
+    }
+}
+
+float TSlimX2Pump::adjustedBasalRate(float scheduledRate) const {
+    if (controlIQBasalRate >= 0) {
+        return controlIQBasalRate;
+    }
+    if (tempBasalPercent >= 0) {
+        return scheduledRate * tempBasalPercent / 100.0f;
+    }
+    return scheduledRate;
+}
+
+float TSlimX2Pump::getScheduledBasalRate(time_t now) {
+    return activeProfile->getSettings(localMinuteOfDay(now)).basalRate;
+}
+
+int TSlimX2Pump::localMinuteOfDay(time_t timestamp) {
+    // Local time only changes offset on hour boundaries, so one localtime
+    // conversion per simulated hour is enough
+    if (cachedHourMinute < 0 || timestamp < cachedHourStart || timestamp >= cachedHourStart + 3600) {
+        struct tm timeinfo = Clock::toLocalTime(timestamp);
+        cachedHourStart = timestamp - timeinfo.tm_min * 60 - timeinfo.tm_sec;
+        cachedHourMinute = timeinfo.tm_hour * 60;
+    }
+    return cachedHourMinute + static_cast<int>((timestamp - cachedHourStart) / 60);
+}
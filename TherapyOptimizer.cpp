@@ -0,0 +1,247 @@
+#include "TherapyOptimizer.h"
+#include "TSlimX2Pump.h"
+#include "Profile.h"
+#include "CGMData.h"
+#include "PumpBlock.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    // Settings per segment in a grid point: start minute, basal, carb ratio, correction factor
+    const size_t FIELDS_PER_SEGMENT = 4;
+    
+    int32_t toSteps(float value, float step) {
+        return std::max<int32_t>(1, static_cast<int32_t>(std::lround(value / step)));
+    }
+    
+    // Outcome so far, over every replicate
+    void summarize(const PumpBlock& block, time_t startTime, time_t endTime, int days,
+                   const TherapyOptimizer::Options& options, TherapyOptimizer::Evaluation& evaluation) {
+        float timeInRange = 0.0f, timeBelowRange = 0.0f, averageGlucose = 0.0f;
+        double insulin = 0.0;
+        for (size_t i = 0; i < block.size(); i++) {
+            const PumpBlock::Member& replicate = block.getMember(i);
+            const CGMData& cgmData = *replicate.cgmData;
+            timeInRange += cgmData.getTimeInRange(3.9f, 10.0f, startTime, endTime);
+            timeBelowRange += 100.0f - cgmData.getTimeInRange(3.9f, HUGE_VALF, startTime, endTime);
+            averageGlucose += cgmData.getAverageGlucose(startTime, endTime);
+            insulin += replicate.pump->getTotalInsulinDelivered();
+        }
+        
+        float count = static_cast<float>(block.size());
+        evaluation.timeInRange = timeInRange / count;
+        evaluation.timeBelowRange = timeBelowRange / count;
+        evaluation.averageGlucose = averageGlucose / count;
+        evaluation.dailyInsulin = static_cast<float>(insulin / (count * std::max(1, days)));
+        evaluation.score = evaluation.timeInRange - options.hypoglycemiaWeight * evaluation.timeBelowRange;
+        evaluation.days = days;
+    }
+}
+
+TherapyOptimizer::TherapyOptimizer(unsigned threadCount) :
+    pool(threadCount),
+    patient()
+{
+}
+
+void TherapyOptimizer::setPatient(const CohortSimulation::PatientConfig& config) {
+    patient = config;
+    cache.clear();
+}
+
+void TherapyOptimizer::setOptions(const Options& newOptions) {
+    options = newOptions;
+    cache.clear();
+}
+
+const TherapyOptimizer::Options& TherapyOptimizer::getOptions() const {
+    return options;
+}
+
+TherapyOptimizer::Result TherapyOptimizer::optimize(const std::vector<Segment>& initial) {
+    Result result = {};
+    result.threadCount = pool.getThreadCount();
+    if (initial.empty()) {
+        return result;
+    }
+    
+    auto started = std::chrono::steady_clock::now();
+    size_t replicateDays = 0;
+    
+    // Simulates the points missing from the cache across the pool
+    auto evaluateAll = [this, &result, &replicateDays](const std::vector<GridPoint>& points, float pruneBelow) {
+        std::vector<const GridPoint*> missing;
+        for (const auto& point : points) {
+            if (cache.count(point)) {
+                result.cacheHits++;
+            } else {
+                missing.push_back(&point);
+            }
+        }
+        
+        std::vector<Evaluation> evaluations(missing.size());
+        pool.parallelFor(missing.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                evaluations[i] = evaluate(patient, options, fromGrid(*missing[i]), pruneBelow);
+            }
+        });
+        
+        for (size_t i = 0; i < missing.size(); i++) {
+            result.evaluations++;
+            result.prunedCount += evaluations[i].pruned ? 1 : 0;
+            replicateDays += static_cast<size_t>(evaluations[i].days) * std::max(1u, options.replicates);
+            cache.emplace(*missing[i], std::move(evaluations[i]));
+        }
+    };
+    
+    GridPoint current = toGrid(initial);
+    evaluateAll({ current }, -HUGE_VALF);
+    result.initial = cache.at(current);
+    result.best = result.initial;
+    
+    // Every generation steps each setting one stride either way from the best
+    int stride = std::max(1, options.initialStride);
+    while (result.generations < options.maxGenerations && stride >= 1) {
+        result.generations++;
+        std::vector<GridPoint> neighbours;
+        for (size_t field = 0; field < current.size(); field++) {
+            if (field % FIELDS_PER_SEGMENT == 0) {
+                continue; // Segment start times are fixed
+            }
+            for (int direction = -1; direction <= 1; direction += 2) {
+                GridPoint neighbour = current;
+                neighbour[field] += direction * stride;
+                if (neighbour[field] >= 1) {
+                    neighbours.push_back(neighbour);
+                }
+            }
+        }
+        
+        // The threshold holds for the whole generation, keeping results
+        // independent of scheduling
+        evaluateAll(neighbours, result.best.score - options.pruneMargin);
+        
+        const GridPoint* move = nullptr;
+        for (const auto& neighbour : neighbours) {
+            const Evaluation& evaluation = cache.at(neighbour);
+            if (!evaluation.pruned && evaluation.score > result.best.score) {
+                result.best = evaluation;
+                move = &neighbour;
+            }
+        }
+        if (move) {
+            current = *move;
+        } else {
+            stride /= 2;
+        }
+    }
+    
+    auto finished = std::chrono::steady_clock::now();
+    result.elapsedSeconds = std::chrono::duration<double>(finished - started).count();
+    result.evaluationsPerSecond = result.elapsedSeconds > 0 ? result.evaluations / result.elapsedSeconds : 0.0;
+    result.simulatedDaysPerSecond = result.elapsedSeconds > 0 ? replicateDays / result.elapsedSeconds : 0.0;
+    return result;
+}
+
+size_t TherapyOptimizer::getCacheSize() const {
+    return cache.size();
+}
+
+void TherapyOptimizer::clearCache() {
+    cache.clear();
+}
+
+TherapyOptimizer::Evaluation TherapyOptimizer::evaluate(const CohortSimulation::PatientConfig& config,
+                                                        const Options& options,
+                                                        const std::vector<Segment>& segments, float pruneBelow) {
+    Evaluation evaluation = {};
+    evaluation.segments = segments;
+    size_t count = std::max(1u, options.replicates);
+    int days = std::max(0, config.days);
+    
+    // Every replicate shares one profile snapshot
+    std::shared_ptr<const Profile> profile = makeProfile("Default", segments, config.targetGlucose);
+    GlucoseModel::Parameters parameters;
+    parameters.basalGlucose = config.initialGlucose;
+    parameters.insulinSensitivity = config.trueSensitivity;
+    parameters.carbRatio = config.trueCarbRatio;
+    parameters.basalInsulinNeed = config.trueBasalNeed;
+    
+    PumpBlock block;
+    block.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        PumpBlock::Member& replicate = block.add(config.startTime, days, config.seed + static_cast<unsigned>(i),
+                                                 parameters, config.initialGlucose);
+        replicate.controlIQ = config.controlIQ;
+        replicate.pump->updateProfile("Default", profile);
+    }
+    block.start();
+    
+    // CohortSimulation's daily routine, scored at the end of every day
+    DailyMeals meals(block);
+    block.run([&meals](size_t index, int minute, time_t now) { meals.act(index, minute, now); },
+              [&](int day) {
+        time_t endTime = config.startTime + static_cast<time_t>(day + 1) * Profile::MINUTES_PER_DAY * 60;
+        summarize(block, config.startTime, endTime, day + 1, options, evaluation);
+        
+        // Hopeless: stop before spending the remaining days on it
+        if (day + 1 < days && day + 1 >= options.pruneAfterDays && evaluation.score < pruneBelow) {
+            evaluation.pruned = true;
+            return false;
+        }
+        return true;
+    });
+    
+    return evaluation;
+}
+
+std::vector<TherapyOptimizer::Segment> TherapyOptimizer::getSegments(const Profile& profile, int segmentCount) {
+    segmentCount = std::min(24, std::max(1, segmentCount));
+    std::vector<Segment> segments;
+    for (int i = 0; i < segmentCount; i++) {
+        // Whole hours, as the pump's schedules are usually set
+        int startMinute = (i * 24 / segmentCount) * 60;
+        const Profile::Settings& settings = profile.getSettings(startMinute);
+        segments.push_back({ startMinute, settings.basalRate, settings.carbRatio, settings.correctionFactor });
+    }
+    return segments;
+}
+
+std::shared_ptr<Profile> TherapyOptimizer::makeProfile(const std::string& name, const std::vector<Segment>& segments,
+                                                       float targetGlucose) {
+    auto profile = std::make_shared<Profile>(name);
+    for (const auto& segment : segments) {
+        int hour = segment.startMinute / 60;
+        int minute = segment.startMinute % 60;
+        profile->addBasalRate(hour, minute, segment.basalRate);
+        profile->addCarbRatio(hour, minute, segment.carbRatio);
+        profile->addCorrectionFactor(hour, minute, segment.correctionFactor);
+    }
+    profile->addTargetGlucose(0, 0, targetGlucose);
+    return profile;
+}
+
+TherapyOptimizer::GridPoint TherapyOptimizer::toGrid(const std::vector<Segment>& segments) {
+    GridPoint point;
+    point.reserve(segments.size() * FIELDS_PER_SEGMENT);
+    for (const auto& segment : segments) {
+        point.push_back(segment.startMinute);
+        point.push_back(toSteps(segment.basalRate, BASAL_STEP));
+        point.push_back(toSteps(segment.carbRatio, CARB_RATIO_STEP));
+        point.push_back(toSteps(segment.correctionFactor, CORRECTION_STEP));
+    }
+    return point;
+}
+
+std::vector<TherapyOptimizer::Segment> TherapyOptimizer::fromGrid(const GridPoint& point) {
+    std::vector<Segment> segments(point.size() / FIELDS_PER_SEGMENT);
+    for (size_t i = 0; i < segments.size(); i++) {
+        const int32_t* fields = &point[i * FIELDS_PER_SEGMENT];
+        segments[i].startMinute = fields[0];
+        segments[i].basalRate = fields[1] * BASAL_STEP;
+        segments[i].carbRatio = fields[2] * CARB_RATIO_STEP;
+        segments[i].correctionFactor = fields[3] * CORRECTION_STEP;
+    }
+    return segments;
+}
@@ -0,0 +1,122 @@
+#ifndef THERAPY_OPTIMIZER_H
+#define THERAPY_OPTIMIZER_H
+
+#include "CohortSimulation.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Profile;
+
+/**
+ * Tunes a virtual patient's Profile settings (basal rate, carb ratio and
+ * correction factor per segment of the day) by simulation.
+ * A candidate is scored on several replicates of the patient, each with
+ * its own meal timings, carb counts and sensor noise, stepped together
+ * through one batched GlucoseModel for days at a time with the same daily
+ * routine as CohortSimulation. The search is a pattern search on a grid
+ * of pump increments: every generation tries each setting one stride up
+ * and down from the best candidate so far, across the thread pool, moves
+ * to the best improvement or halves the stride. Two things keep it cheap:
+ *  - Candidates trailing the best by more than a margin after some days
+ *    are abandoned (pruned) without finishing their days.
+ *  - Results are cached by grid point, so candidates the search returns
+ *    to are never simulated twice.
+ * Scores depend only on the patient, options and candidate, and pruning
+ * thresholds only change between generations, so results are the same
+ * for any thread count.
+ */
+class TherapyOptimizer {
+public:
+    // Grid spacing of the settings
+    static constexpr float BASAL_STEP = 0.05f;         // U/hr
+    static constexpr float CARB_RATIO_STEP = 0.5f;     // g/U
+    static constexpr float CORRECTION_STEP = 0.1f;     // mmol/L per U
+    
+    // Settings from startMinute until the next segment (or midnight)
+    struct Segment {
+        int startMinute;
+        float basalRate;            // U/hr
+        float carbRatio;            // g/U
+        float correctionFactor;     // mmol/L per U
+    };
+    
+    struct Options {
+        unsigned replicates = 8;        // Simulated copies of the patient per candidate
+        int maxGenerations = 40;
+        int initialStride = 4;          // Grid steps
+        float hypoglycemiaWeight = 5.0f; // Score lost per % of time below 3.9 mmol/L
+        int pruneAfterDays = 2;         // Earliest day a candidate may be abandoned
+        float pruneMargin = 10.0f;      // Score a candidate may trail the best by
+    };
+    
+    struct Evaluation {
+        std::vector<Segment> segments;
+        float score;                // Time in range (%) less the hypoglycemia penalty
+        float timeInRange;          // % of readings within 3.9-10.0 mmol/L, all replicates
+        float timeBelowRange;       // % of readings below 3.9 mmol/L
+        float averageGlucose;       // mmol/L
+        float dailyInsulin;         // Units per replicate-day
+        int days;                   // Simulated days per replicate; fewer when pruned
+        bool pruned;
+    };
+    
+    struct Result {
+        Evaluation initial;
+        Evaluation best;
+        unsigned threadCount;
+        int generations;
+        size_t evaluations;         // Candidates simulated
+        size_t cacheHits;           // Candidates answered from the cache
+        size_t prunedCount;
+        double elapsedSeconds;
+        double evaluationsPerSecond;
+        double simulatedDaysPerSecond; // Replicate-days
+    };
+    
+    // A thread count of 0 uses all hardware threads
+    explicit TherapyOptimizer(unsigned threadCount = 0);
+    
+    // The patient's physiology, seed, start time, days simulated per
+    // replicate, target glucose and Control-IQ setting; its other profile
+    // settings are ignored.
+    // Changing the patient or options clears the cache.
+    void setPatient(const CohortSimulation::PatientConfig& config);
+    void setOptions(const Options& options);
+    const Options& getOptions() const;
+    
+    // Search from the given segments (the first must start at midnight);
+    // the best settings found are in result.best.segments
+    Result optimize(const std::vector<Segment>& initial);
+    
+    size_t getCacheSize() const;
+    void clearCache();
+    
+    // Score one candidate on the calling thread, giving up once its score
+    // falls below pruneBelow after options.pruneAfterDays
+    static Evaluation evaluate(const CohortSimulation::PatientConfig& config, const Options& options,
+                               const std::vector<Segment>& segments, float pruneBelow = -HUGE_VALF);
+    
+    // Conversions between segments and profiles
+    static std::vector<Segment> getSegments(const Profile& profile, int segmentCount);
+    static std::shared_ptr<Profile> makeProfile(const std::string& name, const std::vector<Segment>& segments,
+                                                float targetGlucose);
+    
+private:
+    using GridPoint = std::vector<int32_t>;     // Steps of each setting of each segment
+    
+    ThreadPool pool;
+    CohortSimulation::PatientConfig patient;
+    Options options;
+    std::map<GridPoint, Evaluation> cache;
+    
+    static GridPoint toGrid(const std::vector<Segment>& segments);
+    static std::vector<Segment> fromGrid(const GridPoint& point);
+};
+
+#endif // THERAPY_OPTIMIZER_H
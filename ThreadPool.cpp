@@ -0,0 +1,163 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+
+namespace {
+    // Identifies the pool and deque owned by the current worker thread
+    thread_local const ThreadPool* currentPool = nullptr;
+    thread_local unsigned currentWorker = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) :
+    queuedTasks(0),
+    pendingTasks(0),
+    nextQueue(0),
+    stopping(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    for (unsigned i = 0; i < threadCount; i++) {
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned index = (currentPool == this) ?
+        currentWorker : nextQueue.fetch_add(1) % queues.size();
+    
+    pendingTasks.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queuedTasks.fetch_add(1);
+    
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    assert(currentPool != this);
+    helpUntilZero(pendingTasks);
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body) {
+    if (grainSize == 0) {
+        grainSize = 1;
+    }
+    
+    // Count this call's chunks rather than waiting on the whole pool, which
+    // from a worker would include the worker's own task
+    std::atomic<size_t> remaining((count + grainSize - 1) / grainSize);
+    for (size_t begin = 0; begin < count; begin += grainSize) {
+        size_t end = std::min(count, begin + grainSize);
+        submit([this, &body, &remaining, begin, end] {
+            body(begin, end);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                allDone.notify_all();
+            }
+        });
+    }
+    helpUntilZero(remaining);
+}
+
+unsigned ThreadPool::getThreadCount() const {
+    return static_cast<unsigned>(workers.size());
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    currentPool = this;
+    currentWorker = index;
+    
+    std::function<void()> task;
+    while (true) {
+        if (popTask(index, task) || stealTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        workAvailable.wait(lock, [this] {
+            return stopping || queuedTasks.load() > 0;
+        });
+        if (stopping && queuedTasks.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::popTask(unsigned index, std::function<void()>& task) {
+    // Owners take the newest task (LIFO) for cache locality
+    WorkQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queuedTasks.fetch_sub(1);
+    return true;
+}
+
+bool ThreadPool::stealTask(unsigned index, std::function<void()>& task) {
+    // Thieves take the oldest task (FIFO) from the other deques
+    for (size_t offset = 0; offset < queues.size(); offset++) {
+        WorkQueue& queue = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queuedTasks.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::helpUntilZero(const std::atomic<size_t>& remaining) {
+    std::function<void()> task;
+    unsigned index = (currentPool == this) ? currentWorker : 0;
+    
+    while (remaining.load() > 0) {
+        // Help drain the queues instead of just blocking
+        if (stealTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        allDone.wait(lock, [this, &remaining] {
+            return remaining.load() == 0 || queuedTasks.load() > 0;
+        });
+    }
+}
+
+void ThreadPool::runTask(std::function<void()>& task) {
+    task();
+    task = nullptr;
+    
+    if (pendingTasks.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        allDone.notify_all();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Work-stealing thread pool used for headless simulation runs.
+ * Each worker owns a task deque; idle workers steal from the others.
+ */
+class ThreadPool {
+public:
+    // A thread count of 0 uses all hardware threads
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    // Queue a task; tasks submitted from a worker go to that worker's deque
+    void submit(std::function<void()> task);
+    
+    // Block until every submitted task has finished (the caller helps out).
+    // Not from a worker: the worker's own task would never finish.
+    void wait();
+    
+    // Split [0, count) into chunks of grainSize and run body(begin, end) on
+    // each, returning once those chunks are done; safe to nest in a task
+    void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body);
+    
+    unsigned getThreadCount() const;
+    
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    
+    std::mutex sleepMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    std::atomic<size_t> queuedTasks;
+    std::atomic<size_t> pendingTasks;
+    std::atomic<unsigned> nextQueue;
+    bool stopping;
+    
+    void workerLoop(unsigned index);
+    bool popTask(unsigned index, std::function<void()>& task);
+    bool stealTask(unsigned index, std::function<void()>& task);
+    void runTask(std::function<void()>& task);
+    void helpUntilZero(const std::atomic<size_t>& remaining);
+};
+
+#endif // THREAD_POOL_H
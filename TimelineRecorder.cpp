@@ -0,0 +1,461 @@
+#include "TimelineRecorder.h"
+#include "Event.h"
+#include "EventLog.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace {
+    // Thread caches tell recorders apart by id, never by address
+    std::atomic<uint64_t> nextRecorderId(1);
+    
+    // Writes are batched into chunks of about this size
+    const size_t WRITE_CHUNK = 64 * 1024;
+    
+    // How long the writer sleeps when no ring asks to be drained
+    const std::chrono::milliseconds WRITE_INTERVAL(20);
+    
+    const int64_t MICROSECONDS_PER_SECOND = 1000000;
+    
+    const char* const BOLUS_NAMES[] = { "Bolus", "Extended bolus", "Quick bolus", "Correction bolus" };
+    const char* const ALARM_NAMES[] = {
+        "Low glucose alarm",
+        "High glucose alarm",
+        "Low insulin alarm",
+        "Low battery alarm",
+        "Occlusion alarm",
+        "CGM disconnection alarm"
+    };
+    
+    void appendJsonString(std::string& out, const char* text) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (const char* c = text; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                out += '\\';
+                out += *c;
+            } else if (static_cast<unsigned char>(*c) < 0x20) {
+                out += "\\u00";
+                out += hex[(*c >> 4) & 0xf];
+                out += hex[*c & 0xf];
+            } else {
+                out += *c;
+            }
+        }
+        out += '"';
+    }
+    
+    // Shortest form that reads back exactly
+    template <typename T>
+    void appendNumber(std::string& out, T value) {
+        char digits[32];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+    }
+}
+
+TimelineRecorder::TimelineRecorder(size_t ringCapacity) :
+    id(nextRecorderId.fetch_add(1)),
+    capacity(64),
+    stopping(false),
+    recording(false),
+    firstRecord(true),
+    recordCount(0)
+{
+    while (capacity < ringCapacity) {
+        capacity *= 2;
+    }
+}
+
+TimelineRecorder::~TimelineRecorder() {
+    close();
+}
+
+bool TimelineRecorder::open(const std::string& path) {
+    if (isOpen()) {
+        return false;
+    }
+    
+    out.open(path, std::ios::out | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    
+    started = std::chrono::steady_clock::now();
+    firstRecord = true;
+    recordCount.store(0);
+    buffer = "{\"traceEvents\": [\n";
+    for (auto& ring : rings) {
+        ring->named = false;
+    }
+    
+    Record process = {};
+    process.phase = PROCESS_NAME;
+    setText(process, "Simulation");
+    format(process);
+    
+    stopping = false;
+    recording.store(true);
+    writer = std::thread(&TimelineRecorder::writeLoop, this);
+    return true;
+}
+
+bool TimelineRecorder::close() {
+    if (!isOpen()) {
+        return false;
+    }
+    
+    recording.store(false);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    writer.join();
+    
+    // The writer has stopped, so this thread is now the only consumer
+    drain();
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    out.close();
+    return !out.fail();
+}
+
+bool TimelineRecorder::isOpen() const {
+    return recording.load();
+}
+
+int64_t TimelineRecorder::now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+void TimelineRecorder::recordSpan(const char* name, int64_t start, int64_t duration) {
+    if (!recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    Ring& ring = threadRing();
+    Record record = {};
+    record.timestamp = start;
+    record.duration = duration;
+    record.name = name;
+    record.thread = ring.thread;
+    record.phase = SPAN;
+    push(ring, record);
+}
+
+TimelineRecorder::Scope::Scope(TimelineRecorder* recorder, const char* name) :
+    recorder(recorder),
+    name(name),
+    start(recorder ? recorder->now() : 0)
+{
+}
+
+TimelineRecorder::Scope::~Scope() {
+    if (recorder) {
+        recorder->recordSpan(name, start, recorder->now() - start);
+    }
+}
+
+TimelineRecorder::PhaseTotals::PhaseTotals(TimelineRecorder* recorder, const char* const* names, size_t count) :
+    recorder(recorder),
+    names(names),
+    count(std::min(count, MAX_PHASES)),
+    current(MAX_PHASES),
+    start(recorder ? recorder->now() : 0),
+    mark(start),
+    totals()
+{
+}
+
+void TimelineRecorder::PhaseTotals::enter(size_t phase) {
+    if (!recorder) {
+        return;
+    }
+    
+    int64_t time = recorder->now();
+    if (current < count) {
+        totals[current] += time - mark;
+    }
+    current = phase;
+    mark = time;
+}
+
+void TimelineRecorder::PhaseTotals::flush(const char* name) {
+    if (!recorder) {
+        return;
+    }
+    
+    enter(MAX_PHASES);
+    recorder->recordSpan(name, start, mark - start);
+    int64_t phaseStart = start;
+    for (size_t i = 0; i < count; i++) {
+        if (totals[i] > 0) {
+            recorder->recordSpan(names[i], phaseStart, totals[i]);
+        }
+        phaseStart += totals[i];
+        totals[i] = 0;
+    }
+    start = mark;
+}
+
+void TimelineRecorder::recordHistory(uint32_t track, const std::string& name, const EventLog& history, time_t origin) {
+    if (!recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    // Process 0 holds the real-time tracks
+    Ring& ring = threadRing();
+    uint32_t process = track + 1;
+    Record metadata = {};
+    metadata.process = process;
+    metadata.phase = PROCESS_NAME;
+    setText(metadata, name);
+    push(ring, metadata);
+    
+    // A suspension becomes one span once its resume is seen
+    int64_t suspendedAt = -1;
+    uint32_t suspendReason = 0;
+    for (size_t i = 0; i < history.size(); i++) {
+        const EventLog::Record& event = history.getRecord(i);
+        Record record = {};
+        record.timestamp = static_cast<int64_t>(event.timestamp - origin) * MICROSECONDS_PER_SECOND;
+        record.process = process;
+        record.phase = INSTANT;
+        
+        switch (static_cast<Event::EventType>(event.type)) {
+            case Event::BOLUS:
+                record.name = event.subtype <= BolusEvent::CORRECTION ? BOLUS_NAMES[event.subtype] : "Bolus";
+                record.valueName = "units";
+                record.value = event.value;
+                if (event.duration > 0) {
+                    record.phase = SPAN;
+                    record.duration = static_cast<int64_t>(event.duration) * 60 * MICROSECONDS_PER_SECOND;
+                }
+                if (event.flags & EventLog::FLAG_CANCELLED) {
+                    setText(record, "Cancelled");
+                }
+                break;
+            case Event::BASAL_CHANGE:
+                record.phase = COUNTER;
+                record.name = "Basal rate";
+                record.valueName = "U/hr";
+                record.value = event.newValue;
+                break;
+            case Event::PROFILE_CHANGE:
+                record.name = "Profile change";
+                setText(record, history.getText(event.secondText));
+                break;
+            case Event::SUSPEND:
+                if (suspendedAt < 0) {
+                    suspendedAt = record.timestamp;
+                    suspendReason = event.text;
+                }
+                continue;
+            case Event::RESUME:
+                if (suspendedAt >= 0) {
+                    record.phase = SPAN;
+                    record.name = "Suspended";
+                    record.duration = record.timestamp - suspendedAt;
+                    record.timestamp = suspendedAt;
+                    setText(record, history.getText(suspendReason));
+                    suspendedAt = -1;
+                } else {
+                    record.name = "Resume";
+                    setText(record, history.getText(event.text));
+                }
+                break;
+            case Event::CGM_READING:
+                record.phase = COUNTER;
+                record.name = "Glucose";
+                record.valueName = "mmol/L";
+                record.value = event.value;
+                break;
+            case Event::ALARM:
+                record.name = event.subtype <= AlarmEvent::CGM_DISCONNECTION ? ALARM_NAMES[event.subtype] : "Alarm";
+                setText(record, history.getText(event.text));
+                break;
+            case Event::ERROR:
+                record.name = "Error";
+                setText(record, history.getText(event.text));
+                break;
+        }
+        push(ring, record);
+    }
+    
+    if (suspendedAt >= 0) {
+        Record record = {};
+        record.timestamp = suspendedAt;
+        record.name = "Suspend";
+        record.process = process;
+        record.phase = INSTANT;
+        setText(record, history.getText(suspendReason));
+        push(ring, record);
+    }
+}
+
+size_t TimelineRecorder::getRecordCount() const {
+    return recordCount.load();
+}
+
+TimelineRecorder::Ring& TimelineRecorder::threadRing() {
+    // One cached ring per thread, for the recorder it last recorded into
+    thread_local uint64_t cachedRecorder = 0;
+    thread_local Ring* cachedRing = nullptr;
+    if (cachedRecorder == id) {
+        return *cachedRing;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    std::thread::id self = std::this_thread::get_id();
+    Ring* ring = nullptr;
+    for (const auto& candidate : rings) {
+        if (candidate->owner == self) {
+            ring = candidate.get();
+            break;
+        }
+    }
+    if (!ring) {
+        rings.push_back(std::unique_ptr<Ring>(new Ring()));
+        ring = rings.back().get();
+        ring->records.reset(new Record[capacity]);
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->thread = static_cast<uint32_t>(rings.size());
+        ring->owner = self;
+        ring->named = false;
+    }
+    
+    cachedRecorder = id;
+    cachedRing = ring;
+    return *ring;
+}
+
+void TimelineRecorder::push(Ring& ring, const Record& record) {
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    while (head - ring.tail.load(std::memory_order_acquire) >= capacity) {
+        // Full: the writer has fallen behind, so wake it and wait for room
+        wakeup.notify_one();
+        std::this_thread::yield();
+    }
+    
+    ring.records[head & (capacity - 1)] = record;
+    ring.head.store(head + 1, std::memory_order_release);
+    if (((head + 1) & (capacity / 2 - 1)) == 0) {
+        wakeup.notify_one(); // Half a ring is waiting
+    }
+}
+
+void TimelineRecorder::writeLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, WRITE_INTERVAL);
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+bool TimelineRecorder::drain() {
+    std::vector<Ring*> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& ring : rings) {
+            current.push_back(ring.get());
+        }
+    }
+    
+    for (Ring* ring : current) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        if (tail == head) {
+            continue;
+        }
+        
+        if (!ring->named) {
+            Record metadata = {};
+            metadata.thread = ring->thread;
+            metadata.phase = THREAD_NAME;
+            setText(metadata, "Thread " + std::to_string(ring->thread));
+            format(metadata);
+            ring->named = true;
+        }
+        
+        for (; tail != head; tail++) {
+            format(ring->records[tail & (capacity - 1)]);
+            if (buffer.size() >= WRITE_CHUNK) {
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+    return static_cast<bool>(out);
+}
+
+void TimelineRecorder::format(const Record& record) {
+    if (!firstRecord) {
+        buffer += ",\n";
+    }
+    firstRecord = false;
+    recordCount.fetch_add(1, std::memory_order_relaxed);
+    
+    if (record.phase == PROCESS_NAME || record.phase == THREAD_NAME) {
+        buffer += record.phase == PROCESS_NAME ? "{\"name\": \"process_name\", " : "{\"name\": \"thread_name\", ";
+        buffer += "\"ph\": \"M\", \"pid\": ";
+        appendNumber(buffer, record.process);
+        buffer += ", \"tid\": ";
+        appendNumber(buffer, record.thread);
+        buffer += ", \"args\": {\"name\": ";
+        appendJsonString(buffer, record.text);
+        buffer += "}}";
+        return;
+    }
+    
+    buffer += "{\"name\": ";
+    appendJsonString(buffer, record.name);
+    buffer += record.process == 0 ? ", \"cat\": \"simulation\", " : ", \"cat\": \"pump\", ";
+    switch (record.phase) {
+        case SPAN:
+            buffer += "\"ph\": \"X\", \"ts\": ";
+            appendNumber(buffer, record.timestamp);
+            buffer += ", \"dur\": ";
+            appendNumber(buffer, record.duration);
+            break;
+        case COUNTER:
+            buffer += "\"ph\": \"C\", \"ts\": ";
+            appendNumber(buffer, record.timestamp);
+            break;
+        default:
+            buffer += "\"ph\": \"i\", \"s\": \"t\", \"ts\": ";
+            appendNumber(buffer, record.timestamp);
+            break;
+    }
+    buffer += ", \"pid\": ";
+    appendNumber(buffer, record.process);
+    buffer += ", \"tid\": ";
+    appendNumber(buffer, record.thread);
+    
+    if (record.valueName || record.text[0] != '\0') {
+        buffer += ", \"args\": {";
+        if (record.valueName) {
+            appendJsonString(buffer, record.valueName);
+            buffer += ": ";
+            appendNumber(buffer, record.value);
+        }
+        if (record.text[0] != '\0') {
+            buffer += record.valueName ? ", \"detail\": " : "\"detail\": ";
+            appendJsonString(buffer, record.text);
+        }
+        buffer += "}";
+    }
+    buffer += "}";
+}
+
+void TimelineRecorder::setText(Record& record, const std::string& text) {
+    size_t length = std::min(text.size(), TEXT_CAPACITY - 1);
+    std::memcpy(record.text, text.data(), length);
+    record.text[length] = '\0';
+}
@@ -0,0 +1,159 @@
+#ifndef TIMELINE_RECORDER_H
+#define TIMELINE_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class EventLog;
+
+/**
+ * Writes a Chrome trace-event JSON timeline (also read by Perfetto) of a
+ * simulation run. Two kinds of activity share the file:
+ *  - Real time: spans of CPU time spent in simulation phases, one track per
+ *    recording thread under the "Simulation" process.
+ *  - Simulated time: a pump's history (boluses, basal rate, suspensions,
+ *    profile changes, alarms, errors and CGM readings) as one process per
+ *    patient, placed relative to a simulated origin.
+ * Each recording thread appends fixed-size records to its own ring, so
+ * threads never contend with each other; a background thread drains the
+ * rings, formats the JSON and writes it. A thread only waits when its ring
+ * is full because the writer has fallen behind.
+ */
+class TimelineRecorder {
+public:
+    static const size_t DEFAULT_RING_CAPACITY = 1 << 14;   // Records per thread
+    
+    // Capacity is rounded up to a power of two
+    explicit TimelineRecorder(size_t ringCapacity = DEFAULT_RING_CAPACITY);
+    ~TimelineRecorder();
+    
+    TimelineRecorder(const TimelineRecorder&) = delete;
+    TimelineRecorder& operator=(const TimelineRecorder&) = delete;
+    
+    // Recording is only valid between open and close; close waits for the
+    // writer and reports whether the whole file was written
+    bool open(const std::string& path);
+    bool close();
+    bool isOpen() const;
+    
+    // Real time since open (microseconds), the time base of spans
+    int64_t now() const;
+    
+    // Span on the calling thread's track; the name must outlive the recorder
+    // (a string literal)
+    void recordSpan(const char* name, int64_t start, int64_t duration);
+    
+    // Spans the enclosing scope; a null recorder records nothing
+    class Scope {
+    public:
+        Scope(TimelineRecorder* recorder, const char* name);
+        ~Scope();
+        
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        
+    private:
+        TimelineRecorder* recorder;
+        const char* name;
+        int64_t start;
+    };
+    
+    // Splits real time among phases that interleave too finely to record
+    // one by one; flush records a span over the whole stretch with one span
+    // per phase inside it, laid end to end, holding that phase's total.
+    // A null recorder records nothing.
+    class PhaseTotals {
+    public:
+        static constexpr size_t MAX_PHASES = 8;
+        
+        // names must outlive the recorder (string literals)
+        PhaseTotals(TimelineRecorder* recorder, const char* const* names, size_t count);
+        
+        void enter(size_t phase);   // Ends the current phase
+        void flush(const char* name);
+        
+    private:
+        TimelineRecorder* recorder;
+        const char* const* names;
+        size_t count;
+        size_t current;
+        int64_t start;
+        int64_t mark;
+        int64_t totals[MAX_PHASES];
+    };
+    
+    // A pump's history as the simulated-time process for a track, with
+    // timestamps measured from origin
+    void recordHistory(uint32_t track, const std::string& name, const EventLog& history, time_t origin);
+    
+    size_t getRecordCount() const; // Records written so far
+    
+private:
+    static const size_t TEXT_CAPACITY = 48;
+    
+    enum Phase : uint8_t {
+        SPAN,
+        INSTANT,
+        COUNTER,
+        PROCESS_NAME,
+        THREAD_NAME
+    };
+    
+    struct Record {
+        int64_t timestamp;          // Microseconds
+        int64_t duration;           // Microseconds, spans only
+        const char* name;           // Static; the series name for counters
+        const char* valueName;      // Static argument name for value, nullptr when unused
+        float value;
+        uint32_t process;
+        uint32_t thread;
+        Phase phase;
+        char text[TEXT_CAPACITY];   // Detail or metadata name, truncated
+    };
+    
+    // Single-producer, single-consumer ring owned by one recording thread
+    struct Ring {
+        std::unique_ptr<Record[]> records;
+        std::atomic<uint64_t> head;     // Written by the recording thread
+        std::atomic<uint64_t> tail;     // Written by the writer thread
+        uint32_t thread;
+        std::thread::id owner;
+        bool named;                     // Thread name written to the current file
+    };
+    
+    const uint64_t id;                  // Identifies this recorder in thread caches
+    size_t capacity;
+    std::chrono::steady_clock::time_point started;
+    
+    std::mutex mutex;                   // Guards rings, stopping and the wakeup
+    std::condition_variable wakeup;
+    std::vector<std::unique_ptr<Ring>> rings;
+    bool stopping;
+    std::atomic<bool> recording;
+    
+    // Writer thread state
+    std::thread writer;
+    std::ofstream out;
+    std::string buffer;
+    bool firstRecord;
+    std::atomic<size_t> recordCount;
+    
+    Ring& threadRing();
+    void push(Ring& ring, const Record& record);
+    void writeLoop();
+    bool drain();
+    void format(const Record& record);
+    static void setText(Record& record, const std::string& text);
+};
+
+#endif // TIMELINE_RECORDER_H
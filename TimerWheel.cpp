@@ -0,0 +1,215 @@
+#include "TimerWheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(time_t origin) :
+    origin(origin),
+    current(0),
+    nextEvent(UINT64_MAX),
+    freeHead(NIL),
+    count(0)
+{
+    std::fill(std::begin(heads), std::end(heads), NIL);
+    std::fill(std::begin(occupied), std::end(occupied), 0);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(time_t when, uint32_t kind, uint64_t data) {
+    uint32_t index = freeHead;
+    if (index != NIL) {
+        freeHead = nodes[index].next;
+    } else {
+        index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node());
+        nodes[index].generation = 0;
+    }
+    
+    // Overdue timers go in the current slot
+    Node& node = nodes[index];
+    int64_t offset = static_cast<int64_t>(when - origin);
+    node.tick = offset > static_cast<int64_t>(current) ? static_cast<uint64_t>(offset) : current;
+    node.when = when;
+    node.data = data;
+    node.kind = kind;
+    nextEvent = std::min(nextEvent, place(index));
+    count++;
+    
+    return (static_cast<TimerId>(node.generation) << 32) | (index + 1);
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    if (!isPending(id)) {
+        return false;
+    }
+    
+    uint32_t index = static_cast<uint32_t>(id) - 1;
+    unlink(index);
+    release(index);
+    return true;
+}
+
+bool TimerWheel::isPending(TimerId id) const {
+    uint32_t index = static_cast<uint32_t>(id) - 1;
+    return id != NO_TIMER && index < nodes.size() &&
+        nodes[index].generation == static_cast<uint32_t>(id >> 32) && nodes[index].list != FREE_LIST;
+}
+
+bool TimerWheel::expire(time_t until, Timer& timer) {
+    int64_t offset = static_cast<int64_t>(until - origin);
+    uint64_t limit = offset > static_cast<int64_t>(current) ? static_cast<uint64_t>(offset) : current;
+    if (limit < nextEvent) {
+        current = limit;
+        return false; // Most calls find nothing due
+    }
+    
+    for (;;) {
+        // Timers on a lower level all expire before any slot of a higher one
+        // starts, so the lowest busy slot is the next thing to do
+        int level = 0;
+        while (level < LEVELS && occupied[level] == 0) {
+            level++;
+        }
+        
+        uint64_t tick;
+        uint32_t list;
+        if (level < LEVELS) {
+            int shift = level * SLOT_BITS;
+            int slot = __builtin_ctzll(occupied[level]);
+            tick = ((current >> (shift + SLOT_BITS)) << (shift + SLOT_BITS)) | (static_cast<uint64_t>(slot) << shift);
+            list = level * SLOTS + slot;
+        } else if (heads[OVERFLOW_LIST] != NIL) {
+            int span = LEVELS * SLOT_BITS;
+            tick = ((current >> span) + 1) << span;
+            list = OVERFLOW_LIST;
+        } else {
+            nextEvent = UINT64_MAX;
+            current = limit;
+            return false;
+        }
+        
+        if (tick > limit) {
+            nextEvent = tick;
+            current = limit;
+            return false;
+        }
+        current = std::max(current, tick);
+        
+        if (level == 0) {
+            uint32_t index = heads[list];
+            const Node& node = nodes[index];
+            timer.when = node.when;
+            timer.kind = node.kind;
+            timer.data = node.data;
+            timer.id = (static_cast<TimerId>(node.generation) << 32) | (index + 1);
+            unlink(index);
+            release(index);
+            return true;
+        }
+        
+        // The wheel has reached this slot; spread its timers over the levels below
+        uint32_t index = takeList(list);
+        while (index != NIL) {
+            uint32_t next = nodes[index].next;
+            place(index);
+            index = next;
+        }
+    }
+}
+
+time_t TimerWheel::getTime() const {
+    return origin + static_cast<time_t>(current);
+}
+
+size_t TimerWheel::size() const {
+    return count;
+}
+
+void TimerWheel::clear() {
+    // Release nodes rather than dropping them, so old ids stay stale
+    for (uint32_t index = 0; index < nodes.size(); index++) {
+        if (nodes[index].list != FREE_LIST) {
+            release(index);
+        }
+    }
+    std::fill(std::begin(heads), std::end(heads), NIL);
+    std::fill(std::begin(occupied), std::end(occupied), 0);
+    nextEvent = UINT64_MAX;
+}
+
+uint64_t TimerWheel::place(uint32_t index) {
+    // A level holds timers within the current slot of the level above; the
+    // wheel must stop at the start of the timer's slot to move it down
+    uint64_t tick = nodes[index].tick;
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = (level + 1) * SLOT_BITS;
+        if ((tick >> shift) == (current >> shift)) {
+            uint32_t slot = static_cast<uint32_t>(tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+            link(index, level * SLOTS + slot);
+            return (tick >> (level * SLOT_BITS)) << (level * SLOT_BITS);
+        }
+    }
+    link(index, OVERFLOW_LIST);
+    int span = LEVELS * SLOT_BITS;
+    return ((current >> span) + 1) << span;
+}
+
+void TimerWheel::link(uint32_t index, uint32_t list) {
+    Node& node = nodes[index];
+    node.list = list;
+    
+    uint32_t head = heads[list];
+    if (head == NIL) {
+        node.next = index;
+        node.prev = index;
+        heads[list] = index;
+        if (list < OVERFLOW_LIST) {
+            occupied[list / SLOTS] |= 1ULL << (list % SLOTS);
+        }
+        return;
+    }
+    
+    // Append at the tail, keeping scheduling order within a slot
+    uint32_t tail = nodes[head].prev;
+    node.next = head;
+    node.prev = tail;
+    nodes[tail].next = index;
+    nodes[head].prev = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = nodes[index];
+    uint32_t list = node.list;
+    
+    if (node.next == index) {
+        heads[list] = NIL;
+        if (list < OVERFLOW_LIST) {
+            occupied[list / SLOTS] &= ~(1ULL << (list % SLOTS));
+        }
+        return;
+    }
+    
+    nodes[node.prev].next = node.next;
+    nodes[node.next].prev = node.prev;
+    if (heads[list] == index) {
+        heads[list] = node.next;
+    }
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node& node = nodes[index];
+    node.list = FREE_LIST;
+    node.generation++;
+    node.next = freeHead;
+    freeHead = index;
+    count--;
+}
+
+uint32_t TimerWheel::takeList(uint32_t list) {
+    uint32_t head = heads[list];
+    heads[list] = NIL;
+    if (list < OVERFLOW_LIST) {
+        occupied[list / SLOTS] &= ~(1ULL << (list % SLOTS));
+    }
+    
+    // Break the circle so the caller can walk it to NIL
+    nodes[nodes[head].prev].next = NIL;
+    return head;
+}
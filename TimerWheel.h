@@ -0,0 +1,83 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+/**
+ * Hierarchical timer wheel with one-second resolution.
+ * Four levels of 64 slots cover about 194 days from the current time;
+ * later timers wait in an overflow list. A timer sits in the level whose
+ * slot holds its expiry, and moves down a level when the wheel reaches
+ * that slot, so scheduling, cancelling and expiring are O(1). Per-level
+ * occupancy bitmaps let the wheel skip straight to the next busy slot
+ * instead of ticking through empty seconds. Timers live in a pooled,
+ * index-linked node array and are named by generation-checked ids, so a
+ * stale id never cancels a reused node.
+ */
+class TimerWheel {
+public:
+    using TimerId = uint64_t;
+    static constexpr TimerId NO_TIMER = 0;
+    
+    struct Timer {
+        time_t when;        // Expiry as scheduled (may be before the wheel's time)
+        uint32_t kind;      // Caller-defined
+        uint64_t data;      // Caller-defined
+        TimerId id;
+    };
+    
+    explicit TimerWheel(time_t origin = 0);
+    
+    // Timers due at or before the wheel's time fire on the next expire()
+    TimerId schedule(time_t when, uint32_t kind, uint64_t data = 0);
+    bool cancel(TimerId id);
+    bool isPending(TimerId id) const;
+    
+    // Remove the earliest timer due at or before `until`, advancing the
+    // wheel's time to it; once none is due the wheel's time becomes `until`.
+    // Timers come out in expiry order, and in scheduling order within a second.
+    bool expire(time_t until, Timer& timer);
+    
+    time_t getTime() const;
+    size_t size() const;
+    void clear();
+    
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    static constexpr uint32_t NIL = UINT32_MAX;
+    static constexpr uint32_t OVERFLOW_LIST = LEVELS * SLOTS;
+    static constexpr uint32_t FREE_LIST = OVERFLOW_LIST + 1;
+    
+    struct Node {
+        uint64_t tick;      // Expiry, seconds since the origin
+        time_t when;
+        uint64_t data;
+        uint32_t kind;
+        uint32_t generation;
+        uint32_t list;      // level * SLOTS + slot, OVERFLOW_LIST or FREE_LIST
+        uint32_t next;      // Circular within a list; the free list only uses next
+        uint32_t prev;
+    };
+    
+    time_t origin;
+    uint64_t current;       // Wheel time, seconds since the origin
+    uint64_t nextEvent;     // Nothing happens before this tick
+    std::vector<Node> nodes;
+    uint32_t freeHead;
+    size_t count;
+    uint32_t heads[LEVELS * SLOTS + 1];     // Slot lists, then the overflow list
+    uint64_t occupied[LEVELS];
+    
+    uint64_t place(uint32_t index);
+    void link(uint32_t index, uint32_t list);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    uint32_t takeList(uint32_t list);
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,455 @@
+#include "TraceReader.h"
+#include "TSlimX2Pump.h"
+#include "Clock.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    const size_t WRITER_BUFFER_RECORDS = 8192;
+    
+    bool isSeparator(char c) {
+        return c == ',' || c == ';' || c == '\t';
+    }
+    
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+    
+    const char* skipSpaces(const char* p, const char* last) {
+        while (p < last && (*p == ' ' || *p == '"')) {
+            p++;
+        }
+        return p;
+    }
+    
+    // Fixed-width decimal field, e.g. the "2024" of a date
+    bool parseDigits(const char*& p, const char* last, int width, int& value) {
+        if (last - p < width) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < width; i++) {
+            if (!isDigit(p[i])) {
+                return false;
+            }
+            value = value * 10 + (p[i] - '0');
+        }
+        p += width;
+        return true;
+    }
+    
+    // Days since 1970-01-01 of a proleptic Gregorian date
+    long daysFromCivil(int year, int month, int day) {
+        year -= month <= 2;
+        long era = (year >= 0 ? year : year - 399) / 400;
+        long yearOfEra = year - era * 400;
+        long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + dayOfEra - 719468;
+    }
+    
+    // Epoch seconds, or YYYY-MM-DD[T ]HH:MM[:SS][Z] in UTC
+    bool parseTimestamp(const char*& p, const char* last, time_t& timestamp) {
+        const char* digits = p;
+        while (p < last && isDigit(*p)) {
+            p++;
+        }
+        if (p == digits) {
+            return false;
+        }
+        
+        if (p - digits != 4 || p == last || *p != '-') {
+            long long seconds = 0;
+            auto parsed = std::from_chars(digits, p, seconds);
+            timestamp = static_cast<time_t>(seconds);
+            return parsed.ec == std::errc() && parsed.ptr == p;
+        }
+        
+        p = digits;
+        int year, month, day, hour, minute, second = 0;
+        if (!parseDigits(p, last, 4, year) || p == last || *p++ != '-' ||
+            !parseDigits(p, last, 2, month) || p == last || *p++ != '-' ||
+            !parseDigits(p, last, 2, day) || p == last || (*p != 'T' && *p != ' ') ||
+            !parseDigits(++p, last, 2, hour) || p == last || *p++ != ':' ||
+            !parseDigits(p, last, 2, minute)) {
+            return false;
+        }
+        if (p < last && *p == ':' && !parseDigits(++p, last, 2, second)) {
+            return false;
+        }
+        if (p < last && *p == 'Z') {
+            p++;
+        }
+        if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+            return false;
+        }
+        
+        timestamp = static_cast<time_t>(daysFromCivil(year, month, day) * 86400L +
+                                        hour * 3600L + minute * 60L + second);
+        return true;
+    }
+}
+
+TraceReader::TraceReader(size_t chunkSize) :
+    fd(-1),
+    format(CSV),
+    chunkSize(std::max<size_t>(chunkSize, 4096)),
+    begin(0),
+    end(0),
+    endOfFile(true),
+    baseTime(0),
+    malformed(0)
+{
+}
+
+TraceReader::~TraceReader() {
+    close();
+}
+
+bool TraceReader::open(const std::string& path) {
+    close();
+    
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    buffer.resize(chunkSize);
+    
+    if (!rewind()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TraceReader::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    begin = 0;
+    end = 0;
+    endOfFile = true;
+}
+
+bool TraceReader::isOpen() const {
+    return fd >= 0;
+}
+
+bool TraceReader::rewind() {
+    if (fd < 0 || ::lseek(fd, 0, SEEK_SET) < 0) {
+        return false;
+    }
+    
+    begin = 0;
+    end = 0;
+    endOfFile = false;
+    malformed = 0;
+    fill();
+    
+    // Binary traces start with a magic number; anything else is read as text
+    TraceWriter::FileHeader header;
+    format = CSV;
+    if (end >= sizeof(header)) {
+        std::memcpy(&header, buffer.data(), sizeof(header));
+        if (header.magic == TraceWriter::MAGIC) {
+            if (header.version != TraceWriter::VERSION) {
+                return false;
+            }
+            format = BINARY;
+            baseTime = static_cast<time_t>(header.baseTime);
+            begin = sizeof(header);
+        }
+    }
+    return true;
+}
+
+TraceReader::Format TraceReader::getFormat() const {
+    return format;
+}
+
+bool TraceReader::next(Reading& reading) {
+    if (fd < 0) {
+        return false;
+    }
+    return format == BINARY ? nextBinary(reading) : nextCSV(reading);
+}
+
+size_t TraceReader::getMalformedCount() const {
+    return malformed;
+}
+
+TraceReader::FeedResult TraceReader::feed(const std::vector<TSlimX2Pump*>& pumps, FeedMode mode) {
+    FeedResult result = {};
+    
+    std::vector<VirtualClock*> clocks(pumps.size(), nullptr);
+    for (size_t i = 0; i < pumps.size(); i++) {
+        if (pumps[i]) {
+            clocks[i] = dynamic_cast<VirtualClock*>(pumps[i]->getClock().get());
+        }
+    }
+    
+    auto deliver = [&](size_t i, const Reading& reading) {
+        if (!pumps[i]) {
+            result.skipped++;
+            return;
+        }
+        if (clocks[i]) {
+            if (reading.timestamp < clocks[i]->now()) {
+                result.skipped++;
+                return;
+            }
+            pumps[i]->runUntil(reading.timestamp);
+        }
+        pumps[i]->updateCGMData(reading.value);
+        result.readings++;
+    };
+    
+    auto start = std::chrono::steady_clock::now();
+    
+    Reading reading;
+    while (next(reading)) {
+        if (mode == BROADCAST) {
+            for (size_t i = 0; i < pumps.size(); i++) {
+                deliver(i, reading);
+            }
+        } else if (reading.stream < pumps.size()) {
+            deliver(reading.stream, reading);
+        } else {
+            result.skipped++;
+        }
+    }
+    
+    result.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.readingsPerSecond = result.elapsedSeconds > 0 ? result.readings / result.elapsedSeconds : 0.0;
+    return result;
+}
+
+bool TraceReader::fill() {
+    if (endOfFile) {
+        return false;
+    }
+    
+    // Keep the unparsed tail and read the next chunk behind it
+    if (begin > 0) {
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    if (end == buffer.size()) {
+        return false;
+    }
+    
+    ssize_t count;
+    do {
+        count = ::read(fd, buffer.data() + end, buffer.size() - end);
+    } while (count < 0 && errno == EINTR);
+    
+    if (count <= 0) {
+        endOfFile = true;
+        return false;
+    }
+    end += static_cast<size_t>(count);
+    return true;
+}
+
+bool TraceReader::nextCSV(Reading& reading) {
+    while (true) {
+        const char* first = buffer.data() + begin;
+        const char* last = buffer.data() + end;
+        const char* newline = static_cast<const char*>(std::memchr(first, '\n', last - first));
+        
+        if (newline) {
+            begin += static_cast<size_t>(newline - first) + 1;
+            if (parseLine(first, newline, reading)) {
+                return true;
+            }
+            continue;
+        }
+        
+        if (endOfFile) {
+            begin = end;
+            return first < last && parseLine(first, last, reading);
+        }
+        
+        if (begin == 0 && end == buffer.size()) {
+            // A line longer than a whole chunk: drop it
+            malformed++;
+            bool found = false;
+            while (!found && !endOfFile) {
+                begin = end;
+                fill();
+                newline = static_cast<const char*>(std::memchr(buffer.data(), '\n', end));
+                if (newline) {
+                    begin = static_cast<size_t>(newline - buffer.data()) + 1;
+                    found = true;
+                }
+            }
+            continue;
+        }
+        
+        fill();
+    }
+}
+
+bool TraceReader::nextBinary(Reading& reading) {
+    while (end - begin < sizeof(TraceWriter::Record)) {
+        if (!fill()) {
+            if (begin < end) {
+                malformed++; // Torn final record
+                begin = end;
+            }
+            return false;
+        }
+    }
+    
+    TraceWriter::Record record;
+    std::memcpy(&record, buffer.data() + begin, sizeof(record));
+    begin += sizeof(record);
+    
+    reading.timestamp = baseTime + static_cast<time_t>(record.offset);
+    reading.value = record.value / 100.0f;
+    reading.stream = record.stream;
+    return true;
+}
+
+bool TraceReader::parseLine(const char* first, const char* last, Reading& reading) {
+    if (last > first && last[-1] == '\r') {
+        last--;
+    }
+    first = skipSpaces(first, last);
+    
+    // Blank, comment and header lines carry no reading
+    if (first == last || *first == '#' || !isDigit(*first)) {
+        return false;
+    }
+    
+    const char* p = first;
+    if (!parseTimestamp(p, last, reading.timestamp)) {
+        malformed++;
+        return false;
+    }
+    
+    p = skipSpaces(p, last);
+    if (p == last || !isSeparator(*p)) {
+        malformed++;
+        return false;
+    }
+    p = skipSpaces(p + 1, last);
+    
+    auto parsed = std::from_chars(p, last, reading.value);
+    if (parsed.ec != std::errc() || !std::isfinite(reading.value)) {
+        malformed++;
+        return false;
+    }
+    p = skipSpaces(parsed.ptr, last);
+    
+    reading.stream = 0;
+    if (p < last && isSeparator(*p)) {
+        p = skipSpaces(p + 1, last);
+        if (p < last) {
+            parsed = std::from_chars(p, last, reading.stream);
+            if (parsed.ec != std::errc()) {
+                malformed++;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+TraceWriter::TraceWriter() :
+    fd(-1),
+    baseTime(0),
+    count(0),
+    failed(false)
+{
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string& path, time_t baseTime) {
+    close();
+    
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    
+    this->baseTime = baseTime;
+    count = 0;
+    failed = false;
+    buffer.clear();
+    buffer.reserve(WRITER_BUFFER_RECORDS);
+    
+    FileHeader header = { MAGIC, VERSION, static_cast<int64_t>(baseTime) };
+    if (::write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool TraceWriter::close() {
+    if (fd < 0) {
+        return false;
+    }
+    
+    bool ok = flush() && !failed;
+    ::close(fd);
+    fd = -1;
+    return ok;
+}
+
+bool TraceWriter::write(time_t timestamp, float value, uint32_t stream) {
+    if (fd < 0 || timestamp < baseTime || stream > 0xffff ||
+        static_cast<uint64_t>(timestamp - baseTime) > 0xffffffffu) {
+        return false;
+    }
+    
+    Record record;
+    record.offset = static_cast<uint32_t>(timestamp - baseTime);
+    record.stream = static_cast<uint16_t>(stream);
+    record.value = static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 655.35f) * 100.0f));
+    buffer.push_back(record);
+    count++;
+    
+    if (buffer.size() >= WRITER_BUFFER_RECORDS) {
+        return flush();
+    }
+    return true;
+}
+
+size_t TraceWriter::getCount() const {
+    return count;
+}
+
+bool TraceWriter::flush() {
+    const char* data = reinterpret_cast<const char*>(buffer.data());
+    size_t remaining = buffer.size() * sizeof(Record);
+    
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    
+    buffer.clear();
+    return !failed;
+}
@@ -0,0 +1,141 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+class TSlimX2Pump;
+
+/**
+ * Streaming reader for recorded or synthetic CGM traces.
+ * Two formats are understood:
+ *  - CSV: "timestamp,glucose[,stream]" per line, where the timestamp is
+ *    epoch seconds or "YYYY-MM-DD[T ]HH:MM[:SS]" (UTC), glucose is mmol/L,
+ *    and ',', ';' or tab separate fields. Header, blank and '#' lines are
+ *    ignored.
+ *  - Binary: a header followed by fixed 8-byte records (see TraceWriter).
+ * The file is read through a fixed buffer one chunk at a time and lines are
+ * parsed in place, so memory use does not grow with the trace length.
+ */
+class TraceReader {
+public:
+    enum Format {
+        CSV,
+        BINARY
+    };
+    
+    // How readings are assigned to pumps
+    enum FeedMode {
+        ROUTE_BY_STREAM,    // Stream i drives pumps[i]
+        BROADCAST           // Every reading drives every pump
+    };
+    
+    struct Reading {
+        time_t timestamp;
+        float value;        // mmol/L
+        uint32_t stream;    // Sensor / patient the reading belongs to
+    };
+    
+    struct FeedResult {
+        size_t readings;        // Readings delivered to pumps
+        size_t skipped;         // Out-of-order or unroutable readings
+        double elapsedSeconds;
+        double readingsPerSecond;
+    };
+    
+    static const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+    
+    explicit TraceReader(size_t chunkSize = DEFAULT_CHUNK_SIZE);
+    ~TraceReader();
+    
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+    
+    // Open a trace; the format is detected from the file's first bytes
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    bool rewind();
+    Format getFormat() const;
+    
+    // Next reading in file order; false at the end of the trace
+    bool next(Reading& reading);
+    
+    // Lines (CSV) or records (binary) that could not be parsed
+    size_t getMalformedCount() const;
+    
+    // Drive pumps from the rest of the trace: pumps on a VirtualClock are
+    // fast-forwarded to each reading's timestamp before it is delivered
+    // through updateCGMData; readings older than a pump's clock are skipped.
+    // Pumps on a real clock receive readings as they are read.
+    FeedResult feed(const std::vector<TSlimX2Pump*>& pumps, FeedMode mode = ROUTE_BY_STREAM);
+    
+private:
+    int fd;
+    Format format;
+    std::vector<char> buffer;
+    size_t chunkSize;
+    size_t begin;           // First unparsed byte in the buffer
+    size_t end;             // One past the last buffered byte
+    bool endOfFile;
+    time_t baseTime;        // Binary traces store offsets from this time
+    size_t malformed;
+    
+    bool fill();
+    bool nextCSV(Reading& reading);
+    bool nextBinary(Reading& reading);
+    bool parseLine(const char* first, const char* last, Reading& reading);
+};
+
+/**
+ * Writer for the compact binary trace format.
+ * Layout: magic, version and a 64-bit base time, then one record per
+ * reading with a 32-bit offset from the base time (seconds), a 16-bit
+ * stream id and the glucose value in hundredths of mmol/L.
+ */
+class TraceWriter {
+public:
+    static const uint32_t MAGIC = 0x52545354; // "TSTR"
+    static const uint32_t VERSION = 1;
+    
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        int64_t baseTime;
+    };
+    
+    struct Record {
+        uint32_t offset;    // Seconds since the base time
+        uint16_t stream;
+        uint16_t value;     // Hundredths of mmol/L
+    };
+    
+    TraceWriter();
+    ~TraceWriter();
+    
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    
+    // The base time must not be later than any reading written
+    bool open(const std::string& path, time_t baseTime);
+    bool close();
+    
+    // False when the reading cannot be represented (before the base time,
+    // more than ~136 years after it, or a stream id above 65535)
+    bool write(time_t timestamp, float value, uint32_t stream = 0);
+    size_t getCount() const;
+    
+private:
+    int fd;
+    time_t baseTime;
+    std::vector<Record> buffer;
+    size_t count;
+    bool failed;
+    
+    bool flush();
+};
+
+#endif // TRACE_READER_H
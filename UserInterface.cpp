@@ -0,0 +1,482 @@
+#include "UserInterface.h"
+#include "Profile.h"
+#include "Event.h"
+#include "CGMData.h"
+#include "Clock.h"
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+UserInterface::UserInterface(std::shared_ptr<TSlimX2Pump> pump) :
+    pump(pump),
+    running(false),
+    locked(false),
+    pin("1234")
+{
+}
+
+void UserInterface::run() {
+    running = true;
+    pump->powerOn();
+    
+    while (running) {
+        if (locked) {
+            handleLockScreen();
+            continue;
+        }
+        
+        clearScreen();
+        displayHomeScreen();
+        displayMenu();
+        
+        int choice = getIntegerInput("Select an option", 0, 7);
+        switch (choice) {
+            case 1:
+                handleBolus();
+                break;
+            case 2:
+                handleBasalControl();
+                break;
+            case 3:
+                handleProfileManagement();
+                break;
+            case 4:
+                handleHistoryReview();
+                break;
+            case 5:
+                handleSettings();
+                break;
+            case 6:
+                locked = true;
+                break;
+            case 7:
+                if (getConfirmation("Power off the pump?")) {
+                    pump->powerOff();
+                    running = false;
+                }
+                break;
+            case 0:
+                running = false;
+                break;
+        }
+    }
+}
+
+void UserInterface::displayHomeScreen() {
+    static const char* stateNames[] = {
+        "Off", "On", "Sleep", "Delivering bolus", "Delivering basal", "Suspended", "Error"
+    };
+    
+    struct tm timeinfo = Clock::toLocalTime(pump->getClock()->now());
+    
+    std::cout << "t:slim X2 - " << std::setfill('0') << std::setw(2) << timeinfo.tm_hour << ":"
+              << std::setw(2) << timeinfo.tm_min << std::setfill(' ') << std::endl;
+    std::cout << "State: " << stateNames[pump->getState()]
+              << "   Profile: " << pump->getActiveProfileName()
+              << "   Control-IQ: " << (pump->isControlIQEnabled() ? "on" : "off") << std::endl;
+    if (pump->getTempBasalPercent() >= 0) {
+        std::cout << "Temp basal: " << std::fixed << std::setprecision(0) << pump->getTempBasalPercent() << "%" << std::endl;
+    }
+    displayBatteryStatus();
+    displayInsulinStatus();
+    displayIOBStatus();
+    displayCGMData();
+    displayError();
+    std::cout << std::endl;
+}
+
+void UserInterface::displayMenu() {
+    std::cout << "1. Bolus" << std::endl;
+    std::cout << "2. Basal control" << std::endl;
+    std::cout << "3. Profiles" << std::endl;
+    std::cout << "4. History" << std::endl;
+    std::cout << "5. Settings" << std::endl;
+    std::cout << "6. Lock screen" << std::endl;
+    std::cout << "7. Power off" << std::endl;
+    std::cout << "0. Exit" << std::endl;
+}
+
+void UserInterface::displayBatteryStatus() {
+    std::cout << "Battery: " << std::fixed << std::setprecision(0) << pump->getBatteryLevel() << "%" << std::endl;
+}
+
+void UserInterface::displayInsulinStatus() {
+    std::cout << "Insulin: " << std::fixed << std::setprecision(1) << pump->getInsulinLevel() << " U" << std::endl;
+}
+
+void UserInterface::displayIOBStatus() {
+    std::cout << "Insulin on board: " << std::fixed << std::setprecision(2) << pump->getInsulinOnBoard() << " U" << std::endl;
+}
+
+void UserInterface::displayCGMData() {
+    if (!pump->isCGMConnected()) {
+        std::cout << "CGM: not connected" << std::endl;
+        return;
+    }
+    
+    std::cout << "CGM: " << std::fixed << std::setprecision(1) << pump->getCurrentGlucose() << " mmol/L";
+    auto cgmData = pump->getCGMData();
+    if (cgmData && cgmData->getReadingCount() >= 2) {
+        float trend = cgmData->calculateTrend();
+        std::cout << (trend > 0.05f ? " (rising)" : trend < -0.05f ? " (falling)" : " (steady)");
+        
+        GlucosePredictor::Prediction forecast = cgmData->getPrediction(30);
+        std::cout << ", 30 min: " << forecast.value << " (" << forecast.lower << "-" << forecast.upper << ")";
+    }
+    std::cout << std::endl;
+}
+
+void UserInterface::displayError() {
+    if (pump->getErrorState() != TSlimX2Pump::NONE) {
+        std::cout << "!! " << pump->getErrorMessage() << std::endl;
+    }
+}
+
+void UserInterface::handleBolus() {
+    clearScreen();
+    std::cout << "Bolus" << std::endl << std::endl;
+    
+    float glucose = pump->getCurrentGlucose();
+    if (glucose <= 0) {
+        glucose = getNumericInput("Current glucose (mmol/L)", 1.0f, 33.3f);
+    }
+    float carbs = getNumericInput("Carbohydrates (g)", 0.0f, 300.0f);
+    float suggested = pump->calculateSuggestedBolus(glucose, carbs);
+    
+    std::ostringstream prompt;
+    prompt << std::fixed << std::setprecision(2) << "Bolus amount (suggested " << suggested << " U)";
+    float units = getNumericInput(prompt.str(), 0.0f, 25.0f);
+    if (units <= 0) {
+        return;
+    }
+    
+    bool extended = getConfirmation("Extend the bolus over time?");
+    int duration = extended ? getIntegerInput("Duration (minutes)", 15, 480) : 0;
+    
+    if (!getConfirmation("Deliver bolus?")) {
+        return;
+    }
+    if (pump->deliverBolus(units, extended, duration)) {
+        showMessage("Bolus started.");
+    } else {
+        showMessage("Bolus could not be delivered.");
+    }
+}
+
+void UserInterface::handleBasalControl() {
+    clearScreen();
+    std::cout << "Basal control" << std::endl << std::endl;
+    std::cout << "1. Start basal" << std::endl;
+    std::cout << "2. Stop insulin" << std::endl;
+    std::cout << "3. Resume insulin" << std::endl;
+    std::cout << "4. Cancel extended bolus" << std::endl;
+    std::cout << "5. Start temp basal" << std::endl;
+    std::cout << "6. Cancel temp basal" << std::endl;
+    std::cout << "0. Back" << std::endl;
+    
+    bool ok = true;
+    switch (getIntegerInput("Select an option", 0, 6)) {
+        case 1:
+            ok = pump->startBasal();
+            break;
+        case 2:
+            ok = pump->stopBasal();
+            break;
+        case 3:
+            ok = pump->resumeBasal();
+            break;
+        case 4:
+            ok = pump->cancelBolus();
+            break;
+        case 5: {
+            float percent = getNumericInput("Rate (% of scheduled basal)", 0.0f, 250.0f);
+            int minutes = getIntegerInput("Duration (minutes)", 15, 72 * 60);
+            ok = pump->startTempBasal(percent, minutes);
+            break;
+        }
+        case 6:
+            ok = pump->cancelTempBasal();
+            break;
+        default:
+            return;
+    }
+    showMessage(ok ? "Done." : "The pump could not do that right now.");
+}
+
+void UserInterface::handleProfileManagement() {
+    while (running) {
+        clearScreen();
+        std::cout << "Profiles (active: " << pump->getActiveProfileName() << ")" << std::endl << std::endl;
+        for (const auto& name : pump->getAllProfileNames()) {
+            std::cout << "  " << name << std::endl;
+        }
+        std::cout << std::endl;
+        std::cout << "1. Create profile" << std::endl;
+        std::cout << "2. View profile" << std::endl;
+        std::cout << "3. Edit profile" << std::endl;
+        std::cout << "4. Delete profile" << std::endl;
+        std::cout << "5. Activate profile" << std::endl;
+        std::cout << "0. Back" << std::endl;
+        
+        switch (getIntegerInput("Select an option", 0, 5)) {
+            case 1:
+                createNewProfile();
+                break;
+            case 2:
+                viewProfile();
+                break;
+            case 3:
+                updateProfile();
+                break;
+            case 4:
+                deleteProfile();
+                break;
+            case 5:
+                activateProfile();
+                break;
+            default:
+                return;
+        }
+    }
+}
+
+void UserInterface::handleSettings() {
+    clearScreen();
+    std::cout << "Settings" << std::endl << std::endl;
+    std::cout << "1. Charge battery" << std::endl;
+    std::cout << "2. Refill insulin" << std::endl;
+    std::cout << (pump->isCGMConnected() ? "3. Disconnect CGM" : "3. Connect CGM") << std::endl;
+    std::cout << "4. Enter CGM reading" << std::endl;
+    std::cout << (pump->isControlIQEnabled() ? "5. Disable Control-IQ" : "5. Enable Control-IQ") << std::endl;
+    std::cout << "6. Clear error" << std::endl;
+    std::cout << "7. Change PIN" << std::endl;
+    std::cout << "0. Back" << std::endl;
+    
+    bool ok = true;
+    switch (getIntegerInput("Select an option", 0, 7)) {
+        case 1:
+            ok = pump->chargeBattery(getNumericInput("Charge amount (%)", 0.0f, 100.0f));
+            break;
+        case 2:
+            ok = pump->refillInsulin(getNumericInput("Insulin to add (U)", 0.0f, 300.0f));
+            break;
+        case 3:
+            ok = pump->isCGMConnected() ? pump->disconnectCGM() : pump->connectCGM();
+            break;
+        case 4:
+            if (!pump->isCGMConnected()) {
+                ok = false;
+                break;
+            }
+            pump->updateCGMData(getNumericInput("Glucose (mmol/L)", 1.0f, 33.3f));
+            break;
+        case 5:
+            ok = pump->isControlIQEnabled() ? pump->disableControlIQ() : pump->enableControlIQ();
+            break;
+        case 6:
+            ok = pump->clearError();
+            break;
+        case 7: {
+            std::string newPin = getUserInput("New 4-digit PIN");
+            ok = newPin.size() == 4 && newPin.find_first_not_of("0123456789") == std::string::npos;
+            if (ok) {
+                pin = newPin;
+            }
+            break;
+        }
+        default:
+            return;
+    }
+    showMessage(ok ? "Done." : "The pump could not do that right now.");
+}
+
+void UserInterface::handleHistoryReview() {
+    clearScreen();
+    std::cout << "History" << std::endl << std::endl;
+    
+    int count = getIntegerInput("Number of recent events", 1, 100);
+    for (const auto& event : pump->getRecentEvents(count)) {
+        struct tm timeinfo = Clock::toLocalTime(event->getTimestamp());
+        std::cout << std::setfill('0') << std::setw(2) << timeinfo.tm_mon + 1 << "/"
+                  << std::setw(2) << timeinfo.tm_mday << " " << std::setw(2) << timeinfo.tm_hour << ":"
+                  << std::setw(2) << timeinfo.tm_min << std::setfill(' ') << "  "
+                  << event->getDescription() << std::endl;
+    }
+    waitForKey();
+}
+
+void UserInterface::handleLockScreen() {
+    clearScreen();
+    std::cout << "Screen locked" << std::endl << std::endl;
+    
+    std::string entered = getUserInput("Enter PIN");
+    if (entered == pin) {
+        locked = false;
+    } else if (running) {
+        showMessage("Incorrect PIN.");
+    }
+}
+
+void UserInterface::createNewProfile() {
+    std::string name = getUserInput("Profile name");
+    if (!pump->createProfile(name)) {
+        showMessage("A profile with that name already exists, or the name is empty.");
+        return;
+    }
+    
+    // Start from a single all-day segment for each setting
+    auto profile = std::make_shared<Profile>(name);
+    profile->addBasalRate(0, 0, getNumericInput("Basal rate (U/hr)", 0.0f, 15.0f));
+    profile->addCarbRatio(0, 0, getNumericInput("Carb ratio (g/U)", 1.0f, 150.0f));
+    profile->addCorrectionFactor(0, 0, getNumericInput("Correction factor (mmol/L per U)", 0.1f, 20.0f));
+    profile->addTargetGlucose(0, 0, getNumericInput("Target glucose (mmol/L)", 3.9f, 13.9f));
+    profile->setInsulinDuration(getNumericInput("Insulin duration (hours)", 2.0f, 8.0f));
+    pump->updateProfile(name, profile);
+    
+    showMessage(profile->isValid() ? "Profile created." : profile->getValidationMessage());
+}
+
+void UserInterface::viewProfile() {
+    std::string name = getUserInput("Profile name");
+    auto profile = pump->getProfile(name);
+    if (!profile) {
+        showMessage("No such profile.");
+        return;
+    }
+    
+    auto printSchedule = [](const std::string& title, const std::map<int, float>& schedule) {
+        std::cout << title << std::endl;
+        for (const auto& entry : schedule) {
+            std::cout << "  " << std::setfill('0') << std::setw(2) << entry.first / 60 << ":"
+                      << std::setw(2) << entry.first % 60 << std::setfill(' ') << "  "
+                      << std::fixed << std::setprecision(2) << entry.second << std::endl;
+        }
+    };
+    
+    clearScreen();
+    std::cout << "Profile " << profile->getName() << std::endl << std::endl;
+    printSchedule("Basal rates (U/hr)", profile->getAllBasalRates());
+    printSchedule("Carb ratios (g/U)", profile->getAllCarbRatios());
+    printSchedule("Correction factors (mmol/L per U)", profile->getAllCorrectionFactors());
+    printSchedule("Target glucose (mmol/L)", profile->getAllTargetGlucoses());
+    std::cout << "Insulin duration: " << std::fixed << std::setprecision(1)
+              << profile->getInsulinDuration() << " h" << std::endl;
+    std::cout << "Daily basal total: " << std::setprecision(2) << profile->getDailyBasalTotal() << " U" << std::endl;
+    waitForKey();
+}
+
+void UserInterface::updateProfile() {
+    std::string name = getUserInput("Profile name");
+    auto stored = pump->getProfile(name);
+    if (!stored) {
+        showMessage("No such profile.");
+        return;
+    }
+    
+    // Stored profiles are immutable; edit a copy and store it as a new version
+    auto profile = std::make_shared<Profile>(*stored);
+    
+    std::cout << "1. Basal rate" << std::endl;
+    std::cout << "2. Carb ratio" << std::endl;
+    std::cout << "3. Correction factor" << std::endl;
+    std::cout << "4. Target glucose" << std::endl;
+    std::cout << "5. Insulin duration" << std::endl;
+    int setting = getIntegerInput("Setting to change", 1, 5);
+    
+    if (setting == 5) {
+        profile->setInsulinDuration(getNumericInput("Insulin duration (hours)", 2.0f, 8.0f));
+    } else {
+        int hour = getIntegerInput("Start hour", 0, 23);
+        int minute = getIntegerInput("Start minute", 0, 59);
+        switch (setting) {
+            case 1:
+                profile->addBasalRate(hour, minute, getNumericInput("Basal rate (U/hr)", 0.0f, 15.0f));
+                break;
+            case 2:
+                profile->addCarbRatio(hour, minute, getNumericInput("Carb ratio (g/U)", 1.0f, 150.0f));
+                break;
+            case 3:
+                profile->addCorrectionFactor(hour, minute,
+                                             getNumericInput("Correction factor (mmol/L per U)", 0.1f, 20.0f));
+                break;
+            case 4:
+                profile->addTargetGlucose(hour, minute, getNumericInput("Target glucose (mmol/L)", 3.9f, 13.9f));
+                break;
+        }
+    }
+    
+    pump->updateProfile(name, profile);
+    showMessage(profile->isValid() ? "Profile updated." : profile->getValidationMessage());
+}
+
+void UserInterface::deleteProfile() {
+    std::string name = getUserInput("Profile name");
+    if (!getConfirmation("Delete profile " + name + "?")) {
+        return;
+    }
+    showMessage(pump->deleteProfile(name) ? "Profile deleted." : "That profile cannot be deleted.");
+}
+
+void UserInterface::activateProfile() {
+    std::string name = getUserInput("Profile name");
+    showMessage(pump->activateProfile(name) ? "Profile activated." : "No such profile.");
+}
+
+void UserInterface::clearScreen() {
+    std::cout << "\033[2J\033[H";
+}
+
+std::string UserInterface::getUserInput(const std::string& prompt) {
+    std::cout << prompt << ": ";
+    
+    std::string input;
+    if (!std::getline(std::cin, input)) {
+        running = false; // End of input
+        return "";
+    }
+    return input;
+}
+
+float UserInterface::getNumericInput(const std::string& prompt, float min, float max) {
+    while (running) {
+        std::string input = getUserInput(prompt);
+        std::istringstream stream(input);
+        float value;
+        if (stream >> value && value >= min && value <= max) {
+            return value;
+        }
+        if (running) {
+            std::cout << "Enter a number between " << min << " and " << max << "." << std::endl;
+        }
+    }
+    return min;
+}
+
+int UserInterface::getIntegerInput(const std::string& prompt, int min, int max) {
+    while (running) {
+        std::string input = getUserInput(prompt);
+        std::istringstream stream(input);
+        int value;
+        if (stream >> value && value >= min && value <= max) {
+            return value;
+        }
+        if (running) {
+            std::cout << "Enter a whole number between " << min << " and " << max << "." << std::endl;
+        }
+    }
+    return min;
+}
+
+bool UserInterface::getConfirmation(const std::string& prompt) {
+    std::string input = getUserInput(prompt + " (y/n)");
+    return !input.empty() && (input[0] == 'y' || input[0] == 'Y');
+}
+
+void UserInterface::showMessage(const std::string& message) {
+    std::cout << message << std::endl;
+    waitForKey();
+}
+
+void UserInterface::waitForKey() {
+    getUserInput("Press Enter to continue");
+}